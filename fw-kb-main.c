@@ -2,9 +2,10 @@
 
 // Basics to get the Pico going...
 #include <stdio.h>
-#include "pico/stdlib.h"
-#include "pico/multicore.h"
+#include "kb-hal.h"
+#if !KB_HOST
 #include "pico/unique_id.h"
+#endif // !KB_HOST
 #include <string.h>
 #include <ctype.h>
 
@@ -14,6 +15,31 @@
 
 // local parts
 #include "fw-kb-main.h"
+#include "kb-combo.h"
+#include "kb-mouse.h"
+#include "kb-stream.h"
+#include "kb-link.h"
+#include "kb-trace.h"
+#include "kb-telem.h"
+#include "kb-config.h"
+#include "kb-store.h"
+#include "kb-record.h"
+#include "kb-msc.h"
+#include "kb-prof.h"
+#include "kb-sched.h"
+#include "kb-power.h"
+#include "kb-watch.h"
+
+#if PROF_ON
+// Time every message pushed to core-0, wherever it is sent from
+static inline void prof_fifo_push (uint32_t v)
+{
+    PROF_START (t);
+    hal_fifo_push (v);
+    PROF_END (PH_PUSH, t);
+} // prof_fifo_push
+#define hal_fifo_push(v) prof_fifo_push (v)
+#endif // PROF_ON
 
 /* Are we emitting serial debug? */
 //#define SER_DBG_ON  1  // serial debug on
@@ -114,6 +140,71 @@ static uint8_t const int_codes_table [32] = {
 #define Agr (146) // A-grave à
 #define GBP (147) // Code for the GBP £ sign
 
+#if UNICODE_ON
+/* Unicode code points for the "special" keys, for the Unicode entry mode.
+ * Indexed by (code - CER), then [unshifted, shifted]. A zero entry means the
+ * key is sent the normal way, e.g. brackets, or the umlaut dead-key. */
+static uint32_t const uni_table [GBP - CER + 1][2] = {
+    {      0, 0x20AC }, // CER - Euro sign €
+    {      0,      0 }, // CAP
+    {      0,      0 }, // BSQ
+    {      0,      0 }, // BCR
+    {      0, 0x00DF }, // SSZ - sharp-s ß
+    {      0, 0x00A5 }, // YEN - Yen ¥
+    {      0, 0x00A2 }, // CNT - cent ¢
+    { 0x2019,      0 }, // BKT - single quote ’ (the umlaut stays a dead-key)
+    { 0x00A7, 0x00B1 }, // SPM - section mark § and plus/minus ±
+    {      0, 0x00B0 }, // DEG - degree °
+    {      0, 0x00A1 }, // IEX - inverted exclamation mark ¡
+    {      0, 0x00BF }, // IQM - inverted question mark ¿
+    { 0x00F1, 0x00D1 }, // NSQ - ñ and Ñ
+    { 0x00E7, 0x00C7 }, // CED - ç and Ç
+    {      0, 0x03A9 }, // OHM - Omega Ω
+    {      0, 0x00E1 }, // Aac - á
+    {      0, 0x00E8 }, // Egr - è
+    {      0, 0x00F9 }, // Ugr - ù
+    {      0, 0x00E0 }, // Agr - à
+    { 0x00A3, 0x00A3 }  // GBP - £
+};
+
+// Are we in the Unicode entry mode? Toggled by the HELP + Code-II combo
+static int uni_mode = UNICODE_DEFAULT;
+#endif // UNICODE_ON
+
+// Macro keys, on the BLOCK layer
+#define MC1 (150) // Macro 1
+#define MC2 (151)
+#define MC3 (152)
+#define MC4 (153)
+#define MC5 (154)
+#define MC6 (155)
+#define MC7 (156)
+#define MC8 (157)
+#define MC9 (158)
+#define MC0 (159) // Macro 10
+
+// Media (consumer control) keys, on the BLOCK layer
+#define MVU (160) // Volume up
+#define MVD (161) // Volume down
+#define MMU (162) // Mute
+#define MPP (163) // Play / Pause
+#define MNX (164) // Next track
+#define MPV (165) // Previous track
+#define MBU (166) // Brightness up
+#define MBD (167) // Brightness down
+
+// convert the media keys into USB HID consumer control usages
+static uint16_t const media_table [MBD - MVU + 1] = {
+    HID_USAGE_CONSUMER_VOLUME_INCREMENT,
+    HID_USAGE_CONSUMER_VOLUME_DECREMENT,
+    HID_USAGE_CONSUMER_MUTE,
+    HID_USAGE_CONSUMER_PLAY_PAUSE,
+    HID_USAGE_CONSUMER_SCAN_NEXT,
+    HID_USAGE_CONSUMER_SCAN_PREVIOUS,
+    HID_USAGE_CONSUMER_BRIGHTNESS_INCREMENT,
+    HID_USAGE_CONSUMER_BRIGHTNESS_DECREMENT
+};
+
 // Modifier key codes
 #define BLK (200) // BLOCK modifier
 #define HLP (201) // HELP key
@@ -123,11 +214,11 @@ static uint8_t const int_codes_table [32] = {
 #define CTR (205) // Left CTRL modifier
 #define CRR (206) // Right CTRL modifier
 
-#define ROW_SZ  8
-#define COL_SZ 10
+/* The built-in keymaps. These are the defaults for the live configuration,
+ * the scanner uses the copies in kb-config.c, which the host can change. */
 
 // The basic keymap
-static __uint8_t key_table [ROW_SZ * COL_SZ] = {
+static const __uint8_t key_table [ROW_SZ * COL_SZ] = {
     0,  BSQ,  '-',  'p',  ';', '\'', '0',   0,  '/',  BCK,
   BSP,    0,  '=',  'o',  'l',    0, '9',   0,  '.',  WIN,
   FWD,  _UP,  PUP,  'i',  'k',  _EC, '8',   0,  ',',  PDN,
@@ -138,10 +229,10 @@ static __uint8_t key_table [ROW_SZ * COL_SZ] = {
     0,  TAB,  '`',  'q',  'a',  CAP, '1', SHF,  'z',    0
 };
 
-// The basic keymap, but with the Function keys F1 - F10 mapped to the number keys
-static __uint8_t key_FN_table [ROW_SZ * COL_SZ] = {
-    0,  BSQ,  '-',  'p',  ';', '\'',  F10,    0,  '/',  BCK,
-  BSP,    0,  '=',  'o',  'l',    0,  F09,    0,  '.',  WIN,
+// The basic keymap, but with the Function keys F1 - F12 mapped to the number keys, "-" and "="
+static const __uint8_t key_FN_table [ROW_SZ * COL_SZ] = {
+    0,  BSQ,  F11,  'p',  ';', '\'',  F10,    0,  '/',  BCK,
+  BSP,    0,  F12,  'o',  'l',    0,  F09,    0,  '.',  WIN,
   FWD,  _UP,  PUP,  'i',  'k',  _EC,  F08,    0,  ',',  PDN,
   'n',  'y',  F06,  'u',  'j',  'h',  F07,  CRR,  'm',    0,
   'b',  't',  F05,  'r',  'f',  'g',  F04,  CTR,  'v',    0,
@@ -152,8 +243,8 @@ static __uint8_t key_FN_table [ROW_SZ * COL_SZ] = {
 
 // The keymap with the Code-II keys mapped, though some are
 // mapped to keys I like rather than to that shown on the keycap!
-static __uint8_t key2_table [ROW_SZ * COL_SZ] = {
-    0,  BCR,  BKT,  'p',  NSQ, '\\',  Agr,    0,  CED,  BCK,
+static const __uint8_t key2_table [ROW_SZ * COL_SZ] = {
+    0,  BCR,  BKT,  'p',  NSQ,  B_P,  Agr,    0,  CED,  BCK,
   BSP,    0,  SPM,  'o',  'l',    0,  DEG,    0,  IQM,  WIN,
   FWD,  _UP,  PUP,  'i',  'k',  _EC,  Ugr,    0,  IEX,  PDN,
   'n',  'y',  CNT,  'u',  'j',  'h',  Egr,  CRR,  'm',    0,
@@ -163,6 +254,19 @@ static __uint8_t key2_table [ROW_SZ * COL_SZ] = {
     0,  TAB,  B_P,  'q',  'a',  CAP,  OHM,  SHF,  'z',    0
 };
 
+// The keymap for the BLOCK layer, with the macros on the number keys
+// and the media keys on the cursor keys, page up/down, DEL and SPACE
+static const __uint8_t key_BLK_table [ROW_SZ * COL_SZ] = {
+    0,  BSQ,  '-',  'p',  ';', '\'',  MC0,    0,  '/',  MPV,
+  BSP,    0,  '=',  'o',  'l',    0,  MC9,    0,  '.',  WIN,
+  MNX,  MVU,  MBU,  'i',  'k',  _EC,  MC8,    0,  ',',  MBD,
+  'n',  'y',  MC6,  'u',  'j',  'h',  MC7,  CRR,  'm',    0,
+  'b',  't',  MC5,  'r',  'f',  'g',  MC4,  CTR,  'v',    0,
+  MPP,  RTN,  MMU,  'e',  'd',  BLK,  MC3,    0,  'c',  HLP,
+  MVD,  DND,  HOM,  'w',  's',  CD2,  MC2,    0,  'x',  ALT,
+    0,  TAB,  '`',  'q',  'a',  CAP,  MC1,  SHF,  'z',    0
+};
+
 // Table to "quickly" spot the modifier keys
 static __uint8_t is_mod_key [ROW_SZ * COL_SZ] = {
     0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
@@ -176,6 +280,59 @@ static __uint8_t is_mod_key [ROW_SZ * COL_SZ] = {
 };
 
 // The tinyusb ASCII -> HID code table
+#if MOUSE_ON
+// Is the mouse keys layer on? Toggled by the BLOCK + HELP combo
+static int mouse_layer = 0;
+static uint16_t mouse_keys = 0; // The mouse keys held down on the last pass
+
+/* Pick the mouse keys out of the keys held down, and tell core-0 if they
+ * changed. The mouse keys are removed from the list, so that any others can
+ * be decoded as normal. */
+static void mouse_layer_keys (int *keys, int *n_keys)
+{
+    uint16_t mk = 0;
+    int n = 0;
+    int idx;
+
+    for (idx = 0; idx < *n_keys; ++idx)
+    {
+        uint16_t bit = 0;
+        switch (cfg_live ()->keys [CFG_LAYER_BASE][keys[idx]])
+        {
+            case FWD: bit = MK_RIGHT; break;
+            case BCK: bit = MK_LEFT;  break;
+            case _UP: bit = MK_UP;    break;
+            case DWN: bit = MK_DOWN;  break;
+            case HOM: bit = MK_BTN1;  break;
+            case DND: bit = MK_BTN2;  break;
+            case DEL: bit = MK_BTN3;  break;
+            case PUP: bit = MK_WUP;   break;
+            case PDN: bit = MK_WDN;   break;
+            default:  break;
+        }
+        if (bit)
+        {
+            mk |= bit;
+        }
+        else
+        {
+            keys[n] = keys[idx];
+            ++n;
+        }
+    }
+    *n_keys = n;
+
+    if (mk != mouse_keys)
+    {
+        if (hal_fifo_wready ())
+        {
+            hal_fifo_push (FLAG_MOUSE | mk);
+            mouse_keys = mk;
+        }
+    }
+} // mouse_layer_keys
+#endif // MOUSE_ON
+
 static uint8_t const conv_table[128][2] =  { HID_ASCII_TO_KEYCODE };
 
 static __uint8_t prv_scan [COL_SZ]; // keys down on previous scan
@@ -187,6 +344,10 @@ static __uint8_t cur_scan [COL_SZ]; // keys down on this scan
 static uint32_t kc_buf [KC_SZ];
 static uint32_t kc_in  = 0;
 static uint32_t kc_out = 0;
+#if TELEM_COUNT
+static uint32_t kc_ts [KC_SZ];  // Start of the scan behind each key code, for the latency figures
+static uint32_t kc_last_ts = 0; // ...and for the one kc_get() last returned
+#endif // TELEM_COUNT
 
 // Used by main() to queue up Key Codes for sending to the USB hid_task()
 static void kc_put (uint32_t uv)
@@ -195,12 +356,30 @@ static void kc_put (uint32_t uv)
     if (next == kc_out)
     {
         // queue full, skip this character
+        TRACE (TR_KC_FULL, 0, uv);
+#if TELEM_COUNT
+        telem_kc (KC_MSK, 1);
+#endif // TELEM_COUNT
         return;
     }
     kc_buf [kc_in] = uv;
+#if TELEM_COUNT
+    kc_ts [kc_in] = telem_scan_time ();
+    telem_kc ((next - kc_out) & KC_MSK, 0);
+#endif // TELEM_COUNT
     kc_in = next;
 }
 
+// Used by hid_task() in usb-stack.c to look at the next Key Code without removing it
+uint32_t kc_peek (void)
+{
+    if (kc_in == kc_out) // queue is empty
+    {
+        return 0;
+    }
+    return kc_buf [kc_out];
+}
+
 // Used by hid_task() in usb-stack.c to read Key Codes to send on the USB
 uint32_t kc_get (void)
 {
@@ -209,33 +388,189 @@ uint32_t kc_get (void)
         return 0;
     }
     uint32_t uv = kc_buf [kc_out];
+#if TELEM_COUNT
+    kc_last_ts = kc_ts [kc_out];
+#endif // TELEM_COUNT
     kc_out = (kc_out + 1) & KC_MSK;
     return uv;
 }
 
+// Used by hid_task() in usb-stack.c to get the start time of the scan behind the last Key Code read (0 if unknown)
+uint32_t kc_time (void)
+{
+#if TELEM_COUNT
+    return kc_last_ts;
+#else
+    return 0;
+#endif // TELEM_COUNT
+}
+
 // Track whether we have been signalled Caps Lock or not
 #define LED_CAPS    22 // Assign our "extra" Caps Lock LED to GPIO_22
-static int is_caps_lock = 0;
+
+// No GPIO of the matrix (kb-matrix.h) may be an LED or a latency marker as well
+#define MATRIX_GPIOS  (MATRIX_LINE_MASK | MATRIX_ROW_GPIOS)
+#if (MATRIX_LINE_MASK & MATRIX_ROW_GPIOS)
+#error "A GPIO is both a select line and a row, see kb-matrix.h"
+#endif
+#if (MATRIX_GPIOS & (1u << LED_CAPS))
+#error "A matrix GPIO is also the Caps Lock LED, see kb-matrix.h"
+#endif
+#if !KB_HOST && (MATRIX_GPIOS & (1u << PICO_DEFAULT_LED_PIN))
+#error "A matrix GPIO is also the board LED, see kb-matrix.h"
+#endif
+#if LATENCY_ON && (MATRIX_GPIOS & ((1u << LAT_GPIO_SAMPLE) | (1u << LAT_GPIO_ACCEPT) | (1u << LAT_GPIO_ENQUEUE) | \
+                                   (1u << LAT_GPIO_REPORT) | (1u << LAT_GPIO_DONE)))
+#error "A matrix GPIO is also a latency marker pin, see kb-matrix.h"
+#endif
+static volatile int is_caps_lock = 0; // Set by core-0, from the host's LED report
+// The Caps Lock LED doubles as the latched modifier indicator (set by core-1)
+static int is_latch_led = 0;
+static int caps_led_shown = -1; // What core-1 last put on the LED, -1 for nothing yet
+
+/* core-1: called by scan_pass() after every pass of the matrix.
+ * Only core-1 drives the LED, from both flags, so a Caps Lock change from
+ * core-0 cannot cross a latch change and leave the LED wrong. */
+static void show_caps_led (void)
+{
+    int led = (is_caps_lock || is_latch_led) ? 1 : 0;
+    if (led != caps_led_shown)
+    {
+        caps_led_shown = led;
+        hal_gpio_put (LED_CAPS, led);
+    }
+} // show_caps_led
+
+// core-0: the LED follows on core-1's next pass
 void set_caps_lock_led (int i_state)
 {
     if (i_state == CAPS_ON)
     {
         is_caps_lock = i_state;
-        gpio_put (LED_CAPS, 1);
     }
     else
     {
         is_caps_lock = 0;
-        gpio_put (LED_CAPS, 0);
     }
 } // set_caps_lock_led
 
-/* Process the key matrix to determine which keys are pressed
- * and decide what to send to the USB stack. */
-static void process_keys (int all_keys_up)
+/* One-shot modifier handling.
+ * Tapping a latching modifier (press and release it with no other key down)
+ * latches it for the next key. Tapping it again quickly locks it on, and a
+ * further tap unlocks it. A latched (but not locked) modifier is dropped if
+ * no key follows within the timeout (ONESHOT_TIMEOUT ms, unless the host changes it).
+ * These bits track which latching modifiers are involved. */
+#define OS_CD2  0x01
+#define OS_SHF  0x02
+#define OS_HLP  0x04
+
+#if ONESHOT_ON
+static uint8_t  os_held    = 0; // latching modifiers held down on the last pass
+static uint8_t  os_used    = 0; // held modifiers that have been used with another key
+static uint8_t  os_latched = 0; // modifiers latched for the next key
+static uint8_t  os_locked  = 0; // modifiers locked on by a double-tap
+static uint32_t os_tap_us  = 0; // when the last latch was set (us)
+
+// Which modifiers are allowed to latch in this build
+static const uint8_t os_allowed = OS_CD2
+#if ONESHOT_SHIFT
+                                | OS_SHF
+#endif
+#if ONESHOT_HELP
+                                | OS_HLP
+#endif
+                                ;
+
+/* Called by process_keys() with the latching modifiers currently held, and
+ * whether any other key is down. Returns the modifiers currently latched. */
+static uint8_t oneshot_update (uint8_t held_now, int other_keys)
+{
+    uint32_t now = hal_time_us ();
+
+    if (other_keys)
+    {
+        // These modifiers are being used the "press and hold" way
+        os_used |= held_now;
+    }
+
+    uint8_t released = os_held & ~held_now;
+    uint8_t tapped   = released & ~os_used & os_allowed;
+    os_used &= ~released;
+    os_held = held_now;
+
+    uint8_t bit;
+    for (bit = OS_CD2; bit <= OS_HLP; bit = bit << 1)
+    {
+        if ((tapped & bit) == 0)
+        {
+            continue;
+        }
+
+        if (os_locked & bit) // Locked on, so this tap unlocks it
+        {
+            os_locked  &= ~bit;
+            os_latched &= ~bit;
+        }
+        else if (os_latched & bit) // Already latched, lock it on, or cancel it
+        {
+            if ((now - os_tap_us) < (cfg_live ()->timing [CFG_TM_ONESHOT_TAP] * 1000u))
+            {
+                os_locked |= bit;
+            }
+            else
+            {
+                os_latched &= ~bit;
+            }
+        }
+        else // Latch it for the next key
+        {
+            os_latched |= bit;
+            os_tap_us = now;
+        }
+    }
+
+    return os_latched;
+} // oneshot_update
+
+// A key has been sent with the latched modifiers, release any that are not locked
+static void oneshot_consume (void)
+{
+    os_latched &= os_locked;
+} // oneshot_consume
+
+/* Called by scan_thread() after every pass of the matrix, to expire stale
+ * latches and set the indicator LED (see show_caps_led()).
+ * Latched modifiers flash the LED, locked modifiers hold it on. */
+static void oneshot_tick (void)
+{
+    uint32_t now = hal_time_us ();
+
+    if ((os_latched & ~os_locked) && ((now - os_tap_us) >= (cfg_live ()->timing [CFG_TM_ONESHOT_TIMEOUT] * 1000u)))
+    {
+        os_latched &= os_locked;
+    }
+
+    int led = 0;
+    if (os_locked)
+    {
+        led = 1;
+    }
+    else if (os_latched)
+    {
+        led = (((now - os_tap_us) >> 17) & 1) ? 0 : 1; // ~130 ms on, ~130 ms off
+    }
+
+    is_latch_led = led;
+} // oneshot_tick
+#endif // ONESHOT_ON
+
+/* Decode a set of pressed keys (matrix positions) and decide what to send to
+ * the USB stack. "extra_mods" and "extra_code" are added as if a modifier key
+ * was held, e.g. for the AltGr combo. */
+static void decode_keys (int *keys, int i_keys, int all_keys_up, uint8_t extra_mods, uint8_t extra_code)
 {
-    uint8_t Mods  = 0; // Which modifier bits are set
-    uint8_t Kcode = 0; // What is the current key code
+    uint8_t Mods  = extra_mods; // Which modifier bits are set
+    uint8_t Kcode = 0;          // What is the current key code
 
     msg_blk code;     // Holds the USB code to be sent for this key
     msg_blk code_alt; // Holds an additional USB code, e.g. for sending composed keys
@@ -247,66 +582,44 @@ static void process_keys (int all_keys_up)
     /* Which keymap is active?
      * Start assuming we are using the "normal" keymap but this can be updated
      * later when we scan the modifier keys and find the "HELP" or "Code-II"
-     * modifier key is being held. */
-    __uint8_t *pTable = key_table;
+     * modifier key is being held.
+     * The config is taken once, so a change from the host applies to the next pass, not half of this one. */
+    kb_config const *cfg = cfg_live ();
+    __uint8_t const *pTable = cfg->keys [CFG_LAYER_BASE];
 
-    // Pick the active keys out of the keymap
-    int col;
-    int row;
     int idx;
 
-    // Scan the matrix for (at most) 4 pressed keys. In practice we reject any more than 3.
-    // Note that the Fontwriter matrix can be prone to shadow keys even with only 3 held
-    // down, and in any case my use of the Pico multicore FIFO limits me to 3-keys and a
-    // modifier flags byte.
-#define MX_KEYS 4
-    int keys[MX_KEYS];
-    int i_keys = 0;
-    for (col = 0; ((col < COL_SZ) && (i_keys < MX_KEYS)); ++col)
-    {
-        // Is any key down on this column?
-        if (ROW_MASK == cur_scan[col])
-        {
-            // All keys are UP in this column, no further check.
-        }
-        else // There must be at least 1 bit down, find it now
-        {
-            unsigned u_tst = 1;
-            for (row = 0; row < 8; ++row)
-            {
-                if ((u_tst & cur_scan[col]) == 0)
-                {
-                    idx = (row * COL_SZ) + col;
-                    keys [i_keys] = idx;
-                    ++i_keys;
-                    if (i_keys >= MX_KEYS)
-                    {
-                        break;
-                    }
-                }
-                u_tst = u_tst << 1;
-            }
-        }
-    }
-
     // Were any valid keys found?
-    if (i_keys < 1)
+    if ((i_keys < 1) && (extra_code == 0))
     {
+#if ONESHOT_ON
+        oneshot_update (0, 0); // Everything is up, check for a tapped modifier
+#endif // ONESHOT_ON
+
         // Are all the keys UP now? Tell the USB HID stack if so.
         if (all_keys_up != 0)
         {
-            if (multicore_fifo_wready ())
+            if (hal_fifo_wready ())
             {
-                multicore_fifo_push_blocking (FLAG_ALL_UP);
+                hal_fifo_push (FLAG_ALL_UP);
+                LAT_MARK (LAT_GPIO_ENQUEUE);
             }
         }
         return; // No more keys to process on this pass
     }
 
+    if (extra_code != 0)
+    {
+        // Queue up the combo modifier, as if it was a real modifier key
+        code.p[code_idx] = Kcode = extra_code;
+        --code_idx;
+    }
+
     /* Is there a modifier set? Scan the set for any modifiers first,
      * before we try to interpret any "normal" keys. (Since the modifier
      * may change the meaning of the "normal" key.) */
     int is_mod = 0;
+    uint8_t os_mods = 0; // Which of the latching modifiers are held down
     for (idx = 0; idx < i_keys; ++idx)
     {
         __uint8_t kc = is_mod_key [keys[idx]];
@@ -319,6 +632,7 @@ static void process_keys (int all_keys_up)
                 case SHF:
                 Mods |= KEYBOARD_MODIFIER_LEFTSHIFT; // Shift key
                 ucode = HID_KEY_SHIFT_LEFT;
+                os_mods |= OS_SHF;
                 break;
 
                 case WIN:
@@ -342,15 +656,19 @@ static void process_keys (int all_keys_up)
                 break;
 
                 case HLP: // HELP is pressed, map the Function keymap instead
-                pTable = key_FN_table;
+                pTable = cfg->keys [CFG_LAYER_FN];
+                os_mods |= OS_HLP;
                 break;
 
                 case CD2: // Code-II is pressed, map the code-II keymap
-                pTable = key2_table;
+                pTable = cfg->keys [CFG_LAYER_CD2];
+                os_mods |= OS_CD2;
+                break;
+
+                case BLK: // BLOCK is pressed, map the BLOCK layer keymap
+                pTable = cfg->keys [CFG_LAYER_BLK];
                 break;
 
-                case BLK: // Not used at present
-                // is_BLK
                 default:
                 break;
             }
@@ -368,13 +686,37 @@ static void process_keys (int all_keys_up)
 
     int keys_to_go = i_keys - is_mod; // How many keys are left held down?
 
+#if ONESHOT_ON
+    /* Apply any latched modifiers. A modifier that is actually held down
+     * takes priority over a latched one when choosing the keymap. */
+    uint8_t os_latch = oneshot_update (os_mods, (keys_to_go > 0));
+    if (pTable == cfg->keys [CFG_LAYER_BASE])
+    {
+        if (os_latch & OS_CD2)
+        {
+            pTable = cfg->keys [CFG_LAYER_CD2];
+        }
+        else if (os_latch & OS_HLP)
+        {
+            pTable = cfg->keys [CFG_LAYER_FN];
+        }
+    }
+    if (os_latch & OS_SHF)
+    {
+        Mods |= KEYBOARD_MODIFIER_LEFTSHIFT;
+    }
+#else
+    (void) os_mods;
+#endif // ONESHOT_ON
+
     // Are there any "active" keys left to process?
     if ((keys_to_go < 1) && (Kcode == 0))
     {
         // No "active" key is down now, only inactive modifiers, so send a key up
-        if (multicore_fifo_wready ())
+        if (hal_fifo_wready ())
         {
-            multicore_fifo_push_blocking (FLAG_ALL_UP);
+            hal_fifo_push (FLAG_ALL_UP);
+            LAT_MARK (LAT_GPIO_ENQUEUE);
         }
         return;
     }
@@ -409,6 +751,42 @@ static void process_keys (int all_keys_up)
                     --code_idx;
                 }
             }
+#if UNICODE_ON
+            else if ((uni_mode) && (kc >= CER) && (kc <= GBP) &&
+                     (uni_table [kc - CER][((Mods & KEYBOARD_MODIFIER_LEFTSHIFT) != 0) ? 1 : 0] != 0))
+            {
+                // Type the symbol by its code point, this is sent by usb-stack.c as a sequence of keys
+                uint32_t cp = uni_table [kc - CER][((Mods & KEYBOARD_MODIFIER_LEFTSHIFT) != 0) ? 1 : 0];
+                if (hal_fifo_wready ())
+                {
+                    hal_fifo_push (FLAG_UNICODE | cp);
+                }
+                Kcode = 0;     // Nothing else to send for this key
+                code_idx = -1;
+            }
+#endif // UNICODE_ON
+#if MACRO_ON
+            else if ((kc >= MC1) && (kc <= MC0))
+            {
+                // Type a macro, this is sent by usb-stack.c as a sequence of keys
+                if (hal_fifo_wready ())
+                {
+                    hal_fifo_push (FLAG_MACRO | (kc - MC1));
+                }
+                Kcode = 0;     // Nothing else to send for this key
+                code_idx = -1;
+            }
+#endif // MACRO_ON
+            else if ((kc >= MVU) && (kc <= MBD))
+            {
+                // A media key, this is sent by usb-stack.c as a consumer control report
+                if (hal_fifo_wready ())
+                {
+                    hal_fifo_push (FLAG_CONSUMER | media_table [kc - MVU]);
+                }
+                Kcode = 0;     // Nothing else to send for this key
+                code_idx = -1;
+            }
             else if ((kc >= CER) && (kc <= GBP)) // A few special cases
             {
                 uint8_t ucode = 0;
@@ -488,9 +866,9 @@ static void process_keys (int all_keys_up)
                         {
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods |= KEYBOARD_MODIFIER_RIGHTALT;
@@ -537,9 +915,9 @@ static void process_keys (int all_keys_up)
                             // single backtick
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods |= KEYBOARD_MODIFIER_RIGHTALT | KEYBOARD_MODIFIER_LEFTSHIFT;
@@ -557,9 +935,9 @@ static void process_keys (int all_keys_up)
                         {
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods |= KEYBOARD_MODIFIER_RIGHTALT | KEYBOARD_MODIFIER_LEFTSHIFT;
@@ -581,9 +959,9 @@ static void process_keys (int all_keys_up)
                         {
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods |= KEYBOARD_MODIFIER_RIGHTALT | KEYBOARD_MODIFIER_LEFTSHIFT;
@@ -605,9 +983,9 @@ static void process_keys (int all_keys_up)
                         {
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods |= KEYBOARD_MODIFIER_RIGHTALT | KEYBOARD_MODIFIER_LEFTSHIFT;
@@ -620,9 +998,9 @@ static void process_keys (int all_keys_up)
                         {
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods = KEYBOARD_MODIFIER_RIGHTALT | KEYBOARD_MODIFIER_LEFTSHIFT;
@@ -640,9 +1018,9 @@ static void process_keys (int all_keys_up)
                         {
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods |= KEYBOARD_MODIFIER_RIGHTALT | KEYBOARD_MODIFIER_LEFTSHIFT;
@@ -664,9 +1042,9 @@ static void process_keys (int all_keys_up)
                         code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                         code_alt.p[2] = HID_KEY_BRACKET_RIGHT;
                         code_alt.p[1] = HID_KEY_ALT_RIGHT;
-                        if (multicore_fifo_wready ())
+                        if (hal_fifo_wready ())
                         {
-                            multicore_fifo_push_blocking (code_alt.u_msg);
+                            hal_fifo_push (code_alt.u_msg);
                         }
 
                         if ((Mods & KEYBOARD_MODIFIER_LEFTSHIFT) != 0)
@@ -688,9 +1066,9 @@ static void process_keys (int all_keys_up)
                         code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                         code_alt.p[2] = HID_KEY_EQUAL;
                         code_alt.p[1] = HID_KEY_ALT_RIGHT;
-                        if (multicore_fifo_wready ())
+                        if (hal_fifo_wready ())
                         {
-                            multicore_fifo_push_blocking (code_alt.u_msg);
+                            hal_fifo_push (code_alt.u_msg);
                         }
 
                         if ((Mods & KEYBOARD_MODIFIER_LEFTSHIFT) != 0)
@@ -712,9 +1090,9 @@ static void process_keys (int all_keys_up)
                         {
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods |= KEYBOARD_MODIFIER_RIGHTALT;
@@ -737,9 +1115,9 @@ static void process_keys (int all_keys_up)
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
                             code_alt.p[1] = HID_KEY_SEMICOLON;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods = 0;
@@ -760,9 +1138,9 @@ static void process_keys (int all_keys_up)
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
                             code_alt.p[1] = HID_KEY_BACKSLASH;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods = 0;
@@ -783,9 +1161,9 @@ static void process_keys (int all_keys_up)
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
                             code_alt.p[1] = HID_KEY_BACKSLASH;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods = 0;
@@ -806,9 +1184,9 @@ static void process_keys (int all_keys_up)
                             code_alt.p[3] = KEYBOARD_MODIFIER_RIGHTALT;
                             code_alt.p[2] = HID_KEY_ALT_RIGHT;
                             code_alt.p[1] = HID_KEY_BACKSLASH;
-                            if (multicore_fifo_wready ())
+                            if (hal_fifo_wready ())
                             {
-                                multicore_fifo_push_blocking (code_alt.u_msg);
+                                hal_fifo_push (code_alt.u_msg);
                             }
 
                             Mods = 0;
@@ -840,90 +1218,549 @@ static void process_keys (int all_keys_up)
         }
     }
     code.p[3] = Mods;
+#if ONESHOT_ON
+    // The latched modifiers have now been applied to a key, so release them
+    if (keys_to_go > 0)
+    {
+        oneshot_consume ();
+    }
+#endif // ONESHOT_ON
     // If there is a key press ready, pass it to the main thread for processing / sending
     if (Kcode)
     {
-        if (multicore_fifo_wready ())
+        if (hal_fifo_wready ())
+        {
+            hal_fifo_push (code.u_msg);
+            LAT_MARK (LAT_GPIO_ENQUEUE);
+            TRACE (TR_KEYS, i_keys, code.u_msg);
+        }
+        else
         {
-            multicore_fifo_push_blocking (code.u_msg);
+            TRACE (TR_FIFO_FULL, 0, code.u_msg);
+#if TELEM_COUNT
+            telem_fifo_drop ();
+#endif // TELEM_COUNT
         }
     }
     // Are all the keys UP now? Tell the USB HID stack if so.
     if (all_keys_up != 0)
     {
-        if (multicore_fifo_wready ())
+        if (hal_fifo_wready ())
+        {
+            hal_fifo_push (FLAG_ALL_UP);
+            LAT_MARK (LAT_GPIO_ENQUEUE);
+        }
+    }
+} // decode_keys
+
+/* Process the key matrix to determine which keys are pressed
+ * and decide what to send to the USB stack. */
+static void process_keys (int all_keys_up)
+{
+    // Pick the active keys out of the keymap
+    // Scan the matrix for (at most) 4 pressed keys. In practice we reject any more than 3.
+    // Note that the Fontwriter matrix can be prone to shadow keys even with only 3 held
+    // down, and in any case my use of the Pico multicore FIFO limits me to 3-keys and a
+    // modifier flags byte.
+    int keys[MX_KEYS];
+    int i_keys = matrix_keys (cur_scan, keys, MX_KEYS); // Column by column (see kb-matrix.h)
+
+#if TELEM_COUNT
+    if (i_keys >= MX_KEYS)
+    {
+        telem_ghost (); // Too many keys down to trust the scan
+    }
+#endif // TELEM_COUNT
+
+    uint8_t extra_mods = 0;
+    uint8_t extra_code = 0;
+#if COMBO_ON
+    // Check for key combos before decoding the keys themselves
+    msg_blk combo_msg;
+    combo_msg.u_msg = 0;
+    switch (combo_scan (keys, &i_keys, hal_time_us (), &combo_msg))
+    {
+        case COMBO_HOLD: // Wait and see, send nothing for now
+        return;
+
+        case COMBO_FIRE: // Send the combo instead of the keys
+        TRACE (TR_COMBO, COMBO_FIRE, combo_msg.u_msg);
+        if (hal_fifo_wready ())
+        {
+            hal_fifo_push (combo_msg.u_msg);
+        }
+        return;
+
+        case COMBO_ACTION: // Something for us to do, rather than send
+        TRACE (TR_COMBO, COMBO_ACTION, combo_msg.u_msg);
+#if UNICODE_ON
+        if (combo_msg.p[2] == ACT_UNICODE)
         {
-            multicore_fifo_push_blocking (FLAG_ALL_UP);
+            uni_mode = !uni_mode;
         }
+#endif // UNICODE_ON
+#if MOUSE_ON
+        if (combo_msg.p[2] == ACT_MOUSE)
+        {
+            mouse_layer = !mouse_layer;
+            if ((!mouse_layer) && (mouse_keys != 0) && (hal_fifo_wready ()))
+            {
+                hal_fifo_push (FLAG_MOUSE); // Let go of any mouse keys
+                mouse_keys = 0;
+            }
+        }
+#endif // MOUSE_ON
+#if MACRO_ON
+        if ((combo_msg.p[2] >= ACT_MACRO) && (hal_fifo_wready ()))
+        {
+            hal_fifo_push (FLAG_MACRO | (combo_msg.p[2] - ACT_MACRO));
+        }
+#endif // MACRO_ON
+        return;
+
+        case COMBO_FLUSH: // Send the keys that were held back, then carry on with the current keys
+        {
+            int held[MX_KEYS];
+            int n_held = combo_held (held);
+            decode_keys (held, n_held, 0, 0, 0);
+        }
+        break;
+
+        case COMBO_APPLY: // A modifier combo is held down
+        extra_mods = combo_msg.p[3];
+        extra_code = combo_msg.p[2];
+        break;
+
+        default:
+        break;
     }
+#endif // COMBO_ON
+
+#if MOUSE_ON
+    if (mouse_layer)
+    {
+        mouse_layer_keys (keys, &i_keys);
+    }
+#endif // MOUSE_ON
+
+    decode_keys (keys, i_keys, all_keys_up, extra_mods, extra_code);
 } // process_keys
 
-/* The "main" task on the second core.
- * This manages the reading and initial decoding of the keyboard matrix. */
-void scan_thread (void)
+#if TELEM_COUNT
+static __uint8_t old_scan [COL_SZ]; // keys down two scans ago, to spot contact bounce
+static int changed_last = 0;        // set if the last scan found a change
+#endif // TELEM_COUNT
+
+/* Compare a full scan of the matrix (cur_scan) with the last one, and process
+ * the keys if anything changed. "all_off_count" is how many lines had no keys down. */
+static void scan_compare (int all_off_count, uint32_t scan_start)
 {
-    // signal to the primary thread that this worker thread is ready
-    multicore_fifo_push_blocking (99);
+    // Did a key change?
+    int diff = memcmp (cur_scan, prv_scan, COL_SZ);
+#if TELEM_COUNT
+    if (diff != 0)
+    {
+        if ((changed_last) && (memcmp (cur_scan, old_scan, COL_SZ) == 0))
+        {
+            telem_bounce (); // Back to how it was two scans ago
+        }
+        memcpy (old_scan, prv_scan, COL_SZ);
+    }
+    changed_last = (diff != 0);
+#endif // TELEM_COUNT
+    if (diff != 0) // Something changed in the key map
+    {
+        TRACE (TR_SCAN, all_off_count, hal_time_us () - scan_start);
+        LAT_MARK (LAT_GPIO_ACCEPT);
+        // Set non-zero to flag all keys are up
+        int all_keys_up = 0;
+        /* If the previous map had keys down, and the current map does not
+         * then we must have released all the keys - make sure a key up is
+         * sent to the USB HID stack later. */
+        if (all_off_count >= COL_SZ)
+        {
+            all_keys_up = COL_SZ;
+        }
+        else // some key must be pressed
+        {
+            all_keys_up = 0;
+        }
 
-    int sel_line = 0; // For columns 0 to 9 (10 lines)
-    int all_off_count = 0;
-    while (true)
+        // Something changed, scan the current set and process accordingly
+        PROF_START (t_proc);
+        process_keys (all_keys_up);
+        PROF_END (PH_PROCESS, t_proc);
+        // Record the new state
+        memcpy (prv_scan, cur_scan, COL_SZ);
+    }
+} // scan_compare
+
+#if STORE_ON
+#define HOLD_MAX 32 // Changed scans kept whilst core-0 writes the flash, a sector erase is ~20 scans
+static __uint8_t hold_scans [HOLD_MAX][COL_SZ];
+static uint32_t hold_ts [HOLD_MAX]; // When each was scanned (us)
+
+// Busy wait, without the SDK timer calls (they are in flash)
+static inline __attribute__((always_inline)) void hold_wait (uint32_t us)
+{
+    uint32_t t0 = timer_hw->timerawl;
+    while ((timer_hw->timerawl - t0) < us)
+    {
+        // spin
+    }
+} // hold_wait
+
+/* Keep scanning the matrix whilst core-0 writes the flash (see kb-store.c).
+ * The flash cannot be read then, so this runs from RAM and only touches RAM
+ * and the SIO and timer registers. Each scan that differs from the one before
+ * is kept in hold_scans[], to be processed once the flash is back, so no key
+ * is lost, only held up for as long as the write takes.
+ * Returns how many scans were kept, and the longest gap between scans. */
+static int __not_in_flash_func(scan_hold) (uint32_t settle_us, uint32_t recover_us, uint32_t *gap_us)
+{
+    __uint8_t const *prev = prv_scan;
+    uint32_t last = timer_hw->timerawl;
+    uint32_t gap = 0;
+    int n = 0;
+
+    store_hold = STORE_HOLDING; // Tell core-0 the flash is free
+    while (store_hold == STORE_HOLDING)
     {
-        unsigned set_ln = sel_line + 2; // Our "column 0" is GPIO line 2
+        __uint8_t *rows = hold_scans [(n < HOLD_MAX) ? n : (HOLD_MAX - 1)];
+        int same = 1;
+        int line;
+        for (line = 0; line < COL_SZ; ++line)
+        {
+            uint32_t bit = matrix_line_bit (line); // No table, so it is all in RAM
+            sio_hw->gpio_oe_set = bit; // Drive test line low
+#if MATRIX_ACTIVE_LOW
+            sio_hw->gpio_clr = bit;
+#else
+            sio_hw->gpio_set = bit;
+#endif // MATRIX_ACTIVE_LOW
+            hold_wait (settle_us);
+
+            rows [line] = matrix_rows (sio_hw->gpio_in);
+            if (rows [line] != prev [line])
+            {
+                same = 0;
+            }
+
+#if MATRIX_ACTIVE_LOW
+            sio_hw->gpio_set = bit; // Drive test line high again
+#else
+            sio_hw->gpio_clr = bit;
+#endif // MATRIX_ACTIVE_LOW
+            hold_wait (recover_us);
+            sio_hw->gpio_oe_clr = bit; // Back to an input, the pull-up is still set
+        }
+        uint32_t now = timer_hw->timerawl;
+        if ((!same) && (n < HOLD_MAX)) // Keep it, once full the last slot tracks the latest state
+        {
+            hold_ts [n] = now;
+            prev = rows;
+            ++n;
+        }
+
+        if ((now - last) > gap)
+        {
+            gap = now - last;
+        }
+        last = now;
+    }
+    *gap_us = gap;
+    return n;
+} // scan_hold
+#endif // STORE_ON
+
+#if STORE_ON
+static int first_pass = 1;
+#endif // STORE_ON
+
+/* One pass over the matrix, then the keys are processed if anything changed.
+ * This is the work of core-1 - the host build calls it direct, for each scan. */
+void scan_pass (void)
+{
+    PROF_START (t_pass);
+    kb_config const *cfg = cfg_live (); // The config for this pass, it only changes between passes
+    uint32_t scan_start = hal_time_us (); // When this pass over the matrix began
+    int all_off_count = 0;
+    unsigned sel_line; // For columns 0 to 9 (10 lines)
+#if LATENCY_ON
+    int lat_seen = 0; // A changed line was marked on this pass
+#endif // LATENCY_ON
 
-        gpio_set_dir(set_ln, GPIO_OUT);
-        gpio_put (set_ln, 0); // Drive test line low
-        sleep_us (200);
+    for (sel_line = 0; sel_line < COL_SZ; ++sel_line)
+    {
+        PROF_START (t_line);
+        hal_line_select (sel_line); // Drive test line to its active level
+        hal_sleep_us (cfg->timing [CFG_TM_SCAN_SETTLE]);
+        PROF_END (PH_SETTLE, t_line);
 
-        unsigned u_row = gpio_get_all (); // Read the 8 rows (GPIO lines 12 to 19)
-        u_row = (u_row >> 12) & ROW_MASK;
+        PROF_START (t_read);
+        unsigned u_row = hal_rows (); // Read the rows
 
         cur_scan [sel_line] = (__uint8_t)u_row;
+#if LATENCY_ON
+        if ((!lat_seen) && (cur_scan [sel_line] != prv_scan [sel_line]))
+        {
+            LAT_MARK (LAT_GPIO_SAMPLE);
+            lat_seen = 1;
+        }
+#endif // LATENCY_ON
         if (ROW_MASK == u_row)
         {
             // No keys are down in this row
             ++all_off_count;
         }
+        PROF_END (PH_READ, t_read);
 
-        gpio_put (set_ln, 1); // Drive test line high again
-        sleep_us (50);
+        PROF_START (t_recover);
+        hal_line_idle (sel_line); // Drive test line back again
+        hal_sleep_us (cfg->timing [CFG_TM_SCAN_RECOVER]);
 
         // Set line back to an input
-        gpio_set_dir(set_ln, GPIO_IN);
-        gpio_pull_up (set_ln);
+        hal_line_float (sel_line);
+        PROF_END (PH_RECOVER, t_recover);
+    }
+
+    // We have scanned all the lines
+    PROF_START (t_cmp);
+    int changed = (memcmp (cur_scan, prv_scan, COL_SZ) != 0);
+#if TELEM_COUNT
+    // Done before the keys are processed, so the scan time is posted before any message goes
+    telem_scan (hal_time_us () - scan_start, scan_start, changed);
+#endif // TELEM_COUNT
+#if RECORD_ON
+    rec_scan (cur_scan, hal_time_us (), changed); // The raw scan, before the keys are decoded
+#else
+    (void) changed;
+#endif // RECORD_ON
+    PROF_END (PH_COMPARE, t_cmp);
+    scan_compare (all_off_count, scan_start);
+
+    PROF_START (t_tick);
+#if ONESHOT_ON
+    oneshot_tick (); // Expire stale latches and set the indicator LED
+#endif // ONESHOT_ON
+    show_caps_led ();
+#if COMBO_ON
+    if (combo_tick (hal_time_us ()))
+    {
+        // The combo window closed, process the keys that were held back
+        process_keys (0);
+    }
+#endif // COMBO_ON
+
+    // Take up any new config from the host, now that this pass is done
+    cfg_sync ();
+    PROF_END (PH_TICK, t_tick);
 
-        ++sel_line; // Next column
-        if (sel_line >= COL_SZ) // we have scanned all the lines
+#if STORE_ON
+    if (first_pass)
+    {
+        store_boot_scan (hal_time_us ()); // The keyboard is usable from here
+        first_pass = 0;
+    }
+    if (store_hold == STORE_HOLD_REQ)
+    {
+        // Core-0 wants to write the flash, scan from RAM until it is done
+        cfg = cfg_live ();
+        uint32_t gap_us;
+        int n = scan_hold (cfg->timing [CFG_TM_SCAN_SETTLE], cfg->timing [CFG_TM_SCAN_RECOVER], &gap_us);
+        store_scan_gap (gap_us);
+
+        // Then catch up with the scans that changed meanwhile
+        int idx;
+        for (idx = 0; idx < n; ++idx)
         {
-            // Did a key change?
-            int diff = memcmp (cur_scan, prv_scan, COL_SZ);
-            if (diff != 0) // Something changed in the key map
+            int line;
+            all_off_count = 0;
+            for (line = 0; line < COL_SZ; ++line)
             {
-                // Set non-zero to flag all keys are up
-                int all_keys_up = 0;
-                /* If the previous map had keys down, and the current map does not
-                 * then we must have released all the keys - make sure a key up is
-                 * sent to the USB HID stack later. */
-                if (all_off_count >= COL_SZ)
-                {
-                    all_keys_up = COL_SZ;
-                }
-                else // some key must be pressed
+                cur_scan [line] = hold_scans [idx][line];
+                if (cur_scan [line] == ROW_MASK)
                 {
-                    all_keys_up = 0;
+                    ++all_off_count;
                 }
-
-                // Something changed, scan the current set and process accordingly
-                process_keys (all_keys_up);
-                // Record the new state
-                memcpy (prv_scan, cur_scan, COL_SZ);
             }
-
-            // Restart scan sequence
-            sel_line = 0;
-            all_off_count = 0;
+#if RECORD_ON
+            rec_scan (cur_scan, hold_ts [idx], 1);
+#endif // RECORD_ON
+            scan_compare (all_off_count, hold_ts [idx]);
         }
     }
+#endif // STORE_ON
+#if POWER_ON
+    power_park (all_off_count < COL_SZ); // Whilst the host is suspended, wait here for a key
+#endif // POWER_ON
+#if WATCH_ON
+    watch_beat1 (hal_time_us ()); // Core-0 relaunches core-1 if this stops
+#endif // WATCH_ON
+    PROF_END (PH_PASS, t_pass);
+} // scan_pass
+
+/* Set up the keyboard logic - the config, the combo tables and so on.
+ * Must be done before core-1 starts scanning. */
+void kb_init (void)
+{
+    int idx;
+
+#if POWER_ON
+    power_init (); // Moves the UART clock off the system clock, before it is ever slowed down
+#endif // POWER_ON
+
+    // Clear the previous and current keyboard scan states
+    for (idx = 0; idx < COL_SZ; ++idx)
+    {
+        prv_scan [idx] = 0; // previous scan
+    }
+
+    for (idx = 0; idx < COL_SZ; ++idx)
+    {
+        cur_scan [idx] = 0; // current scan
+    }
+
+    // The scanner reads its keymaps and timings from the live config
+    static const __uint8_t *const layers [CFG_LAYERS] = {
+        key_table, key_FN_table, key2_table, key_BLK_table
+    };
+    cfg_init (layers);
+#if STORE_ON
+    store_init (); // Loads the saved config over the defaults, if there is one
+#endif // STORE_ON
+#if RECORD_ON
+    rec_init (); // Finds where the recording in the flash got to
+#endif // RECORD_ON
+
+#if TELEM_COUNT
+    telem_init (); // Measures the telemetry cost, so must be before core-1 starts
+#endif // TELEM_COUNT
+    usb_task_init (); // The HID poll and LED heartbeat tasks
+#if MOUSE_ON
+    mouse_init (); // The mouse keys task, armed whilst one is held
+#endif // MOUSE_ON
+#if CFG_TUD_CDC
+    paste_init (); // The paste task, armed when text comes in
+#endif // CFG_TUD_CDC
+#if CFG_TUD_MSC
+    msc_init (); // The USB drive save task, armed when a CONFIG.BIN is written
+#endif // CFG_TUD_MSC
+#if WATCH_ON
+    watch_init (); // Starts the hardware watchdog, core-1 must be running before it runs out
+#endif // WATCH_ON
+#if PROF_ON
+    prof_init (); // Starts the core-0 SysTick and measures the profiler cost, before core-1 starts
+#endif // PROF_ON
+
+#if COMBO_ON
+    // Build the combo lookup tables before the scanner starts using them
+    int bad_combos = combo_init ();
+#ifdef SER_DBG_ON
+    if (bad_combos)
+    {
+        printf ("%d key combos rejected\n", bad_combos);
+    }
+#else
+    (void) bad_combos;
+#endif // SER_DBG_ON
+#endif // COMBO_ON
+} // kb_init
+
+// A message from core-1 - send it on the link, and queue it for the hid_task()
+static void kb_msg (uint32_t uv)
+{
+#if LINK_ON
+    link_msg (uv); // Send any key changes on the UART
+#endif // LINK_ON
+#if MOUSE_ON
+    if ((uv & FLAG_TAG_MASK) == FLAG_MOUSE)
+    {
+        // Mouse keys go straight to the mouse task, not via the key queue
+        mouse_set_keys ((uint16_t)(uv & 0xFFFF));
+    }
+    else
+#endif // MOUSE_ON
+#if LINK_ONLY
+    // Plain keys went on the link, only the keystroke streams still need the USB
+    if (((uv & FLAG_TAG_MASK) == FLAG_UNICODE) || ((uv & FLAG_TAG_MASK) == FLAG_MACRO))
+#endif // LINK_ONLY
+    {
+        // queue the key-down
+        kc_put (uv);
+    }
+    // diagnostic - log the keycode, without holding up the loop
+    TRACE (TR_MSG, (kc_in - kc_out) & KC_MSK, uv);
+} // kb_msg
+
+/* Take every message waiting in the FIFO, before core-1 is relaunched
+ * (kb-watch.c), as the launch clears it */
+void kb_drain (void)
+{
+    while (hal_fifo_rvalid ())
+    {
+        kb_msg (hal_fifo_pop ());
+    }
+} // kb_drain
+
+/* One pass of the core-0 loop - read keycodes from core-1 and pass them to
+ * the hid_task() for sending, then run the USB and the other tasks. */
+void kb_task (void)
+{
+    PROF_START (t_loop);
+#if WATCH_ON
+    watch_beat0 ();
+#endif // WATCH_ON
+    if (hal_fifo_rvalid ()) // data pending in FIFO
+    {
+        PROF_START (t_msg);
+        kb_msg (hal_fifo_pop ());
+        PROF_END (PH_MSG, t_msg);
+    }
+
+    PROF_START (t_tud);
+    tud_task(); // tinyusb device task, its work comes with the USB interrupt, which wakes core-0
+    PROF_END (PH_TUD, t_tud);
+    PROF_START (t_hid);
+    hid_task(); // HID processing task (in usb-stack.c), moved on by a key from core-1 or a report sent
+    PROF_END (PH_HID, t_hid);
+    PROF_START (t_other);
+    sched_run(); // The tasks that are due: the HID poll, the mouse keys, the store... (in kb-sched.c)
+#if POWER_ON
+    power_task(); // Back to full speed when a key wakes the scanner whilst suspended, core-1 sends a SEV (in kb-power.c)
+#endif // POWER_ON
+    PROF_END (PH_OTHER, t_other);
+    PROF_END (PH_LOOP, t_loop);
+} // kb_task
+
+#if !KB_HOST
+#if SCHED_SLEEP_ON
+// Nothing is waiting for core-0 to do it, so it can sleep until the next deadline or event
+static int kb_idle (void)
+{
+    return ((!hal_fifo_rvalid ()) && (kc_peek () == 0) && (!stream_busy ()));
+} // kb_idle
+#endif // SCHED_SLEEP_ON
+
+/* The "main" task on the second core.
+ * This manages the reading and initial decoding of the keyboard matrix.
+ * Started again by the watchdog if core-1 stalls, so it clears nothing. */
+void scan_thread (void)
+{
+#if PROF_ON
+    prof_init_core1 (); // The SysTick is per core
+#endif // PROF_ON
+#if WATCH_ON
+    hal_lines_unpark (); // The stall may have left some lines driven low
+    watch_start1 ();
+#endif // WATCH_ON
+    // signal to the primary thread that this worker thread is ready
+    hal_fifo_push (99);
+
+    while (true)
+    {
+        scan_pass ();
+    }
 } // scan_thread
 
 // main - initialize the board, start tinyusb, start the worker thread
@@ -950,36 +1787,35 @@ int main()
     gpio_init(LED_CAPS);
     gpio_set_dir(LED_CAPS, GPIO_OUT);
 
-    int idx;
-    // GPIO pins 2 to 11 (ten pins) drive the select lines
-    // These are normally high but driven low to select a line
-    // Set them as inputs until we are ready to drive the line
-    for (idx = 2; idx <= 11; ++idx)
-    {
-        gpio_init (idx);
-        gpio_set_dir (idx, GPIO_IN);
-        gpio_pull_up (idx);
-    }
-
-    // GPIO pins 12 to 19 (8 pins) test the rows
-    // These are pulled high
-    for (idx = 12; idx <= 19; ++idx)
-    {
-        gpio_init (idx);
-        gpio_set_dir (idx, GPIO_IN);
-        gpio_pull_up (idx);
-    }
-
-    // Clear the previous and current keyboard scan states
-    for (idx = 0; idx < COL_SZ; ++idx)
-    {
-        prv_scan [idx] = 0; // previous scan
-    }
+    // The select lines (kb-matrix.h) are inputs, pulled to their idle level,
+    // until the scanner selects one by driving it
+#define LINE_INIT_(i, gpio) gpio_init (gpio); hal_line_float (i);
+    MATRIX_LINE_PINS (LINE_INIT_)
+#undef LINE_INIT_
 
-    for (idx = 0; idx < COL_SZ; ++idx)
+#if LATENCY_ON
+    // The latency marker pins, for a logic analyser
+    static const uint lat_pins [] = {
+        LAT_GPIO_SAMPLE, LAT_GPIO_ACCEPT, LAT_GPIO_ENQUEUE, LAT_GPIO_REPORT, LAT_GPIO_DONE
+    };
+    int idx;
+    for (idx = 0; idx < (int)(sizeof (lat_pins) / sizeof (lat_pins [0])); ++idx)
     {
-        cur_scan [idx] = 0; // current scan
+        gpio_init (lat_pins [idx]);
+        gpio_set_dir (lat_pins [idx], GPIO_OUT);
+        gpio_put (lat_pins [idx], 0);
     }
+#endif // LATENCY_ON
+
+    // The rows are inputs, pulled high for an active low matrix, else low,
+    // so they read as no key down when no line is selected
+#if MATRIX_ACTIVE_LOW
+#define ROW_INIT_(i, gpio) gpio_init (gpio); gpio_set_dir (gpio, GPIO_IN); gpio_pull_up (gpio);
+#else
+#define ROW_INIT_(i, gpio) gpio_init (gpio); gpio_set_dir (gpio, GPIO_IN); gpio_pull_down (gpio);
+#endif // MATRIX_ACTIVE_LOW
+    MATRIX_ROW_PINS (ROW_INIT_)
+#undef ROW_INIT_
 
     tusb_init(); // start tinyusb
 
@@ -988,10 +1824,19 @@ int main()
     printf ("\n-- Keyboard test starting --\n");
 #endif // SER_DBG_ON
 
+#if LINK_ON
+    link_init (); // The key event link takes over the UART at LINK_BAUD
+#endif // LINK_ON
+#if TRACE_ON
+    trace_init (); // The trace log takes over the UART at TRACE_BAUD
+#endif // TRACE_ON
+
+    kb_init (); // The keymaps, saved config, combos and so on
+
     // Start the keyboard scanner thread on core-1
     multicore_launch_core1 (scan_thread);
     // Wait for scan_thread() to start up
-    uint32_t g = multicore_fifo_pop_blocking();
+    uint32_t g = hal_fifo_pop ();
 
     // cursory check that core-1 started OK
     if (g == 99)
@@ -1010,26 +1855,16 @@ int main()
     // forever - read keycodes from core-1 and pass them to the hid_task() for sending
     while (true)
     {
-        if (multicore_fifo_rvalid ()) // data pending in FIFO
+        kb_task ();
+#if SCHED_SLEEP_ON
+        if (kb_idle ())
         {
-            uint32_t uv = multicore_fifo_pop_blocking();
-            // queue the key-down
-            kc_put (uv);
-
-#ifdef SER_DBG_ON
-            if (uv != FLAG_ALL_UP)
-            {
-                // diagnostic - echo the keycode to the serial i/o
-                printf ("  %08X \b\b\b\b\b\b\b\b\b\b\b", (unsigned)uv);
-            }
-#endif // SER_DBG_ON
+            sched_sleep (); // Until the next task is due, or something happens
         }
-
-        tud_task(); // tinyusb device task
-        led_blinking_task(); // LED heartbeat (in usb-stack.c)
-        hid_task(); // HID processing task (in usb-stack.c)
+#endif // SCHED_SLEEP_ON
     }
     return 0;
 } // main
+#endif // !KB_HOST
 
 // end of file
@@ -5,6 +5,8 @@
 #ifndef _KB_MAIN_H_
 #define _KB_MAIN_H_
 
+#include "kb-matrix.h"
+
 #ifdef __cplusplus
  extern "C" {
 #endif
@@ -12,12 +14,195 @@
 // Define the polling rate for the USB HID service
 #define PW_POLL  10  // default to 10ms polling rate
 
-#define ROW_MASK    0x000000FF
+/* Core-0 sleeps (WFE) between the scheduled tasks, until the next deadline, a USB
+ * interrupt or a message from core-1, rather than spinning round the main loop (see kb-sched.c) */
+#define SCHED_SLEEP_ON 1 // Set 0 to keep core-0 spinning
+
+// Define the polling interval the host uses for the HID endpoint (ms) - 1 allows a report every USB frame
+#define HID_EP_POLL  1
+
+/* One-shot (latched) modifiers, as the original FontWriter handled Code-II:
+ * press and release the modifier, then press the key it applies to.
+ * Holding the modifier down whilst pressing the key still works as before. */
+#define ONESHOT_ON       1    // Set 0 to only support the "press and hold" style
+#define ONESHOT_SHIFT    0    // Set 1 to also latch the Shift key
+#define ONESHOT_HELP     1    // Set 1 to also latch the HELP (function key) modifier
+#define ONESHOT_TIMEOUT  3000 // ms a latched modifier waits for a key before it is dropped
+#define ONESHOT_TAP      400  // ms within which a second tap locks the modifier on
+
+// Key combos - keys pressed together to give keys the FontWriter does not have (see kb-combo.c)
+#define COMBO_ON      1  // Set 0 to disable the combo engine
+#define COMBO_WINDOW  40 // ms within which all the keys of a combo must go down
+#define COMBO_KEYS_ON 0  // Set 1 for the Print Screen, Scroll Lock, Pause, Menu and AltGr combos, which hold
+                         // back Page UP/DOWN, HOME, END, Cancel, Backspace, Right CTRL and the Menu keys
+
+/* Unicode entry mode - the Code-II symbols are typed as CTRL + SHIFT + U, hex digits, SPACE.
+ * This works on Linux (IBus / GTK) hosts whatever key map is loaded. HELP + Code-II together toggle it. */
+#define UNICODE_ON       1 // Set 0 to leave the Unicode entry mode out altogether
+#define UNICODE_DEFAULT  0 // Set 1 to start up in the Unicode entry mode
+
+// Minimum gap between reports when streaming keystrokes (0 = as fast as the host polls)
+#define STREAM_GAP_US    0
+
+// Macros - strings typed by BLOCK + 1 to 0 (see kb-macro.c)
+#define MACRO_ON         1    // Set 0 to leave the macros out
+#define MACRO_CNT        10   // How many macros there are
+#define MACRO_GAP_US     1000 // Minimum gap between macro reports (us), 1000 is one report per USB frame
+#define MACRO_INTERRUPT  0    // Set 1 for a real key press to cut a macro short, 0 to queue behind it
+
+// Mouse keys - BLOCK + HELP together toggle the mouse layer (see kb-mouse.c)
+#define MOUSE_ON         1
+#define MOUSE_PROFILE    MOUSE_QUADRATIC // Acceleration profile, MOUSE_LINEAR or MOUSE_QUADRATIC
+#define MOUSE_V0         32   // Starting speed, pixels per ms in Q8 (32 = 125 pixels per second)
+#define MOUSE_VMAX       384  // Top speed, pixels per ms in Q8 (384 = 1500 pixels per second)
+#define MOUSE_ACCEL_MS   1200 // ms to reach top speed
+#define MOUSE_WHEEL_MS   80   // ms between wheel clicks whilst a wheel key is held
+
+/* Paste mode - text sent to the CDC serial port is typed to the host (see kb-paste.c).
+ * Turn it on with CFG_TUD_CDC in tusb_config.h. */
+#define PASTE_BUF_SZ     256  // Paste buffer size, must be a power of 2
+#define PASTE_GAP_US     0    // Minimum gap between pasted reports (us), 0 = as fast as the host polls
+#define PASTE_IDLE_MS    250  // ms with no text before a paste is taken to be done
+
+/* Key event link - key presses and releases are sent as binary frames on the UART,
+ * for the kb-uinputd daemon on a host wired to it (see kb-link.c and tools/) */
+#define LINK_ON          0      // Set 1 to send key events on the UART
+#define LINK_ONLY        0      // Set 1 to send plain keys on the UART only, not as USB reports
+#define LINK_UART        uart0  // The UART stdio uses, on the default pins
+#define LINK_BAUD        921600
+
+/* Binary trace log - fixed size records sent on the UART by DMA, instead of printf
+ * (see kb-trace.c), turned back into text by kb-trace-dump in tools/ */
+#define TRACE_ON         0      // Set 1 to write the trace records
+#define TRACE_RING_SZ    64     // Records in each core's ring, must be a power of 2
+#define TRACE_UART       uart0
+#define TRACE_BAUD       921600
+
+/* Live telemetry - counters and a latency histogram sent on the CDC serial port
+ * every TELEM_MS (see kb-telem.c), shown by kb-telem-view in tools/. Needs CFG_TUD_CDC. */
+#define TELEM_ON         0      // Set 1 to collect and send the telemetry
+#define TELEM_MS         1000   // ms between telemetry frames
+
+// Performance counters feature report - any host can read it with GET_REPORT (e.g. hidraw, see tools/kb-perf)
+#define PERF_REPORT_ON   1
+
+// The counters are kept if the telemetry or the feature report needs them
+#define TELEM_COUNT      (TELEM_ON || PERF_REPORT_ON)
+
+/* Live configuration - the keymaps and timings can be changed by the host over a
+ * vendor HID feature report, and take effect between two scans (see kb-config.c, tools/kb-cfg) */
+#define CONFIG_ON        1      // Set 0 to leave out the config report, the built-in keymaps are used as they are
+
+/* Flash config store - the live configuration can be saved to the last STORE_SECTORS
+ * sectors of the flash, and is loaded at boot (see kb-store.c) */
+#define STORE_ON         1      // Set 0 to always start with the built-in config
+#define STORE_SECTORS    4      // Sectors (4 KB) used in turn, 8 saves each
+
+/* Scan frame recorder - every change in the raw matrix scan is kept, with its time, in a
+ * ring of pages in the flash below the config store (see kb-record.c). Needs STORE_ON. */
+#define RECORD_ON        0      // Set 1 to record, from boot
+#define RECORD_SECTORS   64     // Flash sectors (4 KB) for the recording, 16 pages of ~90 changes each
+#define RECORD_RAM_PAGES 8      // Pages held in RAM until core-0 writes them, must be a power of 2
+
+/* Latency markers - spare GPIOs are toggled at each step from a key change to its USB report,
+ * for a logic analyser. Each step has a pin of its own, and every edge on it is one event.
+ * kb-latency in tools/ reads a sigrok / PulseView CSV capture of them (wire the pins to D0 - D4). */
+#define LATENCY_ON       0      // Set 1 to drive the marker pins
+#define LAT_GPIO_SAMPLE  20     // D0: the line scan that first sees a change
+#define LAT_GPIO_ACCEPT  21     // D1: the change is taken up, at the end of the pass
+#define LAT_GPIO_ENQUEUE 26     // D2: the key message is pushed to core-0
+#define LAT_GPIO_REPORT  27     // D3: tud_hid_keyboard_report() is called
+#define LAT_GPIO_DONE    28     // D4: the keyboard report has gone to the host
+
+/* Phase profiler - the scan loop and the core-0 loop are timed a phase at a time with the
+ * SysTick, and the cycle figures are read back with kb-cfg prof (see kb-prof.h). */
+#define PROF_ON          0      // Set 1 to profile, it adds a few us to each scan pass
+
+/* Suspend power states - whilst the host has the bus suspended, the system clock runs from the
+ * USB PLL, core-0 sleeps longer and core-1 parks the scanner until a key goes down (see kb-power.c). */
+#define POWER_ON         1      // Set 0 to scan flat out whilst suspended, as before
+#define PWR_SLOW_CLOCK   1      // Set 0 to keep the full clock, and only park the scanner
+#define PWR_PARK_MS      100    // ms between full scans whilst parked, a key down wakes it at once
+#define PWR_WAKE_MS      1000   // ms a key waits for the host to resume, before it all goes back to sleep
+
+/* Core-1 watchdog - core-0 watches core-1's heartbeat and relaunches it if it stops, keeping the
+ * key state, and the hardware watchdog reboots the Pico if core-0 stops or core-1 keeps stalling
+ * (see kb-watch.c). */
+#define WATCH_ON         1      // Set 0 for no watchdog, e.g. to stop a core in the debugger for long
+#define WATCH_MS         10     // ms between looks at core-1's heartbeat, the hardware watchdog is fed then too
+#define WATCH_STALL_MS   250    // ms with no pass over the matrix before core-1 is relaunched
+#define WATCH_RETRIES    3      // Relaunches within WATCH_RETRY_MS before giving up, and letting it reboot
+#define WATCH_RETRY_MS   10000
+#define WATCH_HW_MS      1000   // ms the hardware watchdog waits to be fed, more than the longest flash write
+
+/* Host build - the scanner, decoder and report code built on Linux against the
+ * mock GPIO, FIFO and TinyUSB in tools/host/ (see kb-hal.h). KB_HOST is set by
+ * tools/CMakeLists.txt, never by hand. There is no flash, UART nor CDC serial port there,
+ * save for KB_HOST_DRIVE, which keeps the config store, on the RAM flash in
+ * tools/host/kb-flash.c, for the USB drive view (kb-msc-image). */
+#ifndef KB_HOST
+#define KB_HOST          0
+#endif
+#ifndef KB_HOST_DRIVE
+#define KB_HOST_DRIVE    0
+#endif
+#if KB_HOST
+#undef  LINK_ON
+#define LINK_ON          0
+#undef  TRACE_ON
+#define TRACE_ON         0
+#undef  TELEM_ON
+#define TELEM_ON         0
+#if !KB_HOST_DRIVE
+#undef  STORE_ON
+#define STORE_ON         0
+#endif // !KB_HOST_DRIVE
+#undef  RECORD_ON
+#define RECORD_ON        0
+#undef  LATENCY_ON
+#define LATENCY_ON       1      // Always on, the mock GPIO costs nothing and kb-sim can capture them
+#undef  PROF_ON
+#define PROF_ON          0      // There is no SysTick, kb-bench times the host build instead
+#endif // KB_HOST
+
+#if LATENCY_ON
+#define LAT_MARK(gpio) hal_gpio_toggle (gpio)
+#else
+#define LAT_MARK(gpio) ((void) 0)
+#endif // LATENCY_ON
+
+// Matrix scan timings, the defaults for the live configuration
+#define SCAN_SETTLE_US   200    // us a select line is held low before the rows are read
+#define SCAN_RECOVER_US  50     // us a select line is held high again before the next line
+
+// Host key map, used when typing text for the host (e.g. macros)
+#define LAYOUT_US        0
+#define LAYOUT_UK        1
+#define LAYOUT_PROFILE   LAYOUT_UK
+
+// The matrix is 8 rows by 10 columns on the FontWriter, set by MATRIX_MODEL (see kb-matrix.h)
+#define ROW_SZ  MATRIX_ROWS
+#define COL_SZ  MATRIX_COLS
+
+// Most keys we pick out of the matrix on one pass. In practice we reject any more than 3.
+#define MX_KEYS 4
+
+#define ROW_MASK    MATRIX_ROW_BITS
 #define FLAG_ALL_UP 0xFFFFFFFF
 
  // Code to signal Caps Lock on
 #define CAPS_ON     0x55
 
+/* Tagged messages, for things that are not simple key reports.
+ * The top byte is normally the modifiers, but no key we decode ever sets all
+ * these modifier bits together, so they are free to use as tags. */
+#define FLAG_TAG_MASK 0xFF000000
+#define FLAG_UNICODE  0xFE000000 // Type the Unicode code point in the low bits
+#define FLAG_UNI_MASK 0x001FFFFF
+#define FLAG_MACRO    0xFD000000 // Type the macro number in the low bits
+#define FLAG_CONSUMER 0xFC000000 // Press the consumer control (media key) usage in the low 16 bits
+#define FLAG_MOUSE    0xFB000000 // The mouse keys (MK_xxx bits) held down, in the low 16 bits
+
 /* Used to pass a key-combo from the keyboard thread to the USB thread.
  * Uses a Pico FIFO to pass a uint32_t. This word has 4 "codes" packed into
  * it as "modifiers", "k1", "k2", "k3".
@@ -32,11 +217,18 @@ typedef union
 
 // defined in fw-kb-main.c
 extern uint32_t kc_get (void);
+extern uint32_t kc_peek (void);
+extern uint32_t kc_time (void);
 extern void set_caps_lock_led (int i_state);
+extern void scan_pass (void);
+extern void scan_thread (void);
+extern void kb_init (void);
+extern void kb_task (void);
+extern void kb_drain (void);
 
 // Defined in usb-stack.c
-extern void led_blinking_task(void);
 extern void hid_task(void);
+extern void usb_task_init(void);
 
 // Defined in usb_descriptors.c
 extern void set_serial_string (char const *ser);
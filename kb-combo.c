@@ -0,0 +1,407 @@
+/* Key combo (chord) engine for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * The FontWriter has no Print Screen, Scroll Lock, Pause, Menu or AltGr keys,
+ * so these are produced by pressing pairs of keys together instead.
+ *
+ * Each key in the matrix has a precomputed bitmask of the combos it belongs to,
+ * so as keys go down the set of possible combos is narrowed with a single AND
+ * per key press. The cost per scan is the same however many combos are defined.
+ *
+ * Keys that belong to some combo are held back for up to the combo window
+ * (COMBO_WINDOW ms, unless the host changes it, see kb-config.c) while
+ * we wait to see if the rest of the combo arrives. Keys that are not in any
+ * combo are not delayed at all. So the key combos are opt-in (COMBO_KEYS_ON),
+ * and by default only the HELP, Code-II and BLOCK layer keys, which send
+ * nothing by themselves, are in a combo.
+ */
+
+#include "kb-hal.h"
+#include <tusb.h>
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-combo.h"
+#include "kb-config.h"
+
+#define KEY_AT(r, c)  (((r) * COL_SZ) + (c)) // Matrix position of a key
+#define NO_KEY        0xFF                   // Pads the unused key slots of a combo
+
+#define KEY_CNT    (ROW_SZ * COL_SZ)
+#define KEY_WORDS  ((KEY_CNT + 31) / 32) // Words needed for a bitmap of all the keys
+
+typedef struct
+{
+    uint8_t keys [COMBO_MAX_KEYS]; // Matrix positions of the keys in the combo
+    uint8_t kind;                  // COMBO_KEY or COMBO_MOD
+    uint8_t mods;                  // Modifier bits to send
+    uint8_t code;                  // HID key code to send
+} combo_def;
+
+/* The combos. Keys are given by their (row, column) position in the matrix,
+ * see key_table in fw-kb-main.c for the layout. */
+static const combo_def combo_table [] = {
+#if COMBO_KEYS_ON
+    { { KEY_AT(2, 2), KEY_AT(2, 9), NO_KEY, NO_KEY }, COMBO_KEY, 0, HID_KEY_PRINT_SCREEN }, // Page UP + Page DOWN
+    { { KEY_AT(6, 2), KEY_AT(6, 1), NO_KEY, NO_KEY }, COMBO_KEY, 0, HID_KEY_SCROLL_LOCK },  // HOME + Document END
+    { { KEY_AT(2, 5), KEY_AT(1, 0), NO_KEY, NO_KEY }, COMBO_KEY, 0, HID_KEY_PAUSE },        // Cancel + Backspace
+    { { KEY_AT(6, 9), KEY_AT(1, 9), NO_KEY, NO_KEY }, COMBO_KEY, 0, HID_KEY_APPLICATION },  // Both Menu keys
+    { { KEY_AT(3, 7), KEY_AT(1, 9), NO_KEY, NO_KEY }, COMBO_MOD,                            // Right CTRL + right Menu
+        KEYBOARD_MODIFIER_RIGHTALT, HID_KEY_ALT_RIGHT },                                    // ... is AltGr
+#endif // COMBO_KEYS_ON
+#if UNICODE_ON
+    { { KEY_AT(5, 9), KEY_AT(6, 5), NO_KEY, NO_KEY }, COMBO_ACT, 0, ACT_UNICODE },          // HELP + Code-II
+#endif // UNICODE_ON
+#if MOUSE_ON
+    { { KEY_AT(5, 5), KEY_AT(5, 9), NO_KEY, NO_KEY }, COMBO_ACT, 0, ACT_MOUSE },            // BLOCK + HELP
+#endif // MOUSE_ON
+    // A combo can send a macro too, e.g. ";" + "l" for macro 1:
+    //{ { KEY_AT(0, 4), KEY_AT(1, 4), NO_KEY, NO_KEY }, COMBO_ACT, 0, ACT_MACRO + 0 },
+};
+#define COMBO_CNT ((int)(sizeof (combo_table) / sizeof (combo_table[0])))
+
+static uint32_t key_combos [KEY_CNT];              // For each key, which combos it belongs to
+static uint32_t size_combos [COMBO_MAX_KEYS + 1];  // Which combos are made of N keys
+static uint32_t combo_keys [COMBO_MAX][KEY_WORDS]; // Bitmap of the keys in each combo
+
+// Engine state
+enum
+{
+    CB_IDLE = 0, // Nothing going on
+    CB_PENDING,  // Keys are down that might become a combo
+    CB_ACTIVE    // A combo has fired, and its keys are still down
+};
+
+static int      cb_state = CB_IDLE;
+static uint32_t cb_down [KEY_WORDS]; // Keys down on the last pass
+static uint32_t cb_cand  = 0;        // Combos still possible in the current attempt
+static int      cb_count = 0;        // Keys pressed so far in the current attempt
+static uint32_t cb_start = 0;        // When the current attempt started (us)
+static int      cb_fired = 0;        // Which combo is active
+static int      cb_emit  = 0;        // Set when the active combo still has to be sent
+static int      cb_held [MX_KEYS];   // The keys held back by the current attempt
+static int      cb_n_held = 0;
+
+/* Check a combo for the "shadow key" problem: the matrix has no diodes, so
+ * three keys on the corners of a rectangle make the fourth corner appear
+ * pressed too. Such a combo could never be read reliably. */
+static int combo_ghosts (const combo_def *cd, int n)
+{
+    int a, b, c;
+    for (a = 0; a < n; ++a)
+    {
+        for (b = 0; b < n; ++b)
+        {
+            for (c = 0; c < n; ++c)
+            {
+                if ((a == b) || (a == c) || (b == c))
+                {
+                    continue;
+                }
+                int ra = cd->keys[a] / COL_SZ, ca = cd->keys[a] % COL_SZ;
+                int rb = cd->keys[b] / COL_SZ, cb = cd->keys[b] % COL_SZ;
+                int rc = cd->keys[c] / COL_SZ, cc = cd->keys[c] % COL_SZ;
+
+                // b shares a row with a, c shares a column with a: ghost at (rc, cb)
+                if ((ra == rb) && (ca != cb) && (ca == cc) && (ra != rc))
+                {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+} // combo_ghosts
+
+/* Build the lookup masks from combo_table.
+ * Returns the number of combos rejected as unusable. */
+int combo_init (void)
+{
+    int rejected = 0;
+    int idx;
+    int k;
+
+    for (idx = 0; idx < KEY_CNT; ++idx)
+    {
+        key_combos [idx] = 0;
+    }
+    for (idx = 0; idx <= COMBO_MAX_KEYS; ++idx)
+    {
+        size_combos [idx] = 0;
+    }
+
+    for (idx = 0; idx < COMBO_CNT; ++idx)
+    {
+        const combo_def *cd = &combo_table [idx];
+        int n = 0;
+        int bad = 0;
+
+        for (k = 0; k < KEY_WORDS; ++k)
+        {
+            combo_keys [idx][k] = 0;
+        }
+
+        for (k = 0; k < COMBO_MAX_KEYS; ++k)
+        {
+            if (cd->keys[k] == NO_KEY)
+            {
+                break;
+            }
+            if (cd->keys[k] >= KEY_CNT)
+            {
+                bad = 1;
+                break;
+            }
+            ++n;
+        }
+
+        if ((idx >= COMBO_MAX) || bad || (n < 2) || combo_ghosts (cd, n))
+        {
+            ++rejected;
+            continue;
+        }
+
+        uint32_t bit = 1u << idx;
+        for (k = 0; k < n; ++k)
+        {
+            int pos = cd->keys[k];
+            key_combos [pos] |= bit;
+            combo_keys [idx][pos >> 5] |= 1u << (pos & 31);
+        }
+        size_combos [n] |= bit;
+    }
+
+    cb_state = CB_IDLE;
+    return rejected;
+} // combo_init
+
+// Start the combo "idx" - it will be sent on the next pass
+static void combo_activate (int idx)
+{
+    cb_state = CB_ACTIVE;
+    cb_fired = idx;
+    cb_emit  = 1;
+} // combo_activate
+
+// Handle the active combo, whilst any of its keys are down
+static int combo_active (int *keys, int *n_keys, const uint32_t *down, msg_blk *out)
+{
+    const combo_def *cd = &combo_table [cb_fired];
+    int still_down = 0;
+    int k;
+
+    for (k = 0; k < KEY_WORDS; ++k)
+    {
+        if (combo_keys [cb_fired][k] & down[k])
+        {
+            still_down = 1;
+        }
+    }
+
+    if (!still_down)
+    {
+        // The combo is over, anything else that is down is decoded as normal
+        cb_state = CB_IDLE;
+        return COMBO_PASS;
+    }
+
+    out->p[3] = cd->mods;
+    out->p[2] = cd->code;
+
+    if (cd->kind == COMBO_MOD)
+    {
+        // Remove the combo keys, so that the other keys are decoded as normal
+        int n = 0;
+        for (k = 0; k < *n_keys; ++k)
+        {
+            int pos = keys[k];
+            if ((combo_keys [cb_fired][pos >> 5] & (1u << (pos & 31))) == 0)
+            {
+                keys[n] = pos;
+                ++n;
+            }
+        }
+        *n_keys = n;
+        cb_emit = 0;
+        return COMBO_APPLY;
+    }
+
+    if (cb_emit)
+    {
+        cb_emit = 0;
+        return (cd->kind == COMBO_ACT) ? COMBO_ACTION : COMBO_FIRE;
+    }
+    return COMBO_HOLD; // Suppress the component keys until they are all released
+} // combo_active
+
+// See whether the keys pressed so far make up a combo yet
+static int combo_check (int *keys, int *n_keys, const uint32_t *down, msg_blk *out)
+{
+    uint32_t exact = 0;
+
+    if (cb_count <= COMBO_MAX_KEYS)
+    {
+        exact = cb_cand & size_combos [cb_count];
+    }
+    else
+    {
+        cb_cand = 0; // Too many keys for any combo
+    }
+
+    if (cb_cand == 0)
+    {
+        // Not a combo after all
+        cb_state = CB_IDLE;
+        return COMBO_PASS;
+    }
+
+    if ((exact != 0) && ((cb_cand & ~exact) == 0))
+    {
+        // A complete combo, and no bigger combo it could grow into, fire it now
+        combo_activate (__builtin_ctz (exact));
+        return combo_active (keys, n_keys, down, out);
+    }
+
+    // Still waiting for the rest of the combo, remember what is being held back
+    int k;
+    for (k = 0; k < *n_keys; ++k)
+    {
+        cb_held [k] = keys[k];
+    }
+    cb_n_held = *n_keys;
+    cb_state = CB_PENDING;
+    return COMBO_HOLD;
+} // combo_check
+
+/* Called by process_keys() with the keys down on this pass, every time the
+ * matrix changes. May remove keys from the list (for COMBO_APPLY). */
+int combo_scan (int *keys, int *n_keys, uint32_t now_us, msg_blk *out)
+{
+    uint32_t down [KEY_WORDS] = { 0 };
+    uint32_t newk [KEY_WORDS];
+    int result = COMBO_PASS;
+    int n_new = 0;
+    int k;
+
+    for (k = 0; k < *n_keys; ++k)
+    {
+        down [keys[k] >> 5] |= 1u << (keys[k] & 31);
+    }
+    for (k = 0; k < KEY_WORDS; ++k)
+    {
+        newk [k] = down[k] & ~cb_down[k];
+        n_new += __builtin_popcount (newk[k]);
+    }
+
+    switch (cb_state)
+    {
+        case CB_ACTIVE:
+        result = combo_active (keys, n_keys, down, out);
+        break;
+
+        case CB_PENDING:
+        {
+            // Was a held back key let go before the combo completed?
+            int released = 0;
+            for (k = 0; k < cb_n_held; ++k)
+            {
+                int pos = cb_held[k];
+                if ((down [pos >> 5] & (1u << (pos & 31))) == 0)
+                {
+                    released = 1;
+                }
+            }
+            if (released)
+            {
+                // The held back keys were just tapped, they must still be sent
+                cb_state = CB_IDLE;
+                result = COMBO_FLUSH;
+                break;
+            }
+
+            for (k = 0; k < *n_keys; ++k)
+            {
+                int pos = keys[k];
+                if (newk [pos >> 5] & (1u << (pos & 31)))
+                {
+                    cb_cand &= key_combos [pos];
+                    ++cb_count;
+                }
+            }
+            result = combo_check (keys, n_keys, down, out);
+        }
+        break;
+
+        case CB_IDLE:
+        default:
+        {
+            // Only start an attempt when nothing else was already held down
+            if ((n_new == 0) || (n_new != *n_keys))
+            {
+                break;
+            }
+
+            cb_cand  = 0xFFFFFFFF;
+            cb_count = 0;
+            cb_start = now_us;
+            for (k = 0; k < *n_keys; ++k)
+            {
+                cb_cand &= key_combos [keys[k]];
+                ++cb_count;
+            }
+            result = combo_check (keys, n_keys, down, out);
+        }
+        break;
+    }
+
+    for (k = 0; k < KEY_WORDS; ++k)
+    {
+        cb_down [k] = down[k];
+    }
+    return result;
+} // combo_scan
+
+// Get the keys held back by an abandoned attempt, for COMBO_FLUSH
+int combo_held (int *keys)
+{
+    int k;
+    for (k = 0; k < cb_n_held; ++k)
+    {
+        keys[k] = cb_held[k];
+    }
+    return cb_n_held;
+} // combo_held
+
+/* Called by scan_thread() after every pass of the matrix.
+ * Returns non-zero if the held keys must be processed again, because the
+ * combo window has closed. */
+int combo_tick (uint32_t now_us)
+{
+    if (cb_state != CB_PENDING)
+    {
+        return 0;
+    }
+    if ((now_us - cb_start) < (cfg_live ()->timing [CFG_TM_COMBO_WINDOW] * 1000u))
+    {
+        return 0;
+    }
+
+    uint32_t exact = 0;
+    if (cb_count <= COMBO_MAX_KEYS)
+    {
+        exact = cb_cand & size_combos [cb_count];
+    }
+
+    if (exact)
+    {
+        // The keys down are a complete combo, nothing bigger arrived in time
+        combo_activate (__builtin_ctz (exact));
+    }
+    else
+    {
+        // Window closed without a complete combo, let the keys through
+        cb_state = CB_IDLE;
+    }
+    return 1;
+} // combo_tick
+
+/* End of File */
@@ -0,0 +1,55 @@
+/*
+ * Header file for the key combo (chord) engine.
+ * A combo is a set of keys pressed together, within COMBO_WINDOW ms, which
+ * emits some other key instead of the keys themselves.
+ */
+
+#ifndef _KB_COMBO_H_
+#define _KB_COMBO_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define COMBO_MAX_KEYS  4  // Most keys that can make up one combo
+#define COMBO_MAX      32  // Most combos that can be defined (one bit each in a uint32_t)
+
+// What a combo does when it fires
+enum
+{
+    COMBO_KEY = 1, // Emit a key (with modifiers), suppressing the component keys
+    COMBO_MOD,     // Act as a modifier whilst held, e.g. AltGr, other keys pass through
+    COMBO_ACT      // Perform an action inside the firmware, e.g. toggle a mode
+};
+
+// Actions for COMBO_ACT combos (in the "code" field)
+enum
+{
+    ACT_UNICODE = 1,  // Toggle the Unicode entry mode
+    ACT_MOUSE,        // Toggle the mouse keys layer
+    ACT_MACRO   = 0x10 // Send macro (code - ACT_MACRO)
+};
+
+// Results from combo_scan()
+enum
+{
+    COMBO_PASS = 0, // Not a combo, decode the keys as normal
+    COMBO_HOLD,     // Keys are (or might be) part of a combo, send nothing yet
+    COMBO_FIRE,     // A combo fired, send the message returned in "out"
+    COMBO_APPLY,    // A modifier combo is held, OR the mods from "out" in and decode the rest
+    COMBO_FLUSH,    // An attempt was abandoned, decode the held-back keys then the current ones
+    COMBO_ACTION    // An action combo fired, the action is in out.p[2]
+};
+
+extern int  combo_init (void);
+extern int  combo_scan (int *keys, int *n_keys, uint32_t now_us, msg_blk *out);
+extern int  combo_held (int *keys);
+extern int  combo_tick (uint32_t now_us);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_COMBO_H_ */
+
+/* End of File */
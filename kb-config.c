@@ -0,0 +1,381 @@
+/* Live configuration for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * The keymaps and timings are held in two banks. Core-1 reads the live bank,
+ * core-0 edits the other one (the staging bank) for the host. A commit marks
+ * the staging bank ready, and core-1 swaps the two over in cfg_sync(), which
+ * it calls after a full scan of the matrix, so a scan never sees half of one
+ * change. Once core-1 has swapped, core-0 copies the new live bank over the
+ * old one, and that becomes the staging bank for the next set of changes.
+ *
+ * Until core-1 has taken up a commit, the staging bank belongs to it, and any
+ * edit is answered with CFG_ERR_BUSY. It is a single scan, 2.5 ms at most.
+ *
+ * Only core-1 writes cfg_live_idx, and only core-0 sets cfg_commit; core-1
+ * clears it. There are no locks, just a barrier each side of the hand over.
+ *
+ * This file uses no Pico SDK parts, so the host tools can build it too, to
+ * run the protocol against a simulated keyboard (kb-cfg -s).
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-config.h"
+
+#if (ROW_SZ * COL_SZ) != CFG_KEYS
+#error "CFG_KEYS must match the size of the matrix"
+#endif
+
+static kb_config cfg_bank [2];
+static volatile int cfg_live_idx = 0;  // The bank core-1 uses, only written by core-1
+static volatile int cfg_commit = 0;    // Set by core-0 when the staging bank is ready, cleared by core-1
+static int cfg_stage = 1;              // The bank core-0 edits
+static int cfg_stale = 0;              // Set when the staging bank must be refreshed after a commit
+
+static uint8_t const *cfg_default_keys [CFG_LAYERS]; // The built-in keymaps
+static uint8_t cfg_resp [CFG_REPORT_LEN];            // The response to the last request
+
+// The built-in timings, and the range each one may be set to
+static const uint16_t tm_default [CFG_TIMINGS] = {
+    COMBO_WINDOW, ONESHOT_TAP, ONESHOT_TIMEOUT, SCAN_SETTLE_US, SCAN_RECOVER_US
+};
+static const uint16_t tm_min [CFG_TIMINGS] = {   5,   50,   100,   10,   10 };
+static const uint16_t tm_max [CFG_TIMINGS] = { 500, 2000, 30000, 2000, 1000 };
+
+// Load the built-in keymaps and timings into a bank
+static void cfg_load_defaults (kb_config *cfg)
+{
+    int layer;
+    for (layer = 0; layer < CFG_LAYERS; ++layer)
+    {
+        memcpy (cfg->keys [layer], cfg_default_keys [layer], CFG_KEYS);
+    }
+    memcpy (cfg->timing, tm_default, sizeof (tm_default));
+    cfg->layout = LAYOUT_PROFILE;
+    cfg->spare = 0;
+} // cfg_load_defaults
+
+/* Set up both banks from the built-in keymaps, one for each CFG_LAYER_xxx.
+ * Called by core-0 before core-1 starts. */
+void cfg_init (uint8_t const *const layers [CFG_LAYERS])
+{
+    memcpy (cfg_default_keys, layers, sizeof (cfg_default_keys));
+    cfg_load_defaults (&cfg_bank [0]);
+    cfg_bank [1] = cfg_bank [0];
+    cfg_live_idx = 0;
+    cfg_stage = 1;
+    cfg_commit = 0;
+    cfg_stale = 0;
+
+    memset (cfg_resp, 0, sizeof (cfg_resp));
+    cfg_resp [CFG_OFS_STATUS] = CFG_ERR_NONE;
+} // cfg_init
+
+/* Use a saved config (from the flash store) in place of the built-in one.
+ * Any timing out of range is left at its default.
+ * Called by core-0 before core-1 starts. */
+void cfg_restore (kb_config const *saved)
+{
+    int idx;
+    memcpy (cfg_bank [0].keys, saved->keys, sizeof (cfg_bank [0].keys));
+    for (idx = 0; idx < CFG_TIMINGS; ++idx)
+    {
+        if ((saved->timing [idx] >= tm_min [idx]) && (saved->timing [idx] <= tm_max [idx]))
+        {
+            cfg_bank [0].timing [idx] = saved->timing [idx];
+        }
+    }
+    if (saved->layout <= LAYOUT_UK)
+    {
+        cfg_bank [0].layout = saved->layout;
+    }
+    cfg_bank [1] = cfg_bank [0];
+} // cfg_restore
+
+// The config core-1 should use. Take it once per pass, so the whole pass sees one config.
+kb_config const *cfg_live (void)
+{
+    return &cfg_bank [cfg_live_idx];
+} // cfg_live
+
+// Called by core-1 between full scans, to take up a commit
+void cfg_sync (void)
+{
+    if (cfg_commit)
+    {
+        cfg_live_idx = 1 - cfg_live_idx;
+        __sync_synchronize (); // The swap is done before core-0 sees the commit taken up
+        cfg_commit = 0;
+    }
+} // cfg_sync
+
+/* Can core-0 use the staging bank? Not until core-1 has taken up the last
+ * commit, then the staging bank is brought up to date with the live one. */
+static int cfg_stage_ready (void)
+{
+    if (cfg_commit)
+    {
+        return 0;
+    }
+    if (cfg_stale)
+    {
+        __sync_synchronize (); // Core-1 has finished with the old live bank
+        cfg_stage = 1 - cfg_stage;
+        cfg_bank [cfg_stage] = cfg_bank [1 - cfg_stage];
+        cfg_stale = 0;
+    }
+    return 1;
+} // cfg_stage_ready
+
+/* Stage a whole config and commit it, e.g. a CONFIG.BIN written to the USB
+ * drive (kb-msc.c). Unlike cfg_restore(), nothing out of range is taken. */
+int cfg_load (kb_config const *cfg)
+{
+    int idx;
+    for (idx = 0; idx < CFG_TIMINGS; ++idx)
+    {
+        if ((cfg->timing [idx] < tm_min [idx]) || (cfg->timing [idx] > tm_max [idx]))
+        {
+            return CFG_ERR_ARG;
+        }
+    }
+    if (cfg->layout > LAYOUT_UK)
+    {
+        return CFG_ERR_ARG;
+    }
+    if (!cfg_stage_ready ())
+    {
+        return CFG_ERR_BUSY;
+    }
+
+    cfg_bank [cfg_stage] = *cfg;
+    cfg_bank [cfg_stage].spare = 0;
+    __sync_synchronize (); // The staging bank is all written before core-1 sees the commit
+    cfg_commit = 1;
+    cfg_stale = 1;
+    return CFG_OK;
+} // cfg_load
+
+#if STORE_ON
+// Save the live config to the flash, once core-1 has taken up the last commit
+int cfg_save (void)
+{
+    return cfg_stage_ready () ? store_save () : CFG_ERR_BUSY;
+} // cfg_save
+#endif // STORE_ON
+
+/* A request from the host (SET_REPORT, feature REPORT_ID_CONFIG).
+ * It is handled straight away, and the response kept for GET_REPORT. */
+void cfg_set_report (uint8_t const *buf, uint16_t len)
+{
+    uint8_t req [CFG_REPORT_LEN];
+    memset (req, 0, sizeof (req));
+    memcpy (req, buf, (len < sizeof (req)) ? len : sizeof (req));
+
+    uint8_t const *arg = &req [CFG_OFS_ARGS];
+    uint8_t *data = &cfg_resp [CFG_OFS_DATA];
+    uint8_t status = CFG_OK;
+
+    memset (cfg_resp, 0, sizeof (cfg_resp));
+    cfg_resp [CFG_OFS_CMD] = req [CFG_OFS_CMD];
+    cfg_resp [CFG_OFS_SEQ] = req [CFG_OFS_SEQ];
+
+    switch (req [CFG_OFS_CMD])
+    {
+        case CFG_CMD_INFO:
+        data [0] = CFG_VERSION;
+        data [1] = CFG_LAYERS;
+        data [2] = CFG_KEYS;
+        data [3] = CFG_TIMINGS;
+        data [4] = CFG_KEYS_MAX;
+        data [5] = cfg_bank [cfg_stage].layout;
+        break;
+
+        case CFG_CMD_GET_KEYS:
+        case CFG_CMD_SET_KEYS:
+        {
+            int layer = arg [0];
+            int first = arg [1];
+            int count = arg [2];
+            if ((layer >= CFG_LAYERS) || (count > CFG_KEYS_MAX) || ((first + count) > CFG_KEYS))
+            {
+                status = CFG_ERR_ARG;
+            }
+            else if (!cfg_stage_ready ())
+            {
+                status = CFG_ERR_BUSY;
+            }
+            else if (req [CFG_OFS_CMD] == CFG_CMD_GET_KEYS)
+            {
+                data [0] = layer;
+                data [1] = first;
+                data [2] = count;
+                memcpy (&data [3], &cfg_bank [cfg_stage].keys [layer][first], count);
+            }
+            else
+            {
+                memcpy (&cfg_bank [cfg_stage].keys [layer][first], &arg [3], count);
+            }
+            break;
+        }
+
+        case CFG_CMD_GET_TIMING:
+        if (!cfg_stage_ready ())
+        {
+            status = CFG_ERR_BUSY;
+        }
+        else
+        {
+            int idx;
+            data [0] = CFG_TIMINGS;
+            for (idx = 0; idx < CFG_TIMINGS; ++idx)
+            {
+                uint16_t val = cfg_bank [cfg_stage].timing [idx];
+                data [1 + (2 * idx)] = (uint8_t)val;
+                data [2 + (2 * idx)] = (uint8_t)(val >> 8);
+            }
+        }
+        break;
+
+        case CFG_CMD_SET_TIMING:
+        {
+            int id = arg [0];
+            uint16_t val = (uint16_t)(arg [1] | (arg [2] << 8));
+            if ((id >= CFG_TIMINGS) || (val < tm_min [id]) || (val > tm_max [id]))
+            {
+                status = CFG_ERR_ARG;
+            }
+            else if (!cfg_stage_ready ())
+            {
+                status = CFG_ERR_BUSY;
+            }
+            else
+            {
+                cfg_bank [cfg_stage].timing [id] = val;
+            }
+            break;
+        }
+
+        case CFG_CMD_COMMIT:
+        if (!cfg_stage_ready ())
+        {
+            status = CFG_ERR_BUSY;
+        }
+        else
+        {
+            __sync_synchronize (); // The staging bank is all written before core-1 sees the commit
+            cfg_commit = 1;
+            cfg_stale = 1;
+        }
+        break;
+
+        case CFG_CMD_REVERT:
+        if (!cfg_stage_ready ())
+        {
+            status = CFG_ERR_BUSY;
+        }
+        else
+        {
+            cfg_bank [cfg_stage] = cfg_bank [1 - cfg_stage];
+        }
+        break;
+
+        case CFG_CMD_DEFAULTS:
+        if (!cfg_stage_ready ())
+        {
+            status = CFG_ERR_BUSY;
+        }
+        else
+        {
+            cfg_load_defaults (&cfg_bank [cfg_stage]);
+        }
+        break;
+
+        case CFG_CMD_SET_LAYOUT:
+        if (arg [0] > LAYOUT_UK)
+        {
+            status = CFG_ERR_ARG;
+        }
+        else if (!cfg_stage_ready ())
+        {
+            status = CFG_ERR_BUSY;
+        }
+        else
+        {
+            cfg_bank [cfg_stage].layout = arg [0];
+        }
+        break;
+
+#if STORE_ON
+        case CFG_CMD_SAVE: // The live config, so a commit must have been taken up first
+        status = cfg_save ();
+        break;
+
+        case CFG_CMD_STORE_INFO:
+        status = store_info (data, CFG_REPORT_LEN - CFG_OFS_DATA);
+        break;
+#endif // STORE_ON
+
+#if RECORD_ON
+        case CFG_CMD_REC_INFO:
+        status = rec_info (data, CFG_REPORT_LEN - CFG_OFS_DATA);
+        break;
+
+        case CFG_CMD_REC_READ:
+        status = rec_read ((uint32_t)arg [0] | ((uint32_t)arg [1] << 8) | ((uint32_t)arg [2] << 16) |
+                           ((uint32_t)arg [3] << 24), arg [4], data, CFG_REPORT_LEN - CFG_OFS_DATA);
+        break;
+
+        case CFG_CMD_REC_CTRL:
+        status = rec_ctrl (arg [0]);
+        break;
+#endif // RECORD_ON
+
+#if PROF_ON
+        case CFG_CMD_PROF_READ:
+        status = prof_read (arg [0], arg [1], data, CFG_REPORT_LEN - CFG_OFS_DATA);
+        break;
+
+        case CFG_CMD_PROF_CTRL:
+        status = prof_ctrl (arg [0]);
+        break;
+#endif // PROF_ON
+
+        case CFG_CMD_SCHED_INFO:
+        status = sched_info (arg [0], data, CFG_REPORT_LEN - CFG_OFS_DATA);
+        break;
+
+#if POWER_ON
+        case CFG_CMD_POWER_INFO:
+        status = power_info (data, CFG_REPORT_LEN - CFG_OFS_DATA);
+        break;
+#endif // POWER_ON
+
+#if WATCH_ON
+        case CFG_CMD_WATCH_INFO:
+        status = watch_info (data, CFG_REPORT_LEN - CFG_OFS_DATA);
+        break;
+#endif // WATCH_ON
+
+        default:
+        status = CFG_ERR_CMD;
+        break;
+    }
+
+    cfg_resp [CFG_OFS_STATUS] = status;
+} // cfg_set_report
+
+// The response to the last request (GET_REPORT, feature REPORT_ID_CONFIG)
+uint16_t cfg_get_report (uint8_t *buf, uint16_t len)
+{
+    if (len < CFG_REPORT_LEN)
+    {
+        return 0;
+    }
+    memcpy (buf, cfg_resp, CFG_REPORT_LEN);
+    return CFG_REPORT_LEN;
+} // cfg_get_report
+
+/* End of File */
@@ -0,0 +1,139 @@
+/*
+ * Header file for the live configuration.
+ * The keymaps and timings the scanner uses are held in RAM, in two banks.
+ * The host edits the staging bank with the config protocol below, then
+ * commits it, and core-1 swaps it in between two full scans of the matrix.
+ *
+ * The protocol runs over a vendor HID feature report (REPORT_ID_CONFIG).
+ * The host sends a request with SET_REPORT, then reads the response with
+ * GET_REPORT. kb-cfg in tools/ is the host side.
+ *
+ * This header is shared with the host tools, so it must only use standard C.
+ */
+
+#ifndef _KB_CONFIG_H_
+#define _KB_CONFIG_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define CFG_VERSION     1
+#define CFG_REPORT_LEN  32  // Bytes in each request and response, after the report ID
+
+// The keymap layers, in the order they are held
+#define CFG_LAYER_BASE  0  // The basic keymap
+#define CFG_LAYER_FN    1  // HELP held, the function keys
+#define CFG_LAYER_CD2   2  // Code-II held
+#define CFG_LAYER_BLK   3  // BLOCK held, macros and media keys
+#define CFG_LAYERS      4
+
+#define CFG_KEYS        80  // Keys in each layer (ROW_SZ * COL_SZ), indexed as (row * 10) + column
+
+// The timings, each a u16
+#define CFG_TM_COMBO_WINDOW    0  // ms a combo key is held back waiting for the rest of the combo
+#define CFG_TM_ONESHOT_TAP     1  // ms between taps to lock a one-shot modifier on
+#define CFG_TM_ONESHOT_TIMEOUT 2  // ms before an unused one-shot latch is dropped
+#define CFG_TM_SCAN_SETTLE     3  // us a select line is held low before the rows are read
+#define CFG_TM_SCAN_RECOVER    4  // us a select line is held high before the next line
+#define CFG_TIMINGS            5
+
+/* Requests are [cmd][seq][args...], responses are [cmd][seq][status][data...].
+ * The response echoes the command and sequence number, so the host can tell
+ * it is reading the answer to its own request.
+ * The staging bank is the live bank plus any changes not yet committed. */
+#define CFG_CMD_INFO        1  // -> [version][layers][keys][timings][keys per message][host key map]
+#define CFG_CMD_GET_KEYS    2  // [layer][first][count] -> [layer][first][count][codes...], from the staging bank
+#define CFG_CMD_SET_KEYS    3  // [layer][first][count][codes...], into the staging bank
+#define CFG_CMD_GET_TIMING  4  // -> [count][u16 values...], from the staging bank
+#define CFG_CMD_SET_TIMING  5  // [id][u16 value], into the staging bank
+#define CFG_CMD_COMMIT      6  // Hand the staging bank to core-1, to use from the next scan
+#define CFG_CMD_REVERT      7  // Throw away the staged changes
+#define CFG_CMD_DEFAULTS    8  // Load the built-in defaults into the staging bank
+#define CFG_CMD_SET_LAYOUT  9  // [host key map, LAYOUT_US 0 or LAYOUT_UK 1], into the staging bank
+#define CFG_CMD_SAVE        10 // Save the live config to the flash, it is loaded at boot
+#define CFG_CMD_STORE_INFO  11 // -> the store figures, at the CFG_STORE_xxx offsets
+#define CFG_CMD_REC_INFO    12 // -> the scan recorder state, at the REC_INFO_xxx offsets (kb-record.h)
+#define CFG_CMD_REC_READ    13 // [u32 page seq][offset] -> [offset][count][page bytes...], from the flash
+#define CFG_CMD_REC_CTRL    14 // [REC_CTRL_xxx], start, stop or flush the scan recorder
+#define CFG_CMD_PROF_READ   15 // [phase][offset] -> [phase][phases][MHz][offset][count][record bytes...] (kb-prof.h)
+#define CFG_CMD_PROF_CTRL   16 // [PROF_CTRL_xxx], reset the phase profiler
+#define CFG_CMD_SCHED_INFO  17 // [task] -> the core-0 task figures, at the SCHED_INFO_xxx offsets (kb-sched.h)
+#define CFG_CMD_POWER_INFO  18 // -> the suspend power state and figures, at the PWR_INFO_xxx offsets (kb-power.h)
+#define CFG_CMD_WATCH_INFO  19 // -> the core-1 watchdog figures, at the WATCH_INFO_xxx offsets (kb-watch.h)
+
+#define CFG_OK         0
+#define CFG_ERR_CMD    1  // Unknown command
+#define CFG_ERR_ARG    2  // Layer, key or timing out of range
+#define CFG_ERR_BUSY   3  // The last commit has not been taken up yet, try again
+#define CFG_ERR_NONE   4  // No request has been made
+
+#define CFG_KEYS_MAX   24  // Most key codes in one request or response
+
+#define CFG_OFS_CMD     0
+#define CFG_OFS_SEQ     1
+#define CFG_OFS_ARGS    2  // In a request
+#define CFG_OFS_STATUS  2  // In a response
+#define CFG_OFS_DATA    3  // In a response
+
+// The CFG_CMD_STORE_INFO response, little endian, from CFG_OFS_DATA
+#define CFG_STORE_BOOT_SCAN   0  // u32: us from reset to the first full scan, the keyboard is usable
+#define CFG_STORE_BOOT_MOUNT  4  // u32: us from reset to the host mounting the keyboard (0 not yet)
+#define CFG_STORE_SEQ         8  // u32: Sequence number of the newest record (0 none)
+#define CFG_STORE_SAVES       12 // u16: Saves since boot
+#define CFG_STORE_WRITE_US    14 // u32: Longest flash write (erase and program)
+#define CFG_STORE_GAP_US      18 // u32: Longest gap between two scans during a write
+#define CFG_STORE_SLOT        22 // u8:  Slot of the newest record (0xFF none)
+#define CFG_STORE_SLOTS       23 // u8:  Slots in the store
+#define CFG_STORE_INFO_LEN    24
+
+/* The firmware side, in kb-config.c.
+ * cfg_live() and cfg_sync() are for core-1, the rest are for core-0. */
+typedef struct
+{
+    uint8_t  keys [CFG_LAYERS][CFG_KEYS];
+    uint16_t timing [CFG_TIMINGS];
+    uint8_t  layout;  // The host key map (LAYOUT_xxx), for typing text
+    uint8_t  spare;
+} kb_config;
+
+extern void cfg_init (uint8_t const *const layers [CFG_LAYERS]);
+extern void cfg_restore (kb_config const *saved);
+extern int  cfg_load (kb_config const *cfg);
+extern int  cfg_save (void);
+extern kb_config const *cfg_live (void);
+extern void cfg_sync (void);
+extern void cfg_set_report (uint8_t const *buf, uint16_t len);
+extern uint16_t cfg_get_report (uint8_t *buf, uint16_t len);
+
+// The flash store, in kb-store.c (or the simulated keyboard in kb-cfg)
+extern int store_save (void);
+extern int store_info (uint8_t *data, int len);
+
+// The scan recorder, in kb-record.c (or the simulated keyboard in kb-cfg)
+extern int rec_info (uint8_t *data, int len);
+extern int rec_read (uint32_t seq, int ofs, uint8_t *data, int len);
+extern int rec_ctrl (int op);
+
+// The phase profiler, in kb-prof.c (or the simulated keyboard in kb-cfg)
+extern int prof_read (int phase, int ofs, uint8_t *data, int len);
+extern int prof_ctrl (int op);
+
+// The core-0 task scheduler, in kb-sched.c (or the simulated keyboard in kb-cfg)
+extern int sched_info (int task, uint8_t *data, int len);
+
+// The suspend power states, in kb-power.c (or the simulated keyboard in kb-cfg)
+extern int power_info (uint8_t *data, int len);
+
+// The core-1 watchdog, in kb-watch.c (or the simulated keyboard in kb-cfg)
+extern int watch_info (uint8_t *data, int len);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_CONFIG_H_ */
+
+/* End of File */
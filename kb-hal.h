@@ -0,0 +1,148 @@
+/*
+ * Header file for the hardware layer under the keyboard logic.
+ * The scanner, decoder and report code only reach the Pico through these
+ * calls (and TinyUSB), so the same sources also build on a Linux host, with
+ * KB_HOST set, against the mock GPIO, FIFO and timer in tools/host/.
+ *
+ * On the Pico they are inline wrappers round the SDK calls, so the firmware
+ * is the same as calling the SDK direct.
+ */
+
+#ifndef _KB_HAL_H_
+#define _KB_HAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "kb-matrix.h"
+
+#ifndef KB_HOST
+#define KB_HOST 0 // Set 1 by the host build (tools/CMakeLists.txt), never for the Pico
+#endif
+
+#if !KB_HOST
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#endif // !KB_HOST
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* The matrix select lines are numbered from 0, as the columns, and the rows
+ * are read together. Which GPIOs they are on, and whether a line is selected
+ * low or high, is set by the keyboard model (see kb-matrix.h). */
+
+#if KB_HOST
+
+// defined in tools/host/kb-mock.c
+extern uint32_t hal_time_us (void);
+extern void hal_sleep_us (uint32_t us);
+extern bool hal_fifo_wready (void);
+extern void hal_fifo_push (uint32_t v);
+extern bool hal_fifo_rvalid (void);
+extern uint32_t hal_fifo_pop (void);
+extern void hal_gpio_put (unsigned gpio, bool on);
+extern void hal_gpio_toggle (unsigned gpio);
+extern void hal_line_select (unsigned line);
+extern void hal_line_idle (unsigned line);
+extern void hal_line_float (unsigned line);
+extern uint8_t hal_rows (void);
+
+#else
+
+// Time since boot (us), wraps every 71 minutes
+static inline uint32_t hal_time_us (void)
+{
+    return time_us_32 ();
+}
+
+static inline void hal_sleep_us (uint32_t us)
+{
+    sleep_us (us);
+}
+
+// The FIFO from core-1 (the scanner) to core-0 (USB), 8 words deep
+static inline bool hal_fifo_wready (void)
+{
+    return multicore_fifo_wready ();
+}
+
+static inline void hal_fifo_push (uint32_t v)
+{
+    multicore_fifo_push_blocking (v);
+}
+
+static inline bool hal_fifo_rvalid (void)
+{
+    return multicore_fifo_rvalid ();
+}
+
+static inline uint32_t hal_fifo_pop (void)
+{
+    return multicore_fifo_pop_blocking ();
+}
+
+static inline void hal_gpio_put (unsigned gpio, bool on)
+{
+    gpio_put (gpio, on);
+}
+
+// A single write to the SIO, for the latency markers
+static inline void hal_gpio_toggle (unsigned gpio)
+{
+    gpio_xor_mask (1u << gpio);
+}
+
+// Select a line: drive it low (high on an active high matrix)
+static inline void hal_line_select (unsigned line)
+{
+    gpio_set_dir (matrix_line_pin (line), GPIO_OUT);
+    gpio_put (matrix_line_pin (line), MATRIX_SELECT);
+}
+
+// Drive the line back to its idle level, before it is let go
+static inline void hal_line_idle (unsigned line)
+{
+    gpio_put (matrix_line_pin (line), MATRIX_IDLE);
+}
+
+// Set the line back to an input, pulled to its idle level
+static inline void hal_line_float (unsigned line)
+{
+    gpio_set_dir (matrix_line_pin (line), GPIO_IN);
+#if MATRIX_ACTIVE_LOW
+    gpio_pull_up (matrix_line_pin (line));
+#else
+    gpio_pull_down (matrix_line_pin (line));
+#endif // MATRIX_ACTIVE_LOW
+}
+
+// Read the rows, a bit is 0 for a key down on the selected line
+static inline uint8_t hal_rows (void)
+{
+    return matrix_rows (gpio_get_all ());
+}
+
+#endif // KB_HOST
+
+/* Whilst the host is suspended, core-1 parks the scanner: every select line
+ * is selected, so any key down shows on its row, and it sleeps until a row
+ * falls or the time is up. These need the row interrupt, so on the Pico they
+ * are in kb-power.c (in tools/host/kb-mock.c for the host build). */
+extern void hal_lines_park (void);
+extern void hal_lines_unpark (void);
+extern void hal_rows_wait (uint32_t us);
+
+/* Core-0 starts a stalled core-1 again with this: reset, then scan_thread()
+ * on it. On the Pico it is in kb-watch.c (in tools/host/kb-mock.c for the
+ * host build). */
+extern void hal_core1_relaunch (void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_HAL_H_ */
+
+/* End of File */
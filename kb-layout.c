@@ -0,0 +1,78 @@
+/* Host key map ("layout profile") support for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * When we type text for the host (macros and so on) we need to know which key
+ * the host's key map puts each character on. The tinyusb ASCII table assumes
+ * a US map, so the few characters that differ are patched on top of it for
+ * the profile selected. The result is kept in RAM for a quick lookup.
+ */
+
+#include "kb-hal.h"
+#include <tusb.h>
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-stream.h"
+#include "kb-config.h"
+
+// The tinyusb ASCII -> HID code table (US key map)
+static uint8_t const us_table[128][2] = { HID_ASCII_TO_KEYCODE };
+
+// Characters that are on different keys with a UK key map
+typedef struct
+{
+    char    c;    // ASCII character
+    uint8_t mods; // Modifier bits needed
+    uint8_t key;  // HID key code
+} layout_fix;
+
+static layout_fix const uk_fixes [] = {
+    { '"',  KEYBOARD_MODIFIER_LEFTSHIFT, HID_KEY_2 },
+    { '@',  KEYBOARD_MODIFIER_LEFTSHIFT, HID_KEY_APOSTROPHE },
+    { '#',  0,                           HID_KEY_EUROPE_1 },
+    { '~',  KEYBOARD_MODIFIER_LEFTSHIFT, HID_KEY_EUROPE_1 },
+    { '\\', 0,                           HID_KEY_EUROPE_2 },
+    { '|',  KEYBOARD_MODIFIER_LEFTSHIFT, HID_KEY_EUROPE_2 }
+};
+
+static kb_stroke ascii_table [128]; // ASCII -> keystroke for the active profile
+static int layout_profile = -1;
+
+// Select the host key map in use (LAYOUT_US or LAYOUT_UK)
+void layout_set (int profile)
+{
+    int idx;
+    for (idx = 0; idx < 128; ++idx)
+    {
+        ascii_table [idx].mods = us_table[idx][0] ? KEYBOARD_MODIFIER_LEFTSHIFT : 0;
+        ascii_table [idx].key  = us_table[idx][1];
+    }
+
+    if (profile == LAYOUT_UK)
+    {
+        for (idx = 0; idx < (int)(sizeof (uk_fixes) / sizeof (uk_fixes[0])); ++idx)
+        {
+            ascii_table [(uint8_t)uk_fixes[idx].c].mods = uk_fixes[idx].mods;
+            ascii_table [(uint8_t)uk_fixes[idx].c].key  = uk_fixes[idx].key;
+        }
+    }
+    layout_profile = profile;
+} // layout_set
+
+/* Find the keystroke for an ASCII character.
+ * Returns zero if the character cannot be typed. */
+int layout_ascii (uint8_t c, kb_stroke *st)
+{
+    int profile = cfg_live ()->layout; // LAYOUT_PROFILE, unless the host has changed it (see kb-config.c)
+    if (layout_profile != profile)
+    {
+        layout_set (profile);
+    }
+    if ((c >= 128) || (ascii_table [c].key == 0))
+    {
+        return 0;
+    }
+    *st = ascii_table [c];
+    return 1;
+} // layout_ascii
+
+/* End of File */
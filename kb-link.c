@@ -0,0 +1,123 @@
+/* Key event link for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * As well as (or instead of) the USB reports, each key press and release can
+ * be sent on the UART as a framed binary event (see kb-link.h). A host wired
+ * to the UART turns these back into key events with the kb-uinputd daemon.
+ * This works before USB has enumerated, and does not wait for the HID poll.
+ *
+ * The events are worked out on core-0 from the messages core-1 sends, by
+ * comparing the keys in each message with the keys in the last one.
+ * Keystroke streams (Unicode entry, macros, paste mode) and the mouse keys
+ * are only sent on the USB.
+ */
+
+#include "pico/stdlib.h"
+#include "hardware/uart.h"
+#include "hardware/gpio.h"
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-link.h"
+
+#if LINK_ON
+
+static msg_blk  lk_last;           // Keys down in the last message sent on the link
+static uint16_t lk_consumer = 0;   // Consumer usage held down, 0 if none
+
+// Set up the UART for the link, replaces any setting made by stdio_init_all()
+void link_init (void)
+{
+    uart_init (LINK_UART, LINK_BAUD);
+    gpio_set_function (PICO_DEFAULT_UART_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function (PICO_DEFAULT_UART_RX_PIN, GPIO_FUNC_UART);
+    lk_last.u_msg = 0;
+} // link_init
+
+// Send one event, the UART FIFO takes three whole frames without waiting
+static void link_send (uint8_t type, uint16_t usage, uint32_t ts)
+{
+    link_event ev;
+    uint8_t buf [LINK_FRAME_LEN];
+
+    ev.type  = type;
+    ev.usage = usage;
+    ev.ts_us = ts;
+    link_encode (&ev, buf);
+    uart_write_blocking (LINK_UART, buf, LINK_FRAME_LEN);
+} // link_send
+
+// Is "key" one of the three key slots of "mb"?
+static int link_has_key (msg_blk const *mb, uint8_t key)
+{
+    return (key != 0) && ((mb->p[0] == key) || (mb->p[1] == key) || (mb->p[2] == key));
+} // link_has_key
+
+// Called by main() for each message from core-1, sends the events for any keys that changed
+void link_msg (uint32_t uv)
+{
+    uint32_t ts = time_us_32 ();
+    msg_blk cur;
+    int idx;
+
+    if ((uv & FLAG_TAG_MASK) == FLAG_CONSUMER)
+    {
+        lk_consumer = (uint16_t)(uv & 0xFFFF);
+        link_send (LK_CON_DOWN, lk_consumer, ts);
+        return;
+    }
+    if (uv == FLAG_ALL_UP)
+    {
+        cur.u_msg = 0;
+        if (lk_consumer)
+        {
+            link_send (LK_CON_UP, lk_consumer, ts);
+            lk_consumer = 0;
+        }
+    }
+    else if ((uv & FLAG_TAG_MASK) >= FLAG_MOUSE)
+    {
+        return; // A tagged message, nothing to send on the link
+    }
+    else
+    {
+        cur.u_msg = uv;
+    }
+
+    // Releases first, then presses, so a changed modifier applies to the new key
+    for (idx = 0; idx < 3; ++idx)
+    {
+        if ((lk_last.p[idx]) && (!link_has_key (&cur, lk_last.p[idx])))
+        {
+            link_send (LK_KEY_UP, lk_last.p[idx], ts);
+        }
+    }
+    for (idx = 0; idx < 8; ++idx)
+    {
+        uint8_t bit = (uint8_t)(1u << idx);
+        if ((lk_last.p[3] & bit) && (!(cur.p[3] & bit)))
+        {
+            link_send (LK_KEY_UP, (uint16_t)(0xE0 + idx), ts);
+        }
+    }
+    for (idx = 0; idx < 8; ++idx)
+    {
+        uint8_t bit = (uint8_t)(1u << idx);
+        if ((cur.p[3] & bit) && (!(lk_last.p[3] & bit)))
+        {
+            link_send (LK_KEY_DOWN, (uint16_t)(0xE0 + idx), ts);
+        }
+    }
+    for (idx = 0; idx < 3; ++idx)
+    {
+        if ((cur.p[idx]) && (!link_has_key (&lk_last, cur.p[idx])))
+        {
+            link_send (LK_KEY_DOWN, cur.p[idx], ts);
+        }
+    }
+
+    lk_last = cur;
+} // link_msg
+
+#endif // LINK_ON
+
+/* End of File */
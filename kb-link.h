@@ -0,0 +1,140 @@
+/*
+ * Header file for the key event link.
+ * Key presses and releases are sent on the UART as small binary frames, for a
+ * host wired straight to the Pico (e.g. the Raspberry Pi inside the case) to
+ * pick up with the kb-uinputd daemon in tools/.
+ *
+ * This header is shared with the daemon, so it must only use standard C.
+ *
+ * Frame layout (LINK_FRAME_LEN bytes):
+ *   [0]    LINK_SYNC
+ *   [1]    Event type, LK_xxx
+ *   [2..3] HID usage, little endian (keyboard page for LK_KEY_xxx, consumer page for LK_CON_xxx)
+ *   [4..7] Time stamp, us since the Pico started, little endian
+ *   [8]    CRC-8 (polynomial 0x07) of bytes 1 to 7
+ *
+ * The sync byte and CRC let the receiver find the frames again if it starts
+ * part way through, or if debug text is mixed in on the same UART.
+ */
+
+#ifndef _KB_LINK_H_
+#define _KB_LINK_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define LINK_SYNC       0xA5
+#define LINK_FRAME_LEN  9
+
+// Event types
+#define LK_KEY_DOWN  0x01 // Keyboard page usage pressed (modifiers are usages 0xE0 - 0xE7)
+#define LK_KEY_UP    0x02 // Keyboard page usage released
+#define LK_CON_DOWN  0x03 // Consumer page usage pressed
+#define LK_CON_UP    0x04 // Consumer page usage released
+
+// One key event
+typedef struct
+{
+    uint8_t  type;  // LK_xxx
+    uint16_t usage; // HID usage
+    uint32_t ts_us; // Time stamp (us)
+} link_event;
+
+// Frame decoder state, used by the receiver
+typedef struct
+{
+    uint8_t  buf [LINK_FRAME_LEN];
+    uint8_t  len;
+    uint32_t frames;  // Good frames decoded
+    uint32_t errors;  // Frames dropped for a bad CRC or type
+    uint32_t skipped; // Bytes skipped looking for a sync byte
+} link_decoder;
+
+// CRC-8, polynomial 0x07, initial value 0
+static inline uint8_t link_crc8 (uint8_t const *p, int len)
+{
+    uint8_t crc = 0;
+    while (len-- > 0)
+    {
+        crc ^= *p++;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+} // link_crc8
+
+// Build the frame for an event, "buf" must hold LINK_FRAME_LEN bytes
+static inline void link_encode (link_event const *ev, uint8_t *buf)
+{
+    buf[0] = LINK_SYNC;
+    buf[1] = ev->type;
+    buf[2] = (uint8_t)(ev->usage);
+    buf[3] = (uint8_t)(ev->usage >> 8);
+    buf[4] = (uint8_t)(ev->ts_us);
+    buf[5] = (uint8_t)(ev->ts_us >> 8);
+    buf[6] = (uint8_t)(ev->ts_us >> 16);
+    buf[7] = (uint8_t)(ev->ts_us >> 24);
+    buf[8] = link_crc8 (&buf[1], LINK_FRAME_LEN - 2);
+} // link_encode
+
+/* Feed one received byte to the decoder.
+ * Returns 1 when "ev" has been filled in from a good frame, else 0. */
+static inline int link_decode (link_decoder *dec, uint8_t c, link_event *ev)
+{
+    if ((dec->len == 0) && (c != LINK_SYNC))
+    {
+        ++dec->skipped;
+        return 0;
+    }
+    dec->buf [dec->len++] = c;
+    if (dec->len < LINK_FRAME_LEN)
+    {
+        return 0;
+    }
+
+    uint8_t const *b = dec->buf;
+    if ((b[8] == link_crc8 (&b[1], LINK_FRAME_LEN - 2)) && (b[1] >= LK_KEY_DOWN) && (b[1] <= LK_CON_UP))
+    {
+        ev->type  = b[1];
+        ev->usage = (uint16_t)(b[2] | (b[3] << 8));
+        ev->ts_us = (uint32_t)b[4] | ((uint32_t)b[5] << 8) | ((uint32_t)b[6] << 16) | ((uint32_t)b[7] << 24);
+        dec->len = 0;
+        ++dec->frames;
+        return 1;
+    }
+
+    // Bad frame - look for the next sync byte in what we have and start again from there
+    ++dec->errors;
+    int idx;
+    for (idx = 1; idx < LINK_FRAME_LEN; ++idx)
+    {
+        if (b[idx] == LINK_SYNC)
+        {
+            break;
+        }
+    }
+    dec->skipped += (uint32_t)idx;
+    dec->len = (uint8_t)(LINK_FRAME_LEN - idx);
+    for (int j = 0; j < dec->len; ++j)
+    {
+        dec->buf [j] = dec->buf [idx + j];
+    }
+    return 0;
+} // link_decode
+
+// defined in kb-link.c (firmware only)
+extern void link_init (void);
+extern void link_msg (uint32_t uv);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_LINK_H_ */
+
+/* End of File */
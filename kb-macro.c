@@ -0,0 +1,130 @@
+/* Macros (text expansion) for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * A macro is stored as a string, and is turned into keystrokes one at a time
+ * as it is sent, so even a long macro takes no more RAM than a short one.
+ * Macros are sent as a keystroke stream (see kb-stream.c), at most one report
+ * every MACRO_GAP_US.
+ *
+ * As well as plain text, a macro can hold these escapes:
+ *   MK_KEY then a HID key code: press that key, e.g. HOME or a cursor key
+ *   MK_MOD then modifier bits: hold those modifiers for the next keystroke
+ */
+
+#include "kb-hal.h"
+#include <tusb.h>
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-stream.h"
+
+#define MK_KEY "\x01" // Next byte is a HID key code
+#define MK_MOD "\x02" // Next byte is the modifier bits for the next keystroke
+
+// The macros, selected by BLOCK + 1 to BLOCK + 0
+static char const * const macro_table [MACRO_CNT] = {
+    "Kind regards,\n",                                // 1
+    "#include <stdio.h>\n",                           // 2
+    "sudo apt update && sudo apt upgrade\n",          // 3
+    MK_KEY "\x4A" MK_MOD "\x02" MK_KEY "\x4D",        // 4: HOME, then SHIFT + END - select the line
+    "",                                               // 5
+    "",                                               // 6
+    "",                                               // 7
+    "",                                               // 8
+    "",                                               // 9
+    ""                                                // 0
+};
+
+static char const *mc_ptr   = NULL; // Next character of the macro being sent
+static uint32_t    mc_chars = 0;    // Keystrokes sent for this macro
+static uint32_t    mc_start = 0;    // When this macro started (us)
+static macro_stats mc_stats;        // Throughput figures
+
+// Stream source: generates the keystrokes for the macro, one at a time
+static int macro_next (kb_stroke *st)
+{
+    uint8_t mods = 0;
+
+    while ((mc_ptr != NULL) && (*mc_ptr != 0))
+    {
+        uint8_t c = (uint8_t)*mc_ptr++;
+
+        if ((c == MK_KEY[0]) && (*mc_ptr != 0)) // A raw key
+        {
+            st->mods = mods;
+            st->key  = (uint8_t)*mc_ptr++;
+            ++mc_chars;
+            return 1;
+        }
+        if ((c == MK_MOD[0]) && (*mc_ptr != 0)) // Modifiers for the next key
+        {
+            mods = (uint8_t)*mc_ptr++;
+            continue;
+        }
+        if (layout_ascii (c, st)) // A plain character
+        {
+            st->mods |= mods;
+            ++mc_chars;
+            return 1;
+        }
+        // Anything we cannot type is skipped
+    }
+
+    // End of the macro, update the throughput figures
+    if (mc_ptr != NULL)
+    {
+        uint32_t us = hal_time_us () - mc_start;
+        mc_stats.last_chars = mc_chars;
+        mc_stats.last_us    = us;
+        mc_stats.last_cps   = (us > 0) ? (uint32_t)(((uint64_t)mc_chars * 1000000u) / us) : 0;
+        if (mc_chars > mc_stats.max_chars)
+        {
+            mc_stats.max_chars = mc_chars;
+        }
+        if (us > mc_stats.max_us)
+        {
+            mc_stats.max_us = us;
+        }
+        ++mc_stats.count;
+        mc_ptr = NULL;
+    }
+    return 0;
+} // macro_next
+
+// Start sending macro number "idx"
+void macro_start (uint32_t idx)
+{
+    if ((idx >= MACRO_CNT) || (macro_table [idx][0] == 0))
+    {
+        return; // Nothing to send
+    }
+
+    mc_ptr = macro_table [idx];
+    mc_chars = 0;
+    mc_start = hal_time_us ();
+    stream_start (macro_next, MACRO_GAP_US);
+} // macro_start
+
+// Is a macro being sent?
+int macro_busy (void)
+{
+    return (mc_ptr != NULL);
+} // macro_busy
+
+// Stop the macro being sent, e.g. if it is interrupted by a real key press
+void macro_stop (void)
+{
+    if (mc_ptr != NULL)
+    {
+        mc_ptr = NULL;
+        ++mc_stats.interrupted;
+        stream_stop ();
+    }
+} // macro_stop
+
+// Get a copy of the macro throughput figures
+void macro_get_stats (macro_stats *ms)
+{
+    *ms = mc_stats;
+} // macro_get_stats
+
+/* End of File */
@@ -0,0 +1,161 @@
+/*
+ * Header file for the keyboard matrix geometry.
+ * Each keyboard model the firmware can drive is described once here: how
+ * many rows and select lines (columns) it has, the GPIO for each, in order,
+ * and whether a line is selected by driving it low (a key down then reads low
+ * on its row, with pull-ups) or high (pull-downs). MATRIX_MODEL picks the one
+ * to build for, the FontWriter 620 unless the build sets it.
+ *
+ * Everything else is worked out from that at compile time, with no tables,
+ * so the scanner reads as if it were written by hand for the one keyboard:
+ *   - matrix_line_pin() and matrix_line_bit() are a shift when the lines are
+ *     on GPIOs one after another, in order, else a chain of constant compares,
+ *   - matrix_rows() is a shift and mask of one read of all the GPIOs when the
+ *     rows are on GPIOs in order, else each row is picked out by a constant
+ *     shift, and an active high matrix is turned round to read as active low,
+ *   - matrix_keys() picks out the keys down a bit at a time.
+ * Nothing here is in a table in the flash, so all of it may be used whilst
+ * the flash is being written (scan_hold() in fw-kb-main.c).
+ *
+ * The rest of the firmware sees a scan as one byte a line, a bit a row, 0 for
+ * a key down, and a key as its keymap index: (row * MATRIX_COLS) + line.
+ *
+ * To add a keyboard, add its MATRIX_xxx number and a block giving the five
+ * MATRIX_ values below, then build with MATRIX_MODEL set to it. The keymaps
+ * in fw-kb-main.c and the config protocol (CFG_KEYS) must match its size.
+ *
+ * This part must only use standard C (and the GCC builtins), so the host
+ * tools can use it as well.
+ */
+
+#ifndef _KB_MATRIX_H_
+#define _KB_MATRIX_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// The keyboard models
+#define MATRIX_FW620    0  // Sharp FontWriter 620
+#define MATRIX_SCATTER  1  // Not a real keyboard: 8 x 10, active high, the pins out of order (for kb-scan-bench)
+
+#ifndef MATRIX_MODEL
+#define MATRIX_MODEL  MATRIX_FW620
+#endif
+
+/* The pin lists are X-macros, X(index, gpio), so they can be expanded into
+ * constant expressions, and preprocessor tests, as well as code. */
+#if MATRIX_MODEL == MATRIX_FW620
+#define MATRIX_ROWS        8
+#define MATRIX_COLS        10
+#define MATRIX_ACTIVE_LOW  1
+#define MATRIX_LINE_PINS(X) X(0, 2) X(1, 3) X(2, 4) X(3, 5) X(4, 6) X(5, 7) X(6, 8) X(7, 9) X(8, 10) X(9, 11)
+#define MATRIX_ROW_PINS(X)  X(0, 12) X(1, 13) X(2, 14) X(3, 15) X(4, 16) X(5, 17) X(6, 18) X(7, 19)
+
+#elif MATRIX_MODEL == MATRIX_SCATTER
+#define MATRIX_ROWS        8
+#define MATRIX_COLS        10
+#define MATRIX_ACTIVE_LOW  0
+#define MATRIX_LINE_PINS(X) X(0, 11) X(1, 2) X(2, 9) X(3, 4) X(4, 3) X(5, 6) X(6, 10) X(7, 8) X(8, 7) X(9, 5)
+#define MATRIX_ROW_PINS(X)  X(0, 14) X(1, 12) X(2, 19) X(3, 13) X(4, 18) X(5, 16) X(6, 17) X(7, 15)
+
+#else
+#error "Unknown MATRIX_MODEL, see kb-matrix.h"
+#endif // MATRIX_MODEL
+
+#if (MATRIX_ROWS < 1) || (MATRIX_ROWS > 8)
+#error "A scan is a byte a line, so a matrix may have 8 rows at most"
+#endif
+
+// What the pin lists expand to
+#define MATRIX_BIT_(i, gpio)      | (1u << (gpio))
+#define MATRIX_FIRST_(i, gpio)    + (((i) == 0) ? (gpio) : 0)
+#define MATRIX_WEIGHT_(i, gpio)   + ((i) * (gpio))
+#define MATRIX_LINE_PICK_(i, gpio) pin = (line == (i)) ? (gpio) : pin;
+#define MATRIX_ROW_PICK_(i, gpio) | (((gpio_in >> (gpio)) & 1u) << (i))
+
+#define MATRIX_LINE_MASK   (0u MATRIX_LINE_PINS (MATRIX_BIT_))  // All the select lines' GPIOs
+#define MATRIX_ROW_GPIOS   (0u MATRIX_ROW_PINS (MATRIX_BIT_))   // All the rows' GPIOs
+#define MATRIX_ROW_BITS    ((1u << MATRIX_ROWS) - 1)            // All the rows, in a scan byte
+#define MATRIX_LINE_FIRST  (0 MATRIX_LINE_PINS (MATRIX_FIRST_))
+#define MATRIX_ROW_FIRST   (0 MATRIX_ROW_PINS (MATRIX_FIRST_))
+
+/* The lines (rows) are on GPIOs one after another, in order: n of them, from
+ * "first" up. The mask says they are the right GPIOs, and the sum of index
+ * times GPIO is only this high when they are in order, as it is the most any
+ * order of them could make. */
+#define MATRIX_RUN_(n, first, mask, weight) \
+    (((mask) == (((1u << (n)) - 1) << (first))) && \
+     ((weight) == (((first) * (((n) * ((n) - 1)) / 2)) + ((((n) - 1) * (n) * ((2 * (n)) - 1)) / 6))))
+#define MATRIX_LINES_RUN   MATRIX_RUN_ (MATRIX_COLS, MATRIX_LINE_FIRST, MATRIX_LINE_MASK, \
+                                        (0 MATRIX_LINE_PINS (MATRIX_WEIGHT_)))
+#define MATRIX_ROWS_RUN    MATRIX_RUN_ (MATRIX_ROWS, MATRIX_ROW_FIRST, MATRIX_ROW_GPIOS, \
+                                        (0 MATRIX_ROW_PINS (MATRIX_WEIGHT_)))
+
+// The level a line is driven to when it is selected, and back to before it is let go
+#define MATRIX_SELECT      (!MATRIX_ACTIVE_LOW)
+#define MATRIX_IDLE        (MATRIX_ACTIVE_LOW)
+
+// The GPIO for a select line
+static inline __attribute__((always_inline)) unsigned matrix_line_pin (unsigned line)
+{
+#if MATRIX_LINES_RUN
+    return line + MATRIX_LINE_FIRST;
+#else
+    unsigned pin = 0;
+    MATRIX_LINE_PINS (MATRIX_LINE_PICK_)
+    return pin;
+#endif // MATRIX_LINES_RUN
+} // matrix_line_pin
+
+static inline __attribute__((always_inline)) uint32_t matrix_line_bit (unsigned line)
+{
+    return 1u << matrix_line_pin (line);
+} // matrix_line_bit
+
+/* The rows from one read of all the GPIOs, a bit a row, 0 for a key down
+ * whatever the active level */
+static inline __attribute__((always_inline)) uint8_t matrix_rows (uint32_t gpio_in)
+{
+#if MATRIX_ROWS_RUN
+    uint32_t rows = (gpio_in >> MATRIX_ROW_FIRST) & MATRIX_ROW_BITS;
+#else
+    uint32_t rows = 0u MATRIX_ROW_PINS (MATRIX_ROW_PICK_);
+#endif // MATRIX_ROWS_RUN
+#if !MATRIX_ACTIVE_LOW
+    rows ^= MATRIX_ROW_BITS;
+#endif // !MATRIX_ACTIVE_LOW
+    return (uint8_t)rows;
+} // matrix_rows
+
+/* Pick the keys down out of a scan, line by line, then row by row, as their
+ * keymap index, "max" of them at most. Returns how many there were. */
+static inline int matrix_keys (uint8_t const *scan, int *keys, int max)
+{
+    int n = 0;
+    unsigned line;
+    for (line = 0; line < MATRIX_COLS; ++line)
+    {
+        uint32_t down = ~scan [line] & MATRIX_ROW_BITS;
+        while (down != 0)
+        {
+            keys [n] = (__builtin_ctz (down) * MATRIX_COLS) + line;
+            if (++n >= max)
+            {
+                return n;
+            }
+            down &= down - 1; // The next key down on this line
+        }
+    }
+    return n;
+} // matrix_keys
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_MATRIX_H_ */
+
+/* End of File */
@@ -0,0 +1,224 @@
+/* Mouse keys for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * With the mouse layer on, the cursor keys move the pointer, HOME, END and
+ * DEL are the left, right and middle buttons, and Page UP / DOWN turn the
+ * wheel. The pointer speeds up the longer a cursor key is held.
+ *
+ * All the sums are done in fixed point (Q8, i.e. 1/256 pixel), as the M0+
+ * has no FPU. The state is advanced in steps of 1 ms, so the same sequence
+ * of keys always gives exactly the same pointer movement.
+ */
+
+#include "kb-hal.h"
+#include <bsp/board.h>
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-mouse.h"
+#include "kb-sched.h"
+
+/* Pointer speed after the movement keys have been held for "held_ms".
+ * Returns pixels per ms, in Q8. */
+int32_t mouse_speed (uint32_t held_ms)
+{
+    if (held_ms >= MOUSE_ACCEL_MS)
+    {
+        return MOUSE_VMAX;
+    }
+
+    int32_t dv = MOUSE_VMAX - MOUSE_V0;
+    int32_t t  = (int32_t)((held_ms * 256u) / MOUSE_ACCEL_MS); // 0 to 255, fraction of the ramp time
+
+#if MOUSE_PROFILE == MOUSE_QUADRATIC
+    return MOUSE_V0 + ((dv * ((t * t) >> 8)) >> 8);
+#else
+    return MOUSE_V0 + ((dv * t) >> 8);
+#endif
+} // mouse_speed
+
+// Clear the mouse state
+void mouse_reset (mouse_state *ms)
+{
+    ms->keys = 0;
+    ms->move_ms = 0;
+    ms->wheel_ms = 0;
+    ms->frac_x = 0;
+    ms->frac_y = 0;
+} // mouse_reset
+
+// Limit a movement to what one report can carry
+static int8_t mouse_clamp (int32_t v)
+{
+    if (v > 127)
+    {
+        return 127;
+    }
+    if (v < -127)
+    {
+        return -127;
+    }
+    return (int8_t)v;
+} // mouse_clamp
+
+/* Advance the mouse state by 1 ms, with "keys" held down.
+ * Fills in "mv" and returns non-zero if a report is needed. */
+int mouse_step (mouse_state *ms, uint16_t keys, mouse_move *mv)
+{
+    int report = 0;
+
+    mv->buttons = 0;
+    mv->dx = 0;
+    mv->dy = 0;
+    mv->wheel = 0;
+
+    // Buttons - report any change
+    if (keys & MK_BTN1)
+    {
+        mv->buttons |= 0x01;
+    }
+    if (keys & MK_BTN2)
+    {
+        mv->buttons |= 0x02;
+    }
+    if (keys & MK_BTN3)
+    {
+        mv->buttons |= 0x04;
+    }
+    if ((keys ^ ms->keys) & MK_BTNS)
+    {
+        report = 1;
+    }
+
+    // Movement
+    if (keys & MK_MOVE)
+    {
+        if ((ms->keys & MK_MOVE) == 0)
+        {
+            // Just started moving, start from the slowest speed
+            ms->move_ms = 0;
+            ms->frac_x = 0;
+            ms->frac_y = 0;
+        }
+
+        int32_t v = mouse_speed (ms->move_ms);
+        int32_t vx = 0;
+        int32_t vy = 0;
+        if (keys & MK_RIGHT)
+        {
+            vx += v;
+        }
+        if (keys & MK_LEFT)
+        {
+            vx -= v;
+        }
+        if (keys & MK_DOWN)
+        {
+            vy += v;
+        }
+        if (keys & MK_UP)
+        {
+            vy -= v;
+        }
+
+        ms->frac_x += vx;
+        ms->frac_y += vy;
+
+        // Whole pixels to move, the rest is carried over (rounding towards zero)
+        int32_t px = (ms->frac_x >= 0) ? (ms->frac_x >> 8) : -((-ms->frac_x) >> 8);
+        int32_t py = (ms->frac_y >= 0) ? (ms->frac_y >> 8) : -((-ms->frac_y) >> 8);
+        mv->dx = mouse_clamp (px);
+        mv->dy = mouse_clamp (py);
+        ms->frac_x -= (int32_t)mv->dx * 256; // Not << 8, the move can be negative
+        ms->frac_y -= (int32_t)mv->dy * 256;
+
+        if ((mv->dx != 0) || (mv->dy != 0))
+        {
+            report = 1;
+        }
+        ++ms->move_ms;
+    }
+
+    // Wheel - one click straight away, then one every MOUSE_WHEEL_MS
+    if (keys & MK_WHEEL)
+    {
+        if ((ms->keys & MK_WHEEL) == 0)
+        {
+            ms->wheel_ms = 0;
+        }
+        if ((ms->wheel_ms % MOUSE_WHEEL_MS) == 0)
+        {
+            mv->wheel = (keys & MK_WUP) ? 1 : -1;
+            report = 1;
+        }
+        ++ms->wheel_ms;
+    }
+
+    ms->keys = keys;
+    return report;
+} // mouse_step
+
+static mouse_state mk_state;         // The mouse keys state
+static uint16_t    mk_keys    = 0;   // Mouse keys held, from core-1
+static uint32_t    mk_last_ms = 0;   // When the state was last advanced
+static int         mk_task    = -1;  // mouse_task(), armed whilst a mouse key is held
+
+// Add the mouse keys task to the scheduler, called by kb_init()
+void mouse_init (void)
+{
+    mk_task = sched_add ("mouse", mouse_task, 0);
+} // mouse_init
+
+// Called by main() when core-1 sends a new set of mouse keys
+void mouse_set_keys (uint16_t keys)
+{
+    if ((mk_keys == 0) && (keys != 0))
+    {
+        mk_last_ms = board_millis () - 1; // Start moving on this pass
+    }
+    mk_keys = keys;
+    sched_at (mk_task, hal_time_us ());
+} // mouse_set_keys
+
+/* The scheduler runs this every 1 ms whilst a mouse key is held, and once
+ * more to let go - it advances the mouse state and queues up the movement to
+ * be sent in the next mouse report. */
+void mouse_task (void)
+{
+    if ((mk_keys == 0) && (mk_state.keys == 0))
+    {
+        return; // Nothing held, and nothing to release
+    }
+    sched_at (mk_task, hal_time_us () + 1000u); // The next step
+
+    uint32_t now = board_millis ();
+    int steps = 0;
+    mouse_move sum = { 0, 0, 0, 0 };
+    int report = 0;
+
+    // Catch up on any ms missed, but not too many
+    while (((now - mk_last_ms) > 0) && (steps < 8))
+    {
+        mouse_move mv;
+        if (mouse_step (&mk_state, mk_keys, &mv))
+        {
+            report = 1;
+        }
+        sum.buttons = mv.buttons;
+        sum.dx = mouse_clamp (sum.dx + mv.dx);
+        sum.dy = mouse_clamp (sum.dy + mv.dy);
+        sum.wheel = mouse_clamp (sum.wheel + mv.wheel);
+        ++mk_last_ms;
+        ++steps;
+    }
+    if (steps >= 8)
+    {
+        mk_last_ms = now; // Fell well behind, do not try to catch up any more
+    }
+
+    if (report)
+    {
+        mouse_queue (&sum);
+    }
+} // mouse_task
+
+/* End of File */
@@ -0,0 +1,68 @@
+/*
+ * Header file for the mouse keys layer.
+ * The cursor keys move the mouse pointer, with nearby keys for the buttons and wheel.
+ */
+
+#ifndef _KB_MOUSE_H_
+#define _KB_MOUSE_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// Bits for the mouse keys held down, as sent from core-1 with FLAG_MOUSE
+#define MK_RIGHT  0x0001
+#define MK_LEFT   0x0002
+#define MK_UP     0x0004
+#define MK_DOWN   0x0008
+#define MK_BTN1   0x0010 // Left button
+#define MK_BTN2   0x0020 // Right button
+#define MK_BTN3   0x0040 // Middle button
+#define MK_WUP    0x0080 // Wheel up
+#define MK_WDN    0x0100 // Wheel down
+
+#define MK_MOVE   (MK_RIGHT | MK_LEFT | MK_UP | MK_DOWN)
+#define MK_BTNS   (MK_BTN1 | MK_BTN2 | MK_BTN3)
+#define MK_WHEEL  (MK_WUP | MK_WDN)
+
+// Acceleration profiles
+#define MOUSE_LINEAR     0 // Speed ramps up steadily
+#define MOUSE_QUADRATIC  1 // Speed ramps up slowly at first, for fine positioning
+
+// The state of the mouse keys, advanced one step per ms
+typedef struct
+{
+    uint16_t keys;     // Mouse keys held down
+    uint32_t move_ms;  // How long the movement keys have been held (ms)
+    uint32_t wheel_ms; // How long the wheel keys have been held (ms)
+    int32_t  frac_x;   // Sub-pixel movement carried over (Q8)
+    int32_t  frac_y;
+} mouse_state;
+
+// One mouse report's worth of movement
+typedef struct
+{
+    uint8_t buttons;
+    int8_t  dx;
+    int8_t  dy;
+    int8_t  wheel;
+} mouse_move;
+
+// defined in kb-mouse.c
+extern int32_t mouse_speed (uint32_t held_ms);
+extern void    mouse_reset (mouse_state *ms);
+extern int     mouse_step (mouse_state *ms, uint16_t keys, mouse_move *mv);
+extern void    mouse_init (void);
+extern void    mouse_set_keys (uint16_t keys);
+extern void    mouse_task (void);
+
+// defined in usb-stack.c
+extern void    mouse_queue (const mouse_move *mv);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_MOUSE_H_ */
+
+/* End of File */
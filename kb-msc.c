@@ -0,0 +1,466 @@
+/* USB drive view for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * The drive is a FAT12 volume that is never stored anywhere. Each block the
+ * host reads is made up there and then, in the USB buffer, from the few
+ * things it can hold:
+ *   block 0            the boot sector
+ *   MSC_FAT_LBA...     the FAT, one chain of clusters for each file
+ *   MSC_ROOT_LBA       the root directory, the files in msc_files []
+ *   MSC_DATA_LBA...    the files, one after the other, a cluster per block
+ * The file contents come straight from the live config, the counters, the
+ * trace rings in RAM and the recorder's ring in the flash. None of this waits
+ * for anything, so the keyboard interface is never held up, and core-1 is not
+ * involved at all.
+ *
+ * Writes to the FAT and directory are thrown away, so the host only sees the
+ * drive change after it is mounted again. A written block that holds a whole
+ * config record (CONFIG.BIN, in the same form as the flash store) is checked,
+ * committed, and saved to the store by msc_task(), a core-0 task armed by
+ * the write. A bad record fails the
+ * write, so the host reports an error.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "kb-hal.h"
+#include "hardware/flash.h"
+#include <tusb.h>
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-msc.h"
+#include "kb-record.h"
+#include "kb-sched.h"
+#include "kb-store.h"
+#include "kb-telem.h"
+#include "kb-trace.h"
+
+#if CFG_TUD_MSC
+
+#if !STORE_ON
+#error "CONFIG.BIN is saved in the config store, set STORE_ON"
+#endif
+
+#define MSC_BLOCK_SZ      512
+#define MSC_CLUSTERS_FOR(bytes) (((bytes) + MSC_BLOCK_SZ - 1) / MSC_BLOCK_SZ)
+
+#define MSC_STATS_LINE    32 // Each line of STATS.TXT, so its size is fixed
+#define MSC_TRACE_SZ      (2 * TRACE_RING_SZ * sizeof (trace_rec))
+#define MSC_SCANS_SZ      (RECORD_SECTORS * FLASH_SECTOR_SIZE)
+#define MSC_FREE          16 // Free clusters, for the host to write CONFIG.BIN back
+
+typedef struct
+{
+    char     name [11];  // 8.3, padded with spaces
+    uint8_t  attr;       // FAT attributes
+    uint32_t size;       // Bytes
+    void     (*read) (uint32_t ofs, uint8_t *buf, uint32_t len);
+} msc_file;
+
+#define MSC_ATTR_RO     0x01
+#define MSC_ATTR_VOLUME 0x08
+#define MSC_ATTR_ARCH   0x20
+
+// What STATS.TXT shows, each line a name and a number from one of the info blocks
+enum { STAT_PERF, STAT_STORE, STAT_REC };
+
+typedef struct
+{
+    char const *name;
+    uint8_t     src;  // STAT_xxx
+    uint8_t     ofs;  // Offset in its info block
+    uint8_t     u16;  // The number is 16 bits, else 32
+} msc_stat;
+
+static const msc_stat msc_stats [] =
+{
+#if TELEM_COUNT
+    { "uptime_ms",        STAT_PERF,  PERF_OFS_UPTIME,     0 },
+    { "scans",            STAT_PERF,  PERF_OFS_SCANS,      0 },
+    { "scan_min_us",      STAT_PERF,  PERF_OFS_SCAN_MIN,   1 },
+    { "scan_avg_us",      STAT_PERF,  PERF_OFS_SCAN_AVG,   1 },
+    { "scan_max_us",      STAT_PERF,  PERF_OFS_SCAN_MAX,   1 },
+    { "fifo_drops",       STAT_PERF,  PERF_OFS_FIFO_DROP,  0 },
+    { "kc_drops",         STAT_PERF,  PERF_OFS_KC_DROP,    0 },
+    { "ghosts",           STAT_PERF,  PERF_OFS_GHOSTS,     0 },
+    { "bounces",          STAT_PERF,  PERF_OFS_BOUNCES,    0 },
+    { "reports",          STAT_PERF,  PERF_OFS_REPORTS,    0 },
+    { "wakeups",          STAT_PERF,  PERF_OFS_WAKEUPS,    1 },
+    { "wake_max_us",      STAT_PERF,  PERF_OFS_WAKE_MAX,   0 },
+#endif // TELEM_COUNT
+    { "boot_scan_us",     STAT_STORE, CFG_STORE_BOOT_SCAN, 0 },
+    { "boot_mount_us",    STAT_STORE, CFG_STORE_BOOT_MOUNT,0 },
+    { "store_seq",        STAT_STORE, CFG_STORE_SEQ,       0 },
+    { "store_saves",      STAT_STORE, CFG_STORE_SAVES,     1 },
+    { "store_write_us",   STAT_STORE, CFG_STORE_WRITE_US,  0 },
+    { "store_gap_us",     STAT_STORE, CFG_STORE_GAP_US,    0 },
+#if RECORD_ON
+    { "rec_next_page",    STAT_REC,   REC_INFO_NEXT,       0 },
+    { "rec_lost",         STAT_REC,   REC_INFO_LOST,       0 },
+#endif // RECORD_ON
+};
+
+#define MSC_STATS_SZ      ((sizeof (msc_stats) / sizeof (msc_stats [0])) * MSC_STATS_LINE)
+
+// CONFIG.BIN: the live config, as a store record
+static void msc_read_config (uint32_t ofs, uint8_t *buf, uint32_t len)
+{
+    store_rec rec;
+    store_fill (&rec, store_seq ());
+    memcpy (buf, (uint8_t const *)&rec + ofs, len);
+} // msc_read_config
+
+// STATS.TXT: one line for each msc_stats [], of fixed width
+static void msc_read_stats (uint32_t ofs, uint8_t *buf, uint32_t len)
+{
+    uint8_t info [3][PERF_REPORT_LEN];
+    char line [MSC_STATS_LINE + 1];
+    uint32_t end = ofs + len;
+    uint32_t idx;
+
+    memset (info, 0, sizeof (info));
+#if TELEM_COUNT
+    telem_perf_fill (info [STAT_PERF], PERF_REPORT_LEN);
+#endif // TELEM_COUNT
+    store_info (info [STAT_STORE], PERF_REPORT_LEN);
+#if RECORD_ON
+    rec_info (info [STAT_REC], PERF_REPORT_LEN);
+#endif // RECORD_ON
+
+    for (idx = ofs / MSC_STATS_LINE; (idx * MSC_STATS_LINE) < end; ++idx)
+    {
+        msc_stat const *st = &msc_stats [idx];
+        uint8_t const *p = &info [st->src][st->ofs];
+        uint32_t val = st->u16 ? perf_get16 (p) : perf_get32 (p);
+        snprintf (line, sizeof (line), "%-20s %10lu\n", st->name, (unsigned long)val);
+
+        // Copy the part of the line inside the block
+        uint32_t from = idx * MSC_STATS_LINE;
+        uint32_t first = (from < ofs) ? (ofs - from) : 0;
+        uint32_t last = ((from + MSC_STATS_LINE) > end) ? (end - from) : MSC_STATS_LINE;
+        memcpy (&buf [from + first - ofs], &line [first], last - first);
+    }
+} // msc_read_stats
+
+static const msc_file msc_files [] =
+{
+    { "CONFIG  BIN", MSC_ATTR_ARCH,                sizeof (store_rec), msc_read_config },
+    { "STATS   TXT", MSC_ATTR_ARCH | MSC_ATTR_RO, MSC_STATS_SZ,       msc_read_stats  },
+#if TRACE_ON
+    { "TRACE   BIN", MSC_ATTR_ARCH | MSC_ATTR_RO, MSC_TRACE_SZ,       trace_peek      },
+#endif // TRACE_ON
+#if RECORD_ON
+    { "SCANS   BIN", MSC_ATTR_ARCH | MSC_ATTR_RO, MSC_SCANS_SZ,       rec_peek        },
+#endif // RECORD_ON
+};
+
+#define MSC_FILES  (int)(sizeof (msc_files) / sizeof (msc_files [0]))
+
+// The volume, one block for each cluster
+#define MSC_CLUSTERS   (MSC_CLUSTERS_FOR (sizeof (store_rec)) + MSC_CLUSTERS_FOR (MSC_STATS_SZ) + \
+                        (TRACE_ON * MSC_CLUSTERS_FOR (MSC_TRACE_SZ)) + (RECORD_ON * MSC_CLUSTERS_FOR (MSC_SCANS_SZ)) + \
+                        MSC_FREE)
+#define MSC_FAT_LBA    1
+#define MSC_FAT_BLOCKS (((((MSC_CLUSTERS + 2) * 3) + 1) / 2 + MSC_BLOCK_SZ - 1) / MSC_BLOCK_SZ)
+#define MSC_ROOT_LBA   (MSC_FAT_LBA + MSC_FAT_BLOCKS)
+#define MSC_ROOT_ITEMS (MSC_BLOCK_SZ / 32) // One block of directory entries
+#define MSC_DATA_LBA   (MSC_ROOT_LBA + 1)
+#define MSC_BLOCKS     (MSC_DATA_LBA + MSC_CLUSTERS)
+
+_Static_assert (MSC_CLUSTERS < 4085, "Too many clusters for FAT12, make RECORD_SECTORS smaller");
+_Static_assert (MSC_FILES < MSC_ROOT_ITEMS, "The files and the volume label must fit in the root directory");
+
+// The files are all dated when the volume was first made: 1 Jan 2024, 12:00
+#define MSC_DATE  (((2024 - 1980) << 9) | (1 << 5) | 1)
+#define MSC_TIME  (12 << 11)
+
+static struct
+{
+    int save; // A CONFIG.BIN has been committed, and is to be saved
+    int task; // msc_task() in the core-0 scheduler
+} msc = { 0, -1 };
+
+static void msc_put16 (uint8_t *p, uint32_t v)
+{
+    perf_put16 (p, (uint16_t)v);
+} // msc_put16
+
+// The first cluster of each file (clusters are numbered from 2)
+static uint32_t msc_first_cluster (int file)
+{
+    uint32_t cl = 2;
+    int idx;
+    for (idx = 0; idx < file; ++idx)
+    {
+        cl += MSC_CLUSTERS_FOR (msc_files [idx].size);
+    }
+    return cl;
+} // msc_first_cluster
+
+// The FAT entry for a cluster: the next in the chain, 0xFFF at the end, 0 if free
+static uint32_t msc_fat_entry (uint32_t cl)
+{
+    if (cl < 2)
+    {
+        return (cl == 0) ? 0xFF8 : 0xFFF; // The media byte, and the end mark
+    }
+    uint32_t first = 2;
+    int idx;
+    for (idx = 0; idx < MSC_FILES; ++idx)
+    {
+        uint32_t n = MSC_CLUSTERS_FOR (msc_files [idx].size);
+        if (cl < (first + n))
+        {
+            return (cl == (first + n - 1)) ? 0xFFF : (cl + 1);
+        }
+        first += n;
+    }
+    return 0;
+} // msc_fat_entry
+
+static void msc_boot_block (uint8_t *buf)
+{
+    static const uint8_t jump [3] = { 0xEB, 0x3C, 0x90 };
+    memcpy (&buf [0], jump, 3);
+    memcpy (&buf [3], "MSDOS5.0", 8);
+    msc_put16 (&buf [11], MSC_BLOCK_SZ);     // Bytes per sector
+    buf [13] = 1;                            // Sectors per cluster
+    msc_put16 (&buf [14], MSC_FAT_LBA);      // Reserved sectors
+    buf [16] = 1;                            // FATs
+    msc_put16 (&buf [17], MSC_ROOT_ITEMS);   // Root directory entries
+    msc_put16 (&buf [19], MSC_BLOCKS);       // Sectors
+    buf [21] = 0xF8;                         // Media
+    msc_put16 (&buf [22], MSC_FAT_BLOCKS);   // Sectors per FAT
+    msc_put16 (&buf [24], 1);                // Sectors per track
+    msc_put16 (&buf [26], 1);                // Heads
+    buf [36] = 0x80;                         // Drive number
+    buf [38] = 0x29;                         // Extended boot signature
+    perf_put32 (&buf [39], 0x46573632);      // Volume serial number
+    memcpy (&buf [43], "FONTWRITER ", 11);
+    memcpy (&buf [54], "FAT12   ", 8);
+    buf [510] = 0x55;
+    buf [511] = 0xAA;
+} // msc_boot_block
+
+// One block of the FAT, 12 bits an entry, two entries in three bytes
+static void msc_fat_block (uint32_t block, uint8_t *buf)
+{
+    uint32_t ofs;
+    for (ofs = 0; ofs < MSC_BLOCK_SZ; ++ofs)
+    {
+        uint32_t at = (block * MSC_BLOCK_SZ) + ofs;
+        uint32_t cl = (at / 3) * 2;
+        switch (at % 3)
+        {
+            case 0:
+            buf [ofs] = (uint8_t)msc_fat_entry (cl);
+            break;
+
+            case 1:
+            buf [ofs] = (uint8_t)(((msc_fat_entry (cl) >> 8) & 0x0F) | ((msc_fat_entry (cl + 1) & 0x0F) << 4));
+            break;
+
+            default:
+            buf [ofs] = (uint8_t)(msc_fat_entry (cl + 1) >> 4);
+            break;
+        }
+    }
+} // msc_fat_block
+
+static void msc_dir_entry (uint8_t *ent, char const *name, uint8_t attr, uint32_t cl, uint32_t size)
+{
+    memcpy (&ent [0], name, 11);
+    ent [11] = attr;
+    msc_put16 (&ent [14], MSC_TIME);   // Created
+    msc_put16 (&ent [16], MSC_DATE);
+    msc_put16 (&ent [18], MSC_DATE);   // Last read
+    msc_put16 (&ent [22], MSC_TIME);   // Last written
+    msc_put16 (&ent [24], MSC_DATE);
+    msc_put16 (&ent [26], cl);
+    perf_put32 (&ent [28], size);
+} // msc_dir_entry
+
+static void msc_root_block (uint8_t *buf)
+{
+    int idx;
+    msc_dir_entry (&buf [0], "FONTWRITER ", MSC_ATTR_VOLUME, 0, 0);
+    for (idx = 0; idx < MSC_FILES; ++idx)
+    {
+        msc_file const *f = &msc_files [idx];
+        msc_dir_entry (&buf [32 * (idx + 1)], f->name, f->attr, msc_first_cluster (idx), f->size);
+    }
+} // msc_root_block
+
+// A block of file data, or zeros if it is free space or past the end of its file
+static void msc_data_block (uint32_t cl, uint8_t *buf)
+{
+    uint32_t first = 2;
+    int idx;
+    for (idx = 0; idx < MSC_FILES; ++idx)
+    {
+        msc_file const *f = &msc_files [idx];
+        uint32_t n = MSC_CLUSTERS_FOR (f->size);
+        if (cl < (first + n))
+        {
+            uint32_t ofs = (cl - first) * MSC_BLOCK_SZ;
+            uint32_t len = f->size - ofs;
+            f->read (ofs, buf, (len > MSC_BLOCK_SZ) ? MSC_BLOCK_SZ : len);
+            return;
+        }
+        first += n;
+    }
+} // msc_data_block
+
+//--------------------------------------------------------------------+
+// tinyusb MSC callbacks
+//--------------------------------------------------------------------+
+
+void tud_msc_inquiry_cb (uint8_t lun, uint8_t vendor_id [8], uint8_t product_id [16], uint8_t product_rev [4])
+{
+    (void) lun;
+    memcpy (vendor_id,   "PicoWrit", 8);
+    memcpy (product_id,  "Fontwriter Files", 16);
+    memcpy (product_rev, "1.0 ", 4);
+} // tud_msc_inquiry_cb
+
+bool tud_msc_test_unit_ready_cb (uint8_t lun)
+{
+    (void) lun;
+    return true; // Always there, nothing to wait for
+} // tud_msc_test_unit_ready_cb
+
+void tud_msc_capacity_cb (uint8_t lun, uint32_t *block_count, uint16_t *block_size)
+{
+    (void) lun;
+    *block_count = MSC_BLOCKS;
+    *block_size  = MSC_BLOCK_SZ;
+} // tud_msc_capacity_cb
+
+bool tud_msc_start_stop_cb (uint8_t lun, uint8_t power_condition, bool start, bool load_eject)
+{
+    (void) lun;
+    (void) power_condition;
+    (void) start;
+    (void) load_eject;
+    return true; // Nothing to do, the keyboard carries on as it was
+} // tud_msc_start_stop_cb
+
+bool tud_msc_is_writable_cb (uint8_t lun)
+{
+    (void) lun;
+    return true; // For CONFIG.BIN
+} // tud_msc_is_writable_cb
+
+// Make up the blocks asked for, in the USB buffer
+int32_t tud_msc_read10_cb (uint8_t lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize)
+{
+    (void) lun;
+    uint8_t *buf = buffer;
+    uint32_t done;
+
+    if ((offset != 0) || ((bufsize % MSC_BLOCK_SZ) != 0))
+    {
+        return -1; // CFG_TUD_MSC_EP_BUFSIZE is a whole number of blocks
+    }
+    for (done = 0; done < bufsize; done += MSC_BLOCK_SZ, ++lba, buf += MSC_BLOCK_SZ)
+    {
+        memset (buf, 0, MSC_BLOCK_SZ);
+        if (lba == 0)
+        {
+            msc_boot_block (buf);
+        }
+        else if (lba < MSC_ROOT_LBA)
+        {
+            msc_fat_block (lba - MSC_FAT_LBA, buf);
+        }
+        else if (lba == MSC_ROOT_LBA)
+        {
+            msc_root_block (buf);
+        }
+        else if (lba < MSC_BLOCKS)
+        {
+            msc_data_block (lba - MSC_DATA_LBA + 2, buf);
+        }
+    }
+    return (int32_t)bufsize;
+} // tud_msc_read10_cb
+
+// Only a config record is kept, anything else written is thrown away
+int32_t tud_msc_write10_cb (uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
+{
+    uint32_t done;
+
+    if ((offset != 0) || ((bufsize % MSC_BLOCK_SZ) != 0))
+    {
+        return -1;
+    }
+    for (done = 0; done < bufsize; done += MSC_BLOCK_SZ, ++lba)
+    {
+        store_rec rec;
+        memcpy (&rec, &buffer [done], sizeof (rec)); // The USB buffer may not be aligned for it
+        if ((lba < MSC_DATA_LBA) || (rec.magic != STORE_MAGIC))
+        {
+            continue;
+        }
+
+        int status = store_good (&rec) ? cfg_load (&rec.cfg) : CFG_ERR_ARG;
+        if (status == CFG_ERR_BUSY)
+        {
+            return 0; // The last commit is not taken up yet (a scan at most), tinyusb asks again
+        }
+        if (status != CFG_OK)
+        {
+            tud_msc_set_sense (lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x26, 0x00); // Invalid field in parameter list
+            return -1;
+        }
+        msc.save = 1;
+        sched_at (msc.task, hal_time_us ());
+    }
+    return (int32_t)bufsize;
+} // tud_msc_write10_cb
+
+// Any other SCSI command
+int32_t tud_msc_scsi_cb (uint8_t lun, uint8_t const scsi_cmd [16], void *buffer, uint16_t bufsize)
+{
+    (void) buffer;
+    (void) bufsize;
+
+    switch (scsi_cmd [0])
+    {
+        case SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL:
+        return 0; // Nothing to lock
+
+        default:
+        tud_msc_set_sense (lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00); // Invalid command
+        return -1;
+    }
+} // tud_msc_scsi_cb
+
+// Add the save task to the scheduler, called by kb_init()
+void msc_init (void)
+{
+    msc.task = sched_add ("msc", msc_task, 0);
+} // msc_init
+
+/* Run by the scheduler once the host has written a CONFIG.BIN. Saves it
+ * once core-1 has taken it up, looking again every STORE_CLAIM_US till then. */
+void msc_task (void)
+{
+    if (!msc.save)
+    {
+        return;
+    }
+    if (cfg_save () == CFG_OK)
+    {
+        msc.save = 0;
+    }
+    else
+    {
+        sched_at (msc.task, hal_time_us () + STORE_CLAIM_US);
+    }
+} // msc_task
+
+#endif // CFG_TUD_MSC
+
+/* End of File */
@@ -0,0 +1,27 @@
+/*
+ * Header file for the USB drive view.
+ * When CFG_TUD_MSC is set in tusb_config.h, the keyboard also shows up as a
+ * small read-only USB drive, with its config, a stats snapshot and the trace
+ * and scan recordings as files, so they can be copied off with no special
+ * tools. A CONFIG.BIN copied back on to the drive is checked, then made live
+ * and saved to the flash store.
+ */
+
+#ifndef _KB_MSC_H_
+#define _KB_MSC_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// defined in kb-msc.c
+extern void msc_init (void);
+extern void msc_task (void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_MSC_H_ */
+
+/* End of File */
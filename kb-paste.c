@@ -0,0 +1,211 @@
+/* CDC "paste mode" for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * When CFG_TUD_CDC is set in tusb_config.h the keyboard also shows up as a
+ * serial port. Text written to that port is typed to the host, through the
+ * same layout profile as the macros, as fast as the host will take it.
+ *
+ * Flow control: text is only read from the CDC endpoint when there is room in
+ * the paste buffer, otherwise tinyusb leaves the OUT endpoint un-armed and the
+ * host simply waits. So nothing is ever dropped, however much is sent.
+ *
+ * Ordering: pasted text is only typed when no real keys are waiting or held,
+ * and the paste stream stops as soon as a real key arrives, so the two are
+ * never mixed up.
+ *
+ * At the end of each paste (no text for PASTE_IDLE_MS) the characters per
+ * second achieved are written back to the serial port.
+ */
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include <bsp/board.h>
+#include <tusb.h>
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-sched.h"
+#include "kb-stream.h"
+
+#if CFG_TUD_CDC
+
+#define PS_MSK (PASTE_BUF_SZ - 1)
+
+static uint8_t  ps_buf [PASTE_BUF_SZ]; // Text waiting to be typed
+static uint32_t ps_in  = 0;
+static uint32_t ps_out = 0;
+
+static int         ps_streaming = 0; // Set whilst the paste stream is being sent
+static int         ps_active    = 0; // Set from the first character of a paste until it goes idle
+static uint8_t     ps_last      = 0; // Last character taken, to fold CR LF into one ENTER
+static uint32_t    ps_chars     = 0; // Keystrokes typed for this paste
+static uint32_t    ps_start     = 0; // When the first keystroke of this paste was typed (us)
+static uint32_t    ps_end       = 0; // When the last keystroke of this paste was typed (us)
+static uint32_t    ps_rx_ms     = 0; // When text last came in (ms)
+static paste_stats ps_stats;         // Throughput figures
+static int         ps_task      = -1; // paste_task(), armed when text comes in
+
+static uint32_t paste_used (void)
+{
+    return (ps_in - ps_out) & PS_MSK;
+} // paste_used
+
+// Stream source: generates the keystrokes for the pasted text, one at a time
+static int paste_next (kb_stroke *st)
+{
+    while ((ps_in != ps_out) && (kc_peek () == 0)) // A real key waiting goes first
+    {
+        uint8_t c = ps_buf [ps_out];
+        uint8_t last = ps_last;
+        ps_out = (ps_out + 1) & PS_MSK;
+        ps_last = c;
+
+        if ((c == '\n') && (last == '\r'))
+        {
+            continue; // CR LF is one ENTER
+        }
+        if (layout_ascii (c, st))
+        {
+            uint32_t now = time_us_32 ();
+            if (ps_chars == 0)
+            {
+                ps_start = now;
+            }
+            ps_end = now;
+            ++ps_chars;
+            return 1;
+        }
+        // Anything we cannot type is skipped
+    }
+
+    ps_streaming = 0;
+    return 0;
+} // paste_next
+
+/* Start typing any pasted text that is waiting.
+ * Called by hid_task() when no real keys are waiting, returns non-zero if the
+ * paste stream was started. */
+int paste_start (void)
+{
+    if ((ps_in == ps_out) || (stream_busy ()))
+    {
+        return 0;
+    }
+    ps_streaming = 1;
+    stream_start (paste_next, PASTE_GAP_US);
+    return 1;
+} // paste_start
+
+// Is pasted text being typed?
+int paste_busy (void)
+{
+    return (ps_streaming);
+} // paste_busy
+
+// The paste has gone idle - update the throughput figures and tell the sender
+static void paste_done (void)
+{
+    uint32_t us = ps_end - ps_start;
+    char msg [64];
+
+    ps_stats.last_chars = ps_chars;
+    ps_stats.last_us    = us;
+    ps_stats.last_cps   = (us > 0) ? (uint32_t)(((uint64_t)(ps_chars - 1) * 1000000u) / us) : 0;
+    if (ps_stats.last_cps > ps_stats.best_cps)
+    {
+        ps_stats.best_cps = ps_stats.last_cps;
+    }
+    ps_stats.chars += ps_chars;
+    ++ps_stats.count;
+
+    if (tud_cdc_connected ())
+    {
+        snprintf (msg, sizeof (msg), "\r\npaste: %lu chars in %lu ms, %lu cps\r\n",
+                  (unsigned long)ps_chars, (unsigned long)(us / 1000u), (unsigned long)ps_stats.last_cps);
+        tud_cdc_write_str (msg);
+        tud_cdc_write_flush ();
+    }
+
+    ps_active = 0;
+    ps_chars  = 0;
+} // paste_done
+
+// Add the paste task to the scheduler, called by kb_init()
+void paste_init (void)
+{
+    ps_task = sched_add ("paste", paste_task, 0);
+} // paste_init
+
+/* Run by the scheduler when text comes in - take in as much as the paste
+ * buffer has room for, and see when the paste is done */
+void paste_task (void)
+{
+    uint32_t now_ms = board_millis ();
+    uint32_t room = (PASTE_BUF_SZ - 1) - paste_used ();
+
+    while ((room > 0) && (tud_cdc_available ()))
+    {
+        // Read up to the end of the buffer, or the free space, whichever is less
+        uint32_t len = PASTE_BUF_SZ - ps_in;
+        if (len > room)
+        {
+            len = room;
+        }
+        len = tud_cdc_read (&ps_buf [ps_in], len);
+        if (len == 0)
+        {
+            break;
+        }
+        ps_in = (ps_in + len) & PS_MSK;
+        room -= len;
+        ps_active = 1;
+        ps_rx_ms = now_ms;
+    }
+
+    if ((ps_active) && (ps_in == ps_out) && (!ps_streaming) &&
+        ((now_ms - ps_rx_ms) >= PASTE_IDLE_MS))
+    {
+        if (ps_chars > 0)
+        {
+            paste_done ();
+        }
+        ps_active = 0;
+    }
+
+    if (tud_cdc_available ())
+    {
+        sched_at (ps_task, time_us_32 () + (HID_EP_POLL * 1000u)); // No room, look again once a report has gone
+    }
+    else if (ps_active)
+    {
+        sched_at (ps_task, time_us_32 () + (PASTE_IDLE_MS * 1000u)); // To see when it is done
+    }
+} // paste_task
+
+// Get a copy of the paste throughput figures
+void paste_get_stats (paste_stats *ps)
+{
+    *ps = ps_stats;
+} // paste_get_stats
+
+// Invoked by tud_task() when text comes in from the host
+void tud_cdc_rx_cb (uint8_t itf)
+{
+    (void) itf;
+    sched_at (ps_task, time_us_32 ());
+} // tud_cdc_rx_cb
+
+// Invoked when the host opens or closes the serial port - a new paste starts clean
+void tud_cdc_line_state_cb (uint8_t itf, bool dtr, bool rts)
+{
+    (void) itf;
+    (void) rts;
+
+    if (!dtr)
+    {
+        ps_last = 0;
+    }
+} // tud_cdc_line_state_cb
+
+#endif // CFG_TUD_CDC
+
+/* End of File */
@@ -0,0 +1,314 @@
+/* Suspend power states for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * Core-0 owns the state, and moves it on from the TinyUSB callbacks
+ * (tud_suspend_cb, tud_resume_cb) and from power_task(), on each pass of
+ * kb_task() (core-1 wakes core-0 for a key with a SEV) and at the PWR_WAKE_MS
+ * deadline. Core-1 only reads it, at the end of each scan pass, and parks
+ * the scanner whilst it says SUSPENDED (power_park()). Parked, every select
+ * line is driven low and core-1 sleeps until a row falls (a key went down)
+ * or PWR_PARK_MS is up, then it does one full scan as usual, so the timers
+ * and the flash hand over still get a look now and then.
+ *
+ * A key seen whilst parked is counted, and the scanner stays running in
+ * full, so the key is decoded as any other. Core-0 sees the count move on,
+ * goes back to the full clock and waits (WAKING) for the host to resume,
+ * which hid_task() asks for when the key comes out of the queue. If the host
+ * does not resume (it did not allow a remote wake-up), it all goes back to
+ * sleep after PWR_WAKE_MS.
+ *
+ * The clock: at boot clk_peri is moved from clk_sys to pll_sys direct, at
+ * the same speed, so the UART baud rates do not change with clk_sys. Whilst
+ * suspended clk_sys runs from pll_usb (48 MHz), and back on pll_sys after.
+ * The USB itself runs from pll_usb all the time. This is well short of the
+ * 2.5 mA a suspended USB device should draw, which would need the Pico to
+ * go dormant, but it takes away most of what the cores were burning.
+ *
+ * The host build has no clocks, but the states, the parking and the figures
+ * all run there on the mock callbacks (see tools/kb-suspend.c).
+ */
+
+#include <string.h>
+#include "kb-hal.h"
+#if !KB_HOST
+#include "hardware/clocks.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#endif // !KB_HOST
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-power.h"
+#include "kb-sched.h"
+#include "kb-telem.h"
+
+#if POWER_ON
+
+#define PWR_SLOW_HZ  48000000 // pll_usb, as the SDK sets it up for the USB
+
+// Written by core-0 only
+static struct
+{
+    volatile int      state;      // PWR_xxx, core-1 watches this
+    volatile uint32_t resume_us;  // When the last resume came, for core-1's figure
+    volatile uint32_t resumes;    // ...bumped once resume_us is set
+    int      remote;              // The host allows a remote wake-up
+    uint32_t key_seen;            // pw1.key_wakes, when last looked at
+    uint32_t since_us;            // When the state last changed
+    uint32_t suspends;
+    uint32_t clock_max_us;
+    uint64_t slept_us;
+    uint32_t full_hz;
+} pw0;
+
+// Written by core-1 only
+static struct
+{
+    volatile uint32_t key_wakes;  // Keys seen whilst parked
+    volatile uint32_t resume_max_us;
+    uint32_t resume_seen;         // pw0.resumes, when last looked at
+} pw1;
+
+static int pw_task = -1; // power_task() as a one-shot, for the PWR_WAKE_MS time out
+
+// Switch clk_sys between pll_usb (slow) and pll_sys, returns how long it took (us)
+static uint32_t power_clock (int slow)
+{
+    uint32_t t0 = hal_time_us ();
+#if !KB_HOST && PWR_SLOW_CLOCK
+    if (slow)
+    {
+        clock_configure (clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
+                         CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, PWR_SLOW_HZ, PWR_SLOW_HZ);
+    }
+    else
+    {
+        clock_configure (clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
+                         CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS, pw0.full_hz, pw0.full_hz);
+    }
+#else
+    (void) slow;
+#endif // !KB_HOST && PWR_SLOW_CLOCK
+    return hal_time_us () - t0;
+} // power_clock
+
+// core-0: move to a new state, with the clock and the idle time that go with it
+static void power_set (int state)
+{
+    uint32_t now = hal_time_us ();
+    if (pw0.state != PWR_ACTIVE)
+    {
+        pw0.slept_us += now - pw0.since_us;
+    }
+    if (state == PWR_SUSPENDED)
+    {
+        power_clock (1);
+    }
+    else if (pw0.state == PWR_SUSPENDED)
+    {
+        uint32_t took = power_clock (0);
+        if (took > pw0.clock_max_us)
+        {
+            pw0.clock_max_us = took;
+        }
+    }
+    if (state == PWR_WAKING)
+    {
+        sched_at (pw_task, now + (PWR_WAKE_MS * 1000u)); // To go back to sleep if the host does not resume
+    }
+    else
+    {
+        sched_cancel (pw_task);
+    }
+    pw0.since_us = now;
+    pw0.state = state;
+#if !KB_HOST
+    __sev (); // Wake core-1, if it is parked
+#endif // !KB_HOST
+} // power_set
+
+/* core-0: called by kb_init(), before core-1 starts. Moves clk_peri off
+ * clk_sys, so the UART does not notice the clock changes. */
+void power_init (void)
+{
+#if !KB_HOST
+    pw0.full_hz = clock_get_hz (clk_sys);
+#if PWR_SLOW_CLOCK
+    clock_configure (clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS, pw0.full_hz, pw0.full_hz);
+#endif // PWR_SLOW_CLOCK
+#endif // !KB_HOST
+    pw0.state = PWR_ACTIVE;
+    pw_task = sched_add ("power", power_task, 0);
+} // power_init
+
+// core-0: the host has suspended the bus (tud_suspend_cb)
+void power_suspend (int remote_wakeup_en)
+{
+    pw0.remote = remote_wakeup_en;
+    pw0.key_seen = pw1.key_wakes;
+    ++pw0.suspends;
+    power_set (PWR_SUSPENDED);
+} // power_suspend
+
+// core-0: the host has resumed the bus, or reset it (tud_resume_cb, tud_mount_cb...)
+void power_resume (void)
+{
+    if (pw0.state != PWR_ACTIVE)
+    {
+        pw0.resume_us = hal_time_us ();
+        ++pw0.resumes;
+        power_set (PWR_ACTIVE);
+    }
+} // power_resume
+
+// core-0: called on every pass of kb_task() and at the deadline, a key woke the scanner or the host did not wake up
+void power_task (void)
+{
+    if ((pw0.state == PWR_SUSPENDED) && (pw1.key_wakes != pw0.key_seen))
+    {
+        pw0.key_seen = pw1.key_wakes;
+        power_set (PWR_WAKING); // Full speed for the remote wake-up and the reports after it
+    }
+    else if ((pw0.state == PWR_WAKING) && ((hal_time_us () - pw0.since_us) >= (PWR_WAKE_MS * 1000u)))
+    {
+        power_set (PWR_SUSPENDED); // The host did not resume, back to sleep
+    }
+} // power_task
+
+int power_state (void)
+{
+    return pw0.state;
+} // power_state
+
+/* core-1: called at the end of each scan pass. Whilst suspended, with no key
+ * down, the scanner is parked until a key goes down, the host resumes or
+ * PWR_PARK_MS is up. A key down, parked or on the pass, wakes core-0. */
+void power_park (int keys_down)
+{
+    if (pw0.resumes != pw1.resume_seen)
+    {
+        // The first pass after a resume, how long did it take to get here?
+        uint32_t took = hal_time_us () - pw0.resume_us;
+        pw1.resume_seen = pw0.resumes;
+        if (took > pw1.resume_max_us)
+        {
+            pw1.resume_max_us = took;
+        }
+    }
+    if (pw0.state != PWR_SUSPENDED)
+    {
+        return;
+    }
+    if (keys_down)
+    {
+        ++pw1.key_wakes; // Went down whilst this pass was scanning, not whilst parked
+#if !KB_HOST
+        __sev (); // Wake core-0 for it
+#endif // !KB_HOST
+        return;
+    }
+
+    uint32_t t0 = hal_time_us ();
+    uint32_t waited = 0;
+    hal_lines_park ();
+    while ((pw0.state == PWR_SUSPENDED) && (hal_rows () == ROW_MASK) && (waited < (PWR_PARK_MS * 1000u)))
+    {
+        hal_rows_wait ((PWR_PARK_MS * 1000u) - waited);
+        waited = hal_time_us () - t0;
+    }
+    if (hal_rows () != ROW_MASK)
+    {
+        ++pw1.key_wakes; // Core-0 picks this up in power_task()
+#if !KB_HOST
+        __sev ();
+#endif // !KB_HOST
+    }
+    hal_lines_unpark ();
+} // power_park
+
+// The power figures (CFG_CMD_POWER_INFO)
+int power_info (uint8_t *data, int len)
+{
+    if (len < PWR_INFO_LEN)
+    {
+        return CFG_ERR_ARG;
+    }
+    uint64_t slept = pw0.slept_us;
+    if (pw0.state != PWR_ACTIVE)
+    {
+        slept += hal_time_us () - pw0.since_us;
+    }
+    data [PWR_INFO_STATE]  = (uint8_t)pw0.state;
+    data [PWR_INFO_REMOTE] = (uint8_t)pw0.remote;
+    perf_put32 (&data [PWR_INFO_SUSPENDS],  pw0.suspends);
+    perf_put32 (&data [PWR_INFO_KEY_WAKES], pw1.key_wakes);
+    perf_put32 (&data [PWR_INFO_CLOCK_US],  pw0.clock_max_us);
+    perf_put32 (&data [PWR_INFO_RESUME_US], pw1.resume_max_us);
+    perf_put32 (&data [PWR_INFO_SLEPT_MS],  (uint32_t)(slept / 1000));
+    data [PWR_INFO_SLOW_MHZ] = (uint8_t)((PWR_SLOW_CLOCK ? PWR_SLOW_HZ : pw0.full_hz) / 1000000);
+    data [PWR_INFO_FULL_MHZ] = (uint8_t)(pw0.full_hz / 1000000);
+    return CFG_OK;
+} // power_info
+
+#endif // POWER_ON
+
+#if !KB_HOST
+/* The parked scanner's HAL calls, outside POWER_ON as scan_thread() also
+ * unparks the lines when core-1 is relaunched (see kb-watch.c). */
+
+#if MATRIX_ACTIVE_LOW
+#define PARK_EDGE  GPIO_IRQ_EDGE_FALL // A key down pulls its row low
+#else
+#define PARK_EDGE  GPIO_IRQ_EDGE_RISE
+#endif // MATRIX_ACTIVE_LOW
+
+// Only here to wake core-1 from hal_rows_wait(), the SDK clears the interrupt
+static void power_row_irq (uint gpio, uint32_t events)
+{
+    (void) gpio;
+    (void) events;
+} // power_row_irq
+
+// Arm (or disarm) the interrupt on every row, on this core
+static void park_row_irqs (bool on)
+{
+    uint32_t rows = MATRIX_ROW_GPIOS;
+    while (rows != 0)
+    {
+        gpio_set_irq_enabled_with_callback ((uint)__builtin_ctz (rows), PARK_EDGE, on, power_row_irq);
+        rows &= rows - 1;
+    }
+} // park_row_irqs
+
+// core-1: select every line, and arm the rows to wake it
+void hal_lines_park (void)
+{
+#if MATRIX_ACTIVE_LOW
+    gpio_clr_mask (MATRIX_LINE_MASK);
+#else
+    gpio_set_mask (MATRIX_LINE_MASK);
+#endif // MATRIX_ACTIVE_LOW
+    gpio_set_dir_out_masked (MATRIX_LINE_MASK);
+    park_row_irqs (true);
+} // hal_lines_park
+
+// core-1: back to scanning a line at a time, all the lines to idle then let go
+void hal_lines_unpark (void)
+{
+    park_row_irqs (false);
+#if MATRIX_ACTIVE_LOW
+    gpio_set_mask (MATRIX_LINE_MASK);
+#else
+    gpio_clr_mask (MATRIX_LINE_MASK);
+#endif // MATRIX_ACTIVE_LOW
+    gpio_set_dir_in_masked (MATRIX_LINE_MASK); // The pulls are still set
+} // hal_lines_unpark
+
+// core-1: sleep until a row changes, an event (core-0 changed the state) or the time is up
+void hal_rows_wait (uint32_t us)
+{
+    best_effort_wfe_or_timeout (make_timeout_time_us (us));
+} // hal_rows_wait
+#endif // !KB_HOST
+
+/* End of File */
@@ -0,0 +1,60 @@
+/*
+ * Header file for the suspend power states.
+ * When the host suspends the bus, core-0 drops the system clock to the USB
+ * PLL and core-1 parks the scanner (see hal_lines_park() in kb-hal.h)
+ * between full scans. Core-0 sleeps until its next deadline in every state,
+ * suspended or not, so suspend changes nothing else there. A key going down
+ * brings the scanner straight back, and core-0 back to full speed, to ask
+ * the host for a remote wake-up. When the host resumes, everything is back
+ * to full speed, and the time that took is kept.
+ *
+ *   ACTIVE    --suspend-->  SUSPENDED  --key down-->  WAKING
+ *   SUSPENDED --resume-->   ACTIVE
+ *   WAKING    --resume-->   ACTIVE
+ *   WAKING    --no resume within PWR_WAKE_MS-->  SUSPENDED
+ *
+ * The PWR_INFO layout is shared with the host tools, so it must only use
+ * standard C.
+ */
+
+#ifndef _KB_POWER_H_
+#define _KB_POWER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// The power states
+#define PWR_ACTIVE      0
+#define PWR_SUSPENDED   1
+#define PWR_WAKING      2  // A key woke the scanner, waiting for the host to resume
+
+// The CFG_CMD_POWER_INFO response, little endian, from CFG_OFS_DATA (see kb-config.h)
+#define PWR_INFO_STATE     0  // u8:  PWR_xxx
+#define PWR_INFO_REMOTE    1  // u8:  The host allows a remote wake-up
+#define PWR_INFO_SUSPENDS  2  // u32: Times the host has suspended
+#define PWR_INFO_KEY_WAKES 6  // u32: Times a key woke the scanner
+#define PWR_INFO_CLOCK_US  10 // u32: Longest switch back to the full clock (us)
+#define PWR_INFO_RESUME_US 14 // u32: Longest from a resume to the scanner running in full (us)
+#define PWR_INFO_SLEPT_MS  18 // u32: Time spent suspended (ms)
+#define PWR_INFO_SLOW_MHZ  22 // u8:  System clock whilst suspended
+#define PWR_INFO_FULL_MHZ  23 // u8:  ...and otherwise
+#define PWR_INFO_LEN       24
+
+// defined in kb-power.c (firmware and host build)
+extern void power_init (void);
+extern void power_suspend (int remote_wakeup_en);
+extern void power_resume (void);
+extern void power_task (void);
+extern int  power_state (void);
+extern void power_park (int keys_down);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_POWER_H_ */
+
+/* End of File */
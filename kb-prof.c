@@ -0,0 +1,192 @@
+/* Phase profiler for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * Each core runs its own SysTick from the CPU clock, free running over the
+ * full 24 bits, so a phase is timed to the cycle by two reads of it. The
+ * SysTick wraps every 134 ms at 125 MHz, so a phase that took longer than
+ * PROF_LONG_US by the 1 MHz timer is timed by that instead.
+ *
+ * As with the telemetry, each core only writes the figures for its own
+ * phases, so there are no locks. A reset from the host (CFG_CMD_PROF_CTRL)
+ * bumps an epoch on core-0, and each core clears its own figures when it
+ * next sees it has moved on. Core-0 reads the core-1 figures as they are, so
+ * a read may catch a phase half way through an update; they are for a person
+ * to look at, not for the firmware to act on.
+ *
+ * prof_init() times an empty PROF_START / PROF_END pair, and that is taken
+ * off every phase, so a phase shows what it costs without the profiler.
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-prof.h"
+#include "kb-telem.h"
+
+#if PROF_ON
+
+#define PROF_LONG_US    100000   // Longer than this, the SysTick may have wrapped
+#define SYSTICK_MASK    0x00FFFFFF
+#define SYSTICK_ON      0x5      // CLKSOURCE (the CPU clock) | ENABLE
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t hist [PROF_BUCKETS];
+} prof_stat;
+
+static prof_stat prof [PH_COUNT];     // The core-1 phases are written by core-1 only
+static volatile uint32_t prof_epoch;  // Written by core-0, bumped to reset
+static uint32_t prof_seen [2];        // The epoch each core's figures belong to, [core-0, core-1]
+static uint32_t prof_cost;            // Cycles an empty start / end pair takes
+static uint32_t prof_mhz;             // The CPU clock
+
+// Start this core's SysTick, free running
+static void prof_systick (void)
+{
+    systick_hw->csr = 0;
+    systick_hw->rvr = SYSTICK_MASK;
+    systick_hw->cvr = 0;
+    systick_hw->csr = SYSTICK_ON;
+} // prof_systick
+
+/* core-0: start the SysTick and time the profiler itself.
+ * Called by kb_init() before core-1 starts. */
+void prof_init (void)
+{
+    int idx;
+    prof_mhz = clock_get_hz (clk_sys) / 1000000;
+    prof_systick ();
+
+    prof_cost = 0;
+    for (idx = 0; idx < 16; ++idx)
+    {
+        PROF_START (t);
+        PROF_END (PH_LOOP, t);
+    }
+    prof_cost = prof [PH_LOOP].min;
+    memset (&prof [PH_LOOP], 0, sizeof (prof [PH_LOOP]));
+} // prof_init
+
+// core-1: start its own SysTick, called by scan_thread()
+void prof_init_core1 (void)
+{
+    prof_systick ();
+} // prof_init_core1
+
+// Add the time since "m" to a phase, on the core the phase belongs to
+void prof_end (int phase, prof_mark const *m)
+{
+    uint32_t cyc = systick_hw->cvr;
+    uint32_t us = timer_hw->timerawl - m->us;
+    int core = (phase < PH_CORE0) ? 1 : 0;
+
+    cyc = (m->cyc - cyc) & SYSTICK_MASK; // It counts down
+    if (us >= PROF_LONG_US)
+    {
+        uint64_t long_cyc = (uint64_t)us * prof_mhz;
+        cyc = (long_cyc > 0xFFFFFFFFu) ? 0xFFFFFFFFu : (uint32_t)long_cyc;
+    }
+    cyc = (cyc > prof_cost) ? (cyc - prof_cost) : 0;
+
+    if (prof_seen [core] != prof_epoch)
+    {
+        // The host asked for a reset, clear this core's phases
+        prof_seen [core] = prof_epoch;
+        if (core)
+        {
+            memset (&prof [0], 0, PH_CORE0 * sizeof (prof [0]));
+        }
+        else
+        {
+            memset (&prof [PH_CORE0], 0, (PH_COUNT - PH_CORE0) * sizeof (prof [0]));
+        }
+    }
+
+    prof_stat *ps = &prof [phase];
+    if ((ps->count == 0) || (cyc < ps->min))
+    {
+        ps->min = cyc;
+    }
+    if (cyc > ps->max)
+    {
+        ps->max = cyc;
+    }
+    ++ps->count;
+    ps->sum += cyc;
+
+    int bucket = 0;
+    uint32_t v = cyc >> PROF_HIST_SHIFT;
+    while ((v != 0) && (bucket < (PROF_BUCKETS - 1)))
+    {
+        v >>= 2;
+        ++bucket;
+    }
+    ++ps->hist [bucket];
+} // prof_end
+
+// Part of the figures for a phase (CFG_CMD_PROF_READ)
+int prof_read (int phase, int ofs, uint8_t *data, int len)
+{
+    uint8_t rec [PROF_REC_LEN];
+    int idx;
+
+    if ((phase < 0) || (phase >= PH_COUNT) || (ofs >= PROF_REC_LEN))
+    {
+        return CFG_ERR_ARG;
+    }
+    int count = PROF_REC_LEN - ofs;
+    if (count > PROF_READ_MAX)
+    {
+        count = PROF_READ_MAX;
+    }
+    if ((count + PROF_READ_HDR) > len)
+    {
+        return CFG_ERR_ARG;
+    }
+
+    memset (rec, 0, sizeof (rec));
+    if (prof_seen [(phase < PH_CORE0) ? 1 : 0] == prof_epoch) // Not waiting for a reset
+    {
+        prof_stat const *ps = &prof [phase];
+        perf_put32 (&rec [PROF_OFS_COUNT], ps->count);
+        perf_put32 (&rec [PROF_OFS_MIN], ps->min);
+        perf_put32 (&rec [PROF_OFS_MAX], ps->max);
+        uint64_t sum = ps->sum;
+        perf_put32 (&rec [PROF_OFS_SUM], (uint32_t)sum);
+        perf_put32 (&rec [PROF_OFS_SUM + 4], (uint32_t)(sum >> 32));
+        for (idx = 0; idx < PROF_BUCKETS; ++idx)
+        {
+            perf_put32 (&rec [PROF_OFS_HIST + (4 * idx)], ps->hist [idx]);
+        }
+    }
+
+    data [0] = (uint8_t)phase;
+    data [1] = PH_COUNT;
+    data [2] = (uint8_t)prof_mhz;
+    data [3] = (uint8_t)ofs;
+    data [4] = (uint8_t)count;
+    memcpy (&data [PROF_READ_HDR], &rec [ofs], count);
+    return CFG_OK;
+} // prof_read
+
+// Reset the figures (CFG_CMD_PROF_CTRL)
+int prof_ctrl (int op)
+{
+    if (op != PROF_CTRL_RESET)
+    {
+        return CFG_ERR_ARG;
+    }
+    ++prof_epoch;
+    return CFG_OK;
+} // prof_ctrl
+
+#endif // PROF_ON
+
+/* End of File */
@@ -0,0 +1,107 @@
+/*
+ * Header file for the phase profiler.
+ * The scan loop on core-1 and the main loop on core-0 are split into phases,
+ * and each phase is timed in CPU cycles with the core's own SysTick (the 1 MHz
+ * timer takes over for the odd phase too long for the 24-bit SysTick). For
+ * each phase the firmware keeps the count, min, max and sum, and a histogram,
+ * which the host reads with the config protocol (kb-cfg prof).
+ *
+ * This header is shared with the host tools, so the phases and the record
+ * layout must only use standard C.
+ */
+
+#ifndef _KB_PROF_H_
+#define _KB_PROF_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+/* The phases: id, name, and what is timed. The core-1 phases come first,
+ * then the core-0 ones from PH_MSG on. The phases nest, so "pass" and "loop"
+ * are the whole of each loop, and "process" holds the "push" time. */
+#define PROF_PHASES(X) \
+    X (PH_SETTLE,  "settle")  /* core-1: the settle wait after a line is driven low      */ \
+    X (PH_READ,    "read")    /* core-1: reading the rows of the line                     */ \
+    X (PH_RECOVER, "recover") /* core-1: the recover wait, and letting the line go        */ \
+    X (PH_COMPARE, "compare") /* core-1: memcmp of the scan, the telemetry and recorder   */ \
+    X (PH_PROCESS, "process") /* core-1: process_keys(), when a key changed               */ \
+    X (PH_PUSH,    "push")    /* core-1: each message pushed to the FIFO                  */ \
+    X (PH_TICK,    "tick")    /* core-1: the one-shot and combo timers, config sync       */ \
+    X (PH_PASS,    "pass")    /* core-1: a whole scan pass                                */ \
+    X (PH_MSG,     "msg")     /* core-0: a message from the FIFO into the key queue       */ \
+    X (PH_TUD,     "tud")     /* core-0: tud_task()                                       */ \
+    X (PH_HID,     "hid")     /* core-0: hid_task()                                       */ \
+    X (PH_OTHER,   "other")   /* core-0: the mouse, paste, trace, store... tasks          */ \
+    X (PH_LOOP,    "loop")    /* core-0: a whole kb_task() pass                           */
+
+#define PH_ENUM(id, name) id,
+enum
+{
+    PROF_PHASES (PH_ENUM)
+    PH_COUNT
+};
+#undef PH_ENUM
+
+#define PH_CORE0        PH_MSG // The first core-0 phase
+
+/* The histogram buckets go up by 4 times: under 64 cycles, under 256 and so
+ * on, the last one holds everything from 256K cycles (2 ms at 125 MHz) up. */
+#define PROF_BUCKETS    8
+#define PROF_HIST_SHIFT 6      // Bucket 0 is below 1 << PROF_HIST_SHIFT cycles
+
+// The record for a phase, little endian, as CFG_CMD_PROF_READ sends it
+#define PROF_OFS_COUNT  0      // u32: Times the phase ran
+#define PROF_OFS_MIN    4      // u32: Fewest cycles
+#define PROF_OFS_MAX    8      // u32: Most cycles
+#define PROF_OFS_SUM    12     // u64: Total cycles, for the mean
+#define PROF_OFS_HIST   20     // u32 x PROF_BUCKETS
+#define PROF_REC_LEN    (PROF_OFS_HIST + (4 * PROF_BUCKETS))
+
+// The CFG_CMD_PROF_READ response: [phase][phases][MHz][offset][count][record bytes...]
+#define PROF_READ_HDR   5
+#define PROF_READ_MAX   24     // Most record bytes in one response
+
+// Profiler controls (CFG_CMD_PROF_CTRL)
+#define PROF_CTRL_RESET 0      // Start the figures again, on both cores
+
+#if PROF_ON
+#include "hardware/structs/systick.h"
+#include "hardware/structs/timer.h"
+
+// When a phase started
+typedef struct
+{
+    uint32_t cyc; // SysTick, it counts down
+    uint32_t us;
+} prof_mark;
+
+static inline void prof_start (prof_mark *m)
+{
+    m->us = timer_hw->timerawl;
+    m->cyc = systick_hw->cvr;
+} // prof_start
+
+// defined in kb-prof.c (firmware only)
+extern void prof_init (void);
+extern void prof_init_core1 (void);
+extern void prof_end (int phase, prof_mark const *m);
+
+/* PROF_START declares the mark, so it must be at the start of a statement,
+ * and PROF_END must be in the same block. */
+#define PROF_START(m)   prof_mark m; prof_start (&(m))
+#define PROF_END(ph, m) prof_end ((ph), &(m))
+#else
+#define PROF_START(m)
+#define PROF_END(ph, m) ((void) 0)
+#endif // PROF_ON
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_PROF_H_ */
+
+/* End of File */
@@ -0,0 +1,328 @@
+/* Scan frame recorder for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * Core-1 hands every full scan to rec_scan(). When the raw matrix has
+ * changed, the change is packed (see kb-record.h) into the page being filled
+ * in a small RAM ring. The cost on core-1 is the same few us whatever keys
+ * are down, and nothing waits, so the scan cadence is not changed. When a
+ * page is full, core-0 writes it (rec_task(), every REC_TASK_MS) to the next
+ * slot of a ring of pages in the flash, just below the config store, using
+ * the same hand over as the store (core-1 scans from RAM meanwhile, see
+ * kb-store.c).
+ *
+ * If core-0 falls behind and the RAM ring fills up, events are dropped and
+ * counted, and the next page says how many were lost. The keys down at the
+ * start of each page are in its header, so the pages after a gap still
+ * decode correctly.
+ *
+ * A page's flash slot is its sequence number modulo the pages in the ring,
+ * so the host can ask for any page by number (CFG_CMD_REC_READ).
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-link.h"
+#include "kb-record.h"
+#include "kb-sched.h"
+#include "kb-store.h"
+#include "kb-telem.h"
+
+#if RECORD_ON
+
+#if !STORE_ON
+#error "The recorder writes the flash by way of the config store, set STORE_ON"
+#endif
+#if COL_SZ != REC_COLS
+#error "REC_COLS must match the matrix"
+#endif
+
+#define REC_SECTOR_PAGES (int)(FLASH_SECTOR_SIZE / REC_PAGE_SZ)
+#define REC_PAGES        (RECORD_SECTORS * REC_SECTOR_PAGES)
+#define REC_OFFSET       (PICO_FLASH_SIZE_BYTES - ((STORE_SECTORS + RECORD_SECTORS) * FLASH_SECTOR_SIZE))
+#define REC_TASK_MS      10 // How often core-0 looks for a full page, far less than it takes to fill one
+
+static uint8_t rec_ring [RECORD_RAM_PAGES][REC_PAGE_SZ] __attribute__((aligned (4)));
+
+// Written by core-1 only
+static struct
+{
+    volatile uint32_t head;      // Pages filled
+    volatile uint32_t lost_all;  // Events dropped since boot
+    uint32_t last;               // Time of the last change (ticks)
+    uint32_t lost;               // Events dropped since the last page was started
+    int      open;               // A page is being filled, rec_ring [head]
+    uint8_t  down [REC_COLS];    // Keys down after the last change
+} r1;
+
+// Written by core-0 only, except "flush" which core-1 clears
+static struct
+{
+    volatile uint32_t tail;      // Pages written to the flash
+    volatile int on;             // Recording
+    volatile int flush;          // Core-1 is to close the page it is filling
+    uint32_t next_seq;           // Sequence number for the next page written
+    int      ready;              // The page at the tail has its sequence number and CRC
+} r0;
+
+static int rec_task_id = -1; // rec_task() in the core-0 scheduler
+
+// Where a page is, as the CPU reads the flash
+static uint32_t rec_addr (uint32_t seq)
+{
+    return XIP_BASE + REC_OFFSET + ((seq % REC_PAGES) * REC_PAGE_SZ);
+} // rec_addr
+
+static rec_page_hdr const *rec_slot (uint32_t seq)
+{
+    return (rec_page_hdr const *)rec_addr (seq);
+} // rec_slot
+
+static int rec_blank (uint32_t seq)
+{
+    uint32_t const *p = (uint32_t const *)rec_addr (seq);
+    int idx;
+    for (idx = 0; idx < (int)(REC_PAGE_SZ / 4); ++idx)
+    {
+        if (p [idx] != 0xFFFFFFFF)
+        {
+            return 0;
+        }
+    }
+    return 1;
+} // rec_blank
+
+/* Find where the recording in the flash got to, so it carries on from there.
+ * Only the headers are read, to keep the boot quick; the host checks the CRCs.
+ * Called by core-0 before core-1 starts. */
+void rec_init (void)
+{
+    int found = 0;
+    uint32_t newest = 0;
+    int slot;
+
+    for (slot = 0; slot < REC_PAGES; ++slot)
+    {
+        rec_page_hdr const *hdr = rec_slot (slot);
+        if ((hdr->magic == REC_MAGIC) && (hdr->version == REC_VERSION) &&
+            ((hdr->seq % REC_PAGES) == (uint32_t)slot) && ((!found) || ((int32_t)(hdr->seq - newest) > 0)))
+        {
+            newest = hdr->seq;
+            found = 1;
+        }
+    }
+
+    r0.next_seq = found ? (newest + 1) : 0;
+    if (((r0.next_seq % REC_SECTOR_PAGES) != 0) && !rec_blank (r0.next_seq))
+    {
+        r0.next_seq += REC_SECTOR_PAGES - (r0.next_seq % REC_SECTOR_PAGES); // Start a fresh sector
+    }
+    r0.on = 1;
+    rec_task_id = sched_add ("record", rec_task, REC_TASK_MS * 1000u);
+} // rec_init
+
+// Start a new page in the RAM ring (core-1), returns 0 if the ring is full
+static int rec_open (void)
+{
+    if ((r1.head - r0.tail) >= RECORD_RAM_PAGES)
+    {
+        return 0;
+    }
+
+    uint8_t *page = rec_ring [r1.head & (RECORD_RAM_PAGES - 1)];
+    rec_page_hdr *hdr = (rec_page_hdr *)page;
+    memset (page, 0xFF, REC_PAGE_SZ); // As the erased flash
+    hdr->magic   = REC_MAGIC;
+    hdr->version = REC_VERSION;
+    hdr->used    = 0;
+    hdr->lost    = (r1.lost > 255) ? 255 : (uint8_t)r1.lost;
+    hdr->seq     = 0; // Core-0 fills in the sequence number and CRC
+    hdr->t0      = r1.last;
+    memcpy (hdr->down, r1.down, REC_COLS);
+    hdr->crc     = 0;
+    hdr->spare   = 0;
+    r1.lost = 0;
+    r1.open = 1;
+    return 1;
+} // rec_open
+
+// Hand the page being filled to core-0
+static void rec_close (void)
+{
+    __sync_synchronize (); // The page is all written before core-0 sees it
+    ++r1.head;
+    r1.open = 0;
+} // rec_close
+
+/* Called by core-1 after every full scan, with the raw scan (a bit clear for
+ * each key down) and whether it differs from the last one. */
+void rec_scan (uint8_t const *scan, uint32_t now_us, int changed)
+{
+    if (r0.flush)
+    {
+        if (r1.open)
+        {
+            rec_close ();
+        }
+        r0.flush = 0;
+    }
+    if (!changed)
+    {
+        return;
+    }
+
+    uint8_t now [REC_COLS];
+    int col;
+    for (col = 0; col < REC_COLS; ++col)
+    {
+        now [col] = (uint8_t)(~scan [col] & ROW_MASK);
+    }
+    uint32_t tick = now_us / REC_TICK_US;
+
+    if (r0.on)
+    {
+        uint8_t ev [REC_EVENT_MAX];
+        int n = rec_encode (ev, tick - r1.last, r1.down, now);
+        if (n > 0)
+        {
+            uint8_t *page = rec_ring [r1.head & (RECORD_RAM_PAGES - 1)];
+            rec_page_hdr *hdr = (rec_page_hdr *)page;
+            if (r1.open && ((hdr->used + n) > REC_DATA_SZ))
+            {
+                rec_close ();
+                page = rec_ring [r1.head & (RECORD_RAM_PAGES - 1)];
+                hdr = (rec_page_hdr *)page;
+            }
+            if (r1.open || rec_open ())
+            {
+                memcpy (&page [REC_HDR_SZ + hdr->used], ev, n);
+                hdr->used += n;
+            }
+            else
+            {
+                ++r1.lost;
+                ++r1.lost_all;
+            }
+        }
+    }
+
+    // Kept even when not recording, so the first page after a start has the right keys down
+    memcpy (r1.down, now, REC_COLS);
+    r1.last = tick;
+} // rec_scan
+
+/* Run by the core-0 scheduler every REC_TASK_MS, writes the filled pages to
+ * the flash, one at a time, sooner whilst waiting for core-1 to let go. */
+void rec_task (void)
+{
+    if (r0.tail == r1.head)
+    {
+        return;
+    }
+
+    uint8_t *page = rec_ring [r0.tail & (RECORD_RAM_PAGES - 1)];
+    if (!r0.ready)
+    {
+        rec_page_hdr *hdr = (rec_page_hdr *)page;
+        hdr->seq = r0.next_seq;
+        hdr->crc = 0;
+        hdr->crc = link_crc8 (page, REC_PAGE_SZ);
+        r0.ready = 1;
+    }
+    if (!store_flash_claim ())
+    {
+        sched_at (rec_task_id, time_us_32 () + STORE_CLAIM_US); // Core-1 has not finished its pass yet
+        return;
+    }
+
+    uint32_t slot = r0.next_seq % REC_PAGES;
+    if ((slot % REC_SECTOR_PAGES) == 0)
+    {
+        store_flash_write (REC_OFFSET + (slot * REC_PAGE_SZ), NULL, 0);
+    }
+    store_flash_write (REC_OFFSET + (slot * REC_PAGE_SZ), page, REC_PAGE_SZ);
+    store_flash_release ();
+
+    ++r0.next_seq;
+    r0.ready = 0;
+    __sync_synchronize (); // Finished with the page before core-1 can reuse it
+    ++r0.tail;
+} // rec_task
+
+// The recorder state for the config protocol (CFG_CMD_REC_INFO)
+int rec_info (uint8_t *data, int len)
+{
+    if (len < REC_INFO_LEN)
+    {
+        return CFG_ERR_ARG;
+    }
+    data [REC_INFO_ON]      = (uint8_t)r0.on;
+    data [REC_INFO_VERSION] = REC_VERSION;
+    perf_put16 (&data [REC_INFO_PAGES], REC_PAGES);
+    perf_put32 (&data [REC_INFO_NEXT],  r0.next_seq);
+    perf_put32 (&data [REC_INFO_LOST],  r1.lost_all);
+    data [REC_INFO_WAIT]    = (uint8_t)(r1.head - r0.tail);
+    return CFG_OK;
+} // rec_info
+
+// Part of a page from the flash (CFG_CMD_REC_READ)
+int rec_read (uint32_t seq, int ofs, uint8_t *data, int len)
+{
+    rec_page_hdr const *hdr = rec_slot (seq);
+    if (((int32_t)(r0.next_seq - seq) <= 0) || (hdr->magic != REC_MAGIC) || (hdr->seq != seq))
+    {
+        return CFG_ERR_ARG; // Not written yet, or written over
+    }
+
+    int count = REC_PAGE_SZ - ofs;
+    if (count > REC_READ_MAX)
+    {
+        count = REC_READ_MAX;
+    }
+    if ((count <= 0) || ((count + 2) > len))
+    {
+        return CFG_ERR_ARG;
+    }
+    data [0] = (uint8_t)ofs;
+    data [1] = (uint8_t)count;
+    memcpy (&data [2], (uint8_t const *)hdr + ofs, count);
+    return CFG_OK;
+} // rec_read
+
+/* Bytes of the flash ring, straight from the flash, in slot order (SCANS.BIN
+ * on the USB drive, see kb-msc.c). The pages are put in order by the host. */
+void rec_peek (uint32_t ofs, uint8_t *buf, uint32_t len)
+{
+    memcpy (buf, (uint8_t const *)(XIP_BASE + REC_OFFSET + ofs), len);
+} // rec_peek
+
+// Start, stop or flush the recorder (CFG_CMD_REC_CTRL)
+int rec_ctrl (int op)
+{
+    switch (op)
+    {
+        case REC_CTRL_STOP:
+        r0.on = 0;
+        r0.flush = 1;
+        break;
+
+        case REC_CTRL_START:
+        r0.on = 1;
+        break;
+
+        case REC_CTRL_FLUSH:
+        r0.flush = 1;
+        break;
+
+        default:
+        return CFG_ERR_ARG;
+    }
+    return CFG_OK;
+} // rec_ctrl
+
+#endif // RECORD_ON
+
+/* End of File */
@@ -0,0 +1,171 @@
+/*
+ * Header file for the scan frame recorder.
+ * Every change in the raw matrix scan is recorded with its time, so faults
+ * that will not show up on the bench (phantom keys, chatter, missed releases)
+ * can be looked at later. The changes are packed into 256 byte pages, held
+ * in a RAM ring, then written out to a ring of pages in the flash. The host
+ * reads the pages back with the config protocol (kb-cfg download) and
+ * kb-rec-dump in tools/ decodes and replays them.
+ *
+ * A page stands on its own: its header has the time and the keys down when
+ * it was started, so the pages can be decoded even when older ones have been
+ * overwritten. After the header come the events, each one:
+ *   dt     time since the last event (or the page start), in REC_TICK_US
+ *          units, as a LEB128 varint (7 bits a byte, low bits first, bit 7
+ *          set on all but the last byte)
+ *   keys   one byte for each key that went down or up, the key index
+ *          (row * 10 + column) in bits 0-6, bit 7 set on the last one
+ * So a single key going down or up is 2 or 3 bytes.
+ *
+ * This header is shared with the host tools, so it must only use standard C.
+ */
+
+#ifndef _KB_RECORD_H_
+#define _KB_RECORD_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define REC_MAGIC     0xA7
+#define REC_VERSION   1
+#define REC_PAGE_SZ   256  // One flash page
+#define REC_TICK_US   64   // Time unit for the event times
+#define REC_COLS      10   // Columns in the matrix, one byte of rows each
+#define REC_LAST      0x80 // Set on the last key byte of an event
+#define REC_EVENT_MAX (5 + (REC_COLS * 8)) // Longest possible event
+
+// The page header, all little endian
+typedef struct __attribute__((packed))
+{
+    uint8_t  magic;            // REC_MAGIC
+    uint8_t  version;          // REC_VERSION
+    uint8_t  used;             // Bytes of events after the header
+    uint8_t  lost;             // Events dropped just before this page (the RAM ring was full), 255 = 255 or more
+    uint32_t seq;              // Page number, the flash slot is (seq % pages in the flash ring)
+    uint32_t t0;               // Time of the page start, in REC_TICK_US units
+    uint8_t  down [REC_COLS];  // Keys down at the page start, a bit for each row (bit set = key down)
+    uint8_t  crc;              // link_crc8 (kb-link.h) of the whole page, with this byte as 0
+    uint8_t  spare;
+} rec_page_hdr;
+
+#define REC_HDR_SZ   ((int)sizeof (rec_page_hdr))
+#define REC_DATA_SZ  (REC_PAGE_SZ - REC_HDR_SZ)
+
+/* Encode the change from "was" to "now" (keys down, a byte per column) as an
+ * event, "dt" ticks after the last one. "out" must hold REC_EVENT_MAX bytes.
+ * Returns the bytes written, or 0 if nothing changed. */
+static inline int rec_encode (uint8_t *out, uint32_t dt, uint8_t const *was, uint8_t const *now)
+{
+    int n = 0;
+    int last = -1;
+    int col;
+
+    do
+    {
+        out [n++] = (uint8_t)((dt & 0x7F) | ((dt > 0x7F) ? 0x80 : 0));
+        dt >>= 7;
+    } while (dt != 0);
+
+    for (col = 0; col < REC_COLS; ++col)
+    {
+        uint8_t diff = was [col] ^ now [col];
+        int row;
+        for (row = 0; diff != 0; ++row, diff >>= 1)
+        {
+            if (diff & 1)
+            {
+                last = n;
+                out [n++] = (uint8_t)((row * REC_COLS) + col);
+            }
+        }
+    }
+    if (last < 0)
+    {
+        return 0;
+    }
+    out [last] |= REC_LAST;
+    return n;
+} // rec_encode
+
+/* Decode the event at "in" (at most "len" bytes), toggling the keys it
+ * changes in "down" and returning its dt in ticks. Returns the bytes used,
+ * 0 at the end of the data, or -1 if the event is cut short or bad. */
+static inline int rec_decode (uint8_t const *in, int len, uint32_t *dt, uint8_t *down)
+{
+    int n = 0;
+    int shift = 0;
+    uint32_t val = 0;
+
+    if (len <= 0)
+    {
+        return 0;
+    }
+    for (;;)
+    {
+        if ((n >= len) || (shift > 28))
+        {
+            return -1;
+        }
+        uint8_t b = in [n++];
+        val |= (uint32_t)(b & 0x7F) << shift;
+        shift += 7;
+        if ((b & 0x80) == 0)
+        {
+            break;
+        }
+    }
+    *dt = val;
+
+    for (;;)
+    {
+        if (n >= len)
+        {
+            return -1;
+        }
+        uint8_t b = in [n++];
+        int key = b & 0x7F;
+        if (key >= (REC_COLS * 8))
+        {
+            return -1;
+        }
+        down [key % REC_COLS] ^= (uint8_t)(1u << (key / REC_COLS));
+        if (b & REC_LAST)
+        {
+            break;
+        }
+    }
+    return n;
+} // rec_decode
+
+// The CFG_CMD_REC_INFO response, little endian, from CFG_OFS_DATA (see kb-config.h)
+#define REC_INFO_ON      0  // u8:  Recording
+#define REC_INFO_VERSION 1  // u8:  REC_VERSION
+#define REC_INFO_PAGES   2  // u16: Pages in the flash ring
+#define REC_INFO_NEXT    4  // u32: Sequence number the next page will have, the ones before it may be read
+#define REC_INFO_LOST    8  // u32: Events dropped since boot
+#define REC_INFO_WAIT    12 // u8:  Pages in RAM waiting to go to the flash
+#define REC_INFO_LEN     13
+
+#define REC_READ_MAX     26 // Most page bytes in one CFG_CMD_REC_READ response
+
+// Recorder controls (CFG_CMD_REC_CTRL)
+#define REC_CTRL_STOP    0
+#define REC_CTRL_START   1
+#define REC_CTRL_FLUSH   2  // Close the page being filled, so it goes to the flash
+
+// defined in kb-record.c (firmware only)
+extern void rec_init (void);
+extern void rec_scan (uint8_t const *scan, uint32_t now_us, int changed);
+extern void rec_task (void);
+extern void rec_peek (uint32_t ofs, uint8_t *buf, uint32_t len);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_RECORD_H_ */
+
+/* End of File */
@@ -0,0 +1,267 @@
+/* Core-0 task scheduler for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * A small table of tasks, each with a deadline. sched_run() is called on
+ * every pass of kb_task() and runs the tasks that are due, the one that is
+ * most overdue first, each at most once a pass. A periodic task's next
+ * deadline is its last one plus the period, so it does not drift, but one
+ * that has fallen a whole period behind starts again from now rather than
+ * running over and over to catch up. A one-shot task is run once, and can
+ * arm itself again from inside its own call.
+ *
+ * When kb_task() has nothing waiting, main() calls sched_sleep(), and core-0
+ * waits (WFE) until the next deadline, by the SDK's alarm pool, or until
+ * anything else happens first: the USB interrupt, or core-1 pushing to the
+ * FIFO (the SDK push does a SEV) or seeing a key whilst suspended. Nothing
+ * else is polled, so there is no cap on the sleep: the work tud_task() and
+ * the CDC paste wait for comes in with the USB interrupt, and the rest
+ * (the mouse keys, the store, the USB drive...) are tasks here, armed when
+ * there is something for them to do.
+ *
+ * All of this runs on core-0 only, so there are no locks.
+ */
+
+#include <string.h>
+#include "kb-hal.h"
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-sched.h"
+#include "kb-telem.h"
+
+typedef struct
+{
+    sched_fn fn;
+    uint32_t period_us;  // 0 for a one-shot
+    uint32_t due_us;
+    int      armed;
+    char     name [SCHED_NAME_LEN];
+    uint32_t runs;
+    uint32_t run_max;    // us
+    uint32_t run_total;  // us
+    uint32_t late_max;   // us
+} sched_task;
+
+static sched_task tasks [SCHED_TASKS];
+static int n_tasks = 0;
+
+// The scheduler's own figures
+static struct
+{
+    uint32_t passes;
+    uint32_t ovh_max;    // us
+    uint32_t ovh_total;  // us
+    uint32_t late_max;   // us, the most any task started late
+    uint32_t sleeps;
+    uint32_t sleep_max;  // us
+    uint32_t slept_us;   // us
+    uint32_t wake_late;  // us, the most a sleep ended after its deadline
+} sc;
+
+/* Add a task, run every period_us from now, or if period_us is 0 a one-shot,
+ * which waits for sched_at(). Returns the task number, or -1 if there is no
+ * room (SCHED_TASKS). */
+int sched_add (char const *name, sched_fn fn, uint32_t period_us)
+{
+    if (n_tasks >= SCHED_TASKS)
+    {
+        return -1;
+    }
+    sched_task *t = &tasks [n_tasks];
+    memset (t, 0, sizeof (*t));
+    strncpy (t->name, name, SCHED_NAME_LEN); // Not terminated if it fills the field
+    t->fn = fn;
+    t->period_us = period_us;
+    if (period_us != 0)
+    {
+        t->due_us = hal_time_us () + period_us;
+        t->armed = 1;
+    }
+    return n_tasks++;
+} // sched_add
+
+// Run a task (once) at the given time, or again if it is periodic
+void sched_at (int task, uint32_t due_us)
+{
+    if ((task >= 0) && (task < n_tasks))
+    {
+        tasks [task].due_us = due_us;
+        tasks [task].armed = 1;
+    }
+} // sched_at
+
+void sched_cancel (int task)
+{
+    if ((task >= 0) && (task < n_tasks))
+    {
+        tasks [task].armed = 0;
+    }
+} // sched_cancel
+
+// Called by kb_task() - run the tasks that are due
+void sched_run (void)
+{
+    uint32_t t0 = hal_time_us ();
+    uint32_t in_tasks = 0;
+    uint32_t ran = 0; // A bit for each task run on this pass
+
+    for (;;)
+    {
+        uint32_t now = hal_time_us ();
+        int32_t late = -1;
+        int best = -1;
+        int idx;
+        for (idx = 0; idx < n_tasks; ++idx)
+        {
+            int32_t by = (int32_t)(now - tasks [idx].due_us);
+            if ((tasks [idx].armed) && (!(ran & (1u << idx))) && (by > late))
+            {
+                late = by;
+                best = idx;
+            }
+        }
+        if (best < 0)
+        {
+            break; // Nothing more is due
+        }
+
+        sched_task *t = &tasks [best];
+        ran |= 1u << best;
+        if ((uint32_t)late > t->late_max)
+        {
+            t->late_max = (uint32_t)late;
+        }
+        if ((uint32_t)late > sc.late_max)
+        {
+            sc.late_max = (uint32_t)late;
+        }
+        // The next deadline is set before the call, so a task can change it
+        if (t->period_us != 0)
+        {
+            t->due_us += t->period_us;
+            if ((int32_t)(now - t->due_us) >= 0)
+            {
+                t->due_us = now + t->period_us; // A whole period behind, start again from now
+            }
+        }
+        else
+        {
+            t->armed = 0;
+        }
+
+        uint32_t ts = hal_time_us ();
+        t->fn ();
+        uint32_t took = hal_time_us () - ts;
+        ++t->runs;
+        t->run_total += took;
+        if (took > t->run_max)
+        {
+            t->run_max = took;
+        }
+        in_tasks += took;
+    }
+
+    uint32_t ovh = (hal_time_us () - t0) - in_tasks;
+    ++sc.passes;
+    sc.ovh_total += ovh;
+    if (ovh > sc.ovh_max)
+    {
+        sc.ovh_max = ovh;
+    }
+} // sched_run
+
+// How long until the next deadline (us), SCHED_NEVER if no task is armed
+uint32_t sched_wait_us (void)
+{
+    uint32_t now = hal_time_us ();
+    uint32_t wait = SCHED_NEVER;
+    int idx;
+    for (idx = 0; idx < n_tasks; ++idx)
+    {
+        if (tasks [idx].armed)
+        {
+            int32_t until = (int32_t)(tasks [idx].due_us - now);
+            if (until <= 0)
+            {
+                return 0;
+            }
+            if ((uint32_t)until < wait)
+            {
+                wait = (uint32_t)until;
+            }
+        }
+    }
+    return wait;
+} // sched_wait_us
+
+#if !KB_HOST
+// Called by main() when core-0 has nothing waiting - sleep until the next deadline or event
+void sched_sleep (void)
+{
+    uint32_t wait = sched_wait_us ();
+    if (wait == 0)
+    {
+        return;
+    }
+    uint32_t t0 = hal_time_us ();
+    if (wait == SCHED_NEVER)
+    {
+        __wfe (); // Only an event or interrupt can give core-0 anything to do
+    }
+    else
+    {
+        best_effort_wfe_or_timeout (make_timeout_time_us (wait));
+    }
+    uint32_t took = hal_time_us () - t0;
+    ++sc.sleeps;
+    sc.slept_us += took;
+    if (took > sc.sleep_max)
+    {
+        sc.sleep_max = took;
+    }
+    if ((wait != SCHED_NEVER) && (took > wait) && ((took - wait) > sc.wake_late))
+    {
+        sc.wake_late = took - wait;
+    }
+} // sched_sleep
+#endif // !KB_HOST
+
+// The figures for a task, or the scheduler itself (CFG_CMD_SCHED_INFO)
+int sched_info (int task, uint8_t *data, int len)
+{
+    if ((len < SCHED_INFO_LEN) || ((task >= n_tasks) && (task != SCHED_SELF) && (task != SCHED_SLEEP)))
+    {
+        return CFG_ERR_ARG;
+    }
+    memset (data, 0, SCHED_INFO_LEN);
+    data [SCHED_INFO_TASK]  = (uint8_t)task;
+    data [SCHED_INFO_TASKS] = (uint8_t)n_tasks;
+    if (task == SCHED_SELF)
+    {
+        memcpy (&data [SCHED_INFO_NAME], "sched", 5);
+        perf_put32 (&data [SCHED_INFO_RUNS],  sc.passes);
+        perf_put32 (&data [SCHED_INFO_MAX],   sc.ovh_max);
+        perf_put32 (&data [SCHED_INFO_TOTAL], sc.ovh_total);
+        perf_put32 (&data [SCHED_INFO_LATE],  sc.late_max);
+    }
+    else if (task == SCHED_SLEEP)
+    {
+        memcpy (&data [SCHED_INFO_NAME], "sleep", 5);
+        perf_put32 (&data [SCHED_INFO_RUNS],  sc.sleeps);
+        perf_put32 (&data [SCHED_INFO_MAX],   sc.sleep_max);
+        perf_put32 (&data [SCHED_INFO_TOTAL], sc.slept_us);
+        perf_put32 (&data [SCHED_INFO_LATE],  sc.wake_late);
+    }
+    else
+    {
+        sched_task const *t = &tasks [task];
+        memcpy (&data [SCHED_INFO_NAME], t->name, SCHED_NAME_LEN);
+        perf_put32 (&data [SCHED_INFO_RUNS],  t->runs);
+        perf_put32 (&data [SCHED_INFO_MAX],   t->run_max);
+        perf_put32 (&data [SCHED_INFO_TOTAL], t->run_total);
+        perf_put32 (&data [SCHED_INFO_LATE],  t->late_max);
+    }
+    return CFG_OK;
+} // sched_info
+
+/* End of File */
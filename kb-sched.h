@@ -0,0 +1,66 @@
+/*
+ * Header file for the core-0 task scheduler.
+ * Tasks that used to poll board_millis() on every pass of the main loop are
+ * run by deadline instead: each task is added once, either with a period or
+ * as a one-shot that is armed (and re-armed) for a given time. kb_task()
+ * runs whatever is due, earliest deadline first, and in between core-0
+ * sleeps until the next deadline, an interrupt (USB) or an event (a message
+ * from core-1), see sched_sleep(). A task that waits on something else is
+ * armed by whatever starts it off, e.g. store_save() for the store task.
+ *
+ * The scheduler times itself and each task, and the host reads the figures
+ * with the config protocol (kb-cfg sched).
+ *
+ * The layout of the figures is shared with the host tools, so that part must
+ * only use standard C.
+ */
+
+#ifndef _KB_SCHED_H_
+#define _KB_SCHED_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define SCHED_TASKS      12   // Most tasks that can be added
+#define SCHED_NAME_LEN   8    // Characters of a task name that are kept
+#define SCHED_NEVER      0xFFFFFFFF // sched_wait_us() when no task is armed
+
+// The CFG_CMD_SCHED_INFO response, little endian, from CFG_OFS_DATA (see kb-config.h)
+#define SCHED_INFO_TASK  0  // u8:  Task asked for, or SCHED_SELF or SCHED_SLEEP
+#define SCHED_INFO_TASKS 1  // u8:  Tasks added
+#define SCHED_INFO_NAME  2  // SCHED_NAME_LEN chars, 0 padded
+#define SCHED_INFO_RUNS  10 // u32: Times the task ran
+#define SCHED_INFO_MAX   14 // u32: Longest run (us)
+#define SCHED_INFO_TOTAL 18 // u32: Total run time (us)
+#define SCHED_INFO_LATE  22 // u32: Most it started after its deadline (us)
+#define SCHED_INFO_LEN   26
+
+/* The scheduler itself, asked for as task SCHED_SELF: runs are the passes of
+ * sched_run(), the run times are its own overhead, without the tasks, and
+ * "late" is the most any task has started after its deadline.
+ * Core-0's sleeps, asked for as task SCHED_SLEEP: runs are the sleeps, the
+ * run times how long each lasted, and "late" the most one ended after the
+ * deadline it was for, i.e. the cost of waking up. */
+#define SCHED_SELF       0xFF
+#define SCHED_SLEEP      0xFE
+
+typedef void (*sched_fn) (void);
+
+// defined in kb-sched.c (firmware and host build)
+extern int  sched_add (char const *name, sched_fn fn, uint32_t period_us);
+extern void sched_at (int task, uint32_t due_us);
+extern void sched_cancel (int task);
+extern void sched_run (void);
+extern uint32_t sched_wait_us (void);
+extern void sched_sleep (void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_SCHED_H_ */
+
+/* End of File */
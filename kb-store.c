@@ -0,0 +1,298 @@
+/* Flash config store for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * The last STORE_SECTORS sectors of the flash hold a log of config records,
+ * two pages each. A save goes in the next slot after the newest record, so a
+ * sector is only erased when the log wraps round to it, once every
+ * STORE_SLOTS saves, and the wear is spread evenly over all the sectors.
+ * At boot, the good record with the highest sequence number is loaded. A
+ * record cut short by a power cut fails its CRC and is passed over, so the
+ * one before it is used instead.
+ *
+ * The flash cannot be read whilst it is erased or programmed, and core-1
+ * normally runs from it. Rather than stop core-1 for the whole write (a sector
+ * erase takes tens of ms), core-0 asks it to let go of the flash with
+ * store_hold, and core-1 moves into a small scan loop in RAM (scan_hold() in
+ * fw-kb-main.c) that keeps reading the matrix and keeps every change. Core-0
+ * builds the record before it asks, so the hand over only lasts for the erase
+ * and program themselves, with core-0's interrupts off as the SDK needs.
+ *
+ * The config protocol asks for a save (CFG_CMD_SAVE), and store_task() does
+ * it later as a core-0 task, so the USB control transfer is never held up.
+ */
+
+#include <string.h>
+#include "kb-hal.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-sched.h"
+#include "kb-store.h"
+#include "kb-telem.h"
+
+#if STORE_ON
+
+#if STORE_SECTORS < 2
+#error "The store needs at least 2 sectors, so the newest record survives an erase"
+#endif
+
+#define STORE_REC_SZ      (2 * FLASH_PAGE_SIZE)
+#define STORE_SLOTS       (int)((STORE_SECTORS * FLASH_SECTOR_SIZE) / STORE_REC_SZ)
+#define STORE_SECTOR_SLOTS (int)(FLASH_SECTOR_SIZE / STORE_REC_SZ)
+#define STORE_OFFSET      (PICO_FLASH_SIZE_BYTES - (STORE_SECTORS * FLASH_SECTOR_SIZE))
+
+_Static_assert (sizeof (store_rec) <= STORE_REC_SZ, "A store record must fit in STORE_REC_SZ");
+
+volatile int store_hold = STORE_IDLE;
+
+static struct
+{
+    int      want;          // A save has been asked for
+    int      built;         // ...and the record for it is in st_buf
+    int      slot;          // Slot of the newest record, -1 if there is none
+    uint32_t seq;           // Its sequence number
+    uint32_t saves;         // Saves since boot
+    uint32_t write_max_us;  // Longest erase and program, core-1 held in RAM
+    uint32_t gap_max_us;    // Longest gap between scans during a write (from core-1)
+    uint32_t boot_scan_us;  // Time from reset to the first full scan (from core-1)
+    uint32_t boot_mount_us; // Time from reset to the host mounting the keyboard
+} st;
+
+static uint8_t st_buf [STORE_REC_SZ] __attribute__((aligned (4))); // The record being saved
+static int st_task = -1; // store_task(), armed by store_save()
+
+// CRC-32 (IEEE), bit at a time, as it is only used at boot and on a save
+static uint32_t store_crc (uint8_t const *p, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    while (len-- > 0)
+    {
+        crc ^= *p++;
+        int bit;
+        for (bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        }
+    }
+    return ~crc;
+} // store_crc
+
+// Where a slot is, as the CPU reads the flash
+static store_rec const *store_slot (int slot)
+{
+    return (store_rec const *)(XIP_BASE + STORE_OFFSET + (slot * STORE_REC_SZ));
+} // store_slot
+
+// Is the record whole, and from this build? (Also used for CONFIG.BIN, see kb-msc.c)
+int store_good (store_rec const *rec)
+{
+    return (rec->magic == STORE_MAGIC) && (rec->len == sizeof (kb_config)) &&
+           (rec->crc == store_crc ((uint8_t const *)&rec->cfg, sizeof (kb_config)));
+} // store_good
+
+static int store_blank (int slot)
+{
+    uint32_t const *p = (uint32_t const *)store_slot (slot);
+    int idx;
+    for (idx = 0; idx < (int)(STORE_REC_SZ / 4); ++idx)
+    {
+        if (p [idx] != 0xFFFFFFFF)
+        {
+            return 0;
+        }
+    }
+    return 1;
+} // store_blank
+
+/* Find the newest record and load it over the built-in config.
+ * Called by core-0 after cfg_init(), before core-1 starts. */
+void store_init (void)
+{
+    int slot;
+
+    st_task = sched_add ("store", store_task, 0);
+    st.slot = -1;
+    for (slot = 0; slot < STORE_SLOTS; ++slot)
+    {
+        store_rec const *rec = store_slot (slot);
+        if (store_good (rec) && ((st.slot < 0) || ((int32_t)(rec->seq - st.seq) > 0)))
+        {
+            st.slot = slot;
+            st.seq  = rec->seq;
+        }
+    }
+
+    if (st.slot >= 0)
+    {
+        cfg_restore (&store_slot (st.slot)->cfg);
+    }
+} // store_init
+
+// Ask for the live config to be saved (from the config protocol)
+int store_save (void)
+{
+    if (st.want)
+    {
+        return CFG_ERR_BUSY;
+    }
+    st.want = 1;
+    sched_at (st_task, hal_time_us ());
+    return CFG_OK;
+} // store_save
+
+// Where the next record goes, the slot after the newest, or a fresh sector if that is not blank
+static int store_next_slot (void)
+{
+    int slot = (st.slot + 1) % STORE_SLOTS;
+    if (((slot % STORE_SECTOR_SLOTS) != 0) && !store_blank (slot))
+    {
+        slot = ((slot / STORE_SECTOR_SLOTS) + 1) * STORE_SECTOR_SLOTS; // e.g. a write was cut short
+        slot %= STORE_SLOTS;
+    }
+    return slot;
+} // store_next_slot
+
+/* Ask core-1 to let go of the flash (core-0 only). Returns 1 once it is
+ * scanning from RAM, then the flash may be written with store_flash_write(),
+ * and must be given back with store_flash_release() before returning to the
+ * main loop. The recorder (kb-record.c) shares this with the config store. */
+int store_flash_claim (void)
+{
+    if (store_hold == STORE_IDLE)
+    {
+        store_hold = STORE_HOLD_REQ; // Core-1 moves to RAM at the end of its pass
+    }
+    return (store_hold == STORE_HOLDING);
+} // store_flash_claim
+
+void store_flash_release (void)
+{
+    store_hold = STORE_IDLE; // Core-1 can go back to the flash
+} // store_flash_release
+
+/* Erase the sector at "ofs" (data NULL), or program "len" bytes there.
+ * Core-0's interrupts are off meanwhile, as the handlers are in flash too. */
+void store_flash_write (uint32_t ofs, uint8_t const *data, uint32_t len)
+{
+    uint32_t ints = save_and_disable_interrupts ();
+    if (data == NULL)
+    {
+        flash_range_erase (ofs, FLASH_SECTOR_SIZE);
+    }
+    else
+    {
+        flash_range_program (ofs, data, len);
+    }
+    restore_interrupts (ints);
+} // store_flash_write
+
+// Make a record of the live config
+void store_fill (store_rec *rec, uint32_t seq)
+{
+    rec->magic = STORE_MAGIC;
+    rec->seq   = seq;
+    rec->len   = sizeof (kb_config);
+    rec->spare = 0;
+    rec->cfg   = *cfg_live ();
+    rec->crc   = store_crc ((uint8_t const *)&rec->cfg, sizeof (kb_config));
+} // store_fill
+
+// Sequence number of the newest record, 0 if there is none
+uint32_t store_seq (void)
+{
+    return (st.slot >= 0) ? st.seq : 0;
+} // store_seq
+
+/* Run by the core-0 scheduler once a save is asked for. A save takes a few
+ * runs: build the record and ask core-1 for the flash, then look again every
+ * STORE_CLAIM_US until core-1 has moved to RAM, then write the flash and
+ * give it back. */
+void store_task (void)
+{
+    if (!st.want)
+    {
+        return;
+    }
+
+    if (!st.built)
+    {
+        memset (st_buf, 0xFF, sizeof (st_buf));
+        store_fill ((store_rec *)st_buf, st.seq + 1);
+        st.built = 1;
+    }
+    if (!store_flash_claim ())
+    {
+        sched_at (st_task, hal_time_us () + STORE_CLAIM_US); // Core-1 has not finished its pass yet
+        return;
+    }
+
+    int slot = store_next_slot ();
+    uint32_t ofs = STORE_OFFSET + (slot * STORE_REC_SZ);
+    uint32_t t0 = hal_time_us ();
+
+    if ((slot % STORE_SECTOR_SLOTS) == 0)
+    {
+        store_flash_write (STORE_OFFSET + ((slot / STORE_SECTOR_SLOTS) * FLASH_SECTOR_SIZE), NULL, 0);
+    }
+    store_flash_write (ofs, st_buf, STORE_REC_SZ);
+    store_flash_release ();
+
+    uint32_t took = hal_time_us () - t0;
+    if (took > st.write_max_us)
+    {
+        st.write_max_us = took;
+    }
+    st.slot = slot;
+    ++st.seq;
+    ++st.saves;
+    st.want = 0;
+    st.built = 0;
+} // store_task
+
+// Core-1 has done its first full scan, the keyboard is usable from here
+void store_boot_scan (uint32_t now_us)
+{
+    st.boot_scan_us = now_us;
+} // store_boot_scan
+
+// The host has mounted the keyboard (the first time is kept)
+void store_boot_mount (void)
+{
+    if (st.boot_mount_us == 0)
+    {
+        st.boot_mount_us = hal_time_us ();
+    }
+} // store_boot_mount
+
+// Core-1 has been back to the flash, and the longest gap between its scans meanwhile
+void store_scan_gap (uint32_t gap_us)
+{
+    if (gap_us > st.gap_max_us)
+    {
+        st.gap_max_us = gap_us;
+    }
+} // store_scan_gap
+
+// The store figures for the config protocol (CFG_CMD_STORE_INFO)
+int store_info (uint8_t *data, int len)
+{
+    if (len < CFG_STORE_INFO_LEN)
+    {
+        return CFG_ERR_ARG;
+    }
+    perf_put32 (&data [CFG_STORE_BOOT_SCAN],  st.boot_scan_us);
+    perf_put32 (&data [CFG_STORE_BOOT_MOUNT], st.boot_mount_us);
+    perf_put32 (&data [CFG_STORE_SEQ],        store_seq ());
+    perf_put16 (&data [CFG_STORE_SAVES],      (uint16_t)st.saves);
+    perf_put32 (&data [CFG_STORE_WRITE_US],   st.write_max_us);
+    perf_put32 (&data [CFG_STORE_GAP_US],     st.gap_max_us);
+    data [CFG_STORE_SLOT]  = (st.slot >= 0) ? (uint8_t)st.slot : 0xFF;
+    data [CFG_STORE_SLOTS] = STORE_SLOTS;
+    return CFG_OK;
+} // store_info
+
+#endif // STORE_ON
+
+/* End of File */
@@ -0,0 +1,61 @@
+/*
+ * Header file for the flash config store.
+ * The live config (keymaps, timings and host key map) is saved as a log of
+ * records in the last few sectors of the flash, and loaded back at boot.
+ *
+ * Core-1 cannot run from the flash whilst it is written, so core-0 asks it to
+ * let go first (store_hold), and core-1 keeps scanning from RAM until the
+ * write is done (see scan_hold() in fw-kb-main.c).
+ */
+
+#ifndef _KB_STORE_H_
+#define _KB_STORE_H_
+
+#include <stdint.h>
+#include "kb-config.h"
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// The store_hold hand over between the cores
+#define STORE_IDLE      0  // Core-1 may use the flash
+#define STORE_HOLD_REQ  1  // Core-0 wants the flash, core-1 moves to RAM after this pass
+#define STORE_HOLDING   2  // Core-1 is scanning from RAM, core-0 may write the flash
+#define STORE_CLAIM_US  500 // How soon a task waiting for core-1 to let go looks again
+
+extern volatile int store_hold;
+
+// A config record, as saved in the flash (and shown as CONFIG.BIN on the USB drive, see kb-msc.c)
+#define STORE_MAGIC     0x3146574B // "KWF1"
+
+typedef struct
+{
+    uint32_t  magic;  // STORE_MAGIC
+    uint32_t  seq;    // Sequence number, the highest is the newest
+    uint16_t  len;    // sizeof (kb_config), so a record from another build is passed over
+    uint16_t  spare;
+    uint32_t  crc;    // CRC-32 of the config
+    kb_config cfg;
+} store_rec;
+
+// defined in kb-store.c
+extern void store_init (void);
+extern void store_task (void);
+extern void store_boot_scan (uint32_t now_us);
+extern void store_boot_mount (void);
+extern void store_scan_gap (uint32_t gap_us);
+extern int  store_flash_claim (void);
+extern void store_flash_write (uint32_t ofs, uint8_t const *data, uint32_t len);
+extern void store_flash_release (void);
+extern void store_fill (store_rec *rec, uint32_t seq);
+extern int  store_good (store_rec const *rec);
+extern uint32_t store_seq (void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_STORE_H_ */
+
+/* End of File */
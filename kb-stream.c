@@ -0,0 +1,94 @@
+/* Keystroke streaming for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * Some outputs need a whole sequence of key presses rather than one report,
+ * e.g. the Unicode entry mode. These are not pushed through the kc_buf queue
+ * (which is far too small), instead a "source" function generates each
+ * keystroke only when it is needed, and hid_task() sends each report as soon
+ * as the previous one has gone to the host.
+ *
+ * Each keystroke is sent as a key down report followed by a key up report.
+ */
+
+#include "kb-hal.h"
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-stream.h"
+#include "kb-trace.h"
+
+static stream_fn st_next    = NULL; // Source of the active stream, NULL when idle
+static kb_stroke st_cur;            // The keystroke being sent
+static int       st_up      = 0;    // Set when the key up for st_cur is due
+static uint32_t  st_gap_us  = 0;    // Minimum gap between reports for this stream (us)
+static uint32_t  st_last_us = 0;    // When the last report was sent (us)
+
+// Start a new stream - only one can be active at a time
+void stream_start (stream_fn next, uint32_t gap_us)
+{
+    st_next = next;
+    st_gap_us = gap_us;
+    st_up = 0;
+    TRACE (TR_STREAM, 0, gap_us);
+} // stream_start
+
+// Stream source used to cut a stream short
+static int stream_end (kb_stroke *st)
+{
+    (void) st;
+    return 0;
+} // stream_end
+
+// Stop the active stream, once the key up for the current keystroke is sent
+void stream_stop (void)
+{
+    if (st_next != NULL)
+    {
+        st_next = stream_end;
+    }
+} // stream_stop
+
+// Is a stream being sent?
+int stream_busy (void)
+{
+    return (st_next != NULL);
+} // stream_busy
+
+/* Get the next report for the active stream.
+ * Returns zero if there is nothing to send (yet). A stream can be paced more
+ * slowly than the host polls by giving a gap to stream_start(). */
+int stream_report (uint8_t *mods, uint8_t *keycode)
+{
+    if (st_next == NULL)
+    {
+        return 0;
+    }
+
+    uint32_t now = hal_time_us ();
+    if ((now - st_last_us) < st_gap_us)
+    {
+        return 0;
+    }
+
+    if (st_up) // Key up for the last keystroke
+    {
+        st_up = 0;
+        *mods = 0;
+        *keycode = 0;
+    }
+    else if (st_next (&st_cur)) // Key down for the next keystroke
+    {
+        st_up = 1;
+        *mods = st_cur.mods;
+        *keycode = st_cur.key;
+    }
+    else // End of the stream
+    {
+        st_next = NULL;
+        return 0;
+    }
+
+    st_last_us = now;
+    return 1;
+} // stream_report
+
+/* End of File */
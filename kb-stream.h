@@ -0,0 +1,80 @@
+/*
+ * Header file for the keystroke streaming support.
+ * A "stream" is a sequence of keystrokes generated on the fly (e.g. a Unicode
+ * entry sequence), sent to the host as fast as it will take them.
+ */
+
+#ifndef _KB_STREAM_H_
+#define _KB_STREAM_H_
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// One keystroke of a stream - this is sent as a key down report then a key up report
+typedef struct
+{
+    uint8_t mods; // Modifier bits
+    uint8_t key;  // HID key code
+} kb_stroke;
+
+/* Supplies the next keystroke of a stream.
+ * Returns non-zero if "st" was filled in, zero at the end of the stream. */
+typedef int (*stream_fn) (kb_stroke *st);
+
+// Macro throughput figures
+typedef struct
+{
+    uint32_t count;       // Macros sent
+    uint32_t interrupted; // Macros cut short by a real key press
+    uint32_t last_chars;  // Keystrokes in the last macro
+    uint32_t last_us;     // Time taken to send the last macro (us)
+    uint32_t last_cps;    // Keystrokes per second for the last macro
+    uint32_t max_chars;   // Longest macro sent (keystrokes)
+    uint32_t max_us;      // Longest time taken to send a macro (us)
+} macro_stats;
+
+// Paste mode throughput figures
+typedef struct
+{
+    uint32_t count;      // Pastes typed
+    uint32_t chars;      // Keystrokes typed, all pastes
+    uint32_t last_chars; // Keystrokes in the last paste
+    uint32_t last_us;    // Time taken to type the last paste (us)
+    uint32_t last_cps;   // Sustained keystrokes per second for the last paste
+    uint32_t best_cps;   // Best sustained keystrokes per second seen
+} paste_stats;
+
+// defined in kb-stream.c
+extern void stream_start (stream_fn next, uint32_t gap_us);
+extern void stream_stop (void);
+extern int  stream_busy (void);
+extern int  stream_report (uint8_t *mods, uint8_t *keycode);
+
+// defined in kb-unicode.c
+extern void uni_start (uint32_t cp);
+
+// defined in kb-layout.c
+extern void layout_set (int profile);
+extern int  layout_ascii (uint8_t c, kb_stroke *st);
+
+// defined in kb-macro.c
+extern void macro_start (uint32_t idx);
+extern int  macro_busy (void);
+extern void macro_stop (void);
+extern void macro_get_stats (macro_stats *ms);
+
+// defined in kb-paste.c
+extern void paste_init (void);
+extern int  paste_start (void);
+extern int  paste_busy (void);
+extern void paste_task (void);
+extern void paste_get_stats (paste_stats *ps);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_STREAM_H_ */
+
+/* End of File */
@@ -0,0 +1,300 @@
+/* Live telemetry for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * Each core keeps its own counters, and only that core ever writes them, so
+ * there are no locks. Core-0 reads the core-1 counters (single 32-bit words,
+ * so each read is whole) when it builds a frame. The per-frame figures on
+ * core-1 (longest scan) are reset by core-1 itself, when it sees core-0 has
+ * moved on to a new frame.
+ *
+ * Overhead budget: the telemetry must cost less than 1 us per full matrix
+ * scan, i.e. under 0.05% of the 2.5 ms scan. telem_init() times the per-scan
+ * hook and every frame carries the figure (hook_ns), so it is measured on
+ * the real hardware rather than guessed.
+ *
+ * Scan-to-report latency is taken from the start of the scan that found the
+ * change to the moment the HID report is handed to tinyusb. Core-1 posts the
+ * scan start time before it sends the message, and core-0 picks it up when
+ * the message comes out of the FIFO. If two messages are waiting together,
+ * the first one gets the later time, so the figure errs on the low side.
+ *
+ * The counters are kept whenever TELEM_COUNT is set, either for the frames
+ * sent on the CDC port (TELEM_ON) or for the feature report (PERF_REPORT_ON),
+ * which telem_perf_fill() builds for GET_REPORT.
+ */
+
+#include <string.h>
+#include "kb-hal.h"
+#include <bsp/board.h>
+#include <tusb.h>
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-link.h"
+#include "kb-telem.h"
+#include "kb-sched.h"
+
+#if TELEM_COUNT
+
+#if TELEM_ON && !CFG_TUD_CDC
+#error "The telemetry is sent on the CDC serial port, set CFG_TUD_CDC in tusb_config.h"
+#endif
+
+// Written by core-1 only
+static struct
+{
+    volatile uint32_t scans;
+    volatile uint32_t scan_max_us;   // Longest scan, this frame
+    volatile uint32_t scan_top_us;   // Longest scan, since start-up
+    volatile uint32_t scan_min_us;   // Shortest scan, since start-up
+    volatile uint32_t scan_avg_q4;   // Running average scan (us, Q4)
+    volatile uint32_t bounces;
+    volatile uint32_t ghosts;
+    volatile uint32_t fifo_drops;
+    volatile uint32_t scan_us;   // Start of the last scan that found a change
+    uint32_t          epoch;     // The frame the longest scan belongs to
+} tm1;
+
+// Written by core-0 only
+static struct
+{
+    volatile uint32_t epoch;     // Frame number, core-1 watches this
+    uint32_t kc_drops;
+    uint32_t kc_hwm;
+    uint32_t reports;
+    uint32_t frame_ms;           // The 1 ms frame reports are being counted for
+    uint32_t frame_cnt;          // Reports sent in that frame
+    uint32_t frame_max;
+    uint32_t lat [TELEM_LAT_BUCKETS];
+    uint32_t hook_ns;
+    uint32_t wake_us;            // When a remote wake-up was asked for, 0 if none
+    uint32_t wakeups;
+    uint32_t wake_last_us;
+    uint32_t wake_max_us;
+} tm0;
+
+/* Time the per-scan hook, so every frame can say what the telemetry costs.
+ * Called by main() before core-1 starts. */
+void telem_init (void)
+{
+    uint32_t t0 = hal_time_us ();
+    int idx;
+    for (idx = 0; idx < 1000; ++idx)
+    {
+        telem_scan (idx, t0, 0);
+    }
+    tm0.hook_ns = hal_time_us () - t0; // 1000 calls, so us here is ns per call
+
+    tm1.scans = 0;
+    tm1.scan_max_us = 0;
+    tm1.scan_top_us = 0;
+    tm1.scan_min_us = 0;
+    tm1.scan_avg_q4 = 0;
+#if TELEM_ON
+    sched_add ("telem", telem_task, TELEM_MS * 1000u);
+#endif // TELEM_ON
+} // telem_init
+
+// core-1: called once per full matrix scan
+void telem_scan (uint32_t scan_us, uint32_t start_us, int changed)
+{
+    ++tm1.scans;
+    if (tm1.epoch != tm0.epoch)
+    {
+        // Core-0 has sent a frame, start the figures for the next one
+        tm1.epoch = tm0.epoch;
+        tm1.scan_max_us = 0;
+    }
+    if (scan_us > tm1.scan_max_us)
+    {
+        tm1.scan_max_us = scan_us;
+        if (scan_us > tm1.scan_top_us)
+        {
+            tm1.scan_top_us = scan_us;
+        }
+    }
+    if ((scan_us < tm1.scan_min_us) || (tm1.scan_min_us == 0))
+    {
+        tm1.scan_min_us = scan_us;
+    }
+    // Running average over the last 16 scans or so
+    tm1.scan_avg_q4 = tm1.scan_avg_q4 + scan_us - (tm1.scan_avg_q4 >> 4);
+    if (changed)
+    {
+        tm1.scan_us = start_us;
+    }
+} // telem_scan
+
+// core-1: a change was undone on the next scan (contact bounce)
+void telem_bounce (void)
+{
+    ++tm1.bounces;
+} // telem_bounce
+
+// core-1: too many keys down, the scan was not trusted
+void telem_ghost (void)
+{
+    ++tm1.ghosts;
+} // telem_ghost
+
+// core-1: a message was lost as the FIFO was full
+void telem_fifo_drop (void)
+{
+    ++tm1.fifo_drops;
+} // telem_fifo_drop
+
+// core-0: the start time of the scan behind the message just taken from the FIFO
+uint32_t telem_scan_time (void)
+{
+    return tm1.scan_us;
+} // telem_scan_time
+
+// core-0: kc_buf depth after a put, and whether the message was dropped
+void telem_kc (uint32_t depth, int dropped)
+{
+    if (dropped)
+    {
+        ++tm0.kc_drops;
+    }
+    if (depth > tm0.kc_hwm)
+    {
+        tm0.kc_hwm = depth;
+    }
+} // telem_kc
+
+// core-0: a HID report was sent, "ts_us" is the start of the scan behind it (0 if none)
+void telem_report (uint32_t ts_us)
+{
+    uint32_t now_ms = board_millis ();
+
+    ++tm0.reports;
+    if (now_ms != tm0.frame_ms)
+    {
+        tm0.frame_ms = now_ms;
+        tm0.frame_cnt = 0;
+    }
+    if (++tm0.frame_cnt > tm0.frame_max)
+    {
+        tm0.frame_max = tm0.frame_cnt;
+    }
+
+    if (ts_us != 0)
+    {
+        uint32_t lat = hal_time_us () - ts_us;
+        uint32_t lim = TELEM_LAT_FIRST;
+        int b = 0;
+        while ((b < (TELEM_LAT_BUCKETS - 1)) && (lat >= lim))
+        {
+            ++b;
+            lim <<= 1;
+        }
+        ++tm0.lat [b];
+    }
+} // telem_report
+
+// core-0: a remote wake-up has been asked for
+void telem_wake_start (void)
+{
+    if (tm0.wake_us == 0)
+    {
+        tm0.wake_us = hal_time_us () | 1; // Never 0
+    }
+} // telem_wake_start
+
+// core-0: the host has resumed the bus
+void telem_wake_done (void)
+{
+    if (tm0.wake_us != 0)
+    {
+        uint32_t us = hal_time_us () - tm0.wake_us;
+        ++tm0.wakeups;
+        tm0.wake_last_us = us;
+        if (us > tm0.wake_max_us)
+        {
+            tm0.wake_max_us = us;
+        }
+        tm0.wake_us = 0;
+    }
+} // telem_wake_done
+
+// Clip a count to 16 bits
+static uint16_t telem_u16 (uint32_t v)
+{
+    return (uint16_t)((v > 0xFFFF) ? 0xFFFF : v);
+} // telem_u16
+
+/* core-0: fill in the performance counters feature report (see PERF_OFS_xxx in kb-telem.h).
+ * Returns the length filled in, 0 if "len" is too short. */
+uint16_t telem_perf_fill (uint8_t *buf, uint16_t len)
+{
+    if (len < PERF_REPORT_LEN)
+    {
+        return 0;
+    }
+    memset (buf, 0, PERF_REPORT_LEN);
+    buf [PERF_OFS_VERSION] = PERF_VERSION;
+    buf [PERF_OFS_KC_HWM]  = (uint8_t)tm0.kc_hwm;
+    perf_put32 (&buf [PERF_OFS_UPTIME],    board_millis ());
+    perf_put32 (&buf [PERF_OFS_SCANS],     tm1.scans);
+    perf_put16 (&buf [PERF_OFS_SCAN_MIN],  telem_u16 (tm1.scan_min_us));
+    perf_put16 (&buf [PERF_OFS_SCAN_AVG],  telem_u16 (tm1.scan_avg_q4 >> 4));
+    perf_put16 (&buf [PERF_OFS_SCAN_MAX],  telem_u16 (tm1.scan_top_us));
+    perf_put32 (&buf [PERF_OFS_FIFO_DROP], tm1.fifo_drops);
+    perf_put32 (&buf [PERF_OFS_KC_DROP],   tm0.kc_drops);
+    perf_put32 (&buf [PERF_OFS_GHOSTS],    tm1.ghosts);
+    perf_put32 (&buf [PERF_OFS_BOUNCES],   tm1.bounces);
+    perf_put32 (&buf [PERF_OFS_REPORTS],   tm0.reports);
+    perf_put16 (&buf [PERF_OFS_WAKEUPS],   telem_u16 (tm0.wakeups));
+    perf_put32 (&buf [PERF_OFS_WAKE_LAST], tm0.wake_last_us);
+    perf_put32 (&buf [PERF_OFS_WAKE_MAX],  tm0.wake_max_us);
+    return PERF_REPORT_LEN;
+} // telem_perf_fill
+
+#if TELEM_ON
+// core-0: a task in the scheduler, sends a frame every TELEM_MS
+void telem_task (void)
+{
+    uint32_t now = board_millis ();
+
+    if ((!tud_cdc_connected ()) || (tud_cdc_write_available () < sizeof (telem_frame)))
+    {
+        return; // No one listening, or no room - try again next time
+    }
+
+    telem_frame f;
+    int idx;
+
+    f.sync[0]     = TELEM_SYNC0;
+    f.sync[1]     = TELEM_SYNC1;
+    f.version     = TELEM_VERSION;
+    f.len         = sizeof (telem_frame);
+    f.seq         = tm0.epoch;
+    f.uptime_ms   = now;
+    f.scans       = tm1.scans;
+    f.scan_max_us = (uint16_t)((tm1.scan_max_us > 0xFFFF) ? 0xFFFF : tm1.scan_max_us);
+    f.hook_ns     = (uint16_t)tm0.hook_ns;
+    f.bounces     = tm1.bounces;
+    f.ghosts      = tm1.ghosts;
+    f.fifo_drops  = tm1.fifo_drops;
+    f.kc_drops    = tm0.kc_drops;
+    f.kc_hwm      = (uint8_t)tm0.kc_hwm;
+    f.frame_max   = (uint8_t)tm0.frame_max;
+    f.spare       = 0;
+    f.reports     = tm0.reports;
+    for (idx = 0; idx < TELEM_LAT_BUCKETS; ++idx)
+    {
+        f.lat [idx] = (uint16_t)((tm0.lat [idx] > 0xFFFF) ? 0xFFFF : tm0.lat [idx]);
+        tm0.lat [idx] = 0;
+    }
+    f.crc = link_crc8 ((uint8_t const *)&f, sizeof (telem_frame) - 1);
+
+    tud_cdc_write (&f, sizeof (f));
+    tud_cdc_write_flush ();
+
+    tm0.frame_max = 0;
+    ++tm0.epoch; // Tell core-1 to start on the next frame
+} // telem_task
+#endif // TELEM_ON
+
+#endif // TELEM_COUNT
+
+/* End of File */
@@ -0,0 +1,118 @@
+/*
+ * Header file for the live telemetry.
+ * The firmware keeps counters and a latency histogram as it runs, and sends
+ * them out as a small binary frame every TELEM_MS on the CDC serial port.
+ * kb-telem-view in tools/ shows them.
+ *
+ * The same counters can also be read at any time as a HID feature report
+ * (REPORT_ID_PERF), laid out as the PERF_xxx offsets below.
+ *
+ * This header is shared with the host tools, so it must only use standard C.
+ */
+
+#ifndef _KB_TELEM_H_
+#define _KB_TELEM_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define TELEM_SYNC0    0x7E
+#define TELEM_SYNC1    'T'
+#define TELEM_VERSION  1
+
+/* Scan-to-report latency buckets (us), each is twice the last:
+ * < 250, < 500, < 1000, < 2000, < 4000, < 8000, < 16000, and the rest */
+#define TELEM_LAT_BUCKETS  8
+#define TELEM_LAT_FIRST    250
+
+// One telemetry frame, all little endian. Counts are since start-up unless marked otherwise.
+typedef struct __attribute__((packed))
+{
+    uint8_t  sync [2];     // TELEM_SYNC0, TELEM_SYNC1
+    uint8_t  version;      // TELEM_VERSION
+    uint8_t  len;          // sizeof (telem_frame)
+    uint32_t seq;          // Frame number
+    uint32_t uptime_ms;    // When the frame was made
+    uint32_t scans;        // Full matrix scans
+    uint16_t scan_max_us;  // Longest full scan, since the last frame
+    uint16_t hook_ns;      // Measured cost of the telemetry in each scan (ns)
+    uint32_t bounces;      // Key changes undone on the very next scan
+    uint32_t ghosts;       // Scans rejected for too many keys down (shadow keys)
+    uint32_t fifo_drops;   // Messages core-1 could not send, the FIFO was full
+    uint32_t kc_drops;     // Messages core-0 could not queue, kc_buf was full
+    uint8_t  kc_hwm;       // Most messages waiting in kc_buf
+    uint8_t  frame_max;    // Most HID reports sent in one 1 ms frame, since the last frame
+    uint16_t spare;
+    uint32_t reports;      // HID reports sent
+    uint16_t lat [TELEM_LAT_BUCKETS]; // Scan-to-report latency histogram, since the last frame
+    uint8_t  crc;          // CRC-8 of everything before it (see link_crc8 in kb-link.h)
+} telem_frame;
+
+/* The performance counters feature report, little endian, after the report ID.
+ * Scan times are per full pass over the matrix. Counts are since start-up. */
+#define PERF_VERSION       1
+#define PERF_OFS_VERSION   0  // u8:  PERF_VERSION
+#define PERF_OFS_KC_HWM    1  // u8:  Most messages waiting in kc_buf
+#define PERF_OFS_UPTIME    2  // u32: ms since start-up
+#define PERF_OFS_SCANS     6  // u32: Full matrix scans
+#define PERF_OFS_SCAN_MIN  10 // u16: Shortest scan (us)
+#define PERF_OFS_SCAN_AVG  12 // u16: Average scan, recent (us)
+#define PERF_OFS_SCAN_MAX  14 // u16: Longest scan (us)
+#define PERF_OFS_FIFO_DROP 16 // u32: Messages lost, core-1 FIFO full
+#define PERF_OFS_KC_DROP   20 // u32: Messages lost, kc_buf full
+#define PERF_OFS_GHOSTS    24 // u32: Scans rejected for shadow keys
+#define PERF_OFS_BOUNCES   28 // u32: Key changes undone on the next scan
+#define PERF_OFS_REPORTS   32 // u32: HID input reports sent
+#define PERF_OFS_WAKEUPS   36 // u16: Remote wake-ups that completed
+#define PERF_OFS_WAKE_LAST 38 // u32: Time from remote wake-up request to resume, last one (us)
+#define PERF_OFS_WAKE_MAX  42 // u32: ...and the longest (us)
+#define PERF_REPORT_LEN    48 // Bytes in the report, the rest are spare (zero)
+
+static inline void perf_put16 (uint8_t *p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+} // perf_put16
+
+static inline void perf_put32 (uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+} // perf_put32
+
+static inline uint16_t perf_get16 (uint8_t const *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+} // perf_get16
+
+static inline uint32_t perf_get32 (uint8_t const *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+} // perf_get32
+
+// defined in kb-telem.c (firmware only)
+extern void telem_init (void);
+extern void telem_scan (uint32_t scan_us, uint32_t start_us, int changed);
+extern void telem_bounce (void);
+extern void telem_ghost (void);
+extern void telem_fifo_drop (void);
+extern void telem_kc (uint32_t depth, int dropped);
+extern void telem_report (uint32_t ts_us);
+extern uint32_t telem_scan_time (void);
+extern void telem_wake_start (void);
+extern void telem_wake_done (void);
+extern uint16_t telem_perf_fill (uint8_t *buf, uint16_t len);
+extern void telem_task (void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_TELEM_H_ */
+
+/* End of File */
@@ -0,0 +1,174 @@
+/* Binary trace log for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * Each core has its own ring of trace records. Only that core ever writes a
+ * record into its ring (moving "head"), and only trace_task() on core-0 ever
+ * takes them out (moving "tail"), so no locks are needed, just a memory
+ * barrier before the new head is published.
+ *
+ * trace_task() is a core-0 task, run every TR_TASK_US. When the DMA channel
+ * is free it starts sending the next run of records from one ring straight to
+ * the UART, so the CPU does not wait for the UART at all.
+ *
+ * If a ring is full the record is dropped and counted. A TR_DROPPED record
+ * with the count goes out as soon as there is room again.
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/uart.h"
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-sched.h"
+#include "kb-trace.h"
+
+#if TRACE_ON
+
+#if LINK_ON
+#error "The trace log and the key event link both use the UART, only one can be on"
+#endif
+
+#define TR_MSK     (TRACE_RING_SZ - 1)
+#define TR_TASK_US 1000 // The UART sends 7 or so records a ms at TRACE_BAUD, far less than a ring
+
+typedef struct
+{
+    trace_rec         rec [TRACE_RING_SZ];
+    volatile uint32_t head;     // Next record to write, only moved by the owning core
+    volatile uint32_t tail;     // Next record to send, only moved by trace_task()
+    volatile uint32_t dropped;  // Records dropped because the ring was full
+    uint32_t          reported; // Dropped count last sent in a TR_DROPPED record
+} trace_ring;
+
+static trace_ring tr_ring [2];      // One ring for each core
+static int        tr_dma   = -1;    // DMA channel sending the records
+static int        tr_core  = 0;     // Ring the DMA is sending from
+static uint32_t   tr_count = 0;     // Records being sent by the DMA
+
+// Set up the UART and claim a DMA channel
+void trace_init (void)
+{
+    uart_init (TRACE_UART, TRACE_BAUD);
+    gpio_set_function (PICO_DEFAULT_UART_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function (PICO_DEFAULT_UART_RX_PIN, GPIO_FUNC_UART);
+    tr_dma = dma_claim_unused_channel (true);
+    sched_add ("trace", trace_task, TR_TASK_US);
+    trace_put (TR_BOOT, 0, 0);
+} // trace_init
+
+// Write a record into the ring for the core we are running on
+void trace_put (uint8_t id, uint16_t a, uint32_t b)
+{
+    uint32_t core = get_core_num ();
+    trace_ring *r = &tr_ring [core];
+    uint32_t h = r->head;
+    uint32_t room = TRACE_RING_SZ - (h - r->tail);
+
+    if ((r->dropped != r->reported) && (room >= 2))
+    {
+        // Say how many records were lost, before this one
+        trace_rec *d = &r->rec [h & TR_MSK];
+        d->magic = (uint8_t)(TRACE_MAGIC + core);
+        d->id    = TR_DROPPED;
+        d->a     = 0;
+        d->ts_us = time_us_32 ();
+        d->b     = r->dropped;
+        r->reported = d->b;
+        ++h;
+        --room;
+    }
+    if (room == 0)
+    {
+        ++r->dropped;
+        return;
+    }
+
+    trace_rec *t = &r->rec [h & TR_MSK];
+    t->magic = (uint8_t)(TRACE_MAGIC + core);
+    t->id    = id;
+    t->a     = a;
+    t->ts_us = time_us_32 ();
+    t->b     = b;
+
+    __dmb (); // The record must be in memory before the DMA can see it
+    r->head = h + 1;
+} // trace_put
+
+/* Run by the core-0 scheduler every TR_TASK_US.
+ * Frees the records the DMA has sent, then starts the DMA on the next run. */
+void trace_task (void)
+{
+    if ((tr_dma < 0) || (dma_channel_is_busy ((uint)tr_dma)))
+    {
+        return;
+    }
+    if (tr_count)
+    {
+        tr_ring [tr_core].tail += tr_count;
+        tr_count = 0;
+        tr_core ^= 1; // Take the cores in turn
+    }
+
+    int idx;
+    for (idx = 0; idx < 2; ++idx)
+    {
+        trace_ring *r = &tr_ring [tr_core];
+        uint32_t t = r->tail;
+        uint32_t n = r->head - t;
+        if (n)
+        {
+            // Only send up to the end of the ring, the rest goes next time
+            if (n > (TRACE_RING_SZ - (t & TR_MSK)))
+            {
+                n = TRACE_RING_SZ - (t & TR_MSK);
+            }
+
+            dma_channel_config c = dma_channel_get_default_config ((uint)tr_dma);
+            channel_config_set_transfer_data_size (&c, DMA_SIZE_8);
+            channel_config_set_read_increment (&c, true);
+            channel_config_set_write_increment (&c, false);
+            channel_config_set_dreq (&c, uart_get_dreq (TRACE_UART, true));
+            dma_channel_configure ((uint)tr_dma, &c, &uart_get_hw (TRACE_UART)->dr,
+                                   &r->rec [t & TR_MSK], n * sizeof (trace_rec), true);
+            tr_count = n;
+            return;
+        }
+        tr_core ^= 1;
+    }
+} // trace_task
+
+// How many trace records have been dropped, on both cores
+uint32_t trace_dropped (void)
+{
+    return tr_ring [0].dropped + tr_ring [1].dropped;
+} // trace_dropped
+
+/* Bytes of the records still held in the rings, core-0's then core-1's, each
+ * oldest first (TRACE.BIN on the USB drive, see kb-msc.c). Slots not yet
+ * used are zero, which kb-trace-dump passes over. */
+void trace_peek (uint32_t ofs, uint8_t *buf, uint32_t len)
+{
+    while (len > 0)
+    {
+        uint32_t idx = ofs / sizeof (trace_rec);
+        uint32_t part = ofs % sizeof (trace_rec);
+        trace_ring const *r = &tr_ring [(idx / TRACE_RING_SZ) & 1];
+        uint8_t const *rec = (uint8_t const *)&r->rec [(r->head + idx) & TR_MSK];
+        uint32_t n = sizeof (trace_rec) - part;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy (buf, rec + part, n);
+        buf += n;
+        ofs += n;
+        len -= n;
+    }
+} // trace_peek
+
+#endif // TRACE_ON
+
+/* End of File */
@@ -0,0 +1,75 @@
+/*
+ * Header file for the binary trace log.
+ * Trace records are small fixed-size binary records, written into a ring for
+ * each core and sent out on the UART by DMA when core-0 has nothing else to
+ * do. This costs far less time than a printf, so the firmware runs with much
+ * the same timing as it does with the trace off. kb-trace-dump in tools/
+ * turns the records back into text.
+ *
+ * This header is shared with the host tools, so the record layout and the
+ * names must only use standard C.
+ */
+
+#ifndef _KB_TRACE_H_
+#define _KB_TRACE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// First byte of each record, plus the core number (0 or 1)
+#define TRACE_MAGIC  0xC0
+
+/* The trace events: id, name, and what the two arguments hold */
+#define TRACE_IDS(X) \
+    X (TR_BOOT,      "boot")      /* a: -,               b: -                            */ \
+    X (TR_DROPPED,   "dropped")   /* a: -,               b: records dropped on this core  */ \
+    X (TR_SCAN,      "scan")      /* a: columns all up,  b: scan time (us)              */ \
+    X (TR_KEYS,      "keys")      /* a: keys down,       b: message sent to core-0      */ \
+    X (TR_FIFO_FULL, "fifo-full") /* a: -,               b: message that was not sent   */ \
+    X (TR_COMBO,     "combo")     /* a: combo result,    b: message                     */ \
+    X (TR_MSG,       "msg")       /* a: kc_buf depth,    b: message from core-1         */ \
+    X (TR_KC_FULL,   "kc-full")   /* a: -,               b: message that was dropped    */ \
+    X (TR_REPORT,    "report")    /* a: report id,       b: message                     */ \
+    X (TR_STREAM,    "stream")    /* a: -,               b: gap (us)                    */
+
+#define TR_ENUM(id, name) id,
+enum
+{
+    TRACE_IDS (TR_ENUM)
+    TR_COUNT
+};
+#undef TR_ENUM
+
+// One trace record, 12 bytes
+typedef struct
+{
+    uint8_t  magic; // TRACE_MAGIC + core number
+    uint8_t  id;    // TR_xxx
+    uint16_t a;     // Small argument
+    uint32_t ts_us; // Time stamp, us since the Pico started
+    uint32_t b;     // Argument
+} trace_rec;
+
+#if TRACE_ON
+#define TRACE(id, a, b) trace_put ((id), (uint16_t)(a), (uint32_t)(b))
+#else
+#define TRACE(id, a, b) ((void) 0)
+#endif // TRACE_ON
+
+// defined in kb-trace.c (firmware only)
+extern void     trace_init (void);
+extern void     trace_put (uint8_t id, uint16_t a, uint32_t b);
+extern void     trace_task (void);
+extern uint32_t trace_dropped (void);
+extern void     trace_peek (uint32_t ofs, uint8_t *buf, uint32_t len);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_TRACE_H_ */
+
+/* End of File */
@@ -0,0 +1,73 @@
+/* Unicode entry mode for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * Rather than rely on the host key map (AltGr levels and dead keys) to produce
+ * the more unusual symbols, we can type the code point directly using the
+ * IBus / GTK Unicode entry sequence used on Linux:
+ *   CTRL + SHIFT + U, the code point in hex, then SPACE
+ * This works for any code point, whatever key map the host has loaded.
+ */
+
+#include "kb-hal.h"
+#include <tusb.h>
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-stream.h"
+
+// HID key codes for the hex digits 0 - f (no shift needed, IBus takes lower case)
+static uint8_t const hex_keys [16] = {
+    HID_KEY_0, HID_KEY_1, HID_KEY_2, HID_KEY_3, HID_KEY_4, HID_KEY_5, HID_KEY_6, HID_KEY_7,
+    HID_KEY_8, HID_KEY_9, HID_KEY_A, HID_KEY_B, HID_KEY_C, HID_KEY_D, HID_KEY_E, HID_KEY_F
+};
+
+static uint32_t uni_cp    = 0; // The code point being sent
+static int      uni_step  = 0; // Which keystroke of the sequence is next
+static int      uni_shift = 0; // Bit position of the next hex digit to send
+
+// Stream source: generates the entry sequence for uni_cp, one keystroke at a time
+static int uni_next (kb_stroke *st)
+{
+    if (uni_step == 0) // Start the entry sequence
+    {
+        st->mods = KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_LEFTSHIFT;
+        st->key  = HID_KEY_U;
+        ++uni_step;
+        return 1;
+    }
+
+    if (uni_shift >= 0) // Next hex digit, most significant first
+    {
+        st->mods = 0;
+        st->key  = hex_keys [(uni_cp >> uni_shift) & 0x0F];
+        uni_shift -= 4;
+        return 1;
+    }
+
+    if (uni_step == 1) // Finish the entry sequence
+    {
+        st->mods = 0;
+        st->key  = HID_KEY_SPACE;
+        ++uni_step;
+        return 1;
+    }
+
+    return 0; // All done
+} // uni_next
+
+// Start sending the Unicode code point "cp"
+void uni_start (uint32_t cp)
+{
+    uni_cp = cp & FLAG_UNI_MASK;
+    uni_step = 0;
+
+    // Skip the leading zero digits, but always send at least one digit
+    uni_shift = 20;
+    while ((uni_shift > 0) && (((uni_cp >> uni_shift) & 0x0F) == 0))
+    {
+        uni_shift -= 4;
+    }
+
+    stream_start (uni_next, STREAM_GAP_US);
+} // uni_start
+
+/* End of File */
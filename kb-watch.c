@@ -0,0 +1,220 @@
+/* Core-1 watchdog for the Sharp FontWriter 620 keyboard matrix decoder
+ *
+ * Core-1 bumps its heartbeat at the end of every pass over the matrix
+ * (watch_beat1()), with the time, and core-0 bumps its own on every pass of
+ * kb_task(). watch_task() runs on core-0 every WATCH_MS, from the scheduler,
+ * and counts the looks in a row that found core-1's heartbeat where it was.
+ * Counting looks, rather than time, means core-0 being held up itself (a
+ * flash write, whilst core-1 scans from RAM) is not taken as a stall.
+ *
+ * A stall: the words core-1 already pushed are taken from the FIFO first, as
+ * the launch clears it, then core-1 is reset and scan_thread() started on it
+ * again. Nothing core-1 keeps in RAM is cleared, so the scanner carries on
+ * from the last scan it finished. The time from the relaunch to core-1's
+ * first full pass is kept, and the whole time it was not scanning.
+ *
+ * The hardware watchdog is fed by watch_task(), so stops being fed if core-0
+ * stops, or when core-1 has stalled WATCH_RETRIES times in WATCH_RETRY_MS.
+ * A count of the reboots it made is kept in one of its scratch registers,
+ * which a watchdog reboot does not clear.
+ *
+ * The host build has no hardware watchdog, but the relaunch runs on the mock
+ * (see tools/kb-stall.c).
+ */
+
+#include <string.h>
+#include "kb-hal.h"
+#if !KB_HOST
+#include "hardware/watchdog.h"
+#endif // !KB_HOST
+
+// local parts
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-sched.h"
+#include "kb-telem.h"
+#include "kb-watch.h"
+
+#if WATCH_ON
+
+#if POWER_ON && (WATCH_STALL_MS <= (2 * PWR_PARK_MS))
+#error "WATCH_STALL_MS must be well over PWR_PARK_MS, as core-1 only scans that often whilst suspended"
+#endif
+
+#define WATCH_START_US  10000  // us to wait for scan_thread() to start after a relaunch
+#define WATCH_SCRATCH   0      // The watchdog scratch register for the reboot count (the SDK uses 4 to 7)
+
+// Written by core-1 only
+static struct
+{
+    volatile uint32_t beat;
+    volatile uint32_t beat_us;   // When it last beat
+    volatile uint32_t first_us;  // When it first beat, since scan_thread() started
+    uint32_t runs;               // Passes since scan_thread() started
+} wd1;
+
+// Written by core-0 only
+static struct
+{
+    uint32_t beat;
+    int      state;              // WATCH_xxx
+    uint32_t seen;               // wd1.beat at the last look
+    int      misses;             // Looks in a row it had not moved
+    uint32_t relaunch_us;        // When core-1 was last relaunched
+    uint32_t last_us;            // Core-1's last beat before it stalled
+    uint32_t retry_us [WATCH_RETRIES]; // When the last few relaunches were, oldest next
+    int      retry_idx;
+    uint32_t stalls;
+    uint32_t recover_us;
+    uint32_t recover_max;
+    uint32_t outage_max;
+    uint32_t reboots;
+} wd0;
+
+// core-0: reset core-1 and start it again, carrying on from where it got to
+static void watch_relaunch (uint32_t now)
+{
+    if (wd0.stalls >= WATCH_RETRIES)
+    {
+        // The oldest of the last few relaunches, was it recent?
+        if ((now - wd0.retry_us [wd0.retry_idx]) < (WATCH_RETRY_MS * 1000u))
+        {
+            wd0.state = WATCH_GIVEN_UP; // Leave it to the hardware watchdog
+            return;
+        }
+    }
+    wd0.retry_us [wd0.retry_idx] = now;
+    wd0.retry_idx = (wd0.retry_idx + 1) % WATCH_RETRIES;
+    if (wd0.state == WATCH_OK)
+    {
+        wd0.last_us = wd1.beat_us;
+    }
+    ++wd0.stalls;
+
+    kb_drain (); // The launch clears the FIFO, so take what core-1 pushed before it stalled
+    wd0.relaunch_us = hal_time_us ();
+    hal_core1_relaunch ();
+    while (!hal_fifo_rvalid ())
+    {
+        if ((hal_time_us () - wd0.relaunch_us) >= WATCH_START_US)
+        {
+            break; // It did not start, the next looks will try again
+        }
+    }
+    if (hal_fifo_rvalid ())
+    {
+        (void) hal_fifo_pop (); // The 99 from scan_thread(), as at boot
+    }
+    wd0.state = WATCH_RECOVERING;
+    wd0.misses = 0;
+} // watch_relaunch
+
+// core-0: every WATCH_MS, from the scheduler
+static void watch_task (void)
+{
+    uint32_t beat = wd1.beat;
+    if (beat != wd0.seen)
+    {
+        wd0.seen = beat;
+        wd0.misses = 0;
+        if (wd0.state == WATCH_RECOVERING)
+        {
+            // Core-1 is scanning again
+            uint32_t first = wd1.first_us;
+            wd0.recover_us = first - wd0.relaunch_us;
+            if (wd0.recover_us > wd0.recover_max)
+            {
+                wd0.recover_max = wd0.recover_us;
+            }
+            if ((first - wd0.last_us) > wd0.outage_max)
+            {
+                wd0.outage_max = first - wd0.last_us;
+            }
+            wd0.state = WATCH_OK;
+        }
+    }
+    else if ((wd0.state != WATCH_GIVEN_UP) && ((++wd0.misses * WATCH_MS) >= WATCH_STALL_MS))
+    {
+        watch_relaunch (hal_time_us ());
+    }
+
+#if !KB_HOST
+    if (wd0.state != WATCH_GIVEN_UP)
+    {
+        watchdog_update ();
+    }
+#endif // !KB_HOST
+} // watch_task
+
+/* core-0: called by kb_init(), before core-1 starts. Starts the hardware
+ * watchdog, so core-1 must start within WATCH_HW_MS. */
+void watch_init (void)
+{
+#if !KB_HOST
+    if (watchdog_caused_reboot ())
+    {
+        ++watchdog_hw->scratch [WATCH_SCRATCH];
+    }
+    else
+    {
+        watchdog_hw->scratch [WATCH_SCRATCH] = 0; // Power on, or a reset
+    }
+    wd0.reboots = watchdog_hw->scratch [WATCH_SCRATCH];
+    watchdog_enable (WATCH_HW_MS, true); // Paused whilst a debugger has the cores stopped
+#endif // !KB_HOST
+    sched_add ("watch", watch_task, WATCH_MS * 1000u);
+} // watch_init
+
+// core-1: called by scan_thread() whenever it starts, at boot or a relaunch
+void watch_start1 (void)
+{
+    wd1.runs = 0;
+} // watch_start1
+
+// core-0: every pass of kb_task()
+void watch_beat0 (void)
+{
+    ++wd0.beat;
+} // watch_beat0
+
+// core-1: the end of every pass over the matrix
+void watch_beat1 (uint32_t now_us)
+{
+    if (wd1.runs++ == 0)
+    {
+        wd1.first_us = now_us;
+    }
+    wd1.beat_us = now_us;
+    ++wd1.beat; // Last, so core-0 sees the times once it sees this move
+} // watch_beat1
+
+#if !KB_HOST
+// core-0: reset core-1, and start the scanner on it again
+void hal_core1_relaunch (void)
+{
+    multicore_reset_core1 ();
+    multicore_launch_core1 (scan_thread);
+} // hal_core1_relaunch
+#endif // !KB_HOST
+
+// The watchdog figures (CFG_CMD_WATCH_INFO)
+int watch_info (uint8_t *data, int len)
+{
+    if (len < WATCH_INFO_LEN)
+    {
+        return CFG_ERR_ARG;
+    }
+    data [WATCH_INFO_STATE] = (uint8_t)wd0.state;
+    perf_put32 (&data [WATCH_INFO_STALLS],      wd0.stalls);
+    perf_put32 (&data [WATCH_INFO_RECOVER_US],  wd0.recover_us);
+    perf_put32 (&data [WATCH_INFO_RECOVER_MAX], wd0.recover_max);
+    perf_put32 (&data [WATCH_INFO_OUTAGE_MAX],  wd0.outage_max);
+    perf_put32 (&data [WATCH_INFO_BEAT0],       wd0.beat);
+    perf_put32 (&data [WATCH_INFO_BEAT1],       wd1.beat);
+    perf_put32 (&data [WATCH_INFO_REBOOTS],     wd0.reboots);
+    return CFG_OK;
+} // watch_info
+
+#endif // WATCH_ON
+
+/* End of File */
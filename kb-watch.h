@@ -0,0 +1,56 @@
+/*
+ * Header file for the core-1 watchdog.
+ * Each core has a heartbeat: core-0 counts the passes of kb_task(), core-1
+ * its passes over the matrix. Core-0 looks at core-1's heartbeat every
+ * WATCH_MS, and if it has not moved for WATCH_STALL_MS, takes what core-1
+ * left in the FIFO and relaunches it (multicore_reset_core1(), then
+ * scan_thread() again). The debounce and key state is in RAM and is kept,
+ * so a key held through the stall is not sent again, and one let go meanwhile
+ * is sent up on the first pass after.
+ *
+ * If core-1 keeps stalling (WATCH_RETRIES relaunches in WATCH_RETRY_MS), or
+ * core-0 itself stops, the hardware watchdog is no longer fed, and reboots
+ * the Pico after WATCH_HW_MS.
+ *
+ * The WATCH_INFO layout is shared with the host tools, so it must only use
+ * standard C.
+ */
+
+#ifndef _KB_WATCH_H_
+#define _KB_WATCH_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// The watchdog states
+#define WATCH_OK         0
+#define WATCH_RECOVERING 1  // Core-1 has been relaunched, waiting for its first pass
+#define WATCH_GIVEN_UP   2  // Core-1 keeps stalling, waiting for the hardware watchdog
+
+// The CFG_CMD_WATCH_INFO response, little endian, from CFG_OFS_DATA (see kb-config.h)
+#define WATCH_INFO_STATE       0  // u8:  WATCH_xxx
+#define WATCH_INFO_STALLS      1  // u32: Times core-1 stalled and was relaunched
+#define WATCH_INFO_RECOVER_US  5  // u32: The last stall, from the relaunch to core-1's first pass (us)
+#define WATCH_INFO_RECOVER_MAX 9  // u32: ...the longest
+#define WATCH_INFO_OUTAGE_MAX  13 // u32: Longest core-1 was not scanning, from its last pass to its first after (us)
+#define WATCH_INFO_BEAT0       17 // u32: Core-0 heartbeat, passes of kb_task()
+#define WATCH_INFO_BEAT1       21 // u32: Core-1 heartbeat, passes over the matrix
+#define WATCH_INFO_REBOOTS     25 // u32: Reboots by the hardware watchdog, since power on
+#define WATCH_INFO_LEN         29
+
+// defined in kb-watch.c (firmware and host build)
+extern void watch_init (void);
+extern void watch_start1 (void);
+extern void watch_beat0 (void);
+extern void watch_beat1 (uint32_t now_us);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_WATCH_H_ */
+
+/* End of File */
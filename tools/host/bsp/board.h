@@ -0,0 +1,26 @@
+/*
+ * Mock TinyUSB board support header for the host build of the keyboard logic
+ * (see kb-hal.h). The calls are in kb-mock.c, on the mock clock.
+ */
+
+#ifndef _MOCK_BOARD_H_
+#define _MOCK_BOARD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+extern void board_init (void);
+extern uint32_t board_millis (void);
+extern void board_led_write (bool state);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _MOCK_BOARD_H_ */
+
+/* End of File */
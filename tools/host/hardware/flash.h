@@ -0,0 +1,36 @@
+/*
+ * Mock Pico SDK flash header for the host build of the config store and the
+ * USB drive view (KB_HOST_DRIVE, see fw-kb-main.h). The flash is an array in
+ * RAM, in kb-flash.c, that reads as the XIP window does on the Pico.
+ */
+
+#ifndef _MOCK_HARDWARE_FLASH_H_
+#define _MOCK_HARDWARE_FLASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#define FLASH_PAGE_SIZE        (1u << 8)
+#define FLASH_SECTOR_SIZE      (1u << 12)
+#define PICO_FLASH_SIZE_BYTES  (2 * 1024 * 1024)
+
+// defined in kb-flash.c
+extern uint8_t mock_flash [PICO_FLASH_SIZE_BYTES];
+extern void mock_flash_reset (void);
+extern void flash_range_erase (uint32_t flash_offs, size_t count);
+extern void flash_range_program (uint32_t flash_offs, uint8_t const *data, size_t count);
+extern uint32_t mock_flash_erases (void);
+
+#define XIP_BASE  ((uintptr_t) mock_flash)
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _MOCK_HARDWARE_FLASH_H_ */
+
+/* End of File */
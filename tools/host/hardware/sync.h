@@ -0,0 +1,23 @@
+/*
+ * Mock Pico SDK sync header for the host build of the config store (see
+ * hardware/flash.h). There are no interrupts on the host to turn off.
+ */
+
+#ifndef _MOCK_HARDWARE_SYNC_H_
+#define _MOCK_HARDWARE_SYNC_H_
+
+#include <stdint.h>
+
+static inline uint32_t save_and_disable_interrupts (void)
+{
+    return 0;
+}
+
+static inline void restore_interrupts (uint32_t status)
+{
+    (void) status;
+}
+
+#endif /* _MOCK_HARDWARE_SYNC_H_ */
+
+/* End of File */
@@ -0,0 +1,35 @@
+/* kb-check - the pass/fail lines the host checks print, with their count
+ *
+ * Kept apart from kb-mock.c, so the checks that are not built on the mock
+ * (kb-msc-image, kb-rec-check) can use them too. See kb-mock.h.
+ */
+
+#include <stdio.h>
+
+#include "kb-mock.h"
+
+static int failed = 0;
+
+// One line for the check, "ok" or "FAIL" then what it is
+void mock_check (int ok, char const *what)
+{
+    printf ("%-4s %s\n", ok ? "ok" : "FAIL", what);
+    if (!ok)
+    {
+        ++failed;
+    }
+} // mock_check
+
+int mock_failed (void)
+{
+    return failed;
+} // mock_failed
+
+// Ends the last line of a check with the count failed, for main() to return
+int mock_check_end (void)
+{
+    printf ("%d check%s failed\n", failed, (failed == 1) ? "" : "s");
+    return (failed != 0);
+} // mock_check_end
+
+/* End of File */
@@ -0,0 +1,59 @@
+/* kb-flash - the mock Pico flash under the host build of the config store
+ *
+ * A RAM array, erased by mock_flash_reset() as a new Pico's flash is. Like
+ * the real flash, an erase sets a whole sector to 0xFF and programming can
+ * only clear bits, whole pages at a time, so a slot that is written twice
+ * without an erase between reads back wrong, as it would on the Pico.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/flash.h"
+
+uint8_t mock_flash [PICO_FLASH_SIZE_BYTES];
+
+static uint32_t erases = 0;
+
+// All of it erased, as a new Pico, call before anything reads it
+void mock_flash_reset (void)
+{
+    memset (mock_flash, 0xFF, sizeof (mock_flash));
+    erases = 0;
+} // mock_flash_reset
+
+// The SDK panics on a range it cannot write, so does this
+static void flash_check (uint32_t ofs, size_t count, uint32_t align, char const *what)
+{
+    if (((ofs % align) != 0) || ((count % align) != 0) || (count > (sizeof (mock_flash) - ofs)))
+    {
+        fprintf (stderr, "%s: bad range 0x%lx + 0x%lx\n", what, (unsigned long)ofs, (unsigned long)count);
+        abort ();
+    }
+} // flash_check
+
+void flash_range_erase (uint32_t flash_offs, size_t count)
+{
+    flash_check (flash_offs, count, FLASH_SECTOR_SIZE, "flash_range_erase");
+    memset (&mock_flash [flash_offs], 0xFF, count);
+    erases += (uint32_t)(count / FLASH_SECTOR_SIZE);
+} // flash_range_erase
+
+void flash_range_program (uint32_t flash_offs, uint8_t const *data, size_t count)
+{
+    size_t idx;
+    flash_check (flash_offs, count, FLASH_PAGE_SIZE, "flash_range_program");
+    for (idx = 0; idx < count; ++idx)
+    {
+        mock_flash [flash_offs + idx] &= data [idx];
+    }
+} // flash_range_program
+
+// Sectors erased so far
+uint32_t mock_flash_erases (void)
+{
+    return erases;
+} // mock_flash_erases
+
+/* End of File */
@@ -0,0 +1,427 @@
+/* kb-mock - the mock Pico SDK and TinyUSB under the host build of the keyboard logic
+ *
+ * Stands in for the hal_xxx calls (see kb-hal.h), the TinyUSB device calls
+ * and the board support ones. How it behaves is set out in kb-mock.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "kb-hal.h"
+#include <bsp/board.h>
+#include <tusb.h>
+
+#include "fw-kb-main.h"
+#include "kb-mock.h"
+#include "kb-watch.h"
+
+#define MOCK_CORE0_US  20 // Core-0 runs a pass of its loop every so many us that core-1 waits
+#define MOCK_FIFO_SZ   8  // Words, as the Pico's
+#define MOCK_LED_PIN   25 // The Pico's own LED
+#define MOCK_RESUME_US 20000 // A remote wake-up, until the host resumes the bus
+
+static uint64_t now_us = 0;
+static uint64_t core0_due = 0; // When core-0 next runs
+static int in_core0 = 0;
+
+static uint32_t fifo [MOCK_FIFO_SZ];
+static uint32_t fifo_in = 0;
+static uint32_t fifo_out = 0;
+static uint32_t fifo_hwm = 0; // Most words waiting in the FIFO
+static uint32_t pass_msgs = 0; // Most words pushed in one scan pass
+
+static uint8_t keys_down [COL_SZ]; // A bit per row, set for a key down
+static uint32_t sel_lines = 0;     // A bit for each line driven low
+static uint32_t gpio_out = 0;      // The outputs set with hal_gpio_put()
+
+static mock_report_fn report_fn = NULL;
+static mock_gpio_fn gpio_fn = NULL;
+static int report_busy = 0;     // A report is in flight
+static uint64_t report_sent = 0;
+static uint8_t report_buf [64]; // The report in flight, with its ID first
+static uint8_t report_len = 0;
+
+static int suspended = 0;       // The host has the bus suspended
+static int remote_en = 0;       // ...and allows a remote wake-up
+static uint64_t resume_due = 0; // When the host answers a remote wake-up, 0 for none asked
+static uint32_t wakeups = 0;    // Remote wake-ups asked for
+
+static int stalled = 0;         // Core-1 is stuck, until it is relaunched
+static uint32_t relaunches = 0;
+
+// One pass of core-0's loop, unless core-0 is what is running already
+static void core0_run (void)
+{
+    if (!in_core0)
+    {
+        in_core0 = 1;
+        kb_task ();
+        in_core0 = 0;
+    }
+} // core0_run
+
+//--------------------------------------------------------------------+
+// Timer, FIFO and GPIO (kb-hal.h)
+//--------------------------------------------------------------------+
+
+uint32_t hal_time_us (void)
+{
+    return (uint32_t)now_us;
+} // hal_time_us
+
+// Core-1 waits, so core-0 gets to run
+void hal_sleep_us (uint32_t us)
+{
+    uint64_t end = now_us + us;
+    while (core0_due <= end)
+    {
+        if (core0_due > now_us)
+        {
+            now_us = core0_due;
+        }
+        core0_run ();
+        core0_due += MOCK_CORE0_US;
+    }
+    now_us = end;
+} // hal_sleep_us
+
+bool hal_fifo_wready (void)
+{
+    return ((fifo_in - fifo_out) < MOCK_FIFO_SZ);
+} // hal_fifo_wready
+
+// Core-1 blocks on a full FIFO until core-0 takes a word out
+void hal_fifo_push (uint32_t v)
+{
+    if (!hal_fifo_wready ())
+    {
+        core0_run ();
+        if (!hal_fifo_wready ())
+        {
+            fprintf (stderr, "kb-mock: FIFO full, 0x%08lX lost\n", (unsigned long)v);
+            return;
+        }
+    }
+    fifo [fifo_in % MOCK_FIFO_SZ] = v;
+    ++fifo_in;
+    if ((fifo_in - fifo_out) > fifo_hwm)
+    {
+        fifo_hwm = fifo_in - fifo_out;
+    }
+} // hal_fifo_push
+
+bool hal_fifo_rvalid (void)
+{
+    return (fifo_in != fifo_out);
+} // hal_fifo_rvalid
+
+uint32_t hal_fifo_pop (void)
+{
+    if (!hal_fifo_rvalid ())
+    {
+        return 0; // Would block for ever on the Pico
+    }
+    return fifo [fifo_out++ % MOCK_FIFO_SZ];
+} // hal_fifo_pop
+
+void hal_gpio_put (unsigned gpio, bool on)
+{
+    if (((gpio_out >> gpio) & 1) != on)
+    {
+        hal_gpio_toggle (gpio);
+    }
+} // hal_gpio_put
+
+void hal_gpio_toggle (unsigned gpio)
+{
+    gpio_out ^= (1u << gpio);
+    if (gpio_fn != NULL)
+    {
+        gpio_fn (now_us, gpio, (gpio_out >> gpio) & 1);
+    }
+} // hal_gpio_toggle
+
+void hal_line_select (unsigned line)
+{
+    sel_lines |= (1u << line);
+} // hal_line_select
+
+void hal_line_idle (unsigned line)
+{
+    sel_lines &= ~(1u << line);
+} // hal_line_idle
+
+void hal_line_float (unsigned line)
+{
+    (void) line;
+} // hal_line_float
+
+/* With no diodes, a key down joins its line and row. The selected lines pull
+ * down every row they are joined to, through any number of keys and lines. */
+uint8_t hal_rows (void)
+{
+    uint32_t lines = sel_lines;
+    uint32_t seen = 0;
+    uint8_t rows = 0;
+    int line;
+
+    while (lines != seen)
+    {
+        seen = lines;
+        for (line = 0; line < COL_SZ; ++line)
+        {
+            if (lines & (1u << line))
+            {
+                rows |= keys_down [line];
+            }
+        }
+        for (line = 0; line < COL_SZ; ++line)
+        {
+            if (keys_down [line] & rows)
+            {
+                lines |= (1u << line);
+            }
+        }
+    }
+    return (uint8_t)~rows;
+} // hal_rows
+
+// Core-1 starts again: scan_thread() lets go of the lines and says it is ready
+void hal_core1_relaunch (void)
+{
+    stalled = 0;
+    sel_lines = 0;
+    ++relaunches;
+    watch_start1 ();
+    hal_fifo_push (99);
+} // hal_core1_relaunch
+
+// Every line selected, so any key down shows on its row
+void hal_lines_park (void)
+{
+    sel_lines = (1u << COL_SZ) - 1;
+} // hal_lines_park
+
+void hal_lines_unpark (void)
+{
+    sel_lines = 0;
+} // hal_lines_unpark
+
+/* There is no row interrupt, so the wait is cut into core-0 passes, as the
+ * WFE on the Pico may end early too. The caller looks at the rows again. */
+void hal_rows_wait (uint32_t us)
+{
+    hal_sleep_us ((us < MOCK_CORE0_US) ? us : MOCK_CORE0_US);
+} // hal_rows_wait
+
+//--------------------------------------------------------------------+
+// Board support and TinyUSB
+//--------------------------------------------------------------------+
+
+void board_init (void)
+{
+} // board_init
+
+uint32_t board_millis (void)
+{
+    return (uint32_t)(now_us / 1000);
+} // board_millis
+
+void board_led_write (bool state)
+{
+    hal_gpio_put (MOCK_LED_PIN, state);
+} // board_led_write
+
+// Mounted as soon as it starts, as if plugged in to a host
+bool tusb_init (void)
+{
+    tud_mount_cb ();
+    return true;
+} // tusb_init
+
+/* The report in flight is done once the host has polled for it, and the
+ * bus is resumed once the host has seen a remote wake-up */
+void tud_task (void)
+{
+    if ((resume_due != 0) && (now_us >= resume_due))
+    {
+        resume_due = 0;
+        mock_resume ();
+    }
+    if ((report_busy) && ((now_us - report_sent) >= (HID_EP_POLL * 1000)))
+    {
+        report_busy = 0;
+        tud_hid_report_complete_cb (0, report_buf, report_len);
+    }
+} // tud_task
+
+bool tud_mounted (void)
+{
+    return true;
+} // tud_mounted
+
+bool tud_suspended (void)
+{
+    return suspended;
+} // tud_suspended
+
+// As TinyUSB, only if suspended and the host allows it
+bool tud_remote_wakeup (void)
+{
+    if ((!suspended) || (!remote_en))
+    {
+        return false;
+    }
+    if (resume_due == 0)
+    {
+        ++wakeups;
+        resume_due = now_us + MOCK_RESUME_US;
+    }
+    return true;
+} // tud_remote_wakeup
+
+bool tud_hid_ready (void)
+{
+    return ((!report_busy) && (!suspended));
+} // tud_hid_ready
+
+bool tud_hid_report (uint8_t report_id, void const *report, uint16_t len)
+{
+    if ((report_busy) || (len >= sizeof (report_buf)))
+    {
+        return false;
+    }
+    report_buf [0] = report_id;
+    memcpy (&report_buf [1], report, len);
+    report_len = (uint8_t)(len + 1);
+    report_busy = 1;
+    report_sent = now_us;
+    if (report_fn != NULL)
+    {
+        report_fn (now_us, report_id, &report_buf [1], len);
+    }
+    return true;
+} // tud_hid_report
+
+bool tud_hid_keyboard_report (uint8_t report_id, uint8_t modifier, uint8_t const keycode [6])
+{
+    uint8_t report [8] = { modifier, 0 };
+    if (keycode != NULL)
+    {
+        memcpy (&report [2], keycode, 6);
+    }
+    return tud_hid_report (report_id, report, sizeof (report));
+} // tud_hid_keyboard_report
+
+bool tud_hid_mouse_report (uint8_t report_id, uint8_t buttons, int8_t x, int8_t y, int8_t vertical, int8_t horizontal)
+{
+    uint8_t report [5] = { buttons, (uint8_t)x, (uint8_t)y, (uint8_t)vertical, (uint8_t)horizontal };
+    return tud_hid_report (report_id, report, sizeof (report));
+} // tud_hid_mouse_report
+
+//--------------------------------------------------------------------+
+// Test driver calls (kb-mock.h)
+//--------------------------------------------------------------------+
+
+// Start up as main() does on the Pico
+void mock_init (void)
+{
+    board_init ();
+    tusb_init ();
+    kb_init ();
+} // mock_init
+
+void mock_on_report (mock_report_fn fn)
+{
+    report_fn = fn;
+} // mock_on_report
+
+void mock_on_gpio (mock_gpio_fn fn)
+{
+    gpio_fn = fn;
+} // mock_on_gpio
+
+// The keys held down from now on, COL_SZ bytes with a bit per row
+void mock_set_keys (uint8_t const *down)
+{
+    memcpy (keys_down, down, COL_SZ);
+} // mock_set_keys
+
+// Scan the matrix (and run core-0 meanwhile) up to the given time
+void mock_run_until (uint64_t t_us)
+{
+    while (now_us < t_us)
+    {
+        uint64_t was = now_us;
+        uint32_t pushed = fifo_in;
+        if (!stalled)
+        {
+            scan_pass ();
+        }
+        if ((fifo_in - pushed) > pass_msgs)
+        {
+            pass_msgs = fifo_in - pushed;
+        }
+        if (now_us == was)
+        {
+            hal_sleep_us (MOCK_CORE0_US); // With no scan timings, a pass still takes a little while
+        }
+    }
+} // mock_run_until
+
+uint64_t mock_now (void)
+{
+    return now_us;
+} // mock_now
+
+int mock_gpio (unsigned gpio)
+{
+    return (gpio_out >> gpio) & 1;
+} // mock_gpio
+
+uint32_t mock_fifo_hwm (void)
+{
+    return fifo_hwm;
+} // mock_fifo_hwm
+
+uint32_t mock_pass_msgs (void)
+{
+    return pass_msgs;
+} // mock_pass_msgs
+
+// The host suspends the bus, and says whether it allows a remote wake-up
+void mock_suspend (int remote_wakeup_en)
+{
+    suspended = 1;
+    remote_en = remote_wakeup_en;
+    resume_due = 0;
+    tud_suspend_cb (remote_wakeup_en);
+} // mock_suspend
+
+// The host resumes the bus
+void mock_resume (void)
+{
+    if (suspended)
+    {
+        suspended = 0;
+        tud_resume_cb ();
+    }
+} // mock_resume
+
+uint32_t mock_wakeups (void)
+{
+    return wakeups;
+} // mock_wakeups
+
+// Core-1 stops scanning, as if stuck, until the watchdog relaunches it
+void mock_stall (void)
+{
+    stalled = 1;
+} // mock_stall
+
+uint32_t mock_relaunches (void)
+{
+    return relaunches;
+} // mock_relaunches
+
+/* End of File */
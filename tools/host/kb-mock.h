@@ -0,0 +1,73 @@
+/*
+ * Header file for the mock hardware under the host build of the keyboard logic.
+ *
+ * The firmware's scanner, decoder and report code (fw-kb-main.c, usb-stack.c
+ * and the kb-*.c modules they use) are built for the host with KB_HOST set,
+ * on top of kb-mock.c, which stands in for the Pico SDK (see kb-hal.h) and
+ * TinyUSB:
+ *   - The clock only moves when the scanner waits (hal_sleep_us), so a run is
+ *     the same every time, and as fast as the host can go.
+ *   - The matrix has no diodes, as the real one: keys that join a selected
+ *     line to another one show up on it too (ghosting).
+ *   - Core-0 (kb_task) runs in the time core-1 spends waiting, and whenever
+ *     core-1 finds the FIFO full, so the two interleave much as on the Pico.
+ *   - The firmware's state cannot be reset, so mock_init() is called once.
+ *   - A HID report is in flight for HID_EP_POLL ms, then completes in tud_task.
+ *     Each report is handed to the mock_report_fn set with mock_on_report().
+ *   - The GPIO outputs (LEDs, latency markers) can be watched with mock_on_gpio().
+ *   - The most words ever waiting in the FIFO are kept (mock_fifo_hwm()), and
+ *     the most pushed in one scan pass (mock_pass_msgs()).
+ *   - The host suspends and resumes the bus with mock_suspend() and
+ *     mock_resume(). Whilst suspended no report can be sent, and a remote
+ *     wake-up (if allowed) resumes the bus MOCK_RESUME_US later. The remote
+ *     wake-ups asked for are counted (mock_wakeups()).
+ *   - mock_stall() stops core-1 between two passes, as if stuck, and core-0
+ *     carries on. The relaunches (hal_core1_relaunch()) that start it again
+ *     are counted (mock_relaunches()).
+ * The checks print a line each with mock_check(), and end with mock_check_end().
+ * These are in kb-check.c, which the checks not built on the mock link alone.
+ */
+
+#ifndef _KB_MOCK_H_
+#define _KB_MOCK_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// A report sent to the host: when (mock us), report ID, then the report itself
+typedef void (*mock_report_fn) (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len);
+
+// A GPIO output changed: when (mock us), which one, and its new level
+typedef void (*mock_gpio_fn) (uint64_t t_us, unsigned gpio, int level);
+
+// defined in kb-mock.c
+extern void mock_init (void);
+extern void mock_on_report (mock_report_fn fn);
+extern void mock_on_gpio (mock_gpio_fn fn);
+extern void mock_set_keys (uint8_t const *down);
+extern void mock_run_until (uint64_t t_us);
+extern uint64_t mock_now (void);
+extern int mock_gpio (unsigned gpio);
+extern uint32_t mock_fifo_hwm (void);
+extern uint32_t mock_pass_msgs (void);
+extern void mock_suspend (int remote_wakeup_en);
+extern void mock_resume (void);
+extern uint32_t mock_wakeups (void);
+extern void mock_stall (void);
+extern uint32_t mock_relaunches (void);
+
+// defined in kb-check.c
+extern void mock_check (int ok, char const *what);
+extern int mock_failed (void);
+extern int mock_check_end (void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_MOCK_H_ */
+
+/* End of File */
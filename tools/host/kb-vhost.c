@@ -0,0 +1,555 @@
+/* kb-vhost - the virtual host: a Linux PC with the UK (gb) xkb key map
+ *
+ * Turns the HID reports the host build sends into the text a PC would see.
+ * What it models, and what it leaves out, is set out in kb-vhost.h.
+ *
+ * The key map is xkeyboard-config's gb "basic" (on top of "latin"), by HID
+ * usage. The kernel maps both HID_KEY_BACKSLASH and HID_KEY_EUROPE_1 to the
+ * same key (<BKSL>, the # key on a UK keyboard), and HID_KEY_EUROPE_2 to the
+ * extra key by the left Shift (<LSGT>).
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <tusb.h>
+
+#include "usb_descriptors.h"
+#include "kb-vhost.h"
+
+#define VH_TEXT_SZ 4096
+
+// Dead keys, the levels hold DK(n) for them
+#define DK(n)        (0x40000000u | (n))
+#define IS_DK(s)     (((s) & 0x40000000u) != 0)
+#define DK_GRAVE        0
+#define DK_ACUTE        1
+#define DK_CIRCUMFLEX   2
+#define DK_TILDE        3
+#define DK_DIAERESIS    4
+#define DK_CEDILLA      5
+#define DK_ABOVERING    6
+#define DK_CARON        7
+#define DK_BREVE        8
+#define DK_MACRON       9
+#define DK_OGONEK       10
+#define DK_DOUBLEACUTE  11
+#define DK_BELOWDOT     12
+#define DK_ABOVEDOT     13
+#define DK_HOOK         14
+#define DK_HORN         15
+#define DK_COUNT        16
+
+// Name, and the character it gives on its own (dead key then SPACE, or twice), 0 for none
+static struct
+{
+    char const *name;
+    uint32_t    spacing;
+} const dead_keys [DK_COUNT] = {
+    { "dead_grave",       '`'    },
+    { "dead_acute",       '\''   },
+    { "dead_circumflex",  '^'    },
+    { "dead_tilde",       '~'    },
+    { "dead_diaeresis",   '"'    },
+    { "dead_cedilla",     0x00B8 },
+    { "dead_abovering",   0x00B0 },
+    { "dead_caron",       0x02C7 },
+    { "dead_breve",       0x02D8 },
+    { "dead_macron",      0x00AF },
+    { "dead_ogonek",      0x02DB },
+    { "dead_doubleacute", 0x02DD },
+    { "dead_belowdot",    0      },
+    { "dead_abovedot",    0x02D9 },
+    { "dead_hook",        0      },
+    { "dead_horn",        0      }
+};
+
+// The Latin-1 letters the dead keys make, the lower case ones are 0x20 above these
+typedef struct
+{
+    uint8_t  dead;
+    char     base; // Upper case
+    uint16_t cp;
+} vh_compose;
+
+static vh_compose const compose_table [] = {
+    { DK_GRAVE,      'A', 0xC0 }, { DK_GRAVE,      'E', 0xC8 }, { DK_GRAVE,      'I', 0xCC },
+    { DK_GRAVE,      'O', 0xD2 }, { DK_GRAVE,      'U', 0xD9 },
+    { DK_ACUTE,      'A', 0xC1 }, { DK_ACUTE,      'E', 0xC9 }, { DK_ACUTE,      'I', 0xCD },
+    { DK_ACUTE,      'O', 0xD3 }, { DK_ACUTE,      'U', 0xDA }, { DK_ACUTE,      'Y', 0xDD },
+    { DK_CIRCUMFLEX, 'A', 0xC2 }, { DK_CIRCUMFLEX, 'E', 0xCA }, { DK_CIRCUMFLEX, 'I', 0xCE },
+    { DK_CIRCUMFLEX, 'O', 0xD4 }, { DK_CIRCUMFLEX, 'U', 0xDB },
+    { DK_TILDE,      'A', 0xC3 }, { DK_TILDE,      'N', 0xD1 }, { DK_TILDE,      'O', 0xD5 },
+    { DK_DIAERESIS,  'A', 0xC4 }, { DK_DIAERESIS,  'E', 0xCB }, { DK_DIAERESIS,  'I', 0xCF },
+    { DK_DIAERESIS,  'O', 0xD6 }, { DK_DIAERESIS,  'U', 0xDC },
+    { DK_ABOVERING,  'A', 0xC5 },
+    { DK_CEDILLA,    'C', 0xC7 }
+};
+
+/* The four levels (none, Shift, AltGr, AltGr + Shift) of each key that types
+ * something, by HID usage. 0 is nothing. */
+static uint32_t const gb_keys [HID_KEY_EUROPE_2 + 1][4] = {
+    [HID_KEY_A] = { 'a', 'A', 0x00E6, 0x00C6 },
+    [HID_KEY_B] = { 'b', 'B', 0x201D, 0x2019 },
+    [HID_KEY_C] = { 'c', 'C', 0x00A2, 0x00A9 },
+    [HID_KEY_D] = { 'd', 'D', 0x00F0, 0x00D0 },
+    [HID_KEY_E] = { 'e', 'E', 'e',    'E'    },
+    [HID_KEY_F] = { 'f', 'F', 0x0111, 0x00AA },
+    [HID_KEY_G] = { 'g', 'G', 0x014B, 0x014A },
+    [HID_KEY_H] = { 'h', 'H', 0x0127, 0x0126 },
+    [HID_KEY_I] = { 'i', 'I', 0x2192, 0x0131 },
+    [HID_KEY_J] = { 'j', 'J', DK(DK_HOOK), DK(DK_HORN) },
+    [HID_KEY_K] = { 'k', 'K', 0x0138, '&'    },
+    [HID_KEY_L] = { 'l', 'L', 0x0142, 0x0141 },
+    [HID_KEY_M] = { 'm', 'M', 0x00B5, 0x00BA },
+    [HID_KEY_N] = { 'n', 'N', 'n',    'N'    },
+    [HID_KEY_O] = { 'o', 'O', 0x00F8, 0x00D8 },
+    [HID_KEY_P] = { 'p', 'P', 0x00FE, 0x00DE },
+    [HID_KEY_Q] = { 'q', 'Q', '@',    0x03A9 },
+    [HID_KEY_R] = { 'r', 'R', 0x00B6, 0x00AE },
+    [HID_KEY_S] = { 's', 'S', 0x00DF, 0x00A7 },
+    [HID_KEY_T] = { 't', 'T', 0x0167, 0x0166 },
+    [HID_KEY_U] = { 'u', 'U', 0x2193, 0x2191 },
+    [HID_KEY_V] = { 'v', 'V', 0x201C, 0x2018 },
+    [HID_KEY_W] = { 'w', 'W', 0x0142, 0x0141 },
+    [HID_KEY_X] = { 'x', 'X', 0x00BB, '>'    },
+    [HID_KEY_Y] = { 'y', 'Y', 0x2190, 0x00A5 },
+    [HID_KEY_Z] = { 'z', 'Z', 0x00AB, '<'    },
+    [HID_KEY_1] = { '1', '!', 0x00B9, 0x00A1 },
+    [HID_KEY_2] = { '2', '"', 0x00B2, 0x215B },
+    [HID_KEY_3] = { '3', 0x00A3, 0x00B3, 0x00A3 },
+    [HID_KEY_4] = { '4', '$', 0x20AC, 0x00BC },
+    [HID_KEY_5] = { '5', '%', 0x00BD, 0x215C },
+    [HID_KEY_6] = { '6', '^', 0x00BE, 0x215D },
+    [HID_KEY_7] = { '7', '&', '{',    0x215E },
+    [HID_KEY_8] = { '8', '*', '[',    0x2122 },
+    [HID_KEY_9] = { '9', '(', ']',    0x00B1 },
+    [HID_KEY_0] = { '0', ')', '}',    0x00B0 },
+    [HID_KEY_ENTER]         = { '\n', '\n', '\n', '\n' },
+    [HID_KEY_TAB]           = { '\t', '\t', '\t', '\t' },
+    [HID_KEY_SPACE]         = { ' ',  ' ',  ' ',  ' '  },
+    [HID_KEY_MINUS]         = { '-',  '_',  '\\', 0x00BF },
+    [HID_KEY_EQUAL]         = { '=',  '+',  DK(DK_CEDILLA),   DK(DK_OGONEK) },
+    [HID_KEY_BRACKET_LEFT]  = { '[',  '{',  DK(DK_DIAERESIS), DK(DK_ABOVERING) },
+    [HID_KEY_BRACKET_RIGHT] = { ']',  '}',  DK(DK_TILDE),     DK(DK_MACRON) },
+    [HID_KEY_BACKSLASH]     = { '#',  '~',  DK(DK_GRAVE),     DK(DK_BREVE) },
+    [HID_KEY_EUROPE_1]      = { '#',  '~',  DK(DK_GRAVE),     DK(DK_BREVE) },
+    [HID_KEY_SEMICOLON]     = { ';',  ':',  DK(DK_ACUTE),     DK(DK_DOUBLEACUTE) },
+    [HID_KEY_APOSTROPHE]    = { '\'', '@',  DK(DK_CIRCUMFLEX), DK(DK_CARON) },
+    [HID_KEY_GRAVE]         = { '`',  0x00AC, '|', '|' },
+    [HID_KEY_COMMA]         = { ',',  '<',  0x2500, 0x00D7 },
+    [HID_KEY_PERIOD]        = { '.',  '>',  0x00B7, 0x00F7 },
+    [HID_KEY_SLASH]         = { '/',  '?',  DK(DK_BELOWDOT),  DK(DK_ABOVEDOT) },
+    [HID_KEY_EUROPE_2]      = { '\\', '|',  '|',  0x00A6 }
+};
+
+// Names of the keys that do not type anything
+typedef struct
+{
+    uint8_t     usage;
+    char const *name;
+} vh_key_name;
+
+static vh_key_name const key_names [] = {
+    { HID_KEY_ESCAPE, "Escape" },       { HID_KEY_BACKSPACE, "BackSpace" },
+    { HID_KEY_CAPS_LOCK, "Caps_Lock" }, { HID_KEY_F1, "F1" },   { HID_KEY_F2, "F2" },
+    { HID_KEY_F3, "F3" },   { HID_KEY_F4, "F4" },   { HID_KEY_F5, "F5" },   { HID_KEY_F6, "F6" },
+    { HID_KEY_F7, "F7" },   { HID_KEY_F8, "F8" },   { HID_KEY_F9, "F9" },   { HID_KEY_F10, "F10" },
+    { HID_KEY_F11, "F11" }, { HID_KEY_F12, "F12" }, { HID_KEY_PRINT_SCREEN, "Print" },
+    { HID_KEY_SCROLL_LOCK, "Scroll_Lock" }, { HID_KEY_PAUSE, "Pause" },
+    { HID_KEY_INSERT, "Insert" }, { HID_KEY_HOME, "Home" },  { HID_KEY_PAGE_UP, "Prior" },
+    { HID_KEY_DELETE, "Delete" }, { HID_KEY_END, "End" },    { HID_KEY_PAGE_DOWN, "Next" },
+    { HID_KEY_ARROW_RIGHT, "Right" }, { HID_KEY_ARROW_LEFT, "Left" },
+    { HID_KEY_ARROW_DOWN, "Down" },   { HID_KEY_ARROW_UP, "Up" },
+    { HID_KEY_NUM_LOCK, "Num_Lock" }, { HID_KEY_KEYPAD_ENTER, "KP_Enter" },
+    { HID_KEY_APPLICATION, "Menu" }
+};
+
+// The consumer control usages the firmware sends, by their xkb names
+static vh_key_name const con_names [] = {
+    { 0xE9, "XF86AudioRaiseVolume" }, { 0xEA, "XF86AudioLowerVolume" }, { 0xE2, "XF86AudioMute" },
+    { 0xCD, "XF86AudioPlay" },        { 0xB5, "XF86AudioNext" },        { 0xB6, "XF86AudioPrev" },
+    { 0x6F, "XF86MonBrightnessUp" },  { 0x70, "XF86MonBrightnessDown" }
+};
+
+static struct
+{
+    uint8_t  last_kbd [8];  // The last keyboard report
+    uint8_t  key_down [256]; // The kernel's view of each key (HID usage)
+    uint16_t last_con;
+    int      caps;          // Caps Lock is on
+    int      dead;          // The dead key waiting, or -1
+    int      uni_on;        // In IBus Unicode entry
+    uint32_t uni_cp;
+    int      uni_digits;
+    char     text [VH_TEXT_SZ];
+    int      len;
+    uint32_t reports;       // Since the last vhost_mark()
+    uint64_t first_us;
+    uint64_t last_us;
+} vh;
+
+static char show [VH_TEXT_SZ + 32]; // vhost_text(), with any dead key waiting
+
+static void put_str (char const *s)
+{
+    int n = (int)strlen (s);
+    if ((vh.len + n) < VH_TEXT_SZ)
+    {
+        memcpy (&vh.text [vh.len], s, n + 1);
+        vh.len += n;
+    }
+} // put_str
+
+// Add a code point, as UTF-8
+static void put_cp (uint32_t cp)
+{
+    char u [5];
+    if (cp < 0x80)
+    {
+        u [0] = (char)cp;
+        u [1] = 0;
+    }
+    else if (cp < 0x800)
+    {
+        u [0] = (char)(0xC0 | (cp >> 6));
+        u [1] = (char)(0x80 | (cp & 0x3F));
+        u [2] = 0;
+    }
+    else if (cp < 0x10000)
+    {
+        u [0] = (char)(0xE0 | (cp >> 12));
+        u [1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        u [2] = (char)(0x80 | (cp & 0x3F));
+        u [3] = 0;
+    }
+    else
+    {
+        u [0] = (char)(0xF0 | (cp >> 18));
+        u [1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        u [2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        u [3] = (char)(0x80 | (cp & 0x3F));
+        u [4] = 0;
+    }
+    put_str (u);
+} // put_cp
+
+static char const *key_name (uint8_t usage)
+{
+    int idx;
+    for (idx = 0; idx < (int)(sizeof (key_names) / sizeof (key_names [0])); ++idx)
+    {
+        if (key_names [idx].usage == usage)
+        {
+            return key_names [idx].name;
+        }
+    }
+    return NULL;
+} // key_name
+
+// The level 1 glyph, or name, of a key, for the <C-x> style names
+static void put_key (char const *prefix, uint8_t usage)
+{
+    char buf [48];
+    char const *name = key_name (usage);
+    if (name != NULL)
+    {
+        snprintf (buf, sizeof (buf), "<%s%s>", prefix, name);
+    }
+    else if ((usage <= HID_KEY_EUROPE_2) && (gb_keys [usage][0] > ' ') && (gb_keys [usage][0] < 0x7F))
+    {
+        snprintf (buf, sizeof (buf), "<%s%c>", prefix, (char)gb_keys [usage][0]);
+    }
+    else
+    {
+        snprintf (buf, sizeof (buf), "<%skey_%02X>", prefix, usage);
+    }
+    put_str (buf);
+} // put_key
+
+// A dead key, then the next character typed
+static void compose (int dead, uint32_t cp)
+{
+    int idx;
+    if (cp == ' ')
+    {
+        if (dead_keys [dead].spacing != 0)
+        {
+            put_cp (dead_keys [dead].spacing);
+        }
+        return;
+    }
+    for (idx = 0; idx < (int)(sizeof (compose_table) / sizeof (compose_table [0])); ++idx)
+    {
+        if (compose_table [idx].dead != dead)
+        {
+            continue;
+        }
+        if (cp == (uint32_t)compose_table [idx].base)
+        {
+            put_cp (compose_table [idx].cp);
+            return;
+        }
+        if (cp == (uint32_t)(compose_table [idx].base + 0x20))
+        {
+            put_cp (compose_table [idx].cp + 0x20u);
+            return;
+        }
+    }
+    // No such letter, the sequence is dropped
+} // compose
+
+static int hex_digit (uint8_t usage)
+{
+    if ((usage >= HID_KEY_A) && (usage <= HID_KEY_F))
+    {
+        return 10 + (usage - HID_KEY_A);
+    }
+    if ((usage >= HID_KEY_1) && (usage <= HID_KEY_9))
+    {
+        return 1 + (usage - HID_KEY_1);
+    }
+    if (usage == HID_KEY_0)
+    {
+        return 0;
+    }
+    return -1;
+} // hex_digit
+
+// A key went down, with the modifiers as they are now
+static void key_press (uint8_t usage)
+{
+    int ctrl  = vh.key_down [HID_KEY_CONTROL_LEFT] || vh.key_down [HID_KEY_CONTROL_RIGHT];
+    int shift = vh.key_down [HID_KEY_SHIFT_LEFT] || vh.key_down [HID_KEY_SHIFT_RIGHT];
+    int alt   = vh.key_down [HID_KEY_ALT_LEFT];
+    int altgr = vh.key_down [HID_KEY_ALT_RIGHT];
+    int gui   = vh.key_down [HID_KEY_GUI_LEFT] || vh.key_down [HID_KEY_GUI_RIGHT];
+
+    if ((usage >= HID_KEY_CONTROL_LEFT) && (usage <= HID_KEY_GUI_RIGHT))
+    {
+        return; // Only changes the modifiers
+    }
+    if (usage == HID_KEY_CAPS_LOCK)
+    {
+        vh.caps = !vh.caps;
+    }
+
+    if (vh.uni_on)
+    {
+        int digit = hex_digit (usage);
+        if ((digit >= 0) && (vh.uni_digits < 6))
+        {
+            vh.uni_cp = (vh.uni_cp << 4) | (uint32_t)digit;
+            ++vh.uni_digits;
+            return;
+        }
+        if ((usage == HID_KEY_BACKSPACE) && (vh.uni_digits > 0))
+        {
+            vh.uni_cp >>= 4;
+            --vh.uni_digits;
+            return;
+        }
+        vh.uni_on = 0;
+        if ((usage == HID_KEY_SPACE) || (usage == HID_KEY_ENTER) || (usage == HID_KEY_KEYPAD_ENTER))
+        {
+            if (vh.uni_digits > 0)
+            {
+                put_cp (vh.uni_cp);
+            }
+            return;
+        }
+        if (usage == HID_KEY_ESCAPE)
+        {
+            return;
+        }
+        // Anything else ends the entry, and is then taken as normal
+    }
+    if (ctrl && shift && (usage == HID_KEY_U))
+    {
+        vh.uni_on = 1;
+        vh.uni_cp = 0;
+        vh.uni_digits = 0;
+        return;
+    }
+
+    if (ctrl || alt || gui)
+    {
+        char prefix [8];
+        snprintf (prefix, sizeof (prefix), "%s%s%s", ctrl ? "C-" : "", alt ? "A-" : "", gui ? "W-" : "");
+        put_key (prefix, usage);
+        return;
+    }
+
+    uint32_t sym = 0;
+    if (usage <= HID_KEY_EUROPE_2)
+    {
+        int level = shift;
+        if ((vh.caps) && (usage >= HID_KEY_A) && (usage <= HID_KEY_Z))
+        {
+            level = !level;
+        }
+        sym = gb_keys [usage][level + (altgr ? 2 : 0)];
+    }
+    if (sym == 0)
+    {
+        put_key ("", usage);
+        return;
+    }
+
+    if (IS_DK (sym))
+    {
+        int dead = (int)(sym & 0xFF);
+        if (vh.dead < 0)
+        {
+            vh.dead = dead;
+        }
+        else
+        {
+            if ((vh.dead == dead) && (dead_keys [dead].spacing != 0))
+            {
+                put_cp (dead_keys [dead].spacing); // The same dead key twice
+            }
+            vh.dead = -1;
+        }
+    }
+    else if (vh.dead >= 0)
+    {
+        compose (vh.dead, sym);
+        vh.dead = -1;
+    }
+    else
+    {
+        put_cp (sym);
+    }
+} // key_press
+
+// A key event from the HID driver, only changes of state count
+static void key_event (uint8_t usage, int down)
+{
+    if ((usage == 0) || (vh.key_down [usage] == down))
+    {
+        return;
+    }
+    vh.key_down [usage] = (uint8_t)down;
+    if (down)
+    {
+        key_press (usage);
+    }
+} // key_event
+
+static int in_keys (uint8_t const *keys, uint8_t usage)
+{
+    int idx;
+    for (idx = 0; idx < 6; ++idx)
+    {
+        if (keys [idx] == usage)
+        {
+            return 1;
+        }
+    }
+    return 0;
+} // in_keys
+
+// Start again, with nothing typed and no keys down
+void vhost_reset (void)
+{
+    memset (&vh, 0, sizeof (vh));
+    vh.dead = -1;
+} // vhost_reset
+
+// Count the reports and frames from here on, e.g. from a key going down
+void vhost_mark (void)
+{
+    vh.reports = 0;
+} // vhost_mark
+
+// Take a report from the keyboard (the report ID, then the report itself)
+void vhost_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    int idx;
+
+    if (vh.reports == 0)
+    {
+        vh.first_us = t_us;
+    }
+    vh.last_us = t_us;
+    ++vh.reports;
+
+    if ((report_id == REPORT_ID_KEYBOARD) && (len >= 8))
+    {
+        uint8_t const *was = vh.last_kbd;
+        /* The modifier bits come first, each one every time, then the key
+         * array slot by slot: the old key let go if it has gone, then the new
+         * one pressed if it is new. The same key can be both a modifier bit and
+         * in the array, the last event for it wins. */
+        for (idx = 0; idx < 8; ++idx)
+        {
+            key_event ((uint8_t)(HID_KEY_CONTROL_LEFT + idx), (report [0] >> idx) & 1);
+        }
+        for (idx = 2; idx < 8; ++idx)
+        {
+            if (!in_keys (&report [2], was [idx]))
+            {
+                key_event (was [idx], 0);
+            }
+            if (!in_keys (&was [2], report [idx]))
+            {
+                key_event (report [idx], 1);
+            }
+        }
+        memcpy (vh.last_kbd, report, 8);
+    }
+    else if ((report_id == REPORT_ID_CONSUMER_CONTROL) && (len >= 2))
+    {
+        uint16_t usage = (uint16_t)(report [0] | (report [1] << 8));
+        if ((usage != 0) && (usage != vh.last_con))
+        {
+            char buf [40];
+            snprintf (buf, sizeof (buf), "<con_%04X>", usage);
+            for (idx = 0; idx < (int)(sizeof (con_names) / sizeof (con_names [0])); ++idx)
+            {
+                if (con_names [idx].usage == usage)
+                {
+                    snprintf (buf, sizeof (buf), "<%s>", con_names [idx].name);
+                }
+            }
+            put_str (buf);
+        }
+        vh.last_con = usage;
+    }
+} // vhost_report
+
+// The text typed so far, UTF-8
+char const *vhost_text (void)
+{
+    if (vh.dead < 0)
+    {
+        return vh.text;
+    }
+    snprintf (show, sizeof (show), "%s<%s>", vh.text, dead_keys [vh.dead].name);
+    return show;
+} // vhost_text
+
+// The keyboard LEDs the host would set (KEYBOARD_LED_xxx)
+uint8_t vhost_leds (void)
+{
+    return vh.caps ? KEYBOARD_LED_CAPSLOCK : 0;
+} // vhost_leds
+
+// Reports of any kind taken since the last vhost_mark()
+uint32_t vhost_reports (void)
+{
+    return vh.reports;
+} // vhost_reports
+
+// USB frames (ms) from the first report to the last
+uint32_t vhost_frames (void)
+{
+    if (vh.reports == 0)
+    {
+        return 0;
+    }
+    return (uint32_t)((vh.last_us - vh.first_us) / 1000) + 1;
+} // vhost_frames
+
+/* End of File */
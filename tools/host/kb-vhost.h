@@ -0,0 +1,45 @@
+/*
+ * Header file for the virtual host - a model of a Linux PC with the UK (gb)
+ * xkb key map, at the other end of the host build's USB (see kb-mock.h).
+ *
+ * It takes the HID reports the firmware sends and works out the text they
+ * would type, as the kernel and xkb would:
+ *   - Key presses and releases are found by comparing each keyboard report
+ *     with the one before, in the order the Linux HID driver sends them.
+ *   - The four xkb levels: Shift, AltGr (Right Alt) and both. Caps Lock
+ *     swaps the case of the letters.
+ *   - Dead keys, composed with the next key as the en_US.UTF-8 Compose table
+ *     does for the Latin-1 letters, or dropped if there is no such letter.
+ *   - IBus Unicode entry: CTRL + SHIFT + U, hex digits, then SPACE or ENTER.
+ *   - Keys that do not type text are shown by name, e.g. <Up>, <C-c>, and a
+ *     dead key still waiting at the end as e.g. <dead_grave>.
+ * Key repeat is not modelled, each press types once however long it is held.
+ * It also counts the reports, and the USB frames they span, from a mark set
+ * with vhost_mark(), to give the cost of typing each character.
+ */
+
+#ifndef _KB_VHOST_H_
+#define _KB_VHOST_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// defined in kb-vhost.c
+extern void vhost_reset (void);
+extern void vhost_mark (void);
+extern void vhost_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len);
+extern char const *vhost_text (void);
+extern uint8_t vhost_leds (void);
+extern uint32_t vhost_reports (void);
+extern uint32_t vhost_frames (void);
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _KB_VHOST_H_ */
+
+/* End of File */
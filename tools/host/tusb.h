@@ -0,0 +1,326 @@
+/*
+ * Mock TinyUSB header for the host build of the keyboard logic (see kb-hal.h).
+ * Only what the scanner, decoder and report code use: the HID key codes and
+ * usages, and the device calls, which kb-mock.c implements. The values are
+ * the USB HID usage table ones, as in TinyUSB's hid.h.
+ */
+
+#ifndef _MOCK_TUSB_H_
+#define _MOCK_TUSB_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+// No CDC serial port on the host, and the USB drive only for kb-msc-image (KB_HOST_DRIVE)
+#define CFG_TUD_CDC  0
+#ifndef CFG_TUD_MSC
+#define CFG_TUD_MSC  0
+#endif
+
+typedef enum
+{
+    HID_REPORT_TYPE_INVALID = 0,
+    HID_REPORT_TYPE_INPUT,
+    HID_REPORT_TYPE_OUTPUT,
+    HID_REPORT_TYPE_FEATURE
+} hid_report_type_t;
+
+#define KEYBOARD_MODIFIER_LEFTCTRL   0x01
+#define KEYBOARD_MODIFIER_LEFTSHIFT  0x02
+#define KEYBOARD_MODIFIER_LEFTALT    0x04
+#define KEYBOARD_MODIFIER_LEFTGUI    0x08
+#define KEYBOARD_MODIFIER_RIGHTCTRL  0x10
+#define KEYBOARD_MODIFIER_RIGHTSHIFT 0x20
+#define KEYBOARD_MODIFIER_RIGHTALT   0x40
+#define KEYBOARD_MODIFIER_RIGHTGUI   0x80
+
+#define KEYBOARD_LED_NUMLOCK    0x01
+#define KEYBOARD_LED_CAPSLOCK   0x02
+#define KEYBOARD_LED_SCROLLLOCK 0x04
+
+// Consumer page usages
+#define HID_USAGE_CONSUMER_BRIGHTNESS_INCREMENT 0x006F
+#define HID_USAGE_CONSUMER_BRIGHTNESS_DECREMENT 0x0070
+#define HID_USAGE_CONSUMER_SCAN_NEXT            0x00B5
+#define HID_USAGE_CONSUMER_SCAN_PREVIOUS        0x00B6
+#define HID_USAGE_CONSUMER_PLAY_PAUSE           0x00CD
+#define HID_USAGE_CONSUMER_MUTE                 0x00E2
+#define HID_USAGE_CONSUMER_VOLUME_INCREMENT     0x00E9
+#define HID_USAGE_CONSUMER_VOLUME_DECREMENT     0x00EA
+
+// Keyboard page usages
+#define HID_KEY_NONE             0x00
+#define HID_KEY_A                0x04
+#define HID_KEY_B                0x05
+#define HID_KEY_C                0x06
+#define HID_KEY_D                0x07
+#define HID_KEY_E                0x08
+#define HID_KEY_F                0x09
+#define HID_KEY_G                0x0A
+#define HID_KEY_H                0x0B
+#define HID_KEY_I                0x0C
+#define HID_KEY_J                0x0D
+#define HID_KEY_K                0x0E
+#define HID_KEY_L                0x0F
+#define HID_KEY_M                0x10
+#define HID_KEY_N                0x11
+#define HID_KEY_O                0x12
+#define HID_KEY_P                0x13
+#define HID_KEY_Q                0x14
+#define HID_KEY_R                0x15
+#define HID_KEY_S                0x16
+#define HID_KEY_T                0x17
+#define HID_KEY_U                0x18
+#define HID_KEY_V                0x19
+#define HID_KEY_W                0x1A
+#define HID_KEY_X                0x1B
+#define HID_KEY_Y                0x1C
+#define HID_KEY_Z                0x1D
+#define HID_KEY_1                0x1E
+#define HID_KEY_2                0x1F
+#define HID_KEY_3                0x20
+#define HID_KEY_4                0x21
+#define HID_KEY_5                0x22
+#define HID_KEY_6                0x23
+#define HID_KEY_7                0x24
+#define HID_KEY_8                0x25
+#define HID_KEY_9                0x26
+#define HID_KEY_0                0x27
+#define HID_KEY_ENTER            0x28
+#define HID_KEY_ESCAPE           0x29
+#define HID_KEY_BACKSPACE        0x2A
+#define HID_KEY_TAB              0x2B
+#define HID_KEY_SPACE            0x2C
+#define HID_KEY_MINUS            0x2D
+#define HID_KEY_EQUAL            0x2E
+#define HID_KEY_BRACKET_LEFT     0x2F
+#define HID_KEY_BRACKET_RIGHT    0x30
+#define HID_KEY_BACKSLASH        0x31
+#define HID_KEY_EUROPE_1         0x32
+#define HID_KEY_SEMICOLON        0x33
+#define HID_KEY_APOSTROPHE       0x34
+#define HID_KEY_GRAVE            0x35
+#define HID_KEY_COMMA            0x36
+#define HID_KEY_PERIOD           0x37
+#define HID_KEY_SLASH            0x38
+#define HID_KEY_CAPS_LOCK        0x39
+#define HID_KEY_F1               0x3A
+#define HID_KEY_F2               0x3B
+#define HID_KEY_F3               0x3C
+#define HID_KEY_F4               0x3D
+#define HID_KEY_F5               0x3E
+#define HID_KEY_F6               0x3F
+#define HID_KEY_F7               0x40
+#define HID_KEY_F8               0x41
+#define HID_KEY_F9               0x42
+#define HID_KEY_F10              0x43
+#define HID_KEY_F11              0x44
+#define HID_KEY_F12              0x45
+#define HID_KEY_PRINT_SCREEN     0x46
+#define HID_KEY_SCROLL_LOCK      0x47
+#define HID_KEY_PAUSE            0x48
+#define HID_KEY_INSERT           0x49
+#define HID_KEY_HOME             0x4A
+#define HID_KEY_PAGE_UP          0x4B
+#define HID_KEY_DELETE           0x4C
+#define HID_KEY_END              0x4D
+#define HID_KEY_PAGE_DOWN        0x4E
+#define HID_KEY_ARROW_RIGHT      0x4F
+#define HID_KEY_ARROW_LEFT       0x50
+#define HID_KEY_ARROW_DOWN       0x51
+#define HID_KEY_ARROW_UP         0x52
+#define HID_KEY_NUM_LOCK         0x53
+#define HID_KEY_KEYPAD_ENTER     0x58
+#define HID_KEY_EUROPE_2         0x64
+#define HID_KEY_APPLICATION      0x65
+#define HID_KEY_CONTROL_LEFT     0xE0
+#define HID_KEY_SHIFT_LEFT       0xE1
+#define HID_KEY_ALT_LEFT         0xE2
+#define HID_KEY_GUI_LEFT         0xE3
+#define HID_KEY_CONTROL_RIGHT    0xE4
+#define HID_KEY_SHIFT_RIGHT      0xE5
+#define HID_KEY_ALT_RIGHT        0xE6
+#define HID_KEY_GUI_RIGHT        0xE7
+
+// ASCII to { shift, key code }, for a US key map
+#define HID_ASCII_TO_KEYCODE \
+    { 0, 0 }, /* 0x00 */ \
+    { 0, 0 }, /* 0x01 */ \
+    { 0, 0 }, /* 0x02 */ \
+    { 0, 0 }, /* 0x03 */ \
+    { 0, 0 }, /* 0x04 */ \
+    { 0, 0 }, /* 0x05 */ \
+    { 0, 0 }, /* 0x06 */ \
+    { 0, 0 }, /* 0x07 */ \
+    { 0, HID_KEY_BACKSPACE }, /* 0x08 */ \
+    { 0, HID_KEY_TAB }, /* 0x09 */ \
+    { 0, HID_KEY_ENTER }, /* 0x0A */ \
+    { 0, 0 }, /* 0x0B */ \
+    { 0, 0 }, /* 0x0C */ \
+    { 0, HID_KEY_ENTER }, /* 0x0D */ \
+    { 0, 0 }, /* 0x0E */ \
+    { 0, 0 }, /* 0x0F */ \
+    { 0, 0 }, /* 0x10 */ \
+    { 0, 0 }, /* 0x11 */ \
+    { 0, 0 }, /* 0x12 */ \
+    { 0, 0 }, /* 0x13 */ \
+    { 0, 0 }, /* 0x14 */ \
+    { 0, 0 }, /* 0x15 */ \
+    { 0, 0 }, /* 0x16 */ \
+    { 0, 0 }, /* 0x17 */ \
+    { 0, 0 }, /* 0x18 */ \
+    { 0, 0 }, /* 0x19 */ \
+    { 0, 0 }, /* 0x1A */ \
+    { 0, HID_KEY_ESCAPE }, /* 0x1B */ \
+    { 0, 0 }, /* 0x1C */ \
+    { 0, 0 }, /* 0x1D */ \
+    { 0, 0 }, /* 0x1E */ \
+    { 0, 0 }, /* 0x1F */ \
+    { 0, HID_KEY_SPACE }, /* 0x20 */ \
+    { 1, HID_KEY_1 }, /* 0x21 */ \
+    { 1, HID_KEY_APOSTROPHE }, /* 0x22 */ \
+    { 1, HID_KEY_3 }, /* 0x23 */ \
+    { 1, HID_KEY_4 }, /* 0x24 */ \
+    { 1, HID_KEY_5 }, /* 0x25 */ \
+    { 1, HID_KEY_7 }, /* 0x26 */ \
+    { 0, HID_KEY_APOSTROPHE }, /* 0x27 */ \
+    { 1, HID_KEY_9 }, /* 0x28 */ \
+    { 1, HID_KEY_0 }, /* 0x29 */ \
+    { 1, HID_KEY_8 }, /* 0x2A */ \
+    { 1, HID_KEY_EQUAL }, /* 0x2B */ \
+    { 0, HID_KEY_COMMA }, /* 0x2C */ \
+    { 0, HID_KEY_MINUS }, /* 0x2D */ \
+    { 0, HID_KEY_PERIOD }, /* 0x2E */ \
+    { 0, HID_KEY_SLASH }, /* 0x2F */ \
+    { 0, HID_KEY_0 }, /* 0x30 */ \
+    { 0, HID_KEY_1 }, /* 0x31 */ \
+    { 0, HID_KEY_2 }, /* 0x32 */ \
+    { 0, HID_KEY_3 }, /* 0x33 */ \
+    { 0, HID_KEY_4 }, /* 0x34 */ \
+    { 0, HID_KEY_5 }, /* 0x35 */ \
+    { 0, HID_KEY_6 }, /* 0x36 */ \
+    { 0, HID_KEY_7 }, /* 0x37 */ \
+    { 0, HID_KEY_8 }, /* 0x38 */ \
+    { 0, HID_KEY_9 }, /* 0x39 */ \
+    { 1, HID_KEY_SEMICOLON }, /* 0x3A */ \
+    { 0, HID_KEY_SEMICOLON }, /* 0x3B */ \
+    { 1, HID_KEY_COMMA }, /* 0x3C */ \
+    { 0, HID_KEY_EQUAL }, /* 0x3D */ \
+    { 1, HID_KEY_PERIOD }, /* 0x3E */ \
+    { 1, HID_KEY_SLASH }, /* 0x3F */ \
+    { 1, HID_KEY_2 }, /* 0x40 */ \
+    { 1, HID_KEY_A }, /* 0x41 */ \
+    { 1, HID_KEY_B }, /* 0x42 */ \
+    { 1, HID_KEY_C }, /* 0x43 */ \
+    { 1, HID_KEY_D }, /* 0x44 */ \
+    { 1, HID_KEY_E }, /* 0x45 */ \
+    { 1, HID_KEY_F }, /* 0x46 */ \
+    { 1, HID_KEY_G }, /* 0x47 */ \
+    { 1, HID_KEY_H }, /* 0x48 */ \
+    { 1, HID_KEY_I }, /* 0x49 */ \
+    { 1, HID_KEY_J }, /* 0x4A */ \
+    { 1, HID_KEY_K }, /* 0x4B */ \
+    { 1, HID_KEY_L }, /* 0x4C */ \
+    { 1, HID_KEY_M }, /* 0x4D */ \
+    { 1, HID_KEY_N }, /* 0x4E */ \
+    { 1, HID_KEY_O }, /* 0x4F */ \
+    { 1, HID_KEY_P }, /* 0x50 */ \
+    { 1, HID_KEY_Q }, /* 0x51 */ \
+    { 1, HID_KEY_R }, /* 0x52 */ \
+    { 1, HID_KEY_S }, /* 0x53 */ \
+    { 1, HID_KEY_T }, /* 0x54 */ \
+    { 1, HID_KEY_U }, /* 0x55 */ \
+    { 1, HID_KEY_V }, /* 0x56 */ \
+    { 1, HID_KEY_W }, /* 0x57 */ \
+    { 1, HID_KEY_X }, /* 0x58 */ \
+    { 1, HID_KEY_Y }, /* 0x59 */ \
+    { 1, HID_KEY_Z }, /* 0x5A */ \
+    { 0, HID_KEY_BRACKET_LEFT }, /* 0x5B */ \
+    { 0, HID_KEY_BACKSLASH }, /* 0x5C */ \
+    { 0, HID_KEY_BRACKET_RIGHT }, /* 0x5D */ \
+    { 1, HID_KEY_6 }, /* 0x5E */ \
+    { 1, HID_KEY_MINUS }, /* 0x5F */ \
+    { 0, HID_KEY_GRAVE }, /* 0x60 */ \
+    { 0, HID_KEY_A }, /* 0x61 */ \
+    { 0, HID_KEY_B }, /* 0x62 */ \
+    { 0, HID_KEY_C }, /* 0x63 */ \
+    { 0, HID_KEY_D }, /* 0x64 */ \
+    { 0, HID_KEY_E }, /* 0x65 */ \
+    { 0, HID_KEY_F }, /* 0x66 */ \
+    { 0, HID_KEY_G }, /* 0x67 */ \
+    { 0, HID_KEY_H }, /* 0x68 */ \
+    { 0, HID_KEY_I }, /* 0x69 */ \
+    { 0, HID_KEY_J }, /* 0x6A */ \
+    { 0, HID_KEY_K }, /* 0x6B */ \
+    { 0, HID_KEY_L }, /* 0x6C */ \
+    { 0, HID_KEY_M }, /* 0x6D */ \
+    { 0, HID_KEY_N }, /* 0x6E */ \
+    { 0, HID_KEY_O }, /* 0x6F */ \
+    { 0, HID_KEY_P }, /* 0x70 */ \
+    { 0, HID_KEY_Q }, /* 0x71 */ \
+    { 0, HID_KEY_R }, /* 0x72 */ \
+    { 0, HID_KEY_S }, /* 0x73 */ \
+    { 0, HID_KEY_T }, /* 0x74 */ \
+    { 0, HID_KEY_U }, /* 0x75 */ \
+    { 0, HID_KEY_V }, /* 0x76 */ \
+    { 0, HID_KEY_W }, /* 0x77 */ \
+    { 0, HID_KEY_X }, /* 0x78 */ \
+    { 0, HID_KEY_Y }, /* 0x79 */ \
+    { 0, HID_KEY_Z }, /* 0x7A */ \
+    { 1, HID_KEY_BRACKET_LEFT }, /* 0x7B */ \
+    { 1, HID_KEY_BACKSLASH }, /* 0x7C */ \
+    { 1, HID_KEY_BRACKET_RIGHT }, /* 0x7D */ \
+    { 1, HID_KEY_GRAVE }, /* 0x7E */ \
+    { 0, HID_KEY_DELETE }, /* 0x7F */
+
+// Device calls, the mocks are in kb-mock.c
+extern bool tusb_init (void);
+extern void tud_task (void);
+extern bool tud_mounted (void);
+extern bool tud_suspended (void);
+extern bool tud_remote_wakeup (void);
+extern bool tud_hid_ready (void);
+extern bool tud_hid_report (uint8_t report_id, void const *report, uint16_t len);
+extern bool tud_hid_keyboard_report (uint8_t report_id, uint8_t modifier, uint8_t const keycode [6]);
+extern bool tud_hid_mouse_report (uint8_t report_id, uint8_t buttons, int8_t x, int8_t y, int8_t vertical, int8_t horizontal);
+
+// Callbacks, in usb-stack.c
+extern void tud_mount_cb (void);
+extern void tud_umount_cb (void);
+extern void tud_suspend_cb (bool remote_wakeup_en);
+extern void tud_resume_cb (void);
+extern void tud_hid_report_complete_cb (uint8_t instance, uint8_t const *report, uint8_t len);
+extern uint16_t tud_hid_get_report_cb (uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen);
+extern void tud_hid_set_report_cb (uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const *buffer, uint16_t bufsize);
+
+#if CFG_TUD_MSC
+// The USB drive (kb-msc.c), the SCSI values as in TinyUSB's msc.h
+#define SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL 0x1E
+#define SCSI_SENSE_ILLEGAL_REQUEST            0x05
+
+// The mock is in the tool, kb-msc-image.c
+extern bool tud_msc_set_sense (uint8_t lun, uint8_t sense_key, uint8_t add_sense_code, uint8_t add_sense_qualifier);
+
+// Callbacks, in kb-msc.c
+extern void tud_msc_inquiry_cb (uint8_t lun, uint8_t vendor_id [8], uint8_t product_id [16], uint8_t product_rev [4]);
+extern bool tud_msc_test_unit_ready_cb (uint8_t lun);
+extern void tud_msc_capacity_cb (uint8_t lun, uint32_t *block_count, uint16_t *block_size);
+extern bool tud_msc_start_stop_cb (uint8_t lun, uint8_t power_condition, bool start, bool load_eject);
+extern bool tud_msc_is_writable_cb (uint8_t lun);
+extern int32_t tud_msc_read10_cb (uint8_t lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize);
+extern int32_t tud_msc_write10_cb (uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize);
+extern int32_t tud_msc_scsi_cb (uint8_t lun, uint8_t const scsi_cmd [16], void *buffer, uint16_t bufsize);
+#endif // CFG_TUD_MSC
+
+#ifdef __cplusplus
+ }
+#endif
+
+#endif /* _MOCK_TUSB_H_ */
+
+/* End of File */
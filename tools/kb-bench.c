@@ -0,0 +1,611 @@
+/* kb-bench - time the scan-to-report pipeline on typing traces
+ *
+ * Replays typing traces through the firmware's own scanner, debounce, decoder
+ * and report code, built for the host on the mock hardware (see
+ * host/kb-mock.h), and measures what each one costs. Each trace is run in a
+ * process of its own, so it starts from a freshly booted keyboard.
+ *
+ * Usage: kb-bench [-r repeat] [file...]
+ *   Without files, runs the built-in synthetic traces:
+ *     prose   - English text at 120 WPM, with some overlap between keys
+ *     code    - C source at 150 WPM, with Shift and Ctrl on many keys
+ *     symbols - bursts of Code-II special symbols (AltGr and dead keys)
+ *     chatter - the prose again, with every key bouncing as it goes down and up
+ *   Each file is a recording, as printed by "kb-rec-dump -f" (see kb-sim).
+ *   -r plays each trace that many times over, back to back (default 1).
+ *   -f prints the built-in trace named as a recording instead, for kb-sim, or
+ *      for "kb-fuzz -c" to make a seed for the fuzz corpus (tools/corpus/).
+ *
+ * Prints one CSV line per trace, after a header line:
+ *   trace         - its name, or the file name
+ *   chars         - keys pressed, not counting the modifiers
+ *   events        - key changes in the trace (down and up, bounces too)
+ *   sim_ms        - how long it runs for on the keyboard's clock
+ *   scans         - full matrix scans
+ *   reports       - HID reports sent
+ *   wall_ms       - how long it took on this machine
+ *   ns_scan       - wall time per scan (with core-0's share)
+ *   ns_event      - wall time per key change
+ *   reports_char  - HID reports per key pressed
+ *   fifo_hwm      - most words waiting in the core-1 to core-0 FIFO
+ *   kc_hwm        - most key codes waiting in kc_buf
+ *   fifo_drops, kc_drops, ghosts, bounces - the firmware's own counters
+ * The wall times depend on the machine, so only compare them from one run to
+ * the next on the same one. Everything else is the same on every run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-telem.h"
+#include "kb-mock.h"
+
+// Key codes, as in fw-kb-main.c
+#define KC_B_P  23
+#define KC_CER  128
+#define KC_YEN  133
+#define KC_NSQ  140
+#define KC_CED  141
+#define KC_OHM  142
+#define KC_Aac  143
+#define KC_Egr  144
+#define KC_Ugr  145
+#define KC_Agr  146
+#define KC_CD2  202
+#define KC_SHF  203
+#define KC_CTR  205
+#define KC_MODS 200 // Codes from here on are modifiers
+
+#define BENCH_START_US  100000 // When a trace starts, so the scanner has settled
+#define BENCH_TAIL_US   500000 // How long to run on after it, for the queues to empty
+#define BENCH_MOD_US    20000  // A modifier goes down this long before its key, and up after it
+#define BENCH_BOUNCE_US 3000   // Time between the bounces of a chattering key, just over a scan
+#define BENCH_BOUNCES   2      // Extra changes each way, for a chattering key
+
+// One key change, at a time from the start of the trace
+typedef struct
+{
+    uint32_t t_us;
+    uint32_t seq;  // Order they were added, to keep changes at the same time in order
+    uint8_t  key;  // Keymap index, row * COL_SZ + col
+    uint8_t  down;
+} bench_event;
+
+typedef struct
+{
+    char const  *name;
+    bench_event *ev;
+    int          n_ev;
+    int          max_ev;
+    uint32_t     chars;
+} bench_trace;
+
+static kb_config const *cfg;
+
+static void add_event (bench_trace *tr, uint32_t t_us, int key, int down)
+{
+    if (tr->n_ev == tr->max_ev)
+    {
+        tr->max_ev = (tr->max_ev) ? (tr->max_ev * 2) : 256;
+        tr->ev = realloc (tr->ev, tr->max_ev * sizeof (bench_event));
+        if (tr->ev == NULL)
+        {
+            perror ("kb-bench");
+            exit (1);
+        }
+    }
+    tr->ev [tr->n_ev].t_us = t_us;
+    tr->ev [tr->n_ev].seq = (uint32_t)tr->n_ev;
+    tr->ev [tr->n_ev].key = (uint8_t)key;
+    tr->ev [tr->n_ev].down = (uint8_t)down;
+    ++tr->n_ev;
+} // add_event
+
+static int cmp_event (void const *a, void const *b)
+{
+    bench_event const *ea = a;
+    bench_event const *eb = b;
+    if (ea->t_us != eb->t_us)
+    {
+        return (ea->t_us < eb->t_us) ? -1 : 1;
+    }
+    return (ea->seq < eb->seq) ? -1 : (ea->seq > eb->seq);
+} // cmp_event
+
+static int find_key (int layer, uint8_t code)
+{
+    int idx;
+    for (idx = 0; idx < CFG_KEYS; ++idx)
+    {
+        if (cfg->keys [layer][idx] == code)
+        {
+            return idx;
+        }
+    }
+    return -1;
+} // find_key
+
+// The modifiers a key can need, and their keymap indexes
+#define MOD_SHF 0
+#define MOD_CD2 1
+#define MOD_CTR 2
+#define MOD_N   3
+
+static int mod_keys [MOD_N];
+
+// The keymap index for a code (-1 if it has none), and the modifiers it needs
+
+static int resolve (uint8_t code, int *need)
+{
+    static char const shifted [] = "!@#$%^&*()_+:\"<>?~";
+    static char const plain []   = "1234567890-=;',./`";
+    char const *p;
+    int idx;
+
+    for (idx = 0; idx < MOD_N; ++idx)
+    {
+        need [idx] = 0;
+    }
+    if ((code >= 1) && (code <= 26) && (code != '\t') && (code != '\n'))
+    {
+        need [MOD_CTR] = 1; // Ctrl + letter
+        code = (uint8_t)('a' + code - 1);
+    }
+    else if ((code >= 'A') && (code <= 'Z'))
+    {
+        need [MOD_SHF] = 1;
+        code = (uint8_t)(code - 'A' + 'a');
+    }
+    else if ((code != 0) && (code < 0x80) && ((p = strchr (shifted, code)) != NULL))
+    {
+        need [MOD_SHF] = 1;
+        code = (uint8_t)plain [p - shifted];
+    }
+
+    if (code == '\\')
+    {
+        code = KC_B_P; // The UK backslash key
+    }
+    idx = find_key (CFG_LAYER_BASE, code);
+    if (idx < 0)
+    {
+        idx = find_key (CFG_LAYER_CD2, code);
+        need [MOD_CD2] = 1;
+    }
+    return idx;
+} // resolve
+
+// A key change, bouncing first if chatter is set
+static void key_change (bench_trace *tr, uint32_t t_us, int key, int down, int chatter)
+{
+    int idx;
+    if (chatter)
+    {
+        for (idx = 0; idx < BENCH_BOUNCES; ++idx)
+        {
+            add_event (tr, t_us, key, down);
+            t_us += BENCH_BOUNCE_US;
+            add_event (tr, t_us, key, !down);
+            t_us += BENCH_BOUNCE_US;
+        }
+    }
+    add_event (tr, t_us, key, down);
+} // key_change
+
+/* Type the codes from t_us on, one every gap_us, each held for hold_us (which
+ * can be longer than gap_us, to overlap the keys). The modifiers a key needs
+ * go down before it, and stay down while the next keys need them too. Keys
+ * only overlap when they need the same modifiers. Returns when it is done. */
+static uint32_t type_codes (bench_trace *tr, uint32_t t_us, uint8_t const *codes, int n,
+                            uint32_t gap_us, uint32_t hold_us, int chatter)
+{
+    int held [MOD_N] = { 0, 0, 0 };
+    uint32_t last_up = t_us;
+    int idx;
+    int mod;
+
+    for (idx = 0; idx < n; ++idx)
+    {
+        int need [MOD_N];
+        int key = resolve (codes [idx], need);
+        if (key < 0)
+        {
+            fprintf (stderr, "kb-bench: %s: code %u is not in the keymaps, skipped\n", tr->name, codes [idx]);
+            continue;
+        }
+        if (memcmp (need, held, sizeof (held)) != 0)
+        {
+            // Let the last key go before the modifiers change
+            if (t_us < last_up + BENCH_MOD_US)
+            {
+                t_us = last_up + BENCH_MOD_US;
+            }
+            for (mod = 0; mod < MOD_N; ++mod)
+            {
+                if (held [mod] && !need [mod])
+                {
+                    key_change (tr, t_us - BENCH_MOD_US / 2, mod_keys [mod], 0, chatter);
+                }
+            }
+            t_us += BENCH_MOD_US;
+            for (mod = 0; mod < MOD_N; ++mod)
+            {
+                if (need [mod] && !held [mod])
+                {
+                    key_change (tr, t_us - BENCH_MOD_US / 2, mod_keys [mod], 1, chatter);
+                }
+                held [mod] = need [mod];
+            }
+        }
+        key_change (tr, t_us, key, 1, chatter);
+        key_change (tr, t_us + hold_us, key, 0, chatter);
+        ++tr->chars;
+        last_up = t_us + hold_us;
+        t_us += gap_us;
+    }
+    t_us = last_up + BENCH_MOD_US;
+    for (mod = 0; mod < MOD_N; ++mod)
+    {
+        if (held [mod])
+        {
+            key_change (tr, t_us, mod_keys [mod], 0, chatter);
+        }
+    }
+    return t_us + BENCH_MOD_US;
+} // type_codes
+
+static char const prose_text [] =
+    "It was a bright cold day in April, and the clocks were striking thirteen. "
+    "The quick brown fox jumps over the lazy dog, while five boxing wizards jump quickly. "
+    "Pack my box with five dozen liquor jugs.\n"
+    "Most of what we type is plain lower case text, with a capital now and then, "
+    "a comma here, a full stop there, and a new line at the end of each paragraph.\n";
+
+static char const code_text [] =
+    "int main (int argc, char **argv)\n"
+    "\tif ((argc > 1) && (strcmp (*argv, \"-v\") == 0)) verbose = TRUE;\n"
+    "\tprintf (\"%d: %s\\n\", COUNT_MAX * 2, NAME_OF (x));\n"
+    "\tx = y_max + ~MASK_ALL; return !x;\n"
+    "\x13"      // Ctrl + S, save it
+    "\x02" "m"  // Ctrl + B then m, build it
+    "\n";
+
+static uint8_t const symbol_burst [] = {
+    KC_CER, KC_YEN, KC_Agr, KC_Egr, KC_Ugr, KC_Aac, KC_NSQ, KC_CED, KC_OHM
+};
+
+static void make_text (bench_trace *tr, char const *text, uint32_t gap_us, uint32_t hold_us, int chatter)
+{
+    type_codes (tr, 0, (uint8_t const *)text, (int)strlen (text), gap_us, hold_us, chatter);
+} // make_text
+
+static void make_symbols (bench_trace *tr)
+{
+    uint32_t t_us = 0;
+    int idx;
+    for (idx = 0; idx < 8; ++idx)
+    {
+        // A fast burst, then a pause
+        t_us = type_codes (tr, t_us, symbol_burst, sizeof (symbol_burst), 60000, 50000, 0);
+        t_us += 300000;
+    }
+} // make_symbols
+
+// Load a "kb-rec-dump -f" recording as a trace, returns 0 if it cannot be read
+static int load_trace (bench_trace *tr, char const *path)
+{
+    FILE *fp = fopen (path, "r");
+    if (fp == NULL)
+    {
+        perror (path);
+        return 0;
+    }
+
+    char line [256];
+    int n_line = 0;
+    int first = 1;
+    unsigned long long t0 = 0;
+    uint8_t was [COL_SZ];
+    memset (was, 0, sizeof (was));
+    while (fgets (line, sizeof (line), fp) != NULL)
+    {
+        unsigned long long t_us;
+        unsigned col [COL_SZ];
+        ++n_line;
+        if ((line [0] == '#') || (line [0] == '\n'))
+        {
+            continue;
+        }
+        if (sscanf (line, "%llu %x %x %x %x %x %x %x %x %x %x", &t_us,
+                    &col [0], &col [1], &col [2], &col [3], &col [4],
+                    &col [5], &col [6], &col [7], &col [8], &col [9]) != (COL_SZ + 1))
+        {
+            fprintf (stderr, "%s:%d: not a matrix state, skipped\n", path, n_line);
+            continue;
+        }
+        if (first)
+        {
+            t0 = t_us;
+            first = 0;
+        }
+        else if (t_us < t0)
+        {
+            fprintf (stderr, "%s:%d: time goes backwards, skipped\n", path, n_line);
+            continue;
+        }
+
+        int line_idx;
+        int row;
+        for (line_idx = 0; line_idx < COL_SZ; ++line_idx)
+        {
+            uint8_t diff = (uint8_t)(col [line_idx] ^ was [line_idx]);
+            for (row = 0; row < ROW_SZ; ++row)
+            {
+                if (diff & (1u << row))
+                {
+                    int key = (row * COL_SZ) + line_idx;
+                    int down = (col [line_idx] >> row) & 1;
+                    add_event (tr, (uint32_t)(t_us - t0), key, down);
+                    if ((down) && (cfg->keys [CFG_LAYER_BASE][key] < KC_MODS))
+                    {
+                        ++tr->chars;
+                    }
+                }
+            }
+            was [line_idx] = (uint8_t)col [line_idx];
+        }
+    }
+    fclose (fp);
+    return 1;
+} // load_trace
+
+static uint32_t n_reports = 0;
+
+static void count_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    (void) t_us;
+    (void) report_id;
+    (void) report;
+    (void) len;
+    ++n_reports;
+} // count_report
+
+static uint64_t wall_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000u) + (uint64_t)ts.tv_nsec;
+} // wall_ns
+
+// Play the trace on the keyboard (booted already) and print its line
+static void run_trace (bench_trace *tr, int repeat)
+{
+    uint8_t before [PERF_REPORT_LEN];
+    uint8_t after [PERF_REPORT_LEN];
+    uint8_t down [COL_SZ];
+    int rep;
+    int idx;
+
+    mock_run_until (BENCH_START_US);
+    telem_perf_fill (before, sizeof (before));
+    uint64_t sim0 = mock_now ();
+    uint32_t reports0 = n_reports;
+    uint64_t t0 = wall_ns ();
+
+    memset (down, 0, sizeof (down));
+    for (rep = 0; rep < repeat; ++rep)
+    {
+        uint64_t base = mock_now ();
+        for (idx = 0; idx < tr->n_ev; ++idx)
+        {
+            bench_event const *ev = &tr->ev [idx];
+            mock_run_until (base + ev->t_us);
+            if (ev->down)
+            {
+                down [ev->key % COL_SZ] |= (uint8_t)(1u << (ev->key / COL_SZ));
+            }
+            else
+            {
+                down [ev->key % COL_SZ] &= (uint8_t)~(1u << (ev->key / COL_SZ));
+            }
+            mock_set_keys (down);
+        }
+        mock_run_until (mock_now () + BENCH_TAIL_US);
+    }
+
+    uint64_t wall = wall_ns () - t0;
+    telem_perf_fill (after, sizeof (after));
+    uint64_t sim_us = mock_now () - sim0;
+    uint32_t scans = perf_get32 (&after [PERF_OFS_SCANS]) - perf_get32 (&before [PERF_OFS_SCANS]);
+    uint32_t reports = n_reports - reports0;
+    uint32_t chars = tr->chars * (uint32_t)repeat;
+    uint32_t events = (uint32_t)tr->n_ev * (uint32_t)repeat;
+
+    printf ("%s,%lu,%lu,%.1f,%lu,%lu,%.3f,%.0f,%.0f,%.3f,%lu,%u,%lu,%lu,%lu,%lu\n",
+            tr->name, (unsigned long)chars, (unsigned long)events, sim_us / 1000.0,
+            (unsigned long)scans, (unsigned long)reports, wall / 1000000.0,
+            (scans) ? ((double)wall / scans) : 0.0,
+            (events) ? ((double)wall / events) : 0.0,
+            (chars) ? ((double)reports / chars) : 0.0,
+            (unsigned long)mock_fifo_hwm (), after [PERF_OFS_KC_HWM],
+            (unsigned long)(perf_get32 (&after [PERF_OFS_FIFO_DROP]) - perf_get32 (&before [PERF_OFS_FIFO_DROP])),
+            (unsigned long)(perf_get32 (&after [PERF_OFS_KC_DROP]) - perf_get32 (&before [PERF_OFS_KC_DROP])),
+            (unsigned long)(perf_get32 (&after [PERF_OFS_GHOSTS]) - perf_get32 (&before [PERF_OFS_GHOSTS])),
+            (unsigned long)(perf_get32 (&after [PERF_OFS_BOUNCES]) - perf_get32 (&before [PERF_OFS_BOUNCES])));
+    fflush (stdout);
+} // run_trace
+
+/* Build the trace, a built-in one by its name, or the recording at path, on
+ * a keyboard booted already. Returns 0 if it cannot. */
+static int make_trace (bench_trace *tr, char const *name, char const *path)
+{
+    memset (tr, 0, sizeof (*tr));
+    tr->name = name;
+
+    cfg = cfg_live ();
+    mod_keys [MOD_SHF] = find_key (CFG_LAYER_BASE, KC_SHF);
+    mod_keys [MOD_CD2] = find_key (CFG_LAYER_BASE, KC_CD2);
+    mod_keys [MOD_CTR] = find_key (CFG_LAYER_BASE, KC_CTR);
+    if ((mod_keys [MOD_SHF] < 0) || (mod_keys [MOD_CD2] < 0) || (mod_keys [MOD_CTR] < 0))
+    {
+        fprintf (stderr, "kb-bench: Shift, Code-II or Ctrl is not in the basic keymap\n");
+        return 0;
+    }
+
+    if (path != NULL)
+    {
+        if (!load_trace (tr, path))
+        {
+            return 0;
+        }
+    }
+    else if (strcmp (name, "prose") == 0)
+    {
+        make_text (tr, prose_text, 100000, 110000, 0); // 120 WPM is 10 characters a second
+    }
+    else if (strcmp (name, "code") == 0)
+    {
+        make_text (tr, code_text, 80000, 90000, 0);
+    }
+    else if (strcmp (name, "symbols") == 0)
+    {
+        make_symbols (tr);
+    }
+    else if (strcmp (name, "chatter") == 0)
+    {
+        make_text (tr, prose_text, 100000, 110000, 1);
+    }
+    else
+    {
+        fprintf (stderr, "kb-bench: no trace called %s\n", name);
+        return 0;
+    }
+    qsort (tr->ev, tr->n_ev, sizeof (bench_event), cmp_event);
+    return 1;
+} // make_trace
+
+/* Print a built-in trace as a recording, as "kb-rec-dump -f" would: the keys
+ * down after each change, a line for each time any change. kb-fuzz -c turns
+ * it into a seed for its corpus. */
+static int write_trace (char const *name)
+{
+    bench_trace tr;
+    uint8_t down [COL_SZ];
+    int idx;
+    int col;
+
+    mock_init ();
+    if (!make_trace (&tr, name, NULL))
+    {
+        return 0;
+    }
+    printf ("# kb-bench %s trace\n", name);
+    memset (down, 0, sizeof (down));
+    for (idx = 0; idx < tr.n_ev; ++idx)
+    {
+        bench_event const *ev = &tr.ev [idx];
+        if (ev->down)
+        {
+            down [ev->key % COL_SZ] |= (uint8_t)(1u << (ev->key / COL_SZ));
+        }
+        else
+        {
+            down [ev->key % COL_SZ] &= (uint8_t)~(1u << (ev->key / COL_SZ));
+        }
+        if ((idx + 1 < tr.n_ev) && (tr.ev [idx + 1].t_us == ev->t_us))
+        {
+            continue; // More changes at the same time
+        }
+        printf ("%lu", (unsigned long)ev->t_us);
+        for (col = 0; col < COL_SZ; ++col)
+        {
+            printf (" %02X", down [col]);
+        }
+        printf ("\n");
+    }
+    free (tr.ev);
+    return 1;
+} // write_trace
+
+/* Boot a keyboard of its own for the trace, in a child process (the firmware
+ * cannot be reset), build the trace on it and play it. Returns 0 if it fails. */
+static int bench (char const *name, char const *path, int repeat)
+{
+    fflush (stdout);
+    pid_t pid = fork ();
+    if (pid < 0)
+    {
+        perror ("fork");
+        return 0;
+    }
+    if (pid == 0)
+    {
+        bench_trace tr;
+        mock_on_report (count_report);
+        mock_init ();
+        if (!make_trace (&tr, name, path))
+        {
+            _exit (1);
+        }
+        run_trace (&tr, repeat);
+        _exit (0);
+    }
+
+    int status;
+    if ((waitpid (pid, &status, 0) < 0) || (!WIFEXITED (status)) || (WEXITSTATUS (status) != 0))
+    {
+        fprintf (stderr, "kb-bench: %s failed\n", name);
+        return 0;
+    }
+    return 1;
+} // bench
+
+int main (int argc, char **argv)
+{
+    static char const *const synthetic [] = { "prose", "code", "symbols", "chatter" };
+    int repeat = 1;
+    int ok = 1;
+    int opt;
+    int idx;
+
+    while ((opt = getopt (argc, argv, "f:r:")) != -1)
+    {
+        if (opt == 'f')
+        {
+            return write_trace (optarg) ? 0 : 1;
+        }
+        if (opt == 'r')
+        {
+            repeat = atoi (optarg);
+        }
+        if ((opt != 'r') || (repeat < 1))
+        {
+            fprintf (stderr, "usage: %s [-r repeat] [file...] | -f trace\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf ("trace,chars,events,sim_ms,scans,reports,wall_ms,ns_scan,ns_event,reports_char,"
+            "fifo_hwm,kc_hwm,fifo_drops,kc_drops,ghosts,bounces\n");
+    if (optind == argc)
+    {
+        for (idx = 0; idx < (int)(sizeof (synthetic) / sizeof (synthetic [0])); ++idx)
+        {
+            ok &= bench (synthetic [idx], NULL, repeat);
+        }
+    }
+    for (idx = optind; idx < argc; ++idx)
+    {
+        ok &= bench (argv [idx], argv [idx], repeat);
+    }
+    return (ok) ? 0 : 1;
+} // main
+
+/* End of File */
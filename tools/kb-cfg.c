@@ -0,0 +1,782 @@
+/* kb-cfg - read and change the keyboard's keymaps and timings over hidraw
+ *
+ * The keyboard has a vendor defined HID feature report (REPORT_ID_CONFIG)
+ * that carries the config protocol in kb-config.h. Each request is sent with
+ * SET_REPORT and its response read back with GET_REPORT. Changes are staged
+ * on the keyboard and only used once they are committed, all at once,
+ * between two scans of the matrix.
+ *
+ * Usage: kb-cfg [-s | -d /dev/hidrawN] command [args] [, command [args]] ...
+ *   info                     protocol version and sizes
+ *   keys LAYER               show a keymap layer (0 base, 1 HELP, 2 Code-II, 3 BLOCK)
+ *   key LAYER ROW COL CODE   stage one key code
+ *   timing                   show the timings
+ *   timing NAME VALUE        stage a timing (combo, tap, timeout, settle, recover)
+ *   commit                   use the staged changes from the next scan
+ *   revert                   throw away the staged changes
+ *   defaults                 stage the built-in keymaps and timings
+ *   layout us|uk             stage the host key map used to type text
+ *   save                     save the live config to the flash, to be loaded at boot
+ *   store                    show the flash store figures, boot time and write cost
+ *   record [start|stop|flush] show or control the scan recorder (RECORD_ON builds)
+ *   download FILE            copy the recorded pages to FILE, for kb-rec-dump
+ *   prof [reset]             show or reset the phase profiler (PROF_ON builds)
+ *   sched                    show the core-0 tasks, their run times and the scheduler's cost
+ *   power                    show the suspend power state, the wake-ups and the time they took
+ *   watch                    show the core-1 watchdog: heartbeats, stalls and how long recovery took
+ *
+ * Several commands can be given at once, separated by ",".
+ * Without -d, the first hidraw device with the keyboard's vendor ID that
+ * answers is used. -s runs the commands against a simulated keyboard instead,
+ * built from the firmware's own kb-config.c, to try the protocol without one.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include "kb-config.h"
+#include "kb-telem.h"
+#include "kb-record.h"
+#include "kb-prof.h"
+#include "kb-sched.h"
+#include "kb-power.h"
+#include "kb-watch.h"
+#include "usb_descriptors.h"
+
+#define KB_VID     0x0603 // As usb_descriptors.c
+#define KB_TRIES   20     // Requests answered BUSY are tried this many times
+
+static int cfg_fd = -1;   // The hidraw device, or -1 for the simulated keyboard
+static uint8_t cfg_seq = 0;
+
+static const char *const tm_names [CFG_TIMINGS] = { "combo", "tap", "timeout", "settle", "recover" };
+static const char *const tm_units [CFG_TIMINGS] = { "ms", "ms", "ms", "us", "us" };
+
+// The simulated keyboard starts with a test pattern: the layer in the top bits, the key in the rest
+static uint8_t sim_keys [CFG_LAYERS][CFG_KEYS];
+
+static void sim_init (void)
+{
+    uint8_t const *layers [CFG_LAYERS];
+    int layer;
+    int idx;
+
+    for (layer = 0; layer < CFG_LAYERS; ++layer)
+    {
+        for (idx = 0; idx < CFG_KEYS; ++idx)
+        {
+            sim_keys [layer][idx] = (uint8_t)((layer << 6) | (idx & 0x3F));
+        }
+        layers [layer] = sim_keys [layer];
+    }
+    cfg_init (layers);
+} // sim_init
+
+// The simulated keyboard has no flash, a save is only counted
+static uint32_t sim_saves = 0;
+
+int store_save (void)
+{
+    ++sim_saves;
+    return CFG_OK;
+} // store_save
+
+int store_info (uint8_t *data, int len)
+{
+    if (len < CFG_STORE_INFO_LEN)
+    {
+        return CFG_ERR_ARG;
+    }
+    memset (data, 0, CFG_STORE_INFO_LEN);
+    perf_put32 (&data [CFG_STORE_SEQ], sim_saves);
+    perf_put16 (&data [CFG_STORE_SAVES], (uint16_t)sim_saves);
+    data [CFG_STORE_SLOT] = sim_saves ? 0 : 0xFF;
+    data [CFG_STORE_SLOTS] = 1;
+    return CFG_OK;
+} // store_info
+
+// ...nor a scan recorder
+int rec_info (uint8_t *data, int len)
+{
+    return CFG_ERR_CMD;
+} // rec_info
+
+int rec_read (uint32_t seq, int ofs, uint8_t *data, int len)
+{
+    return CFG_ERR_CMD;
+} // rec_read
+
+int rec_ctrl (int op)
+{
+    return CFG_ERR_CMD;
+} // rec_ctrl
+
+// ...nor a profiler
+int prof_read (int phase, int ofs, uint8_t *data, int len)
+{
+    return CFG_ERR_CMD;
+} // prof_read
+
+int prof_ctrl (int op)
+{
+    return CFG_ERR_CMD;
+} // prof_ctrl
+
+// ...nor any tasks to schedule
+int sched_info (int task, uint8_t *data, int len)
+{
+    return CFG_ERR_CMD;
+} // sched_info
+
+// ...nor a USB bus to be suspended
+int power_info (uint8_t *data, int len)
+{
+    return CFG_ERR_CMD;
+} // power_info
+
+// ...nor a second core to watch
+int watch_info (uint8_t *data, int len)
+{
+    return CFG_ERR_CMD;
+} // watch_info
+
+// Send a request and read its response, returns 0 or -1
+static int cfg_send (uint8_t *req, uint8_t *resp)
+{
+    if (cfg_fd < 0)
+    {
+        cfg_set_report (req, CFG_REPORT_LEN);
+        cfg_get_report (resp, CFG_REPORT_LEN);
+        return 0;
+    }
+
+    uint8_t buf [CFG_REPORT_LEN + 1];
+    buf[0] = REPORT_ID_CONFIG;
+    memcpy (&buf[1], req, CFG_REPORT_LEN);
+    if (ioctl (cfg_fd, HIDIOCSFEATURE (sizeof (buf)), buf) < 0)
+    {
+        perror ("HIDIOCSFEATURE");
+        return -1;
+    }
+
+    buf[0] = REPORT_ID_CONFIG;
+    int n = ioctl (cfg_fd, HIDIOCGFEATURE (sizeof (buf)), buf);
+    if ((n < (CFG_REPORT_LEN + 1)) || (buf[0] != REPORT_ID_CONFIG))
+    {
+        perror ("HIDIOCGFEATURE");
+        return -1;
+    }
+    memcpy (resp, &buf[1], CFG_REPORT_LEN);
+    return 0;
+} // cfg_send
+
+/* Make a request, trying again whilst the keyboard is busy.
+ * Returns the response status, or -1 if the device failed. */
+static int cfg_request (uint8_t cmd, uint8_t const *args, int n_args, uint8_t *resp)
+{
+    uint8_t req [CFG_REPORT_LEN];
+    int tries;
+
+    memset (req, 0, sizeof (req));
+    req [CFG_OFS_CMD] = cmd;
+    if (n_args > 0)
+    {
+        memcpy (&req [CFG_OFS_ARGS], args, n_args);
+    }
+
+    for (tries = 0; tries < KB_TRIES; ++tries)
+    {
+        req [CFG_OFS_SEQ] = ++cfg_seq;
+        if (cfg_send (req, resp) < 0)
+        {
+            return -1;
+        }
+        if ((resp [CFG_OFS_CMD] != cmd) || (resp [CFG_OFS_SEQ] != cfg_seq))
+        {
+            fprintf (stderr, "response is not for this request\n");
+            return -1;
+        }
+        if (resp [CFG_OFS_STATUS] != CFG_ERR_BUSY)
+        {
+            break;
+        }
+
+        // The keyboard has not taken up the last commit yet, give it a scan
+        if (cfg_fd < 0)
+        {
+            cfg_sync ();
+        }
+        else
+        {
+            usleep (1000);
+        }
+    }
+    return resp [CFG_OFS_STATUS];
+} // cfg_request
+
+static int cfg_status (int status)
+{
+    static const char *const msg [] = { "ok", "unknown command", "bad argument", "busy", "no request" };
+    if (status > 0)
+    {
+        fprintf (stderr, "error: %s\n", (status <= CFG_ERR_NONE) ? msg [status] : "unknown");
+    }
+    return status;
+} // cfg_status
+
+// Show a keymap layer, in matrix order
+static int show_keys (int layer)
+{
+    uint8_t codes [CFG_KEYS];
+    int first;
+
+    for (first = 0; first < CFG_KEYS; first += CFG_KEYS_MAX)
+    {
+        uint8_t args [3];
+        uint8_t resp [CFG_REPORT_LEN];
+        int count = CFG_KEYS - first;
+        if (count > CFG_KEYS_MAX)
+        {
+            count = CFG_KEYS_MAX;
+        }
+        args[0] = (uint8_t)layer;
+        args[1] = (uint8_t)first;
+        args[2] = (uint8_t)count;
+        int status = cfg_request (CFG_CMD_GET_KEYS, args, 3, resp);
+        if (status != CFG_OK)
+        {
+            return cfg_status (status);
+        }
+        memcpy (&codes [first], &resp [CFG_OFS_DATA + 3], count);
+    }
+
+    int row;
+    int col;
+    printf ("layer %d   ", layer);
+    for (col = 0; col < 10; ++col)
+    {
+        printf (" c%d ", col);
+    }
+    printf ("\n");
+    for (row = 0; row < (CFG_KEYS / 10); ++row)
+    {
+        printf ("  row %d   ", row);
+        for (col = 0; col < 10; ++col)
+        {
+            printf (" %02X ", codes [(row * 10) + col]);
+        }
+        printf ("\n");
+    }
+    return 0;
+} // show_keys
+
+static int show_timing (void)
+{
+    uint8_t resp [CFG_REPORT_LEN];
+    int status = cfg_request (CFG_CMD_GET_TIMING, NULL, 0, resp);
+    if (status != CFG_OK)
+    {
+        return cfg_status (status);
+    }
+
+    uint8_t const *data = &resp [CFG_OFS_DATA];
+    int idx;
+    for (idx = 0; (idx < data[0]) && (idx < CFG_TIMINGS); ++idx)
+    {
+        printf ("%-8s %6u %s\n", tm_names [idx], data [1 + (2 * idx)] | (data [2 + (2 * idx)] << 8), tm_units [idx]);
+    }
+    return 0;
+} // show_timing
+
+static int show_store (void)
+{
+    uint8_t resp [CFG_REPORT_LEN];
+    int status = cfg_request (CFG_CMD_STORE_INFO, NULL, 0, resp);
+    if (status != CFG_OK)
+    {
+        return cfg_status (status);
+    }
+
+    uint8_t const *data = &resp [CFG_OFS_DATA];
+    printf ("boot to first scan  %8lu us\n", (unsigned long)perf_get32 (&data [CFG_STORE_BOOT_SCAN]));
+    printf ("boot to USB mount   %8lu us\n", (unsigned long)perf_get32 (&data [CFG_STORE_BOOT_MOUNT]));
+    printf ("newest record       %8lu (slot %u of %u)\n", (unsigned long)perf_get32 (&data [CFG_STORE_SEQ]),
+            data [CFG_STORE_SLOT], data [CFG_STORE_SLOTS]);
+    printf ("saves since boot    %8u\n", perf_get16 (&data [CFG_STORE_SAVES]));
+    printf ("longest write       %8lu us\n", (unsigned long)perf_get32 (&data [CFG_STORE_WRITE_US]));
+    printf ("longest scan gap    %8lu us, during a write\n", (unsigned long)perf_get32 (&data [CFG_STORE_GAP_US]));
+    return 0;
+} // show_store
+
+static int show_record (void)
+{
+    uint8_t resp [CFG_REPORT_LEN];
+    int status = cfg_request (CFG_CMD_REC_INFO, NULL, 0, resp);
+    if (status != CFG_OK)
+    {
+        return cfg_status (status);
+    }
+
+    uint8_t const *data = &resp [CFG_OFS_DATA];
+    printf ("recording           %8s (format %u)\n", data [REC_INFO_ON] ? "on" : "off", data [REC_INFO_VERSION]);
+    printf ("pages written       %8lu (%u in the flash ring)\n", (unsigned long)perf_get32 (&data [REC_INFO_NEXT]),
+            perf_get16 (&data [REC_INFO_PAGES]));
+    printf ("pages waiting       %8u\n", data [REC_INFO_WAIT]);
+    printf ("events lost         %8lu\n", (unsigned long)perf_get32 (&data [REC_INFO_LOST]));
+    return 0;
+} // show_record
+
+#define PH_NAME(id, name) name,
+static const char *const ph_names [PH_COUNT] = { PROF_PHASES (PH_NAME) };
+#undef PH_NAME
+
+/* The profiler figures for every phase, in cycles, with the mean in us too.
+ * The histogram columns are the runs under each number of cycles. */
+static int show_prof (void)
+{
+    uint8_t resp [CFG_REPORT_LEN];
+    uint8_t args [2];
+    int phase;
+    int idx;
+
+    for (phase = 0; phase < PH_COUNT; ++phase)
+    {
+        uint8_t rec [PROF_REC_LEN];
+        int mhz = 0;
+        int ofs;
+        for (ofs = 0; ofs < PROF_REC_LEN; )
+        {
+            args[0] = (uint8_t)phase;
+            args[1] = (uint8_t)ofs;
+            int status = cfg_request (CFG_CMD_PROF_READ, args, 2, resp);
+            if (status != CFG_OK)
+            {
+                return cfg_status (status);
+            }
+            uint8_t const *data = &resp [CFG_OFS_DATA];
+            int count = data [4];
+            if ((data [0] != phase) || (data [3] != ofs) || (count == 0) || ((ofs + count) > PROF_REC_LEN))
+            {
+                fprintf (stderr, "bad profiler response\n");
+                return 1;
+            }
+            mhz = data [2];
+            memcpy (&rec [ofs], &data [PROF_READ_HDR], count);
+            ofs += count;
+        }
+
+        if (phase == 0)
+        {
+            printf ("phase     core     count      min     mean      max   mean us |");
+            for (idx = 0; idx < (PROF_BUCKETS - 1); ++idx)
+            {
+                char label [16];
+                unsigned long top = 1ul << (PROF_HIST_SHIFT + (2 * idx));
+                if (top >= 1024)
+                {
+                    snprintf (label, sizeof (label), "<%luK", top >> 10);
+                }
+                else
+                {
+                    snprintf (label, sizeof (label), "<%lu", top);
+                }
+                printf (" %6s", label);
+            }
+            printf ("   more\n");
+        }
+
+        uint32_t count = perf_get32 (&rec [PROF_OFS_COUNT]);
+        uint64_t sum = perf_get32 (&rec [PROF_OFS_SUM]) | ((uint64_t)perf_get32 (&rec [PROF_OFS_SUM + 4]) << 32);
+        uint32_t mean = count ? (uint32_t)(sum / count) : 0;
+        printf ("%-8s %4d %9lu %8lu %8lu %8lu %9.2f |", ph_names [phase], (phase < PH_CORE0) ? 1 : 0,
+                (unsigned long)count, (unsigned long)perf_get32 (&rec [PROF_OFS_MIN]), (unsigned long)mean,
+                (unsigned long)perf_get32 (&rec [PROF_OFS_MAX]), mhz ? ((double)mean / mhz) : 0.0);
+        for (idx = 0; idx < PROF_BUCKETS; ++idx)
+        {
+            printf (" %6lu", (unsigned long)perf_get32 (&rec [PROF_OFS_HIST + (4 * idx)]));
+        }
+        printf ("\n");
+    }
+    return 0;
+} // show_prof
+
+// The core-0 tasks, then the scheduler itself
+static int show_sched (void)
+{
+    uint8_t resp [CFG_REPORT_LEN];
+    uint8_t args [1];
+    int tasks = 1;
+    int task;
+
+    printf ("task         runs   max us  mean us   late us\n");
+    for (task = 0; task < tasks + 2; ++task) // Then the scheduler itself and core-0's sleeps
+    {
+        args[0] = (uint8_t)((task < tasks) ? task : ((task == tasks) ? SCHED_SELF : SCHED_SLEEP));
+        int status = cfg_request (CFG_CMD_SCHED_INFO, args, 1, resp);
+        if (status != CFG_OK)
+        {
+            return cfg_status (status);
+        }
+        uint8_t const *data = &resp [CFG_OFS_DATA];
+        tasks = data [SCHED_INFO_TASKS];
+
+        char name [SCHED_NAME_LEN + 1];
+        memcpy (name, &data [SCHED_INFO_NAME], SCHED_NAME_LEN);
+        name [SCHED_NAME_LEN] = 0;
+        uint32_t runs = perf_get32 (&data [SCHED_INFO_RUNS]);
+        uint32_t total = perf_get32 (&data [SCHED_INFO_TOTAL]);
+        printf ("%-8s %8lu %8lu %8.2f %9lu", name, (unsigned long)runs, (unsigned long)perf_get32 (&data [SCHED_INFO_MAX]),
+                runs ? ((double)total / runs) : 0.0, (unsigned long)perf_get32 (&data [SCHED_INFO_LATE]));
+        if (args[0] == SCHED_SELF)
+        {
+            printf ("  (its own cost, late is the most any task was)");
+        }
+        else if (args[0] == SCHED_SLEEP)
+        {
+            printf ("  (%lu ms in all, late is the most a wake-up was)", (unsigned long)(total / 1000));
+        }
+        printf ("\n");
+    }
+    return 0;
+} // show_sched
+
+// The suspend power state and figures
+static int show_power (void)
+{
+    static const char *const states [] = { "active", "suspended", "waking" }; // PWR_xxx
+    uint8_t resp [CFG_REPORT_LEN];
+    int status = cfg_request (CFG_CMD_POWER_INFO, NULL, 0, resp);
+    if (status != CFG_OK)
+    {
+        return cfg_status (status);
+    }
+    uint8_t const *data = &resp [CFG_OFS_DATA];
+    uint8_t state = data [PWR_INFO_STATE];
+
+    printf ("state               %s%s\n", (state <= PWR_WAKING) ? states [state] : "?",
+            data [PWR_INFO_REMOTE] ? ", remote wake-up allowed" : "");
+    printf ("suspends            %8lu\n", (unsigned long)perf_get32 (&data [PWR_INFO_SUSPENDS]));
+    printf ("woken by a key      %8lu\n", (unsigned long)perf_get32 (&data [PWR_INFO_KEY_WAKES]));
+    printf ("time suspended      %8lu ms\n", (unsigned long)perf_get32 (&data [PWR_INFO_SLEPT_MS]));
+    printf ("clock back, max     %8lu us\n", (unsigned long)perf_get32 (&data [PWR_INFO_CLOCK_US]));
+    printf ("resume to scan, max %8lu us\n", (unsigned long)perf_get32 (&data [PWR_INFO_RESUME_US]));
+    printf ("system clock        %8u MHz, %u MHz suspended\n", data [PWR_INFO_FULL_MHZ], data [PWR_INFO_SLOW_MHZ]);
+    return 0;
+} // show_power
+
+// The core-1 watchdog figures
+static int show_watch (void)
+{
+    static const char *const states [] = { "ok", "recovering", "given up, rebooting" }; // WATCH_xxx
+    uint8_t resp [CFG_REPORT_LEN];
+    int status = cfg_request (CFG_CMD_WATCH_INFO, NULL, 0, resp);
+    if (status != CFG_OK)
+    {
+        return cfg_status (status);
+    }
+    uint8_t const *data = &resp [CFG_OFS_DATA];
+    uint8_t state = data [WATCH_INFO_STATE];
+
+    printf ("state               %s\n", (state <= WATCH_GIVEN_UP) ? states [state] : "?");
+    printf ("core-0 heartbeat    %8lu\n", (unsigned long)perf_get32 (&data [WATCH_INFO_BEAT0]));
+    printf ("core-1 heartbeat    %8lu\n", (unsigned long)perf_get32 (&data [WATCH_INFO_BEAT1]));
+    printf ("core-1 stalls       %8lu\n", (unsigned long)perf_get32 (&data [WATCH_INFO_STALLS]));
+    printf ("recovery, last      %8lu us\n", (unsigned long)perf_get32 (&data [WATCH_INFO_RECOVER_US]));
+    printf ("recovery, max       %8lu us\n", (unsigned long)perf_get32 (&data [WATCH_INFO_RECOVER_MAX]));
+    printf ("not scanning, max   %8lu us\n", (unsigned long)perf_get32 (&data [WATCH_INFO_OUTAGE_MAX]));
+    printf ("watchdog reboots    %8lu\n", (unsigned long)perf_get32 (&data [WATCH_INFO_REBOOTS]));
+    return 0;
+} // show_watch
+
+/* Copy the recorded pages still in the flash to a file, oldest first.
+ * Pages that have been written over are skipped. */
+static int download (const char *path)
+{
+    uint8_t resp [CFG_REPORT_LEN];
+    int status = cfg_request (CFG_CMD_REC_INFO, NULL, 0, resp);
+    if (status != CFG_OK)
+    {
+        return cfg_status (status);
+    }
+    uint32_t next  = perf_get32 (&resp [CFG_OFS_DATA + REC_INFO_NEXT]);
+    uint32_t pages = perf_get16 (&resp [CFG_OFS_DATA + REC_INFO_PAGES]);
+    uint32_t seq   = (next > pages) ? (next - pages) : 0;
+
+    FILE *fp = fopen (path, "wb");
+    if (fp == NULL)
+    {
+        perror (path);
+        return 1;
+    }
+
+    int saved = 0;
+    for (; seq < next; ++seq)
+    {
+        uint8_t page [REC_PAGE_SZ];
+        int ofs = 0;
+        while (ofs < REC_PAGE_SZ)
+        {
+            uint8_t args [5];
+            perf_put32 (args, seq);
+            args[4] = (uint8_t)ofs;
+            status = cfg_request (CFG_CMD_REC_READ, args, 5, resp);
+            if (status != CFG_OK)
+            {
+                break;
+            }
+            int count = resp [CFG_OFS_DATA + 1];
+            memcpy (&page [ofs], &resp [CFG_OFS_DATA + 2], count);
+            ofs += count;
+        }
+        if (status < 0)
+        {
+            fclose (fp);
+            return 1;
+        }
+        if (ofs == REC_PAGE_SZ)
+        {
+            fwrite (page, 1, REC_PAGE_SZ, fp);
+            ++saved;
+        }
+    }
+    fclose (fp);
+    printf ("%d pages saved to %s\n", saved, path);
+    return 0;
+} // download
+
+// Run one command, argv[0] is the command name. Returns 0 if it worked.
+static int run_command (int argc, char **argv)
+{
+    uint8_t args [CFG_REPORT_LEN];
+    uint8_t resp [CFG_REPORT_LEN];
+    const char *cmd = argv[0];
+
+    if ((strcmp (cmd, "info") == 0) && (argc == 1))
+    {
+        int status = cfg_request (CFG_CMD_INFO, NULL, 0, resp);
+        if (status == CFG_OK)
+        {
+            uint8_t const *data = &resp [CFG_OFS_DATA];
+            printf ("version %u, %u layers of %u keys, %u timings, %u keys per request, %s host key map\n",
+                    data[0], data[1], data[2], data[3], data[4], data[5] ? "UK" : "US");
+        }
+        return cfg_status (status);
+    }
+    if ((strcmp (cmd, "keys") == 0) && (argc == 2))
+    {
+        return show_keys (atoi (argv[1]));
+    }
+    if ((strcmp (cmd, "key") == 0) && (argc == 5))
+    {
+        args[0] = (uint8_t)atoi (argv[1]);
+        args[1] = (uint8_t)((atoi (argv[2]) * 10) + atoi (argv[3]));
+        args[2] = 1;
+        args[3] = (uint8_t)strtoul (argv[4], NULL, 0);
+        return cfg_status (cfg_request (CFG_CMD_SET_KEYS, args, 4, resp));
+    }
+    if ((strcmp (cmd, "timing") == 0) && (argc == 1))
+    {
+        return show_timing ();
+    }
+    if ((strcmp (cmd, "timing") == 0) && (argc == 3))
+    {
+        int idx;
+        for (idx = 0; idx < CFG_TIMINGS; ++idx)
+        {
+            if (strcmp (argv[1], tm_names [idx]) == 0)
+            {
+                unsigned long val = strtoul (argv[2], NULL, 0);
+                args[0] = (uint8_t)idx;
+                args[1] = (uint8_t)val;
+                args[2] = (uint8_t)(val >> 8);
+                return cfg_status (cfg_request (CFG_CMD_SET_TIMING, args, 3, resp));
+            }
+        }
+        fprintf (stderr, "unknown timing %s\n", argv[1]);
+        return 1;
+    }
+    if ((strcmp (cmd, "commit") == 0) && (argc == 1))
+    {
+        return cfg_status (cfg_request (CFG_CMD_COMMIT, NULL, 0, resp));
+    }
+    if ((strcmp (cmd, "revert") == 0) && (argc == 1))
+    {
+        return cfg_status (cfg_request (CFG_CMD_REVERT, NULL, 0, resp));
+    }
+    if ((strcmp (cmd, "defaults") == 0) && (argc == 1))
+    {
+        return cfg_status (cfg_request (CFG_CMD_DEFAULTS, NULL, 0, resp));
+    }
+
+    if ((strcmp (cmd, "layout") == 0) && (argc == 2))
+    {
+        if ((strcmp (argv[1], "us") != 0) && (strcmp (argv[1], "uk") != 0))
+        {
+            fprintf (stderr, "unknown host key map %s\n", argv[1]);
+            return 1;
+        }
+        args[0] = (strcmp (argv[1], "uk") == 0) ? 1 : 0; // LAYOUT_UK or LAYOUT_US
+        return cfg_status (cfg_request (CFG_CMD_SET_LAYOUT, args, 1, resp));
+    }
+    if ((strcmp (cmd, "save") == 0) && (argc == 1))
+    {
+        return cfg_status (cfg_request (CFG_CMD_SAVE, NULL, 0, resp));
+    }
+    if ((strcmp (cmd, "store") == 0) && (argc == 1))
+    {
+        return show_store ();
+    }
+    if ((strcmp (cmd, "record") == 0) && (argc == 1))
+    {
+        return show_record ();
+    }
+    if ((strcmp (cmd, "record") == 0) && (argc == 2))
+    {
+        static const char *const ops [] = { "stop", "start", "flush" }; // REC_CTRL_xxx
+        int op;
+        for (op = 0; op < 3; ++op)
+        {
+            if (strcmp (argv[1], ops [op]) == 0)
+            {
+                args[0] = (uint8_t)op;
+                return cfg_status (cfg_request (CFG_CMD_REC_CTRL, args, 1, resp));
+            }
+        }
+    }
+    if ((strcmp (cmd, "download") == 0) && (argc == 2))
+    {
+        return download (argv[1]);
+    }
+    if ((strcmp (cmd, "sched") == 0) && (argc == 1))
+    {
+        return show_sched ();
+    }
+    if ((strcmp (cmd, "power") == 0) && (argc == 1))
+    {
+        return show_power ();
+    }
+    if ((strcmp (cmd, "watch") == 0) && (argc == 1))
+    {
+        return show_watch ();
+    }
+    if ((strcmp (cmd, "prof") == 0) && (argc == 1))
+    {
+        return show_prof ();
+    }
+    if ((strcmp (cmd, "prof") == 0) && (argc == 2) && (strcmp (argv[1], "reset") == 0))
+    {
+        args[0] = PROF_CTRL_RESET;
+        return cfg_status (cfg_request (CFG_CMD_PROF_CTRL, args, 1, resp));
+    }
+
+    fprintf (stderr, "bad command: %s\n", cmd);
+    return 1;
+} // run_command
+
+// Find the keyboard amongst the hidraw devices
+static int cfg_find (void)
+{
+    int idx;
+    for (idx = 0; idx < 32; ++idx)
+    {
+        char path [32];
+        struct hidraw_devinfo info;
+        uint8_t resp [CFG_REPORT_LEN];
+
+        snprintf (path, sizeof (path), "/dev/hidraw%d", idx);
+        cfg_fd = open (path, O_RDWR);
+        if (cfg_fd < 0)
+        {
+            continue;
+        }
+        if ((ioctl (cfg_fd, HIDIOCGRAWINFO, &info) == 0) && ((uint16_t)info.vendor == KB_VID) &&
+            (cfg_request (CFG_CMD_INFO, NULL, 0, resp) == CFG_OK))
+        {
+            fprintf (stderr, "using %s\n", path);
+            return 0;
+        }
+        close (cfg_fd);
+        cfg_fd = -1;
+    }
+    return -1;
+} // cfg_find
+
+int main (int argc, char **argv)
+{
+    const char *dev = NULL;
+    int sim = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "sd:")) != -1)
+    {
+        if (opt == 's')
+        {
+            sim = 1;
+        }
+        else if (opt == 'd')
+        {
+            dev = optarg;
+        }
+        else
+        {
+            optind = argc + 1; // Show the usage
+            break;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf (stderr, "usage: %s [-s | -d /dev/hidrawN] command [args] [, command [args]] ...\n", argv[0]);
+        return 2;
+    }
+
+    if (sim)
+    {
+        sim_init ();
+    }
+    else if (dev)
+    {
+        cfg_fd = open (dev, O_RDWR);
+        if (cfg_fd < 0)
+        {
+            perror (dev);
+            return 1;
+        }
+    }
+    else if (cfg_find () < 0)
+    {
+        fprintf (stderr, "keyboard not found\n");
+        return 1;
+    }
+
+    // Run each command in turn, stopping at the first that fails
+    int result = 0;
+    int first = optind;
+    while ((first < argc) && (result == 0))
+    {
+        int last = first;
+        while ((last < argc) && (strcmp (argv[last], ",") != 0))
+        {
+            ++last;
+        }
+        if (last > first)
+        {
+            result = run_command (last - first, &argv[first]);
+        }
+        first = last + 1;
+    }
+
+    if (cfg_fd >= 0)
+    {
+        close (cfg_fd);
+    }
+    return result ? 1 : 0;
+} // main
+
+/* End of File */
@@ -0,0 +1,148 @@
+/* kb-combo-check - check the timing of the key combo engine on the host build
+ *
+ * Drives kb-combo.c directly, with the keys down on each pass and the time,
+ * as process_keys() and scan_thread() do, and checks that:
+ *   - a combo completed inside the combo window fires,
+ *   - the window closes at exactly the window, and a key after it is let through,
+ *   - a key of a combo let go before the combo completes is flushed, not lost,
+ *   - a combo that has fired holds its keys, let go in either order, until all are up,
+ *   - a key in no combo, or a combo key followed by one in no combo, is not held back.
+ * The combos are the default ones, HELP + Code-II and BLOCK + HELP, and with
+ * COMBO_KEYS_ON off the keys that would otherwise be in a combo, such as
+ * Backspace and Right CTRL, must pass at once.
+ *
+ * Usage: kb-combo-check
+ *   Prints each check. The exit status is 1 if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fw-kb-main.h"
+#include "kb-combo.h"
+#include "kb-config.h"
+#include "kb-mock.h"
+
+#define KEY_AT(r, c)  (((r) * COL_SZ) + (c))
+
+#define K_HELP     KEY_AT(5, 9)
+#define K_CODE2    KEY_AT(6, 5)
+#define K_BLOCK    KEY_AT(5, 5)
+#define K_BKSP     KEY_AT(1, 0)
+#define K_PGUP     KEY_AT(2, 2)
+#define K_RCTRL    KEY_AT(3, 7)
+#define K_RMENU    KEY_AT(1, 9)
+#define K_A        KEY_AT(3, 0)
+
+#define T0  1000000u // Start of each case (us), well away from 0
+
+static uint32_t window_us = 0;
+
+// One pass with up to two keys down, -1 for none
+static int scan (uint32_t now_us, msg_blk *out, int k0, int k1)
+{
+    int keys [MX_KEYS];
+    int n = 0;
+    if (k0 >= 0)
+    {
+        keys [n++] = k0;
+    }
+    if (k1 >= 0)
+    {
+        keys [n++] = k1;
+    }
+    out->u_msg = 0;
+    return combo_scan (keys, &n, now_us, out);
+} // scan
+
+// All keys up, and the engine back to idle
+static void reset (void)
+{
+    msg_blk out;
+    scan (0, &out, -1, -1);
+    combo_init ();
+} // reset
+
+int main (void)
+{
+    static const uint8_t no_keys [CFG_KEYS] = { 0 };
+    uint8_t const *layers [CFG_LAYERS];
+    msg_blk out;
+    int held [MX_KEYS];
+    int idx;
+    int r;
+
+    for (idx = 0; idx < CFG_LAYERS; ++idx)
+    {
+        layers [idx] = no_keys;
+    }
+    cfg_init (layers);
+    window_us = cfg_live ()->timing [CFG_TM_COMBO_WINDOW] * 1000u;
+    mock_check (combo_init () == 0, "no combo is rejected");
+
+    // Inside the window
+    reset ();
+    mock_check (scan (T0, &out, K_HELP, -1) == COMBO_HOLD, "HELP is held back");
+    mock_check (combo_tick (T0 + window_us - 1) == 0, "the window is still open 1 us before it closes");
+    r = scan (T0 + window_us - 1, &out, K_HELP, K_CODE2);
+    mock_check ((r == COMBO_ACTION) && (out.p[2] == ACT_UNICODE), "Code-II inside the window toggles Unicode");
+    mock_check (scan (T0 + window_us, &out, K_HELP, K_CODE2) == COMBO_HOLD, "both keys still down are held");
+
+    // Let go in either order, the keys are held until both are up
+    mock_check (scan (T0 + window_us + 1000, &out, K_HELP, -1) == COMBO_HOLD, "Code-II up first, HELP still held");
+    mock_check (scan (T0 + window_us + 2000, &out, -1, -1) == COMBO_PASS, "both up, the combo is over");
+    reset ();
+    scan (T0, &out, K_BLOCK, -1);
+    r = scan (T0 + 1000, &out, K_BLOCK, K_HELP);
+    mock_check ((r == COMBO_ACTION) && (out.p[2] == ACT_MOUSE), "BLOCK + HELP toggles the mouse keys");
+    mock_check (scan (T0 + 2000, &out, K_HELP, -1) == COMBO_HOLD, "BLOCK up first, HELP still held");
+    mock_check (scan (T0 + 3000, &out, K_A, K_HELP) == COMBO_HOLD, "a key pressed whilst the combo is held is held too");
+    mock_check (scan (T0 + 4000, &out, K_A, -1) == COMBO_PASS, "HELP up last, the key left down passes");
+
+    // Exactly at the window
+    reset ();
+    scan (T0, &out, K_HELP, -1);
+    mock_check (combo_tick (T0 + window_us) == 1, "the window closes at exactly the window");
+    r = scan (T0 + window_us, &out, K_HELP, K_CODE2);
+    mock_check ((r == COMBO_PASS) && (out.p[2] == 0), "Code-II at exactly the window is let through");
+
+    // Outside the window
+    reset ();
+    scan (T0, &out, K_CODE2, -1);
+    mock_check (combo_tick (T0 + window_us + 5000) == 1, "the window has closed 5 ms after it");
+    mock_check (scan (T0 + window_us + 5000, &out, K_CODE2, K_HELP) == COMBO_PASS, "HELP after the window is let through");
+
+    // Let go before the combo completes
+    reset ();
+    scan (T0, &out, K_HELP, -1);
+    mock_check (scan (T0 + 10000, &out, -1, -1) == COMBO_FLUSH, "HELP tapped alone is flushed");
+    mock_check ((combo_held (held) == 1) && (held [0] == K_HELP), "the flushed key is HELP");
+    mock_check (combo_tick (T0 + window_us) == 0, "nothing is pending after the flush");
+
+    // Keys in no combo are not held back
+    reset ();
+    mock_check (scan (T0, &out, K_A, -1) == COMBO_PASS, "A passes at once");
+    reset ();
+    scan (T0, &out, K_HELP, -1);
+    mock_check (scan (T0 + 1000, &out, K_HELP, K_A) == COMBO_PASS, "HELP then A passes before the window");
+#if !COMBO_KEYS_ON
+    static const struct { int key; char const *name; } plain [] =
+    {
+        { K_BKSP, "Backspace" }, { K_PGUP, "Page UP" }, { K_RCTRL, "Right CTRL" }, { K_RMENU, "Right Menu" }
+    };
+    for (idx = 0; idx < (int)(sizeof (plain) / sizeof (plain [0])); ++idx)
+    {
+        char what [64];
+        reset ();
+        snprintf (what, sizeof (what), "%s passes at once", plain [idx].name);
+        mock_check (scan (T0, &out, plain [idx].key, -1) == COMBO_PASS, what);
+    }
+#endif // !COMBO_KEYS_ON
+
+    printf ("\n");
+    return mock_check_end ();
+} // main
+
+/* End of File */
@@ -0,0 +1,405 @@
+/* kb-fuzz - fuzz the keyboard's decoder and report code with odd matrix states
+ *
+ * Feeds arbitrary sequences of matrix changes through the firmware's own
+ * scanner, decoder and report code, built for the host on the mock hardware
+ * (see host/kb-mock.h), and checks after every step that:
+ *   - no keyboard report holds the same usage twice,
+ *   - no scan pass pushes more messages than the core-1 FIFO holds,
+ *   - once every key is let go (and a one-shot latch has timed out), the last
+ *     keyboard report holds no keys, and the consumer and mouse button reports
+ *     are back to none.
+ * A failed check aborts, as a crash would. Indexes out of range (code.p[],
+ * keys[] and so on) are left to the sanitizers, so build it with
+ * -DKB_SANITIZE=ON (see CMakeLists.txt).
+ *
+ * Each input is pairs of bytes, a key change and a delay:
+ *   byte 0 - bits 0-6 the keymap index (row * 10 + col), bit 7 set for down.
+ *            An index of 80 or more lets every key go.
+ *   byte 1 - how long to run before the next change: under 128 it is in
+ *            0.5 ms steps, from 128 on in 20 ms steps (up to 2.56 s).
+ * An odd byte at the end is ignored. The keyboard is booted once, and each
+ * input carries on from where the last one left it (locked modifiers, the
+ * Unicode mode), as a keyboard in use would.
+ *
+ * With -DKB_LIBFUZZER=ON (clang) it is a libFuzzer target. Otherwise it has a
+ * main() of its own, which also suits AFL ("afl-fuzz ... -- kb-fuzz @@"):
+ *   kb-fuzz [file...]          - run each file (or stdin) as an input
+ *   kb-fuzz -c [file]          - turn a "kb-rec-dump -f" recording into an
+ *                                input on stdout, for a seed corpus
+ *   kb-fuzz -n count [-s seed] - run that many random inputs
+ * The seed corpus in tools/corpus/ is kb-bench's built-in traces, turned
+ * into inputs with "kb-bench -f <trace> | kb-fuzz -c".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fw-kb-main.h"
+#include "usb_descriptors.h"
+#include "kb-mock.h"
+
+#define FUZZ_START_US  100000 // Run this long after the boot, so the scanner has settled
+#define FUZZ_TAIL_US   ((ONESHOT_TIMEOUT + 1000) * 1000) // Run on after the input, for latches and streams to finish
+#define FUZZ_PASS_MSGS 8      // Most messages one scan pass may push, the depth of the Pico's FIFO
+#define FUZZ_KEYS      (ROW_SZ * COL_SZ)
+
+static uint8_t last_kbd [8];
+static uint8_t last_con [2];
+static uint8_t last_buttons = 0;
+
+static void fuzz_fail (char const *why, uint8_t const *report, uint16_t len)
+{
+    int idx;
+    fprintf (stderr, "kb-fuzz: at %.6f s, %s", mock_now () / 1000000.0, why);
+    for (idx = 0; idx < len; ++idx)
+    {
+        fprintf (stderr, " %02X", report [idx]);
+    }
+    fprintf (stderr, "\n");
+    abort ();
+} // fuzz_fail
+
+// Every report the keyboard sends is checked, and the last of each kind kept
+static void check_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    int idx;
+    int other;
+    (void) t_us;
+
+    if ((report_id == REPORT_ID_KEYBOARD) && (len == sizeof (last_kbd)))
+    {
+        for (idx = 2; idx < 8; ++idx)
+        {
+            for (other = idx + 1; (report [idx] != 0) && (other < 8); ++other)
+            {
+                if (report [other] == report [idx])
+                {
+                    fuzz_fail ("usage sent twice in one keyboard report:", report, len);
+                }
+            }
+        }
+        memcpy (last_kbd, report, len);
+    }
+    else if ((report_id == REPORT_ID_CONSUMER_CONTROL) && (len == sizeof (last_con)))
+    {
+        memcpy (last_con, report, len);
+    }
+    else if ((report_id == REPORT_ID_MOUSE) && (len >= 1))
+    {
+        last_buttons = report [0];
+    }
+} // check_report
+
+// The delay after a key change, from its byte
+static uint32_t fuzz_delay_us (uint8_t code)
+{
+    if (code < 128)
+    {
+        return code * 500u;
+    }
+    return (code - 127u) * 20000u;
+} // fuzz_delay_us
+
+static void fuzz_run (uint8_t const *data, size_t size)
+{
+    static int booted = 0;
+    uint8_t down [COL_SZ];
+    size_t idx;
+    int key;
+
+    if (!booted)
+    {
+        mock_on_report (check_report);
+        mock_init ();
+        mock_run_until (FUZZ_START_US);
+        booted = 1;
+    }
+
+    memset (down, 0, sizeof (down));
+    for (idx = 0; (idx + 1) < size; idx += 2)
+    {
+        key = data [idx] & 0x7F;
+        if (key >= FUZZ_KEYS)
+        {
+            memset (down, 0, sizeof (down));
+        }
+        else if (data [idx] & 0x80)
+        {
+            down [key % COL_SZ] |= (uint8_t)(1u << (key / COL_SZ));
+        }
+        else
+        {
+            down [key % COL_SZ] &= (uint8_t)~(1u << (key / COL_SZ));
+        }
+        mock_set_keys (down);
+        mock_run_until (mock_now () + fuzz_delay_us (data [idx + 1]));
+        if (mock_pass_msgs () > FUZZ_PASS_MSGS)
+        {
+            fuzz_fail ("too many messages pushed in one scan pass", NULL, 0);
+        }
+    }
+
+    // Let everything go, then nothing should be left down
+    memset (down, 0, sizeof (down));
+    mock_set_keys (down);
+    mock_run_until (mock_now () + FUZZ_TAIL_US);
+    for (idx = 2; idx < sizeof (last_kbd); ++idx)
+    {
+        if (last_kbd [idx] != 0)
+        {
+            fuzz_fail ("a key is still down after they were all let go:", last_kbd, sizeof (last_kbd));
+        }
+    }
+    if ((last_con [0] != 0) || (last_con [1] != 0))
+    {
+        fuzz_fail ("a media key is still down after they were all let go:", last_con, sizeof (last_con));
+    }
+    if (last_buttons != 0)
+    {
+        fuzz_fail ("a mouse button is still down after they were all let go:", &last_buttons, 1);
+    }
+} // fuzz_run
+
+#if KB_LIBFUZZER
+
+int LLVMFuzzerTestOneInput (uint8_t const *data, size_t size)
+{
+    fuzz_run (data, size);
+    return 0;
+} // LLVMFuzzerTestOneInput
+
+#else
+
+#define FUZZ_MAX_INPUT 65536
+
+static int run_file (char const *path)
+{
+    static uint8_t buf [FUZZ_MAX_INPUT];
+    FILE *fp = stdin;
+    if (path != NULL)
+    {
+        fp = fopen (path, "rb");
+        if (fp == NULL)
+        {
+            perror (path);
+            return 0;
+        }
+    }
+    size_t size = fread (buf, 1, sizeof (buf), fp);
+    if (fp != stdin)
+    {
+        fclose (fp);
+    }
+    fuzz_run (buf, size);
+    return 1;
+} // run_file
+
+// The delay byte nearest to (not over) the gap, leaving the rest for next time
+static uint8_t delay_code (uint64_t *gap_us)
+{
+    uint8_t code;
+    if (*gap_us < 128 * 500u)
+    {
+        code = (uint8_t)(*gap_us / 500u);
+    }
+    else
+    {
+        uint64_t steps = *gap_us / 20000u;
+        code = (uint8_t)(127u + ((steps > 128u) ? 128u : steps));
+    }
+    *gap_us -= fuzz_delay_us (code);
+    return code;
+} // delay_code
+
+// Turn a "kb-rec-dump -f" recording into an input, the same format kb-sim reads
+static int convert (char const *path)
+{
+    FILE *fp = stdin;
+    if (path != NULL)
+    {
+        fp = fopen (path, "r");
+        if (fp == NULL)
+        {
+            perror (path);
+            return 0;
+        }
+    }
+
+    char line [256];
+    int n_line = 0;
+    int first = 1;
+    unsigned long long t_last = 0;
+    uint8_t was [COL_SZ];
+    int pend_key = -1; // The change waiting for its delay byte
+    memset (was, 0, sizeof (was));
+    while (fgets (line, sizeof (line), fp) != NULL)
+    {
+        unsigned long long t_us;
+        unsigned col [COL_SZ];
+        ++n_line;
+        if ((line [0] == '#') || (line [0] == '\n'))
+        {
+            continue;
+        }
+        if (sscanf (line, "%llu %x %x %x %x %x %x %x %x %x %x", &t_us,
+                    &col [0], &col [1], &col [2], &col [3], &col [4],
+                    &col [5], &col [6], &col [7], &col [8], &col [9]) != (COL_SZ + 1))
+        {
+            fprintf (stderr, "line %d: not a matrix state, skipped\n", n_line);
+            continue;
+        }
+        if (first)
+        {
+            t_last = t_us;
+            first = 0;
+        }
+        else if (t_us < t_last)
+        {
+            fprintf (stderr, "line %d: time goes backwards, skipped\n", n_line);
+            continue;
+        }
+
+        // The gap since the last state goes after the change before it
+        uint64_t gap_us = t_us - t_last;
+        t_last = t_us;
+        while (pend_key >= 0)
+        {
+            putchar (pend_key);
+            putchar (delay_code (&gap_us));
+            if (gap_us < 500u)
+            {
+                pend_key = -1;
+            } // else the same change again, which changes nothing, to run on for a long gap
+        }
+
+        int line_idx;
+        int row;
+        for (line_idx = 0; line_idx < COL_SZ; ++line_idx)
+        {
+            uint8_t diff = (uint8_t)(col [line_idx] ^ was [line_idx]);
+            for (row = 0; row < ROW_SZ; ++row)
+            {
+                if (diff & (1u << row))
+                {
+                    if (pend_key >= 0)
+                    {
+                        putchar (pend_key);
+                        putchar (0); // Changes in the same state go together
+                    }
+                    pend_key = (row * COL_SZ) + line_idx;
+                    if (col [line_idx] & (1u << row))
+                    {
+                        pend_key |= 0x80;
+                    }
+                }
+            }
+            was [line_idx] = (uint8_t)col [line_idx];
+        }
+    }
+    if (pend_key >= 0)
+    {
+        putchar (pend_key);
+        putchar (0);
+    }
+    if (fp != stdin)
+    {
+        fclose (fp);
+    }
+    return 1;
+} // convert
+
+// xorshift32, so a seed always gives the same inputs
+static uint32_t rand_state = 1;
+
+static uint32_t fuzz_rand (void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+} // fuzz_rand
+
+// Random inputs, mostly short gaps and the keys of a small part of the matrix, so keys overlap
+static void run_random (long count)
+{
+    static uint8_t buf [512];
+    long n;
+    for (n = 0; n < count; ++n)
+    {
+        size_t size = 2 + (fuzz_rand () % (sizeof (buf) - 2));
+        size_t idx;
+        int base = (int)(fuzz_rand () % FUZZ_KEYS);
+        for (idx = 0; (idx + 1) < size; idx += 2)
+        {
+            uint32_t r = fuzz_rand ();
+            int key = (r & 3) ? ((base + (int)((r >> 2) % 12)) % FUZZ_KEYS) : (int)((r >> 2) % 128);
+            buf [idx] = (uint8_t)(key | ((r & 0x10000) ? 0x80 : 0));
+            buf [idx + 1] = (uint8_t)(((r >> 17) & 7) ? ((r >> 20) % 40) : (r >> 24));
+        }
+        fuzz_run (buf, size);
+    }
+} // run_random
+
+int main (int argc, char **argv)
+{
+    int to_input = 0;
+    long count = 0;
+    int opt;
+    int idx;
+
+    while ((opt = getopt (argc, argv, "cn:s:")) != -1)
+    {
+        if (opt == 'c')
+        {
+            to_input = 1;
+        }
+        else if (opt == 'n')
+        {
+            count = atol (optarg);
+        }
+        else if (opt == 's')
+        {
+            rand_state = (uint32_t)strtoul (optarg, NULL, 0);
+            if (rand_state == 0)
+            {
+                rand_state = 1;
+            }
+        }
+        else
+        {
+            fprintf (stderr, "usage: %s [file...] | -c [file] | -n count [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (to_input)
+    {
+        return convert ((optind < argc) ? argv [optind] : NULL) ? 0 : 1;
+    }
+    if (count > 0)
+    {
+        run_random (count);
+        printf ("%ld random inputs passed\n", count);
+        return 0;
+    }
+    if (optind == argc)
+    {
+        return run_file (NULL) ? 0 : 1;
+    }
+    for (idx = optind; idx < argc; ++idx)
+    {
+        if (!run_file (argv [idx]))
+        {
+            return 1;
+        }
+    }
+    printf ("%d input%s passed\n", argc - optind, ((argc - optind) == 1) ? "" : "s");
+    return 0;
+} // main
+
+#endif // KB_LIBFUZZER
+
+/* End of File */
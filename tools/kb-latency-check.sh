@@ -0,0 +1,70 @@
+#!/bin/sh
+# kb-latency-check - check kb-latency on a synthetic capture from the host build
+#
+# Types the built-in prose trace through kb-sim -l, which writes the latency
+# marker pins as a CSV with a time column, and checks that kb-latency:
+#   - follows changes to the host and loses none, with no change missing its
+#     sample, and every step counted for each change followed,
+#   - gives the same figures for the start of the capture as a line per
+#     sample, with the rate from a "; Samplerate:" comment or from -r.
+# The kb-sim times are all a multiple of 50 us, so 20 kHz samples lose nothing.
+#
+# Usage: kb-latency-check.sh kb-bench kb-sim kb-latency
+#   Prints each check. The exit status is 1 if any check fails.
+
+bench=$1
+sim=$2
+latency=$3
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+check ()
+{
+    if [ "$1" -eq 0 ]; then
+        echo "ok   $2"
+    else
+        echo "FAIL $2"
+        failed=$((failed + 1))
+    fi
+}
+
+"$bench" -f prose | "$sim" -l "$dir/cap.csv" > /dev/null || exit 1
+"$latency" "$dir/cap.csv" > "$dir/time.txt" || exit 1
+cat "$dir/time.txt"
+echo
+
+# The first line: "N changes, F followed to the host, 0 with no sample, ... 0 lost"
+followed=$(sed -n '1s/.* \([0-9]*\) followed to the host.*/\1/p' "$dir/time.txt")
+[ -n "$followed" ] && [ "$followed" -gt 0 ]
+check $? "$followed changes followed to the host"
+grep -q '^[0-9]* changes, .* 0 with no sample, .* 0 lost$' "$dir/time.txt"
+check $? "...none lost, nor with no sample"
+[ "$(awk -v f="$followed" 'NR > 2 && $2 != f' "$dir/time.txt" | wc -l)" -eq 0 ] &&
+    [ "$(awk 'NR > 2' "$dir/time.txt" | wc -l)" -eq 5 ]
+check $? "...and counted in each of the 5 step rows"
+
+# The start of the capture, with its time column and as a line per sample
+head -n 400 "$dir/cap.csv" > "$dir/start.csv"
+"$latency" "$dir/start.csv" > "$dir/start.txt"
+awk -F, '
+    /^;/ { next }
+    !hdr { hdr = 1; print "; Samplerate: 20 kHz"; print substr ($0, index ($0, ",") + 1); next }
+    {
+        k = $1 / 50
+        while (have && (n < k)) { print prev; ++n }
+        prev = substr ($0, index ($0, ",") + 1)
+        have = 1
+    }
+    END { print prev }' "$dir/start.csv" > "$dir/rate.csv"
+"$latency" "$dir/rate.csv" | diff "$dir/start.txt" -
+check $? "a line per sample and \"; Samplerate: 20 kHz\" gives the same figures as the time column"
+grep -v '^;' "$dir/rate.csv" | "$latency" -r 20000 | diff "$dir/start.txt" -
+check $? "...as does no comment, with -r 20000"
+grep -v '^;' "$dir/rate.csv" | "$latency" > /dev/null 2>&1
+[ $? -ne 0 ]
+check $? "...and with no rate at all it gives up"
+
+echo
+echo "$failed check$( [ $failed -eq 1 ] || echo s) failed"
+[ $failed -eq 0 ]
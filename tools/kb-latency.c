@@ -0,0 +1,437 @@
+/* kb-latency - key press to USB report latency, from a logic analyser capture
+ *
+ * With LATENCY_ON set in fw-kb-main.h the keyboard toggles a GPIO at each
+ * step from a key change to its HID report (LAT_GPIO_xxx), so every edge on
+ * a pin is one event:
+ *   D0 sample  - the line scan that first sees the change
+ *   D1 accept  - the change is taken up at the end of the pass
+ *   D2 enqueue - the key message goes into the FIFO to core-0
+ *   D3 report  - tud_hid_keyboard_report() is called
+ *   D4 done    - the report has been taken by the host
+ * This reads a CSV export of a capture of them (sigrok-cli -O csv, or
+ * PulseView's "Export as CSV"), follows each change through the steps and
+ * prints the spread of the time each step takes.
+ *
+ * Usage: kb-latency [-r rate] [-c names] [-w ms] [capture.csv]
+ *   -r  sample rate (Hz), when the capture has no time column and no
+ *       "; Samplerate:" comment
+ *   -c  the five channel names, comma separated, in the order above
+ *       (default D0,D1,D2,D3,D4)
+ *   -w  longest the report or done step may take before the change is
+ *       counted as lost (ms, default 100)
+ * The capture is read from stdin by default. kb-sim -l writes one from the
+ * host build, to try this out with no keyboard or analyser.
+ *
+ * The CSV may have a time column (named "Time...", with its unit in brackets,
+ * e.g. "Time [us]", seconds if none), or a line per sample at the sample
+ * rate. Lines starting with ';' are comments.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define LAT_STEPS   5
+#define LAT_MAX_COL 64
+
+static char const *const step_names [LAT_STEPS] = { "sample", "accept", "enqueue", "report", "done" };
+
+// The edges seen on one channel (us)
+typedef struct
+{
+    double *t;
+    int     n;
+    int     max;
+} edge_list;
+
+static edge_list edges [LAT_STEPS];
+
+static void add_edge (edge_list *el, double t_us)
+{
+    if (el->n == el->max)
+    {
+        el->max = (el->max) ? (el->max * 2) : 1024;
+        el->t = realloc (el->t, el->max * sizeof (double));
+        if (el->t == NULL)
+        {
+            perror ("kb-latency");
+            exit (1);
+        }
+    }
+    el->t [el->n++] = t_us;
+} // add_edge
+
+// The rate from a sigrok "; Samplerate: 24 MHz" comment, 0 if it is not one
+static double comment_rate (char const *line)
+{
+    char const *p = strstr (line, "Samplerate:");
+    double rate;
+    char unit [8] = "";
+    if ((p == NULL) || (sscanf (p + 11, "%lf %7s", &rate, unit) < 1))
+    {
+        return 0.0;
+    }
+    if (unit [0] == 'k')
+    {
+        rate *= 1e3;
+    }
+    else if (unit [0] == 'M')
+    {
+        rate *= 1e6;
+    }
+    else if (unit [0] == 'G')
+    {
+        rate *= 1e9;
+    }
+    return rate;
+} // comment_rate
+
+// The scale to us for a time column, from the unit in its name
+static double time_scale (char const *name)
+{
+    if (strstr (name, "[ns]") != NULL)
+    {
+        return 1e-3;
+    }
+    if ((strstr (name, "[us]") != NULL) || (strstr (name, "[\xC2\xB5s]") != NULL))
+    {
+        return 1.0;
+    }
+    if (strstr (name, "[ms]") != NULL)
+    {
+        return 1e3;
+    }
+    return 1e6; // seconds
+} // time_scale
+
+// Split a CSV line in place, returns the number of fields
+static int split (char *line, char **field, int max)
+{
+    int n = 0;
+    char *p = line;
+    while ((n < max) && (p != NULL))
+    {
+        while ((*p == ' ') || (*p == '"'))
+        {
+            ++p;
+        }
+        field [n++] = p;
+        p = strchr (p, ',');
+        if (p != NULL)
+        {
+            *p++ = 0;
+        }
+    }
+    // Trim the ends
+    int idx;
+    for (idx = 0; idx < n; ++idx)
+    {
+        char *end = field [idx] + strlen (field [idx]);
+        while ((end > field [idx]) && ((end [-1] == '\n') || (end [-1] == '\r') ||
+                                        (end [-1] == ' ') || (end [-1] == '"')))
+        {
+            *--end = 0;
+        }
+    }
+    return n;
+} // split
+
+// Read the capture into the edge lists, returns 0 if it cannot be used
+static int read_capture (FILE *fp, char const *const *names, double rate)
+{
+    char line [1024];
+    char *field [LAT_MAX_COL];
+    int col [LAT_STEPS];
+    int level [LAT_STEPS];
+    int time_col = -1;
+    double scale = 1.0;
+    int have_header = 0;
+    long sample = 0;
+    int n_line = 0;
+    int idx;
+
+    for (idx = 0; idx < LAT_STEPS; ++idx)
+    {
+        col [idx] = -1;
+        level [idx] = -1; // Not known until the first sample
+    }
+
+    while (fgets (line, sizeof (line), fp) != NULL)
+    {
+        ++n_line;
+        if (line [0] == ';')
+        {
+            if (rate == 0.0)
+            {
+                rate = comment_rate (line);
+            }
+            continue;
+        }
+        int n = split (line, field, LAT_MAX_COL);
+        if ((n == 0) || (field [0][0] == 0))
+        {
+            continue;
+        }
+
+        if (!have_header)
+        {
+            int f;
+            for (f = 0; f < n; ++f)
+            {
+                if (strncasecmp (field [f], "time", 4) == 0)
+                {
+                    time_col = f;
+                    scale = time_scale (field [f]);
+                }
+                for (idx = 0; idx < LAT_STEPS; ++idx)
+                {
+                    if (strcmp (field [f], names [idx]) == 0)
+                    {
+                        col [idx] = f;
+                    }
+                }
+            }
+            for (idx = 0; idx < LAT_STEPS; ++idx)
+            {
+                if (col [idx] < 0)
+                {
+                    fprintf (stderr, "kb-latency: no channel %s (%s) in the header\n", names [idx], step_names [idx]);
+                    return 0;
+                }
+            }
+            if ((time_col < 0) && (rate <= 0.0))
+            {
+                fprintf (stderr, "kb-latency: no time column, and no sample rate (use -r)\n");
+                return 0;
+            }
+            have_header = 1;
+            continue;
+        }
+
+        double t_us;
+        if (time_col >= 0)
+        {
+            if (time_col >= n)
+            {
+                fprintf (stderr, "kb-latency: line %d: no time, skipped\n", n_line);
+                continue;
+            }
+            t_us = strtod (field [time_col], NULL) * scale;
+        }
+        else
+        {
+            t_us = (sample * 1e6) / rate;
+        }
+        ++sample;
+
+        for (idx = 0; idx < LAT_STEPS; ++idx)
+        {
+            if (col [idx] >= n)
+            {
+                continue;
+            }
+            int now = (atoi (field [col [idx]]) != 0);
+            if ((level [idx] >= 0) && (now != level [idx]))
+            {
+                add_edge (&edges [idx], t_us);
+            }
+            level [idx] = now;
+        }
+    }
+    if (!have_header)
+    {
+        fprintf (stderr, "kb-latency: no header line in the capture\n");
+        return 0;
+    }
+    return 1;
+} // read_capture
+
+// The first edge at or after t, from *pos on (which moves on to it), -1 if none
+static double edge_from (edge_list const *el, int *pos, double t)
+{
+    while ((*pos < el->n) && (el->t [*pos] < t))
+    {
+        ++*pos;
+    }
+    return (*pos < el->n) ? el->t [*pos] : -1.0;
+} // edge_from
+
+static int cmp_double (void const *a, void const *b)
+{
+    double da = *(double const *)a;
+    double db = *(double const *)b;
+    return (da < db) ? -1 : (da > db);
+} // cmp_double
+
+// Nearest rank percentile of a sorted list
+static double percentile (double const *v, int n, int pc)
+{
+    int rank = (pc * n + 99) / 100;
+    if (rank < 1)
+    {
+        rank = 1;
+    }
+    return v [rank - 1];
+} // percentile
+
+static void print_spread (char const *name, double *v, int n)
+{
+    if (n == 0)
+    {
+        printf ("%-16s %7d\n", name, 0);
+        return;
+    }
+    qsort (v, n, sizeof (double), cmp_double);
+    printf ("%-16s %7d %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, n,
+            v [0], percentile (v, n, 50), percentile (v, n, 90), percentile (v, n, 99), v [n - 1]);
+} // print_spread
+
+int main (int argc, char **argv)
+{
+    static char const *default_names [LAT_STEPS] = { "D0", "D1", "D2", "D3", "D4" };
+    char const *names [LAT_STEPS];
+    char name_buf [256];
+    double rate = 0.0;
+    double window_us = 100000.0;
+    int opt;
+    int idx;
+
+    memcpy (names, default_names, sizeof (names));
+    while ((opt = getopt (argc, argv, "r:c:w:")) != -1)
+    {
+        if (opt == 'r')
+        {
+            rate = strtod (optarg, NULL);
+        }
+        else if (opt == 'w')
+        {
+            window_us = strtod (optarg, NULL) * 1000.0;
+        }
+        else if (opt == 'c')
+        {
+            char *field [LAT_STEPS + 1];
+            snprintf (name_buf, sizeof (name_buf), "%s", optarg);
+            if (split (name_buf, field, LAT_STEPS + 1) != LAT_STEPS)
+            {
+                fprintf (stderr, "kb-latency: -c needs %d channel names\n", LAT_STEPS);
+                return 2;
+            }
+            for (idx = 0; idx < LAT_STEPS; ++idx)
+            {
+                names [idx] = field [idx];
+            }
+        }
+        else
+        {
+            fprintf (stderr, "usage: %s [-r rate] [-c names] [-w ms] [capture.csv]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    FILE *fp = stdin;
+    if (optind < argc)
+    {
+        fp = fopen (argv [optind], "r");
+        if (fp == NULL)
+        {
+            perror (argv [optind]);
+            return 1;
+        }
+    }
+    int ok = read_capture (fp, names, rate);
+    if (fp != stdin)
+    {
+        fclose (fp);
+    }
+    if (!ok)
+    {
+        return 1;
+    }
+
+    /* Each accept is one change. It goes back to the first sample since the
+     * accept before it, then on to the next enqueue before the next accept,
+     * the next report before the enqueue after that, and the next done. A
+     * report that comes after the following message (a backlog) is not
+     * matched, the change counts as having no report. */
+    int n_accept = edges [1].n;
+    double *spread [LAT_STEPS]; // The four steps, then end to end
+    int n_spread = 0;
+    int no_sample = 0;
+    int no_message = 0;
+    int no_report = 0;
+    int lost = 0;
+    for (idx = 0; idx < LAT_STEPS; ++idx)
+    {
+        spread [idx] = malloc ((n_accept + 1) * sizeof (double));
+        if (spread [idx] == NULL)
+        {
+            perror ("kb-latency");
+            return 1;
+        }
+    }
+
+    int pos [LAT_STEPS] = { 0, 0, 0, 0, 0 };
+    double last_accept = -1.0;
+    int acc;
+    for (acc = 0; acc < n_accept; ++acc)
+    {
+        double t [LAT_STEPS];
+        double accept = edges [1].t [acc];
+        double next_accept = (acc + 1 < n_accept) ? edges [1].t [acc + 1] : 1e300;
+
+        t [0] = edge_from (&edges [0], &pos [0], last_accept + 1e-9);
+        last_accept = accept;
+        if ((t [0] < 0.0) || (t [0] > accept))
+        {
+            ++no_sample;
+            continue;
+        }
+        t [1] = accept;
+        t [2] = edge_from (&edges [2], &pos [2], accept);
+        if ((t [2] < 0.0) || (t [2] >= next_accept))
+        {
+            ++no_message; // e.g. a change to too many keys, which is dropped
+            continue;
+        }
+        double next_enqueue = (pos [2] + 1 < edges [2].n) ? edges [2].t [pos [2] + 1] : 1e300;
+        t [3] = edge_from (&edges [3], &pos [3], t [2]);
+        if ((t [3] < 0.0) || (t [3] >= next_enqueue))
+        {
+            ++no_report; // e.g. a modifier on its own, or a key with nothing in the keymap
+            continue;
+        }
+        t [4] = edge_from (&edges [4], &pos [4], t [3]);
+        if ((t [4] < 0.0) || ((t [3] - t [2]) > window_us) || ((t [4] - t [3]) > window_us))
+        {
+            ++lost;
+            continue;
+        }
+        for (idx = 0; idx < LAT_STEPS - 1; ++idx)
+        {
+            spread [idx][n_spread] = t [idx + 1] - t [idx];
+        }
+        spread [LAT_STEPS - 1][n_spread] = t [4] - t [0];
+        ++n_spread;
+    }
+
+    printf ("%d changes, %d followed to the host, %d with no sample, %d with no message, %d with no report, %d lost\n",
+            n_accept, n_spread, no_sample, no_message, no_report, lost);
+    printf ("%-16s %7s %9s %9s %9s %9s %9s  (us)\n", "step", "count", "min", "p50", "p90", "p99", "max");
+    for (idx = 0; idx < LAT_STEPS - 1; ++idx)
+    {
+        char name [32];
+        snprintf (name, sizeof (name), "%s-%s", step_names [idx], step_names [idx + 1]);
+        print_spread (name, spread [idx], n_spread);
+    }
+    print_spread ("sample-done", spread [LAT_STEPS - 1], n_spread);
+    for (idx = 0; idx < LAT_STEPS; ++idx)
+    {
+        free (spread [idx]);
+    }
+    return 0;
+} // main
+
+/* End of File */
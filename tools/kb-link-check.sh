@@ -0,0 +1,68 @@
+#!/bin/sh
+# kb-link-check - check the key event link framing (kb-link.h) end to end
+#
+# Starts "kb-uinputd -n -p" on a pseudo-terminal, sends it a fixed set of
+# frames with kb-link-send, with junk bytes between them (each starts with a
+# sync byte, so the frame after it fails its CRC and has to be found again),
+# and compares the events it prints, and its frame counts, with the list
+# below. The time stamps are fixed (kb-link-send -t), so every run is the same.
+#
+# Usage: kb-link-check.sh kb-uinputd kb-link-send
+#   The exit status is 1 if the events differ.
+
+uinputd=$1
+send=$2
+out=$(mktemp)
+want=$(mktemp)
+pid=
+
+cleanup ()
+{
+    [ -n "$pid" ] && kill "$pid" 2>/dev/null
+    rm -f "$out" "$want"
+}
+trap cleanup EXIT
+
+cat > "$want" <<'EOF'
+      1000 us (+   1000) down key 0xE1 -> 42
+      2000 us (+   1000) down key 0x0B -> 35
+      3000 us (+   1000) up   key 0x0B -> 35
+      4000 us (+   1000) up   key 0xE1 -> 42
+      5000 us (+   1000) down con 0xE9 -> 115
+      6000 us (+   1000) up   con 0xE9 -> 115
+      7000 us (+   1000) down key 0x73 -> 194
+7 frames, 6 bad, 24 bytes skipped
+EOF
+
+"$uinputd" -n -p > "$out" &
+pid=$!
+
+# The pseudo-terminal it listens on
+pts=
+n=0
+while [ -z "$pts" ] && [ $n -lt 50 ]; do
+    sleep 0.1
+    pts=$(sed -n 's/^listening on //p' "$out")
+    n=$((n + 1))
+done
+if [ -z "$pts" ]; then
+    echo "kb-uinputd did not open a pseudo-terminal"
+    exit 1
+fi
+
+# Hold the other end open, so nothing sent is lost when kb-link-send closes it
+exec 3<>"$pts"
+"$send" -t 1000 "$pts" +E1 ! +0B -0B ! -E1 c+E9 c-E9 ! +73 || exit 1
+
+# Wait for the events to be printed, then stop it for the frame counts
+n=0
+while [ "$(grep -c ' -> ' "$out")" -lt 7 ] && [ $n -lt 50 ]; do
+    sleep 0.1
+    n=$((n + 1))
+done
+kill -TERM "$pid"
+wait "$pid"
+pid=
+exec 3>&-
+
+grep -v '^listening on ' "$out" | diff "$want" - && echo "ok   every event came through, and the junk was skipped"
@@ -0,0 +1,120 @@
+/* kb-link-send - send key event link frames, for testing kb-uinputd
+ *
+ * Writes the same frames the keyboard sends on its UART (see kb-link.h) to a
+ * tty or pseudo-terminal, e.g. the one "kb-uinputd -n -p" listens on.
+ *
+ * Usage: kb-link-send [-d ms] [-t us] tty event...
+ *   +XX   press keyboard usage XX (hex), e.g. +E1 +0B -0B -E1 types "H"
+ *   -XX   release keyboard usage XX
+ *   c+XX  press consumer usage XX, c-XX releases it
+ *   !     send some junk bytes, to check the receiver finds the frames again
+ *   -d    ms to wait between events (default 0)
+ *   -t    time stamp the events from "us", 1000 us apart, instead of from the
+ *         clock, so the frames are the same every time (for kb-link-check.sh)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "kb-link.h"
+
+// Time stamp in us, as the keyboard would send it
+static uint32_t now_us (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((ts.tv_sec * 1000000ull) + (ts.tv_nsec / 1000));
+} // now_us
+
+int main (int argc, char **argv)
+{
+    long delay_ms = 0;
+    int fixed_ts = 0;
+    uint32_t ts_us = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "+d:t:")) != -1)
+    {
+        if (opt == 'd')
+        {
+            delay_ms = strtol (optarg, NULL, 0);
+        }
+        else if (opt == 't')
+        {
+            fixed_ts = 1;
+            ts_us = (uint32_t) strtoul (optarg, NULL, 0);
+        }
+        else
+        {
+            fprintf (stderr, "usage: %s [-d ms] [-t us] tty event...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf (stderr, "usage: %s [-d ms] [-t us] tty event...\n", argv[0]);
+        return 2;
+    }
+
+    int fd = open (argv[optind], O_WRONLY | O_NOCTTY);
+    if (fd < 0)
+    {
+        perror (argv[optind]);
+        return 1;
+    }
+
+    for (int idx = optind + 1; idx < argc; ++idx)
+    {
+        char const *arg = argv[idx];
+        uint8_t buf [LINK_FRAME_LEN];
+        link_event ev;
+        int con = 0;
+
+        if (arg[0] == '!')
+        {
+            static uint8_t const junk [] = { LINK_SYNC, 0x01, 0x04, 'o', 'k', '\r', '\n', LINK_SYNC };
+            if (write (fd, junk, sizeof (junk)) < 0)
+            {
+                perror ("write");
+                return 1;
+            }
+            continue;
+        }
+        if (arg[0] == 'c')
+        {
+            con = 1;
+            ++arg;
+        }
+        if ((arg[0] != '+') && (arg[0] != '-'))
+        {
+            fprintf (stderr, "bad event \"%s\"\n", argv[idx]);
+            return 2;
+        }
+
+        ev.type  = (arg[0] == '+') ? (con ? LK_CON_DOWN : LK_KEY_DOWN) : (con ? LK_CON_UP : LK_KEY_UP);
+        ev.usage = (uint16_t)strtoul (arg + 1, NULL, 16);
+        ev.ts_us = fixed_ts ? ts_us : now_us ();
+        ts_us += 1000;
+        link_encode (&ev, buf);
+        if (write (fd, buf, sizeof (buf)) != (ssize_t)sizeof (buf))
+        {
+            perror ("write");
+            return 1;
+        }
+        if (delay_ms > 0)
+        {
+            usleep ((useconds_t)(delay_ms * 1000));
+        }
+    }
+
+    close (fd);
+    return 0;
+} // main
+
+/* End of File */
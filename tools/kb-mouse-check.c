@@ -0,0 +1,200 @@
+/* kb-mouse-check - check the mouse keys acceleration on the host build
+ *
+ * Steps kb-mouse.c 1 ms at a time, as mouse_task() does, and checks that:
+ *   - the speed starts at MOUSE_V0, never falls as a key is held, and is
+ *     MOUSE_VMAX from MOUSE_ACCEL_MS on,
+ *   - a held key moves the pointer exactly the whole pixels of the speeds
+ *     added up, with no drift from the sub-pixel carry,
+ *   - the same keys always give the same trajectory, left and up are the
+ *     mirror of right and down, and a diagonal moves each axis as a
+ *     straight move does,
+ *   - letting go and pressing again starts from MOUSE_V0, with nothing carried,
+ *   - the buttons are reported on a change only, and the wheel clicks at once
+ *     and then every MOUSE_WHEEL_MS.
+ * With the built-in profile, the distances after a few hold times are checked
+ * too, so any change to the sums shows up. The ramp covers 691 pixels, where
+ * the smooth curve it steps along would cover 700.
+ *
+ * Usage: kb-mouse-check [-v]
+ *   -v prints the trajectory, a line each 100 ms
+ *   Prints each check. The exit status is 1 if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fw-kb-main.h"
+#include "kb-mouse.h"
+#include "kb-mock.h"
+
+#define RUN_MS  3000 // Long enough to reach top speed and stay there
+
+// Hold "keys" for "ms", from a fresh state, the pointer position after each ms in x [] and y []
+static void trajectory (uint16_t keys, int ms, int32_t *x, int32_t *y)
+{
+    mouse_state st;
+    mouse_move mv;
+    int32_t px = 0;
+    int32_t py = 0;
+    int t;
+    mouse_reset (&st);
+    for (t = 0; t < ms; ++t)
+    {
+        (void) mouse_step (&st, keys, &mv);
+        px += mv.dx;
+        py += mv.dy;
+        x [t] = px;
+        y [t] = py;
+    }
+} // trajectory
+
+int main (int argc, char **argv)
+{
+    static int32_t x [RUN_MS], y [RUN_MS], x2 [RUN_MS], y2 [RUN_MS];
+    char what [100];
+    int verbose = 0;
+    int opt;
+    int t;
+    while ((opt = getopt (argc, argv, "v")) != -1)
+    {
+        if (opt != 'v')
+        {
+            fprintf (stderr, "usage: kb-mouse-check [-v]\n");
+            return 2;
+        }
+        verbose = 1;
+    }
+
+    // The speed curve
+    int rising = 1;
+    for (t = 1; t <= MOUSE_ACCEL_MS + 100; ++t)
+    {
+        if ((mouse_speed (t) < mouse_speed (t - 1)) || (mouse_speed (t) > MOUSE_VMAX))
+        {
+            rising = 0;
+        }
+    }
+    mock_check (mouse_speed (0) == MOUSE_V0, "the speed starts at MOUSE_V0");
+    mock_check (rising, "...never falls, nor goes over MOUSE_VMAX");
+    mock_check ((mouse_speed (MOUSE_ACCEL_MS - 1) < MOUSE_VMAX) && (mouse_speed (MOUSE_ACCEL_MS) == MOUSE_VMAX),
+           "...and reaches MOUSE_VMAX at MOUSE_ACCEL_MS");
+
+    // Right: exactly the whole pixels of the speeds added up
+    trajectory (MK_RIGHT, RUN_MS, x, y);
+    int64_t sum = 0;
+    int exact = 1;
+    int step_max = 0;
+    for (t = 0; t < RUN_MS; ++t)
+    {
+        sum += mouse_speed (t);
+        if (x [t] != (int32_t)(sum >> 8))
+        {
+            exact = 0;
+        }
+        if ((x [t] - ((t > 0) ? x [t - 1] : 0)) > step_max)
+        {
+            step_max = x [t] - ((t > 0) ? x [t - 1] : 0);
+        }
+        if (verbose && ((t % 100) == 99))
+        {
+            printf ("%5d ms %6d px  %5.2f px/ms\n", t + 1, x [t], mouse_speed (t) / 256.0);
+        }
+    }
+    snprintf (what, sizeof (what), "right moves %d pixels in %d ms, the speeds added up", x [RUN_MS - 1], RUN_MS);
+    mock_check (exact && (y [RUN_MS - 1] == 0), what);
+    snprintf (what, sizeof (what), "...at most %d pixels a ms", step_max);
+    mock_check (step_max <= ((MOUSE_VMAX + 255) / 256), what);
+
+    // The same again
+    trajectory (MK_RIGHT, RUN_MS, x2, y2);
+    mock_check (memcmp (x, x2, sizeof (x)) == 0, "the same keys give the same trajectory");
+
+    // Mirrors and diagonals
+    int mirror = 1;
+    int diagonal = 1;
+    trajectory (MK_LEFT, RUN_MS, x2, y2);
+    for (t = 0; t < RUN_MS; ++t)
+    {
+        mirror &= (x2 [t] == -x [t]) && (y2 [t] == 0);
+    }
+    trajectory (MK_DOWN, RUN_MS, x2, y2);
+    for (t = 0; t < RUN_MS; ++t)
+    {
+        mirror &= (y2 [t] == x [t]) && (x2 [t] == 0);
+    }
+    trajectory (MK_UP, RUN_MS, x2, y2);
+    for (t = 0; t < RUN_MS; ++t)
+    {
+        mirror &= (y2 [t] == -x [t]) && (x2 [t] == 0);
+    }
+    mock_check (mirror, "left, down and up are the same as right, turned");
+    trajectory (MK_UP | MK_LEFT, RUN_MS, x2, y2);
+    for (t = 0; t < RUN_MS; ++t)
+    {
+        diagonal &= (x2 [t] == -x [t]) && (y2 [t] == -x [t]);
+    }
+    mock_check (diagonal, "up and left together move each axis as a straight move");
+    trajectory (MK_LEFT | MK_RIGHT, RUN_MS, x2, y2);
+    mock_check ((x2 [RUN_MS - 1] == 0) && (y2 [RUN_MS - 1] == 0), "left and right together do not move");
+
+    // Let go and press again
+    mouse_state st;
+    mouse_move mv;
+    mouse_reset (&st);
+    for (t = 0; t < 500; ++t)
+    {
+        (void) mouse_step (&st, MK_RIGHT, &mv);
+    }
+    (void) mouse_step (&st, 0, &mv);
+    int32_t again = 0;
+    for (t = 0; t < 100; ++t)
+    {
+        (void) mouse_step (&st, MK_RIGHT, &mv);
+        again += mv.dx;
+    }
+    mock_check (again == x [99], "pressed again, it starts from MOUSE_V0 with nothing carried");
+
+    // Buttons and wheel
+    mouse_reset (&st);
+    int reports = 0;
+    for (t = 0; t < 100; ++t)
+    {
+        reports += mouse_step (&st, (t < 50) ? MK_BTN1 : 0, &mv);
+    }
+    mock_check (reports == 2, "a button held 50 ms is reported down and up, and not in between");
+    mouse_reset (&st);
+    int clicks = 0;
+    int first = -1;
+    for (t = 0; t < (MOUSE_WHEEL_MS * 5); ++t)
+    {
+        if (mouse_step (&st, MK_WDN, &mv) && (mv.wheel != 0))
+        {
+            clicks += -mv.wheel;
+            first = (first < 0) ? t : first;
+        }
+    }
+    snprintf (what, sizeof (what), "the wheel held %d ms turns %d clicks down, the first at once",
+              MOUSE_WHEEL_MS * 5, clicks);
+    mock_check ((clicks == 5) && (first == 0), what);
+
+#if (MOUSE_PROFILE == MOUSE_QUADRATIC) && (MOUSE_V0 == 32) && (MOUSE_VMAX == 384) && (MOUSE_ACCEL_MS == 1200)
+    // The built-in profile
+    static const struct { int ms; int32_t px; } tuned [] =
+    {
+        { 100, 12 }, { 500, 99 }, { 1200, 691 }, { 2000, 1891 }, { 3000, 3391 }
+    };
+    for (t = 0; t < (int)(sizeof (tuned) / sizeof (tuned [0])); ++t)
+    {
+        snprintf (what, sizeof (what), "%d pixels in %d ms (built-in profile)", x [tuned [t].ms - 1], tuned [t].ms);
+        mock_check (x [tuned [t].ms - 1] == tuned [t].px, what);
+    }
+#endif
+
+    printf ("\n");
+    return mock_check_end ();
+} // main
+
+/* End of File */
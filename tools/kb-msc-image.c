@@ -0,0 +1,451 @@
+/* kb-msc-image - make the USB drive image on the host, and check it is a good FAT12 volume
+ *
+ * Builds the firmware's own kb-msc.c, kb-store.c and kb-config.c for the
+ * host (KB_HOST_DRIVE, see fw-kb-main.h), with the config store on a RAM
+ * flash (host/kb-flash.c) and their tasks run by kb-sched.c, and reads every block of the drive through
+ * tud_msc_read10_cb(), as the host would. Checks that:
+ *   - the boot sector, FAT and root directory agree with each other and
+ *     with the capacity, and there are few enough clusters for FAT12,
+ *   - each file is one unbroken chain of clusters, as long as its size,
+ *     no cluster is in two files, and the rest are free,
+ *   - CONFIG.BIN is a good store record of the live config, and STATS.TXT
+ *     lines of a fixed width with the counters in them,
+ *   - a changed CONFIG.BIN written back is made live once core-1 takes it
+ *     up, saved to the store by the tasks it arms, which then stop, and
+ *     loaded again at the next boot,
+ *   - a bad CONFIG.BIN fails the write, and a write to the FAT or the
+ *     directory is thrown away.
+ *
+ * Usage: kb-msc-image [image]
+ *   Prints each check. With "image", the drive as it is at the end (the
+ *   config saved once) is written there, to be checked with the standard
+ *   tools, e.g. fsck.fat -n image, mdir -i image, mtype -i image ::STATS.TXT,
+ *   or mounted with mount -o loop,ro. The exit status is 1 if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-msc.h"
+#include "kb-sched.h"
+#include "kb-store.h"
+#include "kb-telem.h"
+#include "kb-hal.h"
+#include "kb-mock.h"
+#include "hardware/flash.h"
+#include "tusb.h"
+
+#define BLOCK_SZ     512
+#define MAX_BLOCKS   4096 // Far more than any build of the drive
+#define XFER_BLOCKS  8    // Blocks asked for at once, as a host does
+
+#define FAKE_SCANS   123456
+#define FAKE_UPTIME  4242
+#define NEW_COMBO_MS 77   // CONFIG.BIN is written back with this combo window
+
+static uint8_t image [MAX_BLOCKS * BLOCK_SZ];
+static uint32_t n_blocks = 0;
+static uint32_t now_us = 0;
+static uint8_t sense [3];
+//--------------------------------------------------------------------+
+// What the drive needs from the rest of the firmware
+//--------------------------------------------------------------------+
+
+uint32_t hal_time_us (void)
+{
+    now_us += 1000;
+    return now_us;
+} // hal_time_us
+
+bool tud_msc_set_sense (uint8_t lun, uint8_t sense_key, uint8_t add_sense_code, uint8_t add_sense_qualifier)
+{
+    (void) lun;
+    sense [0] = sense_key;
+    sense [1] = add_sense_code;
+    sense [2] = add_sense_qualifier;
+    return true;
+} // tud_msc_set_sense
+
+// The counters, made up so STATS.TXT can be checked
+uint16_t telem_perf_fill (uint8_t *buf, uint16_t len)
+{
+    if (len < PERF_REPORT_LEN)
+    {
+        return 0;
+    }
+    memset (buf, 0, PERF_REPORT_LEN);
+    buf [PERF_OFS_VERSION] = PERF_VERSION;
+    perf_put32 (&buf [PERF_OFS_UPTIME], FAKE_UPTIME);
+    perf_put32 (&buf [PERF_OFS_SCANS], FAKE_SCANS);
+    return PERF_REPORT_LEN;
+} // telem_perf_fill
+
+// There are no suspend states nor watchdog here, only the config protocol uses them
+int power_info (uint8_t *data, int len)
+{
+    return CFG_ERR_CMD;
+} // power_info
+
+int watch_info (uint8_t *data, int len)
+{
+    return CFG_ERR_CMD;
+} // watch_info
+
+//--------------------------------------------------------------------+
+// The volume, as the host sees it
+//--------------------------------------------------------------------+
+
+static uint16_t get16 (uint8_t const *p)
+{
+    return perf_get16 (p);
+} // get16
+
+// Read the whole drive into image [], a few blocks at a time
+static int read_drive (void)
+{
+    uint32_t lba;
+    for (lba = 0; lba < n_blocks; lba += XFER_BLOCKS)
+    {
+        uint32_t n = ((n_blocks - lba) < XFER_BLOCKS) ? (n_blocks - lba) : XFER_BLOCKS;
+        if (tud_msc_read10_cb (0, lba, 0, &image [lba * BLOCK_SZ], n * BLOCK_SZ) != (int32_t)(n * BLOCK_SZ))
+        {
+            return 0;
+        }
+    }
+    return 1;
+} // read_drive
+
+typedef struct
+{
+    uint32_t fat_lba;
+    uint32_t fat_blocks;
+    uint32_t root_lba;
+    uint32_t root_items;
+    uint32_t data_lba;
+    uint32_t clusters;
+} volume;
+
+static volume vol;
+
+static uint32_t fat_entry (uint32_t cl)
+{
+    uint8_t const *fat = &image [vol.fat_lba * BLOCK_SZ];
+    uint32_t v = fat [(cl * 3) / 2] | (fat [((cl * 3) / 2) + 1] << 8);
+    return (cl & 1) ? (v >> 4) : (v & 0xFFF);
+} // fat_entry
+
+// The root directory entry with this 8.3 name, or NULL
+static uint8_t const *dir_find (char const *name)
+{
+    uint32_t idx;
+    for (idx = 0; idx < vol.root_items; ++idx)
+    {
+        uint8_t const *ent = &image [(vol.root_lba * BLOCK_SZ) + (idx * 32)];
+        if ((ent [0] != 0) && (memcmp (ent, name, 11) == 0))
+        {
+            return ent;
+        }
+    }
+    return NULL;
+} // dir_find
+
+// A file's data, following its chain, returns its size
+static uint32_t file_read (char const *name, uint8_t *buf, uint32_t len)
+{
+    uint8_t const *ent = dir_find (name);
+    if (ent == NULL)
+    {
+        return 0;
+    }
+    uint32_t size = perf_get32 (&ent [28]);
+    uint32_t cl = get16 (&ent [26]);
+    uint32_t done = 0;
+    while ((done < size) && (done < len) && (cl >= 2) && (cl < (vol.clusters + 2)))
+    {
+        uint32_t n = ((size - done) < BLOCK_SZ) ? (size - done) : BLOCK_SZ;
+        n = ((len - done) < n) ? (len - done) : n;
+        memcpy (&buf [done], &image [(vol.data_lba + cl - 2) * BLOCK_SZ], n);
+        done += n;
+        cl = fat_entry (cl);
+    }
+    return size;
+} // file_read
+
+// The boot sector and the FAT, checked against the capacity
+static void check_volume (void)
+{
+    uint8_t const *boot = image;
+    char what [100];
+
+    mock_check ((boot [510] == 0x55) && (boot [511] == 0xAA) && (boot [0] == 0xEB) && (boot [2] == 0x90),
+           "the boot sector has its jump and signature");
+    mock_check ((get16 (&boot [11]) == BLOCK_SZ) && (boot [13] == 1) && (boot [16] == 1),
+           "...512 byte sectors, a cluster each, one FAT");
+    mock_check ((get16 (&boot [19]) == n_blocks) && (boot [21] == 0xF8), "...the size of the drive, a fixed disk");
+    mock_check ((boot [38] == 0x29) && (memcmp (&boot [54], "FAT12   ", 8) == 0), "...and says it is FAT12");
+
+    vol.fat_lba = get16 (&boot [14]);
+    vol.fat_blocks = get16 (&boot [22]);
+    vol.root_lba = vol.fat_lba + vol.fat_blocks;
+    vol.root_items = get16 (&boot [17]);
+    vol.data_lba = vol.root_lba + (((vol.root_items * 32) + BLOCK_SZ - 1) / BLOCK_SZ);
+    vol.clusters = (vol.data_lba < n_blocks) ? (n_blocks - vol.data_lba) : 0;
+    snprintf (what, sizeof (what), "%lu clusters, few enough for FAT12, and the FAT holds them all",
+              (unsigned long)vol.clusters);
+    mock_check ((vol.clusters > 0) && (vol.clusters < 4085) &&
+           (((vol.fat_blocks * BLOCK_SZ * 2) / 3) >= (vol.clusters + 2)) && (vol.fat_lba >= 1), what);
+    mock_check ((fat_entry (0) == 0xFF8) && (fat_entry (1) == 0xFFF), "the FAT starts with the media byte and an end mark");
+} // check_volume
+
+// The directory, and each file's chain
+static void check_files (void)
+{
+    static uint8_t used [4096];
+    char what [100];
+    uint32_t idx;
+    uint32_t cl;
+    int files = 0;
+    int chains = 1;
+
+    uint8_t const *label = &image [vol.root_lba * BLOCK_SZ];
+    mock_check ((label [11] == 0x08) && (memcmp (label, "FONTWRITER ", 11) == 0), "the volume label is FONTWRITER");
+
+    memset (used, 0, sizeof (used));
+    for (idx = 1; idx < vol.root_items; ++idx)
+    {
+        uint8_t const *ent = &image [(vol.root_lba * BLOCK_SZ) + (idx * 32)];
+        if (ent [0] == 0)
+        {
+            break;
+        }
+        uint32_t size = perf_get32 (&ent [28]);
+        uint32_t want = (size + BLOCK_SZ - 1) / BLOCK_SZ;
+        uint32_t n = 0;
+        ++files;
+        for (cl = get16 (&ent [26]); (cl >= 2) && (cl < (vol.clusters + 2)) && (n <= want); cl = fat_entry (cl))
+        {
+            if (used [cl] || ((fat_entry (cl) != 0xFFF) && (fat_entry (cl) != (cl + 1))))
+            {
+                chains = 0; // In two files, or not one after the other as kb-msc.c lays them out
+            }
+            used [cl] = 1;
+            ++n;
+        }
+        if ((n != want) || (cl != 0xFFF) || (ent [11] & 0x18))
+        {
+            chains = 0;
+        }
+    }
+    snprintf (what, sizeof (what), "%d files, each one chain of clusters as long as its size", files);
+    mock_check ((files >= 2) && chains, what);
+
+    uint32_t n_free = 0;
+    int stray = 0;
+    for (cl = 2; cl < (vol.clusters + 2); ++cl)
+    {
+        if (!used [cl])
+        {
+            stray |= (fat_entry (cl) != 0);
+            ++n_free;
+        }
+    }
+    snprintf (what, sizeof (what), "the other %lu clusters are free, to copy CONFIG.BIN back", (unsigned long)n_free);
+    mock_check (!stray && (n_free > 0), what);
+} // check_files
+
+// CONFIG.BIN and STATS.TXT, what they should hold
+static void check_contents (uint32_t seq, uint16_t combo_ms, uint32_t saves)
+{
+    store_rec rec;
+    char stats [2048];
+    char what [100];
+    char want [80];
+
+    memset (&rec, 0, sizeof (rec));
+    mock_check (file_read ("CONFIG  BIN", (uint8_t *)&rec, sizeof (rec)) == sizeof (store_rec),
+           "CONFIG.BIN is a store record long");
+    snprintf (what, sizeof (what), "...a good one, of the live config, store sequence %lu", (unsigned long)seq);
+    mock_check (store_good (&rec) && (rec.seq == seq) && (memcmp (&rec.cfg, cfg_live (), sizeof (kb_config)) == 0) &&
+           (rec.cfg.timing [CFG_TM_COMBO_WINDOW] == combo_ms), what);
+
+    memset (stats, 0, sizeof (stats));
+    uint32_t size = file_read ("STATS   TXT", (uint8_t *)stats, sizeof (stats) - 1);
+    int lines = 1;
+    uint32_t ofs;
+    for (ofs = 0; ofs < size; ofs += 32)
+    {
+        lines &= (stats [ofs + 31] == '\n') && (stats [ofs + 20] == ' ') && (stats [ofs] != ' ');
+    }
+    mock_check ((size > 0) && (size < sizeof (stats)) && ((size % 32) == 0) && lines,
+           "STATS.TXT is lines of 32 characters");
+    snprintf (want, sizeof (want), "%-20s %10lu\n", "scans", (unsigned long)FAKE_SCANS);
+    mock_check (strstr (stats, want) != NULL, "...with the scans counted");
+    snprintf (want, sizeof (want), "%-20s %10lu\n%-20s %10lu\n", "store_seq", (unsigned long)seq,
+              "store_saves", (unsigned long)saves);
+    snprintf (what, sizeof (what), "...and the store sequence %lu after %lu saves", (unsigned long)seq,
+              (unsigned long)saves);
+    mock_check (strstr (stats, want) != NULL, what);
+} // check_contents
+
+// CRC-32 (IEEE), as kb-store.c, to make up records
+static uint32_t crc32 (uint8_t const *p, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    while (len-- > 0)
+    {
+        crc ^= *p++;
+        int bit;
+        for (bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        }
+    }
+    return ~crc;
+} // crc32
+
+// Write one block, as the host does when CONFIG.BIN is copied on to the drive
+static int32_t write_block (uint32_t lba, void const *data, uint32_t len)
+{
+    uint8_t buf [BLOCK_SZ];
+    memset (buf, 0, sizeof (buf));
+    memcpy (buf, data, len);
+    memset (sense, 0, sizeof (sense));
+    return tud_msc_write10_cb (0, lba, 0, buf, sizeof (buf));
+} // write_block
+
+// Copy a changed CONFIG.BIN back, and see it made live and saved
+static void check_write_back (void)
+{
+    store_rec rec;
+    store_rec bad;
+    uint8_t before [BLOCK_SZ];
+    uint8_t buf [BLOCK_SZ];
+    char what [100];
+
+    uint8_t const *ent = dir_find ("CONFIG  BIN");
+    uint32_t lba = vol.data_lba + get16 (&ent [26]) - 2;
+    file_read ("CONFIG  BIN", (uint8_t *)&rec, sizeof (rec));
+    uint16_t was_ms = rec.cfg.timing [CFG_TM_COMBO_WINDOW];
+
+    // A bad record
+    bad = rec;
+    bad.cfg.timing [CFG_TM_COMBO_WINDOW] = NEW_COMBO_MS; // CRC not made again
+    mock_check ((write_block (lba, &bad, sizeof (bad)) == -1) && (sense [0] == SCSI_SENSE_ILLEGAL_REQUEST) &&
+           (sense [1] == 0x26), "a CONFIG.BIN with a bad CRC fails the write, an invalid field");
+    bad.len = (uint16_t)(sizeof (kb_config) + 2);
+    bad.crc = crc32 ((uint8_t const *)&bad.cfg, sizeof (kb_config));
+    mock_check (write_block (lba, &bad, sizeof (bad)) == -1, "...as does one from another build");
+    cfg_sync ();
+    mock_check (cfg_live ()->timing [CFG_TM_COMBO_WINDOW] == was_ms, "...and neither is made live");
+
+    // The FAT and directory are made up, writes to them are thrown away
+    tud_msc_read10_cb (0, vol.fat_lba, 0, before, sizeof (before));
+    memset (buf, 0, sizeof (buf));
+    mock_check (write_block (vol.fat_lba, buf, sizeof (buf)) == BLOCK_SZ, "a write to the FAT is taken");
+    tud_msc_read10_cb (0, vol.fat_lba, 0, buf, sizeof (buf));
+    mock_check (memcmp (before, buf, sizeof (buf)) == 0, "...and thrown away");
+
+    // A good one
+    rec.cfg.timing [CFG_TM_COMBO_WINDOW] = NEW_COMBO_MS;
+    rec.crc = crc32 ((uint8_t const *)&rec.cfg, sizeof (kb_config));
+    mock_check (write_block (lba, &rec, sizeof (rec)) == BLOCK_SZ, "a changed CONFIG.BIN written back is taken");
+    sched_run ();
+    mock_check ((cfg_live ()->timing [CFG_TM_COMBO_WINDOW] == was_ms) && (store_hold == STORE_IDLE),
+           "...not made live nor saved before core-1 takes it up");
+    cfg_sync (); // Core-1's end of a pass
+    snprintf (what, sizeof (what), "...then made live, combo window %u ms", cfg_live ()->timing [CFG_TM_COMBO_WINDOW]);
+    mock_check (cfg_live ()->timing [CFG_TM_COMBO_WINDOW] == NEW_COMBO_MS, what);
+    sched_run ();
+    mock_check (store_hold == STORE_HOLD_REQ, "...and core-1 is asked for the flash to save it");
+    store_hold = STORE_HOLDING; // Core-1 scanning from RAM
+    sched_run ();
+    mock_check ((store_hold == STORE_IDLE) && (store_seq () == 1) && (mock_flash_erases () == 1),
+           "...saved in the first slot, and the flash given back");
+    sched_run ();
+    mock_check ((store_seq () == 1) && (sched_wait_us () == SCHED_NEVER), "...once only, and no task is left armed");
+
+    // Boot again
+    uint8_t const *layers [CFG_LAYERS];
+    static const uint8_t no_keys [CFG_KEYS] = { 0 };
+    int layer;
+    for (layer = 0; layer < CFG_LAYERS; ++layer)
+    {
+        layers [layer] = no_keys;
+    }
+    cfg_init (layers);
+    mock_check (cfg_live ()->timing [CFG_TM_COMBO_WINDOW] == was_ms, "a reboot starts from the built-in config");
+    store_init ();
+    mock_check (cfg_live ()->timing [CFG_TM_COMBO_WINDOW] == NEW_COMBO_MS, "...and loads the saved one over it");
+} // check_write_back
+
+int main (int argc, char **argv)
+{
+    static const uint8_t no_keys [CFG_KEYS] = { 0 };
+    uint8_t const *layers [CFG_LAYERS];
+    uint8_t buf [BLOCK_SZ];
+    uint16_t block_sz = 0;
+    char what [100];
+    int layer;
+
+    if (argc > 2)
+    {
+        fprintf (stderr, "usage: kb-msc-image [image]\n");
+        return 2;
+    }
+
+    // Boot, as main() does: the built-in config, then the store over it, on a new flash
+    mock_flash_reset ();
+    for (layer = 0; layer < CFG_LAYERS; ++layer)
+    {
+        layers [layer] = no_keys;
+    }
+    cfg_init (layers);
+    store_init ();
+    msc_init ();
+    uint16_t combo_ms = cfg_live ()->timing [CFG_TM_COMBO_WINDOW];
+
+    tud_msc_capacity_cb (0, &n_blocks, &block_sz);
+    snprintf (what, sizeof (what), "the drive is %lu blocks of %u bytes", (unsigned long)n_blocks, block_sz);
+    mock_check ((block_sz == BLOCK_SZ) && (n_blocks > 0) && (n_blocks <= MAX_BLOCKS), what);
+    if (mock_failed ())
+    {
+        return 1;
+    }
+    mock_check (tud_msc_read10_cb (0, 0, 1, buf, sizeof (buf)) == -1, "a read part way into a block is refused");
+    static const uint8_t prevent [16] = { SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL };
+    static const uint8_t format [16] = { 0x04 };
+    mock_check ((tud_msc_scsi_cb (0, prevent, buf, 0) == 0) && (tud_msc_scsi_cb (0, format, buf, 0) == -1),
+           "medium removal is allowed, and any other command refused");
+
+    mock_check (read_drive (), "every block reads");
+    check_volume ();
+    if (mock_failed ())
+    {
+        return 1; // The rest would only read garbage
+    }
+    check_files ();
+    check_contents (0, combo_ms, 0);
+
+    check_write_back ();
+    mock_check (read_drive (), "every block reads again");
+    check_contents (1, NEW_COMBO_MS, 1);
+
+    if (argc == 2)
+    {
+        FILE *fp = fopen (argv [1], "wb");
+        if ((fp == NULL) || (fwrite (image, BLOCK_SZ, n_blocks, fp) != n_blocks) || (fclose (fp) != 0))
+        {
+            perror (argv [1]);
+            return 1;
+        }
+    }
+
+    printf ("\n");
+    return mock_check_end ();
+} // main
+
+/* End of File */
@@ -0,0 +1,349 @@
+/* kb-oracle - check what each key types on a UK Linux host
+ *
+ * Types every key of the basic and Code-II keymaps, with and without Shift,
+ * through the firmware's own scanner, decoder and report code (the host
+ * build, see host/kb-mock.h), and decodes the reports with the virtual host
+ * (host/kb-vhost.h, the gb xkb key map). Each key is typed twice: the normal
+ * way (AltGr levels, dead keys), then in the Unicode entry mode, where the
+ * special symbols are sent by their code points from the firmware's table.
+ *
+ * Usage: kb-oracle [-v]
+ *   Prints the keys that fail, then the report and frame totals. -v prints
+ *   every key, with the text it types and what that costs.
+ *
+ * A key fails if:
+ *   - it is a plain ASCII character in the keymap (or B_P, the UK backslash
+ *     key), without Shift, and types something else, or
+ *   - it is a special symbol (CER to GBP) and types something different the
+ *     normal way to the Unicode way.
+ * The exit status is 1 if any key fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tusb.h>
+
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "usb_descriptors.h"
+#include "kb-mock.h"
+#include "kb-vhost.h"
+
+// Key codes, as in fw-kb-main.c
+#define KC_TAB  '\t'
+#define KC_RTN  '\n'
+#define KC_B_P  23   // Backslash, by the UK key next to the left Shift
+#define KC_CER  128
+#define KC_GBP  147
+#define KC_HLP  201
+#define KC_CD2  202
+#define KC_SHF  203
+#define KC_MODS 200 // Codes from here on are modifiers
+
+static char const *const special_names [KC_GBP - KC_CER + 1] = {
+    "CER", "CAP", "BSQ", "BCR", "SSZ", "YEN", "CNT", "BKT", "SPM", "DEG",
+    "IEX", "IQM", "NSQ", "CED", "OHM", "Aac", "Egr", "Ugr", "Agr", "GBP"
+};
+
+// How long each step of a keystroke is held (us)
+#define HOLD_MODS_US  60000  // Longer than the combo window
+#define HOLD_KEY_US   100000
+#define SETTLE_US     100000
+#define GAP_US        500000 // Longer than the one-shot double tap
+
+static uint8_t host_leds = 0;
+
+// Each report goes to the virtual host, which sets the LEDs back as a PC would
+static void on_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    vhost_report (t_us, report_id, report, len);
+    if (vhost_leds () != host_leds)
+    {
+        host_leds = vhost_leds ();
+        tud_hid_set_report_cb (0, REPORT_ID_KEYBOARD, HID_REPORT_TYPE_OUTPUT, &host_leds, 1);
+    }
+} // on_report
+
+// Press and let go of some keys together, given by their keymap index
+static void tap (int const *keys, int n, uint32_t hold_us)
+{
+    uint8_t down [COL_SZ];
+    int idx;
+    memset (down, 0, sizeof (down));
+    for (idx = 0; idx < n; ++idx)
+    {
+        down [keys [idx] % COL_SZ] |= (uint8_t)(1u << (keys [idx] / COL_SZ));
+    }
+    mock_set_keys (down);
+    mock_run_until (mock_now () + hold_us);
+    memset (down, 0, sizeof (down));
+    mock_set_keys (down);
+    mock_run_until (mock_now () + GAP_US);
+} // tap
+
+// Type one key with the modifiers held, return the text and the cost
+static void type_key (int key, int const *mods, int n_mods, char *text, int len,
+                      uint32_t *reports, uint32_t *frames)
+{
+    uint8_t down [COL_SZ];
+    int idx;
+
+    vhost_reset ();
+    memset (down, 0, sizeof (down));
+    for (idx = 0; idx < n_mods; ++idx)
+    {
+        down [mods [idx] % COL_SZ] |= (uint8_t)(1u << (mods [idx] / COL_SZ));
+    }
+    mock_set_keys (down);
+    mock_run_until (mock_now () + HOLD_MODS_US);
+
+    // Count the reports from the key going down, and from it being let go
+    vhost_mark ();
+    down [key % COL_SZ] |= (uint8_t)(1u << (key / COL_SZ));
+    mock_set_keys (down);
+    mock_run_until (mock_now () + HOLD_KEY_US);
+    *reports = vhost_reports ();
+    *frames = vhost_frames ();
+
+    vhost_mark ();
+    down [key % COL_SZ] &= (uint8_t)~(1u << (key / COL_SZ));
+    mock_set_keys (down);
+    mock_run_until (mock_now () + SETTLE_US);
+    *reports += vhost_reports ();
+    *frames += vhost_frames ();
+
+    memset (down, 0, sizeof (down));
+    mock_set_keys (down);
+    mock_run_until (mock_now () + GAP_US);
+    snprintf (text, len, "%s", vhost_text ());
+} // type_key
+
+// The text in quotes, with the control characters escaped, padded to the width given
+static char const *quoted (char const *text, int width)
+{
+    static char buf [2][256];
+    static int which = 0;
+    int out = 0;
+    int shown = 0;
+    char *p = buf [which];
+    which = !which; // Two can be used in one printf
+    p [out++] = '"';
+    while ((*text) && (out < (int)sizeof (buf [0]) - 40))
+    {
+        if (*text == '\n')
+        {
+            p [out++] = '\\';
+            p [out++] = 'n';
+        }
+        else if (*text == '\t')
+        {
+            p [out++] = '\\';
+            p [out++] = 't';
+        }
+        else
+        {
+            p [out++] = *text;
+        }
+        if ((*text & 0xC0) != 0x80) // Not a UTF-8 continuation byte
+        {
+            ++shown;
+        }
+        ++text;
+    }
+    p [out++] = '"';
+    for (shown += 2; (shown < width) && (out < (int)sizeof (buf [0]) - 1); ++shown)
+    {
+        p [out++] = ' ';
+    }
+    p [out] = 0;
+    return p;
+} // quoted
+
+static void code_name (uint8_t code, char *buf, int len)
+{
+    if ((code >= KC_CER) && (code <= KC_GBP))
+    {
+        snprintf (buf, len, "%s", special_names [code - KC_CER]);
+    }
+    else if ((code > ' ') && (code < 0x7F))
+    {
+        snprintf (buf, len, "'%c'", code);
+    }
+    else if (code == ' ')
+    {
+        snprintf (buf, len, "SPC");
+    }
+    else if (code == KC_B_P)
+    {
+        snprintf (buf, len, "B_P");
+    }
+    else
+    {
+        snprintf (buf, len, "%u", code);
+    }
+} // code_name
+
+static int find_key (uint8_t const *layer, uint8_t code)
+{
+    int idx;
+    for (idx = 0; idx < CFG_KEYS; ++idx)
+    {
+        if (layer [idx] == code)
+        {
+            return idx;
+        }
+    }
+    return -1;
+} // find_key
+
+int main (int argc, char **argv)
+{
+    int verbose = 0;
+    int opt;
+    while ((opt = getopt (argc, argv, "v")) != -1)
+    {
+        if (opt == 'v')
+        {
+            verbose = 1;
+        }
+        else
+        {
+            fprintf (stderr, "usage: %s [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    mock_on_report (on_report);
+    mock_init ();
+    mock_run_until (SETTLE_US);
+
+    kb_config const *cfg = cfg_live ();
+    int shift = find_key (cfg->keys [CFG_LAYER_BASE], KC_SHF);
+    int cd2 = find_key (cfg->keys [CFG_LAYER_BASE], KC_CD2);
+    int hlp = find_key (cfg->keys [CFG_LAYER_BASE], KC_HLP);
+    if ((shift < 0) || (cd2 < 0) || (hlp < 0))
+    {
+        fprintf (stderr, "Shift, Code-II or HELP is not in the basic keymap\n");
+        return 1;
+    }
+
+    // Type them all the normal way, then in the Unicode entry mode
+    static char texts [2][4][CFG_KEYS][64];
+    static uint32_t costs [2][4][CFG_KEYS][2];
+    int mode;
+    for (mode = 0; mode < 2; ++mode)
+    {
+        if (mode == 1)
+        {
+            int toggle [2] = { hlp, cd2 };
+            tap (toggle, 2, HOLD_KEY_US); // HELP + Code-II toggles the Unicode entry mode
+        }
+        int pass;
+        for (pass = 0; pass < 4; ++pass)
+        {
+            int mods [2];
+            int n_mods = 0;
+            if (pass >= 2)
+            {
+                mods [n_mods++] = cd2;
+            }
+            if (pass & 1)
+            {
+                mods [n_mods++] = shift;
+            }
+            uint8_t const *layer = cfg->keys [(pass >= 2) ? CFG_LAYER_CD2 : CFG_LAYER_BASE];
+            int key;
+            for (key = 0; key < CFG_KEYS; ++key)
+            {
+                if ((layer [key] == 0) || (layer [key] >= KC_MODS))
+                {
+                    continue;
+                }
+                type_key (key, mods, n_mods, texts [mode][pass][key], sizeof (texts [mode][pass][key]),
+                          &costs [mode][pass][key][0], &costs [mode][pass][key][1]);
+            }
+        }
+    }
+
+    static char const *const pass_names [4] = { "", "SHF", "CD2", "CD2+SHF" };
+    uint32_t total [2][2] = { { 0, 0 }, { 0, 0 } }; // Special symbols, [mode][reports, frames]
+    int n_keys = 0;
+    int n_checked = 0;
+    int n_failed = 0;
+    int pass;
+    for (pass = 0; pass < 4; ++pass)
+    {
+        uint8_t const *layer = cfg->keys [(pass >= 2) ? CFG_LAYER_CD2 : CFG_LAYER_BASE];
+        int key;
+        for (key = 0; key < CFG_KEYS; ++key)
+        {
+            uint8_t code = layer [key];
+            if ((code == 0) || (code >= KC_MODS))
+            {
+                continue;
+            }
+            ++n_keys;
+
+            char const *text = texts [0][pass][key];
+            char const *uni = texts [1][pass][key];
+            char want [2] = { (char)((code == KC_B_P) ? '\\' : code), 0 };
+            char const *fail = NULL;
+            if ((!(pass & 1)) && (((code >= ' ') && (code < 0x7F)) || (code == KC_TAB) || (code == KC_RTN) ||
+                                  (code == KC_B_P)))
+            {
+                ++n_checked;
+                if (strcmp (text, want) != 0)
+                {
+                    fail = "not the keymap's character";
+                }
+            }
+            else if ((code >= KC_CER) && (code <= KC_GBP))
+            {
+                ++n_checked;
+                if (strcmp (text, uni) != 0)
+                {
+                    fail = "differs from the Unicode entry";
+                }
+                total [0][0] += costs [0][pass][key][0];
+                total [0][1] += costs [0][pass][key][1];
+                total [1][0] += costs [1][pass][key][0];
+                total [1][1] += costs [1][pass][key][1];
+            }
+            if (fail != NULL)
+            {
+                ++n_failed;
+            }
+
+            if ((verbose) || (fail != NULL))
+            {
+                char name [16];
+                code_name (code, name, sizeof (name));
+                printf ("r%dc%d %-8s %-5s %s %3lu reports %3lu frames", key / COL_SZ, key % COL_SZ,
+                        pass_names [pass], name, quoted (text, 18),
+                        (unsigned long)costs [0][pass][key][0], (unsigned long)costs [0][pass][key][1]);
+                if (strcmp (text, uni) != 0)
+                {
+                    printf ("  unicode %s %lu/%lu", quoted (uni, 0),
+                            (unsigned long)costs [1][pass][key][0], (unsigned long)costs [1][pass][key][1]);
+                }
+                if (fail != NULL)
+                {
+                    printf ("  FAIL: %s", fail);
+                }
+                printf ("\n");
+            }
+        }
+    }
+
+    printf ("%d keys typed, %d checked, %d failed\n", n_keys, n_checked, n_failed);
+    printf ("special symbols: %lu reports %lu frames the normal way, %lu reports %lu frames by Unicode entry\n",
+            (unsigned long)total [0][0], (unsigned long)total [0][1],
+            (unsigned long)total [1][0], (unsigned long)total [1][1]);
+    return (n_failed != 0) ? 1 : 0;
+} // main
+
+/* End of File */
@@ -0,0 +1,215 @@
+/* kb-perf-check - check the GET_REPORT answers on the host build
+ *
+ * Boots the firmware's own scanner, decoder and report code (the host build,
+ * see host/kb-mock.h), and asks it for reports as a host would, with
+ * tud_hid_get_report_cb(). Checks that:
+ *   - perf_put16/32 and perf_get16/32 give little endian and read back what
+ *     was put, at the edges of their ranges,
+ *   - the performance counters feature report is PERF_REPORT_LEN bytes of
+ *     PERF_VERSION, with the spare bytes zero, and a short buffer is STALLed,
+ *   - its counters follow what happens: the uptime and scans, the reports
+ *     the host was sent, a ghost, and a remote wake-up with its time,
+ *   - the input reports give the keys and the media key held down now.
+ *
+ * Usage: kb-perf-check
+ *   Prints each check, then the report as kb-perf would. The exit status is
+ *   1 if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fw-kb-main.h"
+#include "kb-telem.h"
+#include "usb_descriptors.h"
+#include "kb-mock.h"
+#include "tusb.h"
+
+#define KEY_AT(r, c)  (((r) * COL_SZ) + (c))
+
+#define K_E        KEY_AT(5, 3)
+#define K_BLOCK    KEY_AT(5, 5)
+#define K_VOLUP    KEY_AT(2, 1) // Cursor UP, volume up on the BLOCK layer
+#define K_N        KEY_AT(3, 0) // n, y and b are three corners of a rectangle,
+#define K_Y        KEY_AT(3, 1) // so t shows up as well (a ghost)
+#define K_B        KEY_AT(4, 0)
+
+#define HID_E        0x08
+#define USAGE_VOLUP  0x00E9 // HID_USAGE_CONSUMER_VOLUME_INCREMENT
+
+#define BOOT_US  500000
+#define HOLD_US  100000
+
+static uint32_t n_reports = 0;
+static void count_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    (void) t_us;
+    (void) report_id;
+    (void) report;
+    (void) len;
+    ++n_reports;
+} // count_report
+
+// The keys down, by their keymap index, -1 for none
+static void set_keys (int k0, int k1, int k2)
+{
+    int const keys [3] = { k0, k1, k2 };
+    uint8_t down [COL_SZ];
+    int i;
+    memset (down, 0, sizeof (down));
+    for (i = 0; i < 3; ++i)
+    {
+        if (keys [i] >= 0)
+        {
+            down [keys [i] % COL_SZ] |= (uint8_t)(1u << (keys [i] / COL_SZ));
+        }
+    }
+    mock_set_keys (down);
+} // set_keys
+
+static void run_for (uint64_t us)
+{
+    mock_run_until (mock_now () + us);
+} // run_for
+
+// GET_REPORT for the performance counters
+static uint16_t get_perf (uint8_t *rep, uint16_t len)
+{
+    return tud_hid_get_report_cb (0, REPORT_ID_PERF, HID_REPORT_TYPE_FEATURE, rep, len);
+} // get_perf
+
+static void check_put_get (void)
+{
+    static const uint32_t v32 [] = { 0, 1, 0x12345678, 0x80000000, 0xFFFFFFFF };
+    static const uint16_t v16 [] = { 0, 1, 0x1234, 0x8000, 0xFFFF };
+    uint8_t b [4];
+    int ok = 1;
+    unsigned i;
+    for (i = 0; i < sizeof (v32) / sizeof (v32 [0]); ++i)
+    {
+        perf_put32 (b, v32 [i]);
+        ok &= (perf_get32 (b) == v32 [i]);
+    }
+    for (i = 0; i < sizeof (v16) / sizeof (v16 [0]); ++i)
+    {
+        perf_put16 (b, v16 [i]);
+        ok &= (perf_get16 (b) == v16 [i]);
+    }
+    mock_check (ok, "perf_put16/32 read back with perf_get16/32");
+    perf_put32 (b, 0x12345678);
+    mock_check ((b [0] == 0x78) && (b [1] == 0x56) && (b [2] == 0x34) && (b [3] == 0x12), "...little endian");
+} // check_put_get
+
+static void show (uint8_t const *r)
+{
+    printf ("\nuptime %lu ms, scans %lu (%u/%u/%u us), fifo drops %lu, kc drops %lu (hwm %u),\n"
+            "ghosts %lu, bounces %lu, reports %lu, wake-ups %u (last %lu us, longest %lu us)\n",
+            (unsigned long)perf_get32 (&r [PERF_OFS_UPTIME]), (unsigned long)perf_get32 (&r [PERF_OFS_SCANS]),
+            perf_get16 (&r [PERF_OFS_SCAN_MIN]), perf_get16 (&r [PERF_OFS_SCAN_AVG]),
+            perf_get16 (&r [PERF_OFS_SCAN_MAX]), (unsigned long)perf_get32 (&r [PERF_OFS_FIFO_DROP]),
+            (unsigned long)perf_get32 (&r [PERF_OFS_KC_DROP]), r [PERF_OFS_KC_HWM],
+            (unsigned long)perf_get32 (&r [PERF_OFS_GHOSTS]), (unsigned long)perf_get32 (&r [PERF_OFS_BOUNCES]),
+            (unsigned long)perf_get32 (&r [PERF_OFS_REPORTS]), perf_get16 (&r [PERF_OFS_WAKEUPS]),
+            (unsigned long)perf_get32 (&r [PERF_OFS_WAKE_LAST]), (unsigned long)perf_get32 (&r [PERF_OFS_WAKE_MAX]));
+} // show
+
+int main (int argc, char **argv)
+{
+    uint8_t r0 [PERF_REPORT_LEN + 8];
+    uint8_t r1 [PERF_REPORT_LEN + 8];
+    uint8_t in [16];
+    char what [100];
+    int i;
+
+    (void) argv;
+    if (argc != 1)
+    {
+        fprintf (stderr, "usage: kb-perf-check\n");
+        return 2;
+    }
+
+    check_put_get ();
+
+    mock_on_report (count_report);
+    mock_init ();
+    mock_run_until (BOOT_US);
+
+    // The layout
+    memset (r0, 0xAA, sizeof (r0));
+    mock_check (get_perf (r0, PERF_REPORT_LEN - 1) == 0, "a short buffer is STALLed");
+    mock_check (get_perf (r0, sizeof (r0)) == PERF_REPORT_LEN, "the feature report is PERF_REPORT_LEN bytes");
+    mock_check (r0 [PERF_OFS_VERSION] == PERF_VERSION, "...of PERF_VERSION");
+    int spare_zero = 1;
+    for (i = PERF_OFS_WAKE_MAX + 4; i < PERF_REPORT_LEN; ++i)
+    {
+        spare_zero &= (r0 [i] == 0);
+    }
+    mock_check (spare_zero, "...with the spare bytes zero");
+    mock_check (r0 [PERF_REPORT_LEN] == 0xAA, "...and nothing written past it");
+    snprintf (what, sizeof (what), "uptime %lu ms, at %lu ms", (unsigned long)perf_get32 (&r0 [PERF_OFS_UPTIME]),
+              (unsigned long)(mock_now () / 1000));
+    mock_check (perf_get32 (&r0 [PERF_OFS_UPTIME]) == (uint32_t)(mock_now () / 1000), what);
+    mock_check (perf_get32 (&r0 [PERF_OFS_SCANS]) > 0, "the scans are counted");
+    mock_check ((perf_get16 (&r0 [PERF_OFS_SCAN_MIN]) > 0) &&
+           (perf_get16 (&r0 [PERF_OFS_SCAN_MIN]) <= perf_get16 (&r0 [PERF_OFS_SCAN_AVG])) &&
+           (perf_get16 (&r0 [PERF_OFS_SCAN_AVG]) <= perf_get16 (&r0 [PERF_OFS_SCAN_MAX])),
+           "...the shortest scan, the average and the longest in order");
+
+    // Keys typed, and what the host is sent
+    uint32_t sent = n_reports;
+    set_keys (K_E, -1, -1);
+    run_for (HOLD_US);
+    memset (in, 0, sizeof (in));
+    mock_check ((tud_hid_get_report_cb (0, REPORT_ID_KEYBOARD, HID_REPORT_TYPE_INPUT, in, sizeof (in)) == 8) &&
+           (in [2] == HID_E), "the keyboard input report has the key held down");
+    mock_check (tud_hid_get_report_cb (0, REPORT_ID_KEYBOARD, HID_REPORT_TYPE_INPUT, in, 7) == 0,
+           "...and a short buffer is STALLed");
+    set_keys (K_BLOCK, -1, -1);
+    run_for (HOLD_US);
+    set_keys (K_BLOCK, K_VOLUP, -1);
+    run_for (HOLD_US);
+    mock_check ((tud_hid_get_report_cb (0, REPORT_ID_CONSUMER_CONTROL, HID_REPORT_TYPE_INPUT, in, sizeof (in)) == 2) &&
+           (perf_get16 (in) == USAGE_VOLUP), "the consumer control input report has the media key held down");
+    set_keys (-1, -1, -1);
+    run_for (HOLD_US);
+    mock_check ((tud_hid_get_report_cb (0, REPORT_ID_CONSUMER_CONTROL, HID_REPORT_TYPE_INPUT, in, sizeof (in)) == 2) &&
+           (perf_get16 (in) == 0), "...and zero once let go");
+    get_perf (r1, sizeof (r1));
+    snprintf (what, sizeof (what), "the reports are counted, %lu more for %lu sent",
+              (unsigned long)(perf_get32 (&r1 [PERF_OFS_REPORTS]) - perf_get32 (&r0 [PERF_OFS_REPORTS])),
+              (unsigned long)(n_reports - sent));
+    mock_check ((perf_get32 (&r1 [PERF_OFS_REPORTS]) - perf_get32 (&r0 [PERF_OFS_REPORTS])) == (n_reports - sent), what);
+    mock_check (perf_get32 (&r1 [PERF_OFS_SCANS]) > perf_get32 (&r0 [PERF_OFS_SCANS]), "...and the scans go up");
+
+    // A ghost
+    set_keys (K_N, K_Y, K_B);
+    run_for (HOLD_US);
+    set_keys (-1, -1, -1);
+    run_for (HOLD_US);
+    get_perf (r0, sizeof (r0));
+    mock_check (perf_get32 (&r0 [PERF_OFS_GHOSTS]) > perf_get32 (&r1 [PERF_OFS_GHOSTS]), "three corners of a rectangle count a ghost");
+
+    // A remote wake-up
+    mock_suspend (1);
+    run_for (HOLD_US);
+    set_keys (K_E, -1, -1);
+    run_for (HOLD_US);
+    set_keys (-1, -1, -1);
+    run_for (HOLD_US);
+    get_perf (r1, sizeof (r1));
+    snprintf (what, sizeof (what), "a remote wake-up is counted, %lu us", (unsigned long)perf_get32 (&r1 [PERF_OFS_WAKE_LAST]));
+    mock_check ((perf_get16 (&r1 [PERF_OFS_WAKEUPS]) == perf_get16 (&r0 [PERF_OFS_WAKEUPS]) + 1) &&
+           (perf_get32 (&r1 [PERF_OFS_WAKE_LAST]) > 0) &&
+           (perf_get32 (&r1 [PERF_OFS_WAKE_LAST]) <= perf_get32 (&r1 [PERF_OFS_WAKE_MAX])), what);
+
+    mock_check (tud_hid_get_report_cb (0, REPORT_ID_PERF, HID_REPORT_TYPE_INPUT, in, sizeof (in)) == 0,
+           "the performance counters are not an input report");
+
+    show (r1);
+    printf ("\n");
+    return mock_check_end ();
+} // main
+
+/* End of File */
@@ -0,0 +1,149 @@
+/* kb-perf - read the keyboard's performance counters over hidraw
+ *
+ * The keyboard has a vendor defined HID feature report (REPORT_ID_PERF) with
+ * its performance counters (see kb-telem.h), which any host can read with a
+ * GET_REPORT request - no extra interface or driver is needed.
+ *
+ * Usage: kb-perf [-w secs] [/dev/hidrawN]
+ *   Without a device, the first hidraw device with the keyboard's vendor ID
+ *   that answers is used. -w repeats every "secs" seconds.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include "kb-telem.h"
+#include "usb_descriptors.h"
+
+#define KB_VID  0x0603 // As usb_descriptors.c
+
+// Read the feature report, returns the length read (without the report ID) or -1
+static int perf_read (int fd, uint8_t *rep)
+{
+    uint8_t buf [PERF_REPORT_LEN + 1];
+
+    buf[0] = REPORT_ID_PERF;
+    int n = ioctl (fd, HIDIOCGFEATURE (sizeof (buf)), buf);
+    if ((n < (PERF_REPORT_LEN + 1)) || (buf[0] != REPORT_ID_PERF))
+    {
+        return -1;
+    }
+    memcpy (rep, &buf[1], PERF_REPORT_LEN);
+    return PERF_REPORT_LEN;
+} // perf_read
+
+// Find the keyboard amongst the hidraw devices
+static int perf_find (void)
+{
+    int idx;
+    for (idx = 0; idx < 32; ++idx)
+    {
+        char path [32];
+        struct hidraw_devinfo info;
+        uint8_t rep [PERF_REPORT_LEN];
+
+        snprintf (path, sizeof (path), "/dev/hidraw%d", idx);
+        int fd = open (path, O_RDWR);
+        if (fd < 0)
+        {
+            continue;
+        }
+        if ((ioctl (fd, HIDIOCGRAWINFO, &info) == 0) && ((uint16_t)info.vendor == KB_VID) &&
+            (perf_read (fd, rep) > 0))
+        {
+            fprintf (stderr, "using %s\n", path);
+            return fd;
+        }
+        close (fd);
+    }
+    return -1;
+} // perf_find
+
+// Print the counters
+static void perf_show (uint8_t const *r)
+{
+    if (r [PERF_OFS_VERSION] != PERF_VERSION)
+    {
+        printf ("unknown report version %u\n", r [PERF_OFS_VERSION]);
+        return;
+    }
+    printf ("uptime        %10.1f s\n",  perf_get32 (&r [PERF_OFS_UPTIME]) / 1000.0);
+    printf ("scans         %10lu\n",     (unsigned long)perf_get32 (&r [PERF_OFS_SCANS]));
+    printf ("scan time     %10u us min, %u us avg, %u us max\n",
+            perf_get16 (&r [PERF_OFS_SCAN_MIN]), perf_get16 (&r [PERF_OFS_SCAN_AVG]),
+            perf_get16 (&r [PERF_OFS_SCAN_MAX]));
+    printf ("fifo drops    %10lu\n",     (unsigned long)perf_get32 (&r [PERF_OFS_FIFO_DROP]));
+    printf ("kc_buf drops  %10lu   high water %u\n",
+            (unsigned long)perf_get32 (&r [PERF_OFS_KC_DROP]), r [PERF_OFS_KC_HWM]);
+    printf ("ghosts        %10lu\n",     (unsigned long)perf_get32 (&r [PERF_OFS_GHOSTS]));
+    printf ("bounces       %10lu\n",     (unsigned long)perf_get32 (&r [PERF_OFS_BOUNCES]));
+    printf ("reports       %10lu\n",     (unsigned long)perf_get32 (&r [PERF_OFS_REPORTS]));
+    printf ("wake-ups      %10u   last %lu us, longest %lu us\n",
+            perf_get16 (&r [PERF_OFS_WAKEUPS]), (unsigned long)perf_get32 (&r [PERF_OFS_WAKE_LAST]),
+            (unsigned long)perf_get32 (&r [PERF_OFS_WAKE_MAX]));
+    fflush (stdout);
+} // perf_show
+
+int main (int argc, char **argv)
+{
+    int secs = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "w:")) != -1)
+    {
+        if (opt == 'w')
+        {
+            secs = atoi (optarg);
+        }
+        else
+        {
+            fprintf (stderr, "usage: %s [-w secs] [/dev/hidrawN]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int fd;
+    if (optind < argc)
+    {
+        fd = open (argv[optind], O_RDWR);
+        if (fd < 0)
+        {
+            perror (argv[optind]);
+            return 1;
+        }
+    }
+    else if ((fd = perf_find ()) < 0)
+    {
+        fprintf (stderr, "keyboard not found\n");
+        return 1;
+    }
+
+    do
+    {
+        uint8_t rep [PERF_REPORT_LEN];
+        if (perf_read (fd, rep) < 0)
+        {
+            perror ("HIDIOCGFEATURE");
+            close (fd);
+            return 1;
+        }
+        perf_show (rep);
+        if (secs > 0)
+        {
+            printf ("\n");
+            sleep ((unsigned)secs);
+        }
+    } while (secs > 0);
+
+    close (fd);
+    return 0;
+} // main
+
+/* End of File */
@@ -0,0 +1,269 @@
+/* kb-rec-check - round trip the scan frame recording format (kb-record.h)
+ *
+ * Makes up runs of matrix changes, with gaps from one tick to years, and
+ * checks that rec_decode() gives back exactly what rec_encode() was given:
+ *   - the keys down after every change, and each gap, at the edges of the
+ *     LEB128 sizes (127, 128, 16383, 16384 ... 0xFFFFFFFF ticks),
+ *   - an event with every key changed fits in REC_EVENT_MAX,
+ *   - no change is no event,
+ *   - an event cut short, a key out of range or a gap too long to be a
+ *     uint32_t is an error, not a wrong frame.
+ *
+ * Usage: kb-rec-check [-s seed] [-w pages]
+ *   -s the seed for the changes (default 1)
+ *   -w instead packs a run of changes into pages, as kb-record.c does (the
+ *      ticks wrap around part way), and writes them to the file "pages" in
+ *      flash ring order, with some pages still erased, as in SCANS.BIN. The
+ *      frames kb-rec-dump -f should decode from it are printed, so the two
+ *      can be compared:
+ *        kb-rec-check -w scans.bin > want.txt && kb-rec-dump -f scans.bin | diff want.txt -
+ *   Prints each check. The exit status is 1 if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kb-link.h"
+#include "kb-record.h"
+#include "kb-mock.h"
+
+#define N_CHANGES  20000 // Changes in a run
+#define RING_PAGES 64    // Pages in the made up flash ring, more than a run fills
+
+static uint32_t seed = 1;
+
+static uint32_t rand32 (void)
+{
+    // xorshift32, so the runs are the same on every machine
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+} // rand32
+
+// A gap, mostly as when typing, sometimes a long pause
+static uint32_t make_dt (void)
+{
+    uint32_t r = rand32 () % 100;
+    if (r < 70)
+    {
+        return 1 + (rand32 () % 2000); // Up to 128 ms
+    }
+    if (r < 95)
+    {
+        return rand32 () % (1u << 21);
+    }
+    return rand32 ();
+} // make_dt
+
+// The next keys down: one to three keys change, or now and then all go up
+static void make_change (uint8_t const *was, uint8_t *now)
+{
+    memcpy (now, was, REC_COLS);
+    if ((rand32 () % 20) == 0)
+    {
+        memset (now, 0, REC_COLS);
+    }
+    int n = 1 + (int)(rand32 () % 3);
+    while (n-- > 0)
+    {
+        int key = (int)(rand32 () % (REC_COLS * 8));
+        now [key % REC_COLS] ^= (uint8_t)(1u << (key / REC_COLS));
+    }
+    if (memcmp (now, was, REC_COLS) == 0)
+    {
+        now [0] ^= 1;
+    }
+} // make_change
+
+// Encode then decode one change, returns non-zero if it comes back the same
+static int round_trip (uint32_t dt, uint8_t const *was, uint8_t const *now)
+{
+    uint8_t ev [REC_EVENT_MAX + 1];
+    uint8_t down [REC_COLS];
+    uint32_t got_dt = 0;
+    int n = rec_encode (ev, dt, was, now);
+    memcpy (down, was, REC_COLS);
+    return (n > 0) && (n <= REC_EVENT_MAX) && (rec_decode (ev, n, &got_dt, down) == n) &&
+           (got_dt == dt) && (memcmp (down, now, REC_COLS) == 0);
+} // round_trip
+
+static void check_events (void)
+{
+    static const uint32_t edges [] =
+    {
+        0, 1, 127, 128, 16383, 16384, 2097151, 2097152, 268435455, 268435456, 0xFFFFFFFF
+    };
+    uint8_t was [REC_COLS];
+    uint8_t now [REC_COLS];
+    uint8_t ev [REC_EVENT_MAX + 1];
+    uint8_t down [REC_COLS];
+    uint32_t dt;
+    char what [100];
+    unsigned i;
+    int ok;
+
+    // A run of changes
+    memset (was, 0, sizeof (was));
+    ok = 1;
+    size_t bytes = 0;
+    for (i = 0; i < N_CHANGES; ++i)
+    {
+        uint32_t gap = make_dt ();
+        make_change (was, now);
+        ok &= round_trip (gap, was, now);
+        bytes += (size_t)rec_encode (ev, gap, was, now);
+        memcpy (was, now, REC_COLS);
+    }
+    snprintf (what, sizeof (what), "%d changes come back the same, %.2f bytes each", N_CHANGES,
+              (double)bytes / N_CHANGES);
+    mock_check (ok, what);
+
+    // The gaps at the edges of the varint sizes
+    memset (was, 0, sizeof (was));
+    memcpy (now, was, REC_COLS);
+    now [3] = 0x10;
+    ok = 1;
+    for (i = 0; i < sizeof (edges) / sizeof (edges [0]); ++i)
+    {
+        ok &= round_trip (edges [i], was, now);
+    }
+    mock_check (ok, "gaps of 0 to 0xFFFFFFFF ticks come back the same");
+    mock_check ((rec_encode (ev, 127, was, now) == 2) && (rec_encode (ev, 128, was, now) == 3) &&
+           (rec_encode (ev, 0xFFFFFFFF, was, now) == 6), "...in 1 to 5 bytes");
+
+    // Every key at once
+    memset (now, 0xFF, sizeof (now));
+    int n = rec_encode (ev, 0xFFFFFFFF, was, now);
+    snprintf (what, sizeof (what), "every key changed, %d bytes, fits in REC_EVENT_MAX (%d)", n, REC_EVENT_MAX);
+    mock_check ((n <= REC_EVENT_MAX) && round_trip (0xFFFFFFFF, was, now) && round_trip (5, now, was), what);
+    mock_check (rec_encode (ev, 5, now, now) == 0, "no change is no event");
+
+    // Bad events
+    memset (now, 0, sizeof (now));
+    now [9] = 0x81; // Keys 9 and 79
+    n = rec_encode (ev, 300, was, now);
+    ok = 1;
+    int len;
+    for (len = 1; len < n; ++len)
+    {
+        memset (down, 0, sizeof (down));
+        ok &= (rec_decode (ev, len, &dt, down) == -1);
+    }
+    mock_check (ok && (rec_decode (ev, 0, &dt, down) == 0), "an event cut short is an error, no data is the end");
+    static const uint8_t bad_key [] = { 0x01, 80 | REC_LAST };
+    static const uint8_t long_gap [] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0 | REC_LAST };
+    mock_check (rec_decode (bad_key, sizeof (bad_key), &dt, down) == -1, "a key past the matrix is an error");
+    mock_check (rec_decode (long_gap, sizeof (long_gap), &dt, down) == -1, "a gap of more than 5 bytes is an error");
+} // check_events
+
+// Pack a run of changes into pages as kb-record.c does, and print the frames kb-rec-dump -f should give
+static int write_pages (char const *path)
+{
+    static uint8_t ring [RING_PAGES][REC_PAGE_SZ];
+    uint8_t was [REC_COLS];
+    uint8_t now [REC_COLS];
+    uint8_t ev [REC_EVENT_MAX];
+    uint32_t tick = 0xFFFFFFFFu - (1u << 24); // The ticks wrap part way through
+    uint32_t seq = 1000;
+    uint64_t t = 0;
+    rec_page_hdr *hdr = NULL;
+    int n_pages = 0;
+    int i;
+
+    memset (ring, 0xFF, sizeof (ring));
+    memset (was, 0, sizeof (was));
+    for (i = 0; i < N_CHANGES / 4; ++i)
+    {
+        uint32_t dt = make_dt () % (1u << 21);
+        make_change (was, now);
+        int n = rec_encode (ev, dt, was, now);
+        if ((hdr != NULL) && ((hdr->used + n) > REC_DATA_SZ))
+        {
+            hdr->crc = link_crc8 ((uint8_t const *)hdr, REC_PAGE_SZ);
+            hdr = NULL;
+        }
+        if (hdr == NULL)
+        {
+            if (n_pages >= RING_PAGES - 4)
+            {
+                break; // Leave some pages erased
+            }
+            hdr = (rec_page_hdr *)ring [seq % RING_PAGES];
+            hdr->magic   = REC_MAGIC;
+            hdr->version = REC_VERSION;
+            hdr->used    = 0;
+            hdr->lost    = 0;
+            hdr->seq     = seq++;
+            hdr->t0      = tick;
+            memcpy (hdr->down, was, REC_COLS);
+            hdr->crc     = 0;
+            hdr->spare   = 0;
+            ++n_pages;
+        }
+        memcpy ((uint8_t *)hdr + REC_HDR_SZ + hdr->used, ev, (size_t)n);
+        hdr->used += n;
+        tick += dt;
+        t += dt;
+        memcpy (was, now, REC_COLS);
+
+        int col;
+        printf ("%llu", (unsigned long long)(t * REC_TICK_US));
+        for (col = 0; col < REC_COLS; ++col)
+        {
+            printf (" %02X", now [col]);
+        }
+        printf ("\n");
+    }
+    if (hdr != NULL)
+    {
+        hdr->crc = link_crc8 ((uint8_t const *)hdr, REC_PAGE_SZ);
+    }
+
+    FILE *fp = fopen (path, "wb");
+    if ((fp == NULL) || (fwrite (ring, 1, sizeof (ring), fp) != sizeof (ring)) || (fclose (fp) != 0))
+    {
+        perror (path);
+        return 1;
+    }
+    return 0;
+} // write_pages
+
+int main (int argc, char **argv)
+{
+    char const *pages = NULL;
+    int opt;
+    while ((opt = getopt (argc, argv, "s:w:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            seed = (uint32_t) strtoul (optarg, NULL, 0);
+            break;
+        case 'w':
+            pages = optarg;
+            break;
+        default:
+            fprintf (stderr, "usage: kb-rec-check [-s seed] [-w pages]\n");
+            return 2;
+        }
+    }
+    if (seed == 0)
+    {
+        fprintf (stderr, "kb-rec-check: the seed must not be 0\n");
+        return 2;
+    }
+
+    if (pages != NULL)
+    {
+        return write_pages (pages);
+    }
+    check_events ();
+    printf ("\n");
+    return mock_check_end ();
+} // main
+
+/* End of File */
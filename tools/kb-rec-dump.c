@@ -0,0 +1,222 @@
+/* kb-rec-dump - decode and replay the keyboard's scan frame recording
+ *
+ * Reads the pages saved by "kb-cfg download FILE", or SCANS.BIN copied off
+ * the keyboard's USB drive (see kb-record.h, RECORD_ON in fw-kb-main.h),
+ * puts them in order and decodes them.
+ *
+ * Usage: kb-rec-dump [-f | -r] file
+ *   By default, one line per change: the time and the keys that went down
+ *   (+) or up (-), as r<row>c<column>.
+ *   -f prints the whole matrix after each change instead, one line of
+ *      "time_us" and ten columns of keys down (hex, a bit per row), which can
+ *      be fed back into a host build of the scanner.
+ *   -r replays the changes in real time, with the same gaps between them
+ *      (pauses longer than 2 s are cut to 2 s).
+ * Pages that fail their CRC are reported and skipped, as are gaps where
+ * events were lost or pages written over.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kb-link.h"
+#include "kb-record.h"
+
+static int page_cmp (void const *a, void const *b)
+{
+    rec_page_hdr const *pa = a;
+    rec_page_hdr const *pb = b;
+    return (int32_t)(pa->seq - pb->seq);
+} // page_cmp
+
+// Is the page still erased? (SCANS.BIN is the whole flash ring)
+static int page_blank (uint8_t const *page)
+{
+    int idx;
+    for (idx = 0; idx < REC_PAGE_SZ; ++idx)
+    {
+        if (page [idx] != 0xFF)
+        {
+            return 0;
+        }
+    }
+    return 1;
+} // page_blank
+
+// Is the page whole, and in a format we know?
+static int page_good (uint8_t const *page)
+{
+    rec_page_hdr hdr;
+    uint8_t copy [REC_PAGE_SZ];
+
+    memcpy (&hdr, page, sizeof (hdr));
+    if ((hdr.magic != REC_MAGIC) || (hdr.version != REC_VERSION) || (hdr.used > REC_DATA_SZ))
+    {
+        return 0;
+    }
+    memcpy (copy, page, REC_PAGE_SZ);
+    ((rec_page_hdr *)copy)->crc = 0;
+    return (link_crc8 (copy, REC_PAGE_SZ) == hdr.crc);
+} // page_good
+
+static void print_frame (uint64_t t_us, uint8_t const *down)
+{
+    int col;
+    printf ("%llu", (unsigned long long)t_us);
+    for (col = 0; col < REC_COLS; ++col)
+    {
+        printf (" %02X", down [col]);
+    }
+    printf ("\n");
+} // print_frame
+
+static void print_change (uint64_t t_us, uint8_t const *was, uint8_t const *now)
+{
+    int col;
+    printf ("%10.6f", t_us / 1000000.0);
+    for (col = 0; col < REC_COLS; ++col)
+    {
+        uint8_t diff = was [col] ^ now [col];
+        int row;
+        for (row = 0; row < 8; ++row)
+        {
+            if (diff & (1u << row))
+            {
+                printf (" %cr%dc%d", (now [col] & (1u << row)) ? '+' : '-', row, col);
+            }
+        }
+    }
+    printf ("\n");
+    fflush (stdout);
+} // print_change
+
+int main (int argc, char **argv)
+{
+    int frames = 0;
+    int replay = 0;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "fr")) != -1)
+    {
+        if (opt == 'f')
+        {
+            frames = 1;
+        }
+        else if (opt == 'r')
+        {
+            replay = 1;
+        }
+        else
+        {
+            optind = argc; // Show the usage
+            break;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf (stderr, "usage: %s [-f | -r] file\n", argv[0]);
+        return 2;
+    }
+
+    FILE *fp = fopen (argv[optind], "rb");
+    if (fp == NULL)
+    {
+        perror (argv[optind]);
+        return 1;
+    }
+
+    // Read all the good pages, then put them in order
+    uint8_t *pages = NULL;
+    int n_pages = 0;
+    uint8_t page [REC_PAGE_SZ];
+    int n_read = 0;
+    while (fread (page, 1, REC_PAGE_SZ, fp) == REC_PAGE_SZ)
+    {
+        ++n_read;
+        if (page_blank (page))
+        {
+            continue;
+        }
+        if (!page_good (page))
+        {
+            fprintf (stderr, "page %d of the file is bad, skipped\n", n_read - 1);
+            continue;
+        }
+        pages = realloc (pages, (size_t)(n_pages + 1) * REC_PAGE_SZ);
+        memcpy (&pages [n_pages * REC_PAGE_SZ], page, REC_PAGE_SZ);
+        ++n_pages;
+    }
+    fclose (fp);
+    qsort (pages, n_pages, REC_PAGE_SZ, page_cmp);
+
+    // Times are kept as 64 bits from the first page, the 32 bit ticks wrap every 76 hours
+    uint64_t t = 0;
+    uint32_t last_tick = 0;
+    uint32_t last_seq = 0;
+    int idx;
+    for (idx = 0; idx < n_pages; ++idx)
+    {
+        uint8_t const *p = &pages [idx * REC_PAGE_SZ];
+        rec_page_hdr hdr;
+        memcpy (&hdr, p, sizeof (hdr));
+
+        if (idx == 0)
+        {
+            last_tick = hdr.t0;
+        }
+        else if (hdr.seq != (last_seq + 1))
+        {
+            printf ("# pages %lu to %lu missing\n", (unsigned long)(last_seq + 1), (unsigned long)(hdr.seq - 1));
+        }
+        if (hdr.lost)
+        {
+            printf ("# %u%s changes lost\n", hdr.lost, (hdr.lost == 255) ? " or more" : "");
+        }
+        t += (uint32_t)(hdr.t0 - last_tick);
+        last_tick = hdr.t0;
+        last_seq = hdr.seq;
+
+        uint8_t down [REC_COLS];
+        memcpy (down, hdr.down, REC_COLS);
+
+        int ofs = 0;
+        while (ofs < hdr.used)
+        {
+            uint8_t was [REC_COLS];
+            uint32_t dt;
+            memcpy (was, down, REC_COLS);
+            int len = rec_decode (&p [REC_HDR_SZ + ofs], hdr.used - ofs, &dt, down);
+            if (len <= 0)
+            {
+                printf ("# page %lu is cut short\n", (unsigned long)hdr.seq);
+                break;
+            }
+            ofs += len;
+            t += dt;
+            last_tick += dt;
+
+            if (replay)
+            {
+                uint64_t gap_us = (uint64_t)dt * REC_TICK_US;
+                usleep ((useconds_t)((gap_us > 2000000) ? 2000000 : gap_us));
+            }
+            if (frames)
+            {
+                print_frame (t * REC_TICK_US, down);
+            }
+            else
+            {
+                print_change (t * REC_TICK_US, was, down);
+            }
+        }
+    }
+
+    free (pages);
+    return 0;
+} // main
+
+/* End of File */
@@ -0,0 +1,297 @@
+/* kb-report-check - check how the keyboard, media and mouse reports share the USB
+ *
+ * Boots the firmware's own scanner, decoder and report code (the host build,
+ * see host/kb-mock.h), which has one report slot for each report ID, served in
+ * turn as each report completes (tud_hid_report_complete_cb). Checks that:
+ *   - a media key on the BLOCK layer sends its consumer control usage, and
+ *     zero when let go, with no keyboard report for it,
+ *   - a letter typed straight after a media key, with BLOCK still held, is
+ *     sent within a frame of when it would be on its own, and the media key
+ *     is let go within a frame of it, as only one key is decoded at a time,
+ *   - whilst the mouse keys move the pointer at top speed, a report every
+ *     frame, a letter is still typed within a frame of when it would be with
+ *     no mouse report, and the pointer goes on moving, never missing more
+ *     than a frame.
+ *
+ * Usage: kb-report-check [-v]
+ *   -v lists every report
+ *   Prints each check. The exit status is 1 if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fw-kb-main.h"
+#include "usb_descriptors.h"
+#include "kb-mock.h"
+
+#define KEY_AT(r, c)  (((r) * COL_SZ) + (c))
+
+#define K_BLOCK    KEY_AT(5, 5)
+#define K_HELP     KEY_AT(5, 9)
+#define K_VOLUP    KEY_AT(2, 1) // Cursor UP, volume up on the BLOCK layer
+#define K_FWD      KEY_AT(2, 0) // Cursor right, the pointer right on the mouse layer
+#define K_E        KEY_AT(5, 3)
+
+#define HID_E          0x08
+#define USAGE_VOLUP    0x00E9 // HID_USAGE_CONSUMER_VOLUME_INCREMENT
+
+#define BOOT_US    500000
+#define HOLD_US    100000
+#define FRAME_US   (HID_EP_POLL * 1000)
+#define MAX_LOG    20000
+
+typedef struct
+{
+    uint64_t t_us;
+    uint8_t  id;
+    uint8_t  len;
+    uint8_t  data [8];
+} report_rec;
+
+static report_rec log_ [MAX_LOG];
+static int n_log = 0;
+static int verbose = 0;
+static void on_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    if (n_log < MAX_LOG)
+    {
+        report_rec *rr = &log_ [n_log++];
+        rr->t_us = t_us;
+        rr->id = report_id;
+        rr->len = (uint8_t)((len > sizeof (rr->data)) ? sizeof (rr->data) : len);
+        memcpy (rr->data, report, rr->len);
+    }
+    if (verbose)
+    {
+        uint16_t i;
+        printf ("%10.6f %u", (double)t_us / 1e6, report_id);
+        for (i = 0; i < len; ++i)
+        {
+            printf (" %02x", report [i]);
+        }
+        printf ("\n");
+    }
+} // on_report
+
+// The keys down, by their keymap index, -1 for none
+static void set_keys (int k0, int k1, int k2)
+{
+    int const keys [3] = { k0, k1, k2 };
+    uint8_t down [COL_SZ];
+    int i;
+    memset (down, 0, sizeof (down));
+    for (i = 0; i < 3; ++i)
+    {
+        if (keys [i] >= 0)
+        {
+            down [keys [i] % COL_SZ] |= (uint8_t)(1u << (keys [i] / COL_SZ));
+        }
+    }
+    mock_set_keys (down);
+} // set_keys
+
+static void run_for (uint64_t us)
+{
+    mock_run_until (mock_now () + us);
+} // run_for
+
+// Does a keyboard report have this key code in it?
+static int has_key (report_rec const *rr, uint8_t code)
+{
+    int i;
+    for (i = 2; i < rr->len; ++i)
+    {
+        if (rr->data [i] == code)
+        {
+            return 1;
+        }
+    }
+    return 0;
+} // has_key
+
+static uint16_t usage (report_rec const *rr)
+{
+    return (uint16_t)(rr->data [0] | (rr->data [1] << 8));
+} // usage
+
+// The first report of this ID from log entry "from" on that passes "want", or -1
+static int find (int from, uint8_t id, int (*want) (report_rec const *rr))
+{
+    int i;
+    for (i = from; i < n_log; ++i)
+    {
+        if ((log_ [i].id == id) && want (&log_ [i]))
+        {
+            return i;
+        }
+    }
+    return -1;
+} // find
+
+static int is_e (report_rec const *rr)        { return has_key (rr, HID_E); }
+static int is_volup (report_rec const *rr)    { return usage (rr) == USAGE_VOLUP; }
+static int is_zero (report_rec const *rr)     { return usage (rr) == 0; }
+static int any_key (report_rec const *rr)
+{
+    int i;
+    for (i = 2; i < rr->len; ++i)
+    {
+        if (rr->data [i] != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+} // any_key
+
+// Press "e" (with any keys given held) and let it go, the us from the press to its report, or -1
+static int64_t type_e (int held0, int held1)
+{
+    int from = n_log;
+    uint64_t t0 = mock_now ();
+    set_keys (held0, held1, K_E);
+    run_for (HOLD_US);
+    set_keys (held0, held1, -1);
+    run_for (HOLD_US);
+    int at = find (from, REPORT_ID_KEYBOARD, is_e);
+    return (at < 0) ? -1 : (int64_t)(log_ [at].t_us - t0);
+} // type_e
+
+int main (int argc, char **argv)
+{
+    char what [100];
+    int opt;
+    while ((opt = getopt (argc, argv, "v")) != -1)
+    {
+        if (opt != 'v')
+        {
+            fprintf (stderr, "usage: kb-report-check [-v]\n");
+            return 2;
+        }
+        verbose = 1;
+    }
+
+    mock_on_report (on_report);
+    mock_init ();
+    mock_run_until (BOOT_US);
+
+    // The time to type a letter with nothing else going on, at each phase of the PW_POLL period
+    int64_t plain_max = 0;
+    int phase;
+    for (phase = 0; phase < PW_POLL; ++phase)
+    {
+        run_for (1000 + (phase * 100));
+        int64_t t = type_e (-1, -1);
+        if (t > plain_max)
+        {
+            plain_max = t;
+        }
+        if (t < 0)
+        {
+            plain_max = -1;
+            break;
+        }
+    }
+    snprintf (what, sizeof (what), "a letter is typed, within %lld us", (long long)plain_max);
+    mock_check (plain_max > 0, what);
+
+    // A media key
+    int from = n_log;
+    set_keys (K_BLOCK, -1, -1);
+    run_for (HOLD_US);
+    set_keys (K_BLOCK, K_VOLUP, -1);
+    run_for (HOLD_US);
+    int at = find (from, REPORT_ID_CONSUMER_CONTROL, is_volup);
+    mock_check (at >= 0, "BLOCK + cursor UP sends volume up");
+    set_keys (K_BLOCK, -1, -1);
+    run_for (HOLD_US);
+    set_keys (-1, -1, -1);
+    run_for (HOLD_US);
+    mock_check ((at >= 0) && (find (at, REPORT_ID_CONSUMER_CONTROL, is_zero) >= 0), "...and zero when it is let go");
+    mock_check (find (from, REPORT_ID_KEYBOARD, any_key) < 0, "...and no key in a keyboard report");
+
+    // A letter straight after the media key, the two reports queued together
+    from = n_log;
+    set_keys (K_BLOCK, -1, -1);
+    run_for (HOLD_US);
+    set_keys (K_BLOCK, K_VOLUP, -1);
+    run_for (PW_POLL * 1000);
+    int64_t t = type_e (K_BLOCK, -1);
+    at = find (from, REPORT_ID_CONSUMER_CONTROL, is_volup);
+    int up = (at < 0) ? -1 : find (at, REPORT_ID_CONSUMER_CONTROL, is_zero);
+    int e = find (from, REPORT_ID_KEYBOARD, is_e);
+    snprintf (what, sizeof (what), "a letter typed straight after volume up is sent, within %lld us", (long long)t);
+    mock_check ((t >= 0) && (t <= plain_max + FRAME_US), what);
+    mock_check ((up >= 0) && (e >= 0) && (llabs ((long long)log_ [up].t_us - (long long)log_ [e].t_us) <= FRAME_US),
+           "...and volume up is let go with it");
+    set_keys (-1, -1, -1);
+    run_for (HOLD_US);
+
+    // Letters whilst the pointer moves
+    set_keys (K_BLOCK, K_HELP, -1); // The mouse keys layer on
+    run_for (HOLD_US);
+    set_keys (-1, -1, -1);
+    run_for (HOLD_US);
+    set_keys (K_FWD, -1, -1);
+    run_for ((MOUSE_ACCEL_MS * 1000) + HOLD_US); // Up to top speed, a report every frame
+    from = n_log;
+    int64_t mouse_max = 0;
+    for (phase = 0; phase < PW_POLL; ++phase)
+    {
+        run_for (1000 + (phase * 100));
+        t = type_e (K_FWD, -1);
+        if ((t < 0) || (mouse_max < 0))
+        {
+            mouse_max = -1;
+        }
+        else if (t > mouse_max)
+        {
+            mouse_max = t;
+        }
+    }
+    int n_mouse = 0;
+    uint64_t gap_max = 0;
+    uint64_t last = 0;
+    int i;
+    for (i = from; i < n_log; ++i)
+    {
+        if (log_ [i].id == REPORT_ID_MOUSE)
+        {
+            if ((last != 0) && ((log_ [i].t_us - last) > gap_max))
+            {
+                gap_max = log_ [i].t_us - last;
+            }
+            last = log_ [i].t_us;
+            ++n_mouse;
+        }
+    }
+    uint64_t span = mock_now () - log_ [from].t_us;
+    snprintf (what, sizeof (what), "the pointer moves, %d reports in %llu ms", n_mouse,
+              (unsigned long long)(span / 1000));
+    mock_check ((uint64_t)n_mouse >= ((span / FRAME_US) * 3) / 4, what);
+    snprintf (what, sizeof (what), "...never more than %llu us apart", (unsigned long long)gap_max);
+    mock_check (gap_max <= 2 * FRAME_US, what);
+    snprintf (what, sizeof (what), "a letter is typed whilst it moves, within %lld us", (long long)mouse_max);
+    mock_check ((mouse_max >= 0) && (mouse_max <= plain_max + FRAME_US), what);
+    set_keys (-1, -1, -1);
+    run_for (HOLD_US);
+    set_keys (K_BLOCK, K_HELP, -1); // The mouse keys layer off
+    run_for (HOLD_US);
+    set_keys (-1, -1, -1);
+    run_for (HOLD_US);
+    at = -1;
+    for (i = 0; i < n_log; ++i)
+    {
+        at = (log_ [i].id == REPORT_ID_KEYBOARD) ? i : at;
+    }
+    mock_check ((at >= 0) && !any_key (&log_ [at]), "every key is up at the end");
+
+    printf ("\n%d report%s, ", n_log, (n_log == 1) ? "" : "s");
+    return mock_check_end ();
+} // main
+
+/* End of File */
@@ -0,0 +1,279 @@
+/* kb-scan-bench - time the matrix scan and key extraction of kb-matrix.h
+ *
+ * Makes up a run of matrix passes, as the GPIO words one read of all the
+ * GPIOs gives on each select line (the keys down, the line itself, and noise
+ * on every other GPIO), then puts each pass through:
+ *   reference - a plain loop over the pins, a GPIO at a time,
+ *   generic   - matrix_rows() and matrix_keys() from kb-matrix.h, as the
+ *               firmware's scan_pass() and process_keys() now use them,
+ *   hand      - the FontWriter 620 loops they replaced, a fixed shift of 12
+ *               and a test of each of the 8 rows (MATRIX_FW620 only).
+ * Checks they all find the same keys, in the same order, then times them.
+ *
+ * It is built twice, for MATRIX_FW620 (kb-scan-bench) and for the made up
+ * MATRIX_SCATTER (kb-scan-bench-scatter), whose pins are out of order and
+ * active high, to check the gather path against the reference as well.
+ *
+ * Usage: kb-scan-bench [-n passes] [-r repeat] [-s seed]
+ *   -n the passes to make up (default 4096), most with no key down, as when
+ *      typing, the rest with one to six keys down
+ *   -r how many times to time them all over (default 500)
+ *   -s the seed for the passes (default 1)
+ * Prints the ns per pass for each, and exits 1 if any pass differs. The times
+ * depend on the machine, so only compare them with each other.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kb-matrix.h"
+
+#define MAX_KEYS   4   // As MX_KEYS in fw-kb-main.h
+#define MOST_DOWN  6   // Some passes have more keys down than MAX_KEYS, to check where it stops
+#define IDLE_PCT   80  // Passes with no key down
+
+// The pins, as tables, to make up the passes and for the reference
+#define PIN_(i, gpio) gpio,
+static const unsigned line_pins [MATRIX_COLS] = { MATRIX_LINE_PINS (PIN_) };
+static const unsigned row_pins [MATRIX_ROWS]  = { MATRIX_ROW_PINS (PIN_) };
+
+typedef struct
+{
+    uint32_t gpio_in [MATRIX_COLS]; // One read of all the GPIOs on each select line
+} scan_pass;
+
+static uint32_t seed = 1;
+
+static uint32_t rand32 (void)
+{
+    // xorshift32, so the passes are the same on every machine
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+} // rand32
+
+static uint64_t wall_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000u) + (uint64_t)ts.tv_nsec;
+} // wall_ns
+
+// Make up a pass: n keys down (by keymap index), noise on the other GPIOs
+static void make_pass (scan_pass *sp, int n)
+{
+    int down [MATRIX_ROWS * MATRIX_COLS];
+    int line;
+    int row;
+    memset (down, 0, sizeof (down));
+    while (n-- > 0)
+    {
+        down [rand32 () % (MATRIX_ROWS * MATRIX_COLS)] = 1;
+    }
+    for (line = 0; line < MATRIX_COLS; ++line)
+    {
+        uint32_t gpio_in = rand32 () & ~(MATRIX_ROW_GPIOS | MATRIX_LINE_MASK);
+        gpio_in |= (uint32_t)MATRIX_SELECT << line_pins [line]; // It reads back the line it drives
+        for (row = 0; row < MATRIX_ROWS; ++row)
+        {
+            int level = down [(row * MATRIX_COLS) + line] ? !MATRIX_ACTIVE_LOW : MATRIX_ACTIVE_LOW;
+            gpio_in |= (uint32_t)level << row_pins [row];
+        }
+        sp->gpio_in [line] = gpio_in;
+    }
+} // make_pass
+
+// A pin at a time, from the tables
+static __attribute__((noinline)) int pass_reference (scan_pass const *sp, int *keys)
+{
+    int n = 0;
+    int line;
+    int row;
+    for (line = 0; line < MATRIX_COLS; ++line)
+    {
+        for (row = 0; row < MATRIX_ROWS; ++row)
+        {
+            unsigned level = (sp->gpio_in [line] >> row_pins [row]) & 1u;
+            if (level == (MATRIX_ACTIVE_LOW ? 0u : 1u))
+            {
+                keys [n] = (row * MATRIX_COLS) + line;
+                if (++n >= MAX_KEYS)
+                {
+                    return n;
+                }
+            }
+        }
+    }
+    return n;
+} // pass_reference
+
+// As scan_pass() and process_keys() do it now
+static __attribute__((noinline)) int pass_generic (scan_pass const *sp, int *keys)
+{
+    uint8_t scan [MATRIX_COLS];
+    int line;
+    for (line = 0; line < MATRIX_COLS; ++line)
+    {
+        scan [line] = matrix_rows (sp->gpio_in [line]);
+    }
+    return matrix_keys (scan, keys, MAX_KEYS);
+} // pass_generic
+
+#if MATRIX_MODEL == MATRIX_FW620
+// As scan_pass() and process_keys() did it, written for the FontWriter 620
+static __attribute__((noinline)) int pass_hand (scan_pass const *sp, int *keys)
+{
+    uint8_t cur_scan [10];
+    int col;
+    int row;
+    for (col = 0; col < 10; ++col)
+    {
+        cur_scan [col] = (uint8_t)((sp->gpio_in [col] >> 12) & 0xFF);
+    }
+
+    int i_keys = 0;
+    for (col = 0; ((col < 10) && (i_keys < MAX_KEYS)); ++col)
+    {
+        if (cur_scan [col] != 0xFF)
+        {
+            unsigned u_tst = 1;
+            for (row = 0; row < 8; ++row)
+            {
+                if ((u_tst & cur_scan [col]) == 0)
+                {
+                    keys [i_keys] = (row * 10) + col;
+                    ++i_keys;
+                    if (i_keys >= MAX_KEYS)
+                    {
+                        break;
+                    }
+                }
+                u_tst = u_tst << 1;
+            }
+        }
+    }
+    return i_keys;
+} // pass_hand
+#endif // MATRIX_MODEL == MATRIX_FW620
+
+typedef int (*pass_fn) (scan_pass const *sp, int *keys);
+
+typedef struct
+{
+    char const *name;
+    pass_fn     fn;
+} bench_way;
+
+static const bench_way ways [] =
+{
+    { "reference", pass_reference },
+    { "generic",   pass_generic },
+#if MATRIX_MODEL == MATRIX_FW620
+    { "hand",      pass_hand },
+#endif // MATRIX_MODEL == MATRIX_FW620
+};
+#define N_WAYS ((int)(sizeof (ways) / sizeof (ways [0])))
+
+int main (int argc, char **argv)
+{
+    int n_passes = 4096;
+    int repeat = 500;
+    int opt;
+    while ((opt = getopt (argc, argv, "n:r:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            n_passes = atoi (optarg);
+            break;
+        case 'r':
+            repeat = atoi (optarg);
+            break;
+        case 's':
+            seed = (uint32_t) strtoul (optarg, NULL, 0);
+            break;
+        default:
+            fprintf (stderr, "usage: kb-scan-bench [-n passes] [-r repeat] [-s seed]\n");
+            return 2;
+        }
+    }
+    if ((n_passes < 1) || (repeat < 1) || (seed == 0))
+    {
+        fprintf (stderr, "kb-scan-bench: the passes and repeat must be over 0, and the seed not 0\n");
+        return 2;
+    }
+
+    scan_pass *passes = malloc ((size_t)n_passes * sizeof (scan_pass));
+    if (passes == NULL)
+    {
+        fprintf (stderr, "kb-scan-bench: out of memory\n");
+        return 1;
+    }
+    int i;
+    for (i = 0; i < n_passes; ++i)
+    {
+        int n = ((rand32 () % 100) < IDLE_PCT) ? 0 : (int)(1 + (rand32 () % MOST_DOWN));
+        make_pass (&passes [i], n);
+    }
+
+    // Do they all find the same keys?
+    int bad = 0;
+    for (i = 0; i < n_passes; ++i)
+    {
+        int want [MAX_KEYS];
+        int n_want = pass_reference (&passes [i], want);
+        int w;
+        for (w = 1; w < N_WAYS; ++w)
+        {
+            int got [MAX_KEYS];
+            int n_got = ways [w].fn (&passes [i], got);
+            if ((n_got != n_want) || (memcmp (got, want, (size_t)n_want * sizeof (int)) != 0))
+            {
+                if (bad < 10)
+                {
+                    fprintf (stderr, "kb-scan-bench: pass %d, %s found %d keys, the reference %d\n",
+                             i, ways [w].name, n_got, n_want);
+                }
+                ++bad;
+            }
+        }
+    }
+
+    printf ("matrix model %d, %d x %d, active %s, lines %s, rows %s\n", MATRIX_MODEL,
+            MATRIX_ROWS, MATRIX_COLS, MATRIX_ACTIVE_LOW ? "low" : "high",
+            MATRIX_LINES_RUN ? "in a run" : "scattered", MATRIX_ROWS_RUN ? "in a run" : "scattered");
+    int w;
+    for (w = 0; w < N_WAYS; ++w)
+    {
+        volatile int sink = 0; // So the passes are not optimised away
+        int keys [MAX_KEYS];
+        int r;
+        uint64_t t0 = wall_ns ();
+        for (r = 0; r < repeat; ++r)
+        {
+            for (i = 0; i < n_passes; ++i)
+            {
+                sink += ways [w].fn (&passes [i], keys);
+            }
+        }
+        uint64_t t1 = wall_ns ();
+        printf ("%-10s %7.2f ns per pass\n", ways [w].name,
+                (double)(t1 - t0) / ((double)n_passes * (double)repeat));
+    }
+
+    free (passes);
+    if (bad)
+    {
+        printf ("\n%d pass%s differed\n", bad, (bad == 1) ? "" : "es");
+        return 1;
+    }
+    printf ("\nall %d passes the same\n", n_passes);
+    return 0;
+} // main
+
+/* End of File */
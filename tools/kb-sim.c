@@ -0,0 +1,214 @@
+/* kb-sim - run the keyboard firmware's scanner and decoder on the host
+ *
+ * Plays a list of matrix states through the firmware's own scanner, decoder
+ * and report code, built for the host on the mock hardware (see
+ * host/kb-mock.h), and prints the HID reports it sends.
+ *
+ * Usage: kb-sim [-t] [-l capture.csv] [file]
+ *   The input (stdin by default) is the output of "kb-rec-dump -f": one line
+ *   per matrix state, the time (us) and ten columns of keys down (hex, a bit
+ *   per row). Lines starting with # are skipped. The first state goes in after
+ *   SIM_START_US, so the scanner has settled, then the gaps are kept.
+ *
+ * Each report is printed as the time (s), the report (kbd, con or mouse) and
+ * its bytes, e.g.
+ *   0.102533 kbd 00 00 04 00 00 00 00 00
+ *
+ * -t prints the text a UK Linux host would type from the reports instead (see
+ * host/kb-vhost.h), once the last state has gone through.
+ *
+ * -l also writes the latency marker pins (LAT_GPIO_xxx in fw-kb-main.h) to a
+ * CSV file, as a logic analyser capture of them would be, with a line for
+ * each change, for kb-latency to read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fw-kb-main.h"
+#include "usb_descriptors.h"
+#include "kb-mock.h"
+#include "kb-vhost.h"
+
+#define SIM_START_US  100000  // When the first state goes in
+#define SIM_TAIL_US   1000000 // How long to run on after the last one
+
+static int show_text = 0;
+
+static void print_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    char const *name = "id?";
+    int idx;
+
+    if (show_text)
+    {
+        vhost_report (t_us, report_id, report, len);
+        return;
+    }
+    if (report_id == REPORT_ID_KEYBOARD)
+    {
+        name = "kbd";
+    }
+    else if (report_id == REPORT_ID_CONSUMER_CONTROL)
+    {
+        name = "con";
+    }
+    else if (report_id == REPORT_ID_MOUSE)
+    {
+        name = "mouse";
+    }
+
+    printf ("%10.6f %s", t_us / 1000000.0, name);
+    for (idx = 0; idx < len; ++idx)
+    {
+        printf (" %02X", report [idx]);
+    }
+    printf ("\n");
+} // print_report
+
+// The marker pins, in the order of the capture's channels D0 - D4
+static unsigned const lat_pins [] = {
+    LAT_GPIO_SAMPLE, LAT_GPIO_ACCEPT, LAT_GPIO_ENQUEUE, LAT_GPIO_REPORT, LAT_GPIO_DONE
+};
+#define LAT_PINS (sizeof (lat_pins) / sizeof (lat_pins [0]))
+
+static FILE *cap_fp = NULL;
+
+static void capture_gpio (uint64_t t_us, unsigned gpio, int level)
+{
+    unsigned idx;
+    (void) level;
+    for (idx = 0; idx < LAT_PINS; ++idx)
+    {
+        if (gpio == lat_pins [idx])
+        {
+            break;
+        }
+    }
+    if (idx == LAT_PINS)
+    {
+        return; // Not a marker
+    }
+    fprintf (cap_fp, "%llu", (unsigned long long)t_us);
+    for (idx = 0; idx < LAT_PINS; ++idx)
+    {
+        fprintf (cap_fp, ",%d", mock_gpio (lat_pins [idx]));
+    }
+    fprintf (cap_fp, "\n");
+} // capture_gpio
+
+int main (int argc, char **argv)
+{
+    FILE *fp = stdin;
+    int opt;
+    while ((opt = getopt (argc, argv, "tl:")) != -1)
+    {
+        if (opt == 't')
+        {
+            show_text = 1;
+        }
+        else if (opt == 'l')
+        {
+            cap_fp = fopen (optarg, "w");
+            if (cap_fp == NULL)
+            {
+                perror (optarg);
+                return 1;
+            }
+        }
+        else
+        {
+            break; // A bad option
+        }
+    }
+    if ((opt != -1) || (optind < (argc - 1)))
+    {
+        fprintf (stderr, "usage: %s [-t] [-l capture.csv] [file]\n", argv[0]);
+        return 2;
+    }
+    if (optind == (argc - 1))
+    {
+        fp = fopen (argv[optind], "r");
+        if (fp == NULL)
+        {
+            perror (argv[optind]);
+            return 1;
+        }
+    }
+
+    if (cap_fp != NULL)
+    {
+        // As a sigrok CSV export, with a time column (us) and a line for each change
+        fprintf (cap_fp, "; CSV from kb-sim, the latency markers of the host build\n");
+        fprintf (cap_fp, "; Channels (%u/%u): D0, D1, D2, D3, D4\n", (unsigned)LAT_PINS, (unsigned)LAT_PINS);
+        fprintf (cap_fp, "; Samplerate: 1 MHz\n");
+        fprintf (cap_fp, "Time [us],D0,D1,D2,D3,D4\n");
+        fprintf (cap_fp, "0,0,0,0,0,0\n");
+        mock_on_gpio (capture_gpio);
+    }
+    vhost_reset ();
+    mock_on_report (print_report);
+    mock_init ();
+
+    char line [256];
+    int n_line = 0;
+    int first = 1;
+    uint64_t t0 = 0;
+    while (fgets (line, sizeof (line), fp) != NULL)
+    {
+        unsigned long long t_us;
+        unsigned col [COL_SZ];
+        ++n_line;
+        if ((line [0] == '#') || (line [0] == '\n'))
+        {
+            continue;
+        }
+        if (sscanf (line, "%llu %x %x %x %x %x %x %x %x %x %x", &t_us,
+                    &col [0], &col [1], &col [2], &col [3], &col [4],
+                    &col [5], &col [6], &col [7], &col [8], &col [9]) != (COL_SZ + 1))
+        {
+            fprintf (stderr, "line %d: not a matrix state, skipped\n", n_line);
+            continue;
+        }
+        if (first)
+        {
+            t0 = t_us;
+            first = 0;
+        }
+        else if (t_us < t0)
+        {
+            fprintf (stderr, "line %d: time goes backwards, skipped\n", n_line);
+            continue;
+        }
+
+        uint8_t down [COL_SZ];
+        int idx;
+        for (idx = 0; idx < COL_SZ; ++idx)
+        {
+            down [idx] = (uint8_t)col [idx];
+        }
+        mock_run_until (SIM_START_US + (t_us - t0));
+        mock_set_keys (down);
+    }
+    if (fp != stdin)
+    {
+        fclose (fp);
+    }
+
+    // Let the last keys go through, and any key repeats or streams finish
+    mock_run_until (mock_now () + SIM_TAIL_US);
+    if (cap_fp != NULL)
+    {
+        fclose (cap_fp);
+    }
+    if (show_text)
+    {
+        printf ("%s\n", vhost_text ());
+    }
+    return 0;
+} // main
+
+/* End of File */
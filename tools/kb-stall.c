@@ -0,0 +1,158 @@
+/* kb-stall - check the core-1 watchdog on the host build
+ *
+ * Boots the firmware's own scanner, decoder and report code (the host build,
+ * see host/kb-mock.h), then stops core-1 between two passes, as if it had
+ * hung, and checks that core-0 relaunches it:
+ *   - a key held down through the stall is not sent again after it,
+ *   - a key let go during the stall is sent up once core-1 is back,
+ *   - the stalls and the recovery time are counted,
+ *   - after WATCH_RETRIES stalls in WATCH_RETRY_MS, the watchdog gives up and
+ *     leaves it to the hardware watchdog (which the host build does not have).
+ *
+ * Usage: kb-stall
+ *   Prints each check and the figures, as kb-cfg watch would. The exit status
+ *   is 1 if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-telem.h"
+#include "kb-watch.h"
+#include "usb_descriptors.h"
+#include "kb-mock.h"
+
+#define BOOT_US       500000
+#define HOLD_US       200000
+#define STALL_US      ((WATCH_STALL_MS * 1000) + 100000) // Long enough to be found and recovered
+#define RECOVER_MAX_US 5000  // From the relaunch to core-1's first pass
+
+static uint32_t n_reports = 0;
+static uint8_t last_keys [8]; // The last keyboard report
+static void on_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    (void) t_us;
+    if ((report_id == REPORT_ID_KEYBOARD) && (len >= sizeof (last_keys)))
+    {
+        memcpy (last_keys, report, sizeof (last_keys));
+        ++n_reports;
+    }
+} // on_report
+
+// A key down (or up, with key < 0), by its keymap index
+static void set_key (int key)
+{
+    uint8_t down [COL_SZ];
+    memset (down, 0, sizeof (down));
+    if (key >= 0)
+    {
+        down [key % COL_SZ] = (uint8_t)(1u << (key / COL_SZ));
+    }
+    mock_set_keys (down);
+} // set_key
+
+static void run_for (uint64_t us)
+{
+    mock_run_until (mock_now () + us);
+} // run_for
+
+// No key in the last keyboard report
+static int keys_up (void)
+{
+    static const uint8_t none [8] = { 0 };
+    return (memcmp (last_keys, none, sizeof (none)) == 0);
+} // keys_up
+
+// The index of a plain letter in the basic keymap, so a key types on its own
+static int find_letter (void)
+{
+    kb_config const *cfg = cfg_live ();
+    int idx;
+    for (idx = 0; idx < CFG_KEYS; ++idx)
+    {
+        if ((cfg->keys [CFG_LAYER_BASE][idx] >= 'a') && (cfg->keys [CFG_LAYER_BASE][idx] <= 'z'))
+        {
+            return idx;
+        }
+    }
+    return -1;
+} // find_letter
+
+static void info (uint8_t *data)
+{
+    watch_info (data, WATCH_INFO_LEN);
+} // info
+
+int main (int argc, char **argv)
+{
+    uint8_t wi [WATCH_INFO_LEN];
+    char what [80];
+
+    (void) argv;
+    if (argc != 1)
+    {
+        fprintf (stderr, "usage: kb-stall\n");
+        return 2;
+    }
+
+    mock_on_report (on_report);
+    mock_init ();
+    int key = find_letter ();
+    if (key < 0)
+    {
+        fprintf (stderr, "kb-stall: no letter in the basic keymap\n");
+        return 1;
+    }
+    mock_run_until (BOOT_US);
+
+    // A key held through a stall
+    set_key (key);
+    run_for (HOLD_US);
+    mock_check (!keys_up (), "a key is down");
+    uint32_t reports = n_reports;
+    mock_stall ();
+    run_for (STALL_US);
+    info (wi);
+    mock_check (mock_relaunches () == 1, "a stalled core-1 is relaunched");
+    mock_check (wi [WATCH_INFO_STATE] == WATCH_OK, "...and is scanning again");
+    snprintf (what, sizeof (what), "...%lu us after the relaunch",
+              (unsigned long)perf_get32 (&wi [WATCH_INFO_RECOVER_US]));
+    mock_check (perf_get32 (&wi [WATCH_INFO_RECOVER_US]) <= RECOVER_MAX_US, what);
+    mock_check (n_reports == reports, "the key held through it is not sent again");
+    set_key (-1);
+    run_for (HOLD_US);
+    mock_check (keys_up (), "...and is sent up when let go");
+
+    // A key let go during a stall
+    set_key (key);
+    run_for (HOLD_US);
+    mock_stall ();
+    run_for (WATCH_STALL_MS * 500);
+    set_key (-1);
+    run_for (STALL_US);
+    mock_check (keys_up (), "a key let go during a stall is sent up after it");
+    info (wi);
+    mock_check (perf_get32 (&wi [WATCH_INFO_STALLS]) == 2, "two stalls counted");
+    mock_check (perf_get32 (&wi [WATCH_INFO_BEAT1]) != 0, "core-1 heartbeat");
+
+    // Stalls over and over, it gives up
+    mock_stall ();
+    run_for (STALL_US);
+    mock_stall ();
+    run_for (STALL_US);
+    info (wi);
+    mock_check (wi [WATCH_INFO_STATE] == WATCH_GIVEN_UP, "given up after the stalls keep coming");
+    snprintf (what, sizeof (what), "...after %lu relaunches", (unsigned long)mock_relaunches ());
+    mock_check (mock_relaunches () == WATCH_RETRIES, what);
+
+    printf ("\nlongest core-1 was not scanning %lu us, worst recovery %lu us, ",
+            (unsigned long)perf_get32 (&wi [WATCH_INFO_OUTAGE_MAX]),
+            (unsigned long)perf_get32 (&wi [WATCH_INFO_RECOVER_MAX]));
+    return mock_check_end ();
+} // main
+
+/* End of File */
@@ -0,0 +1,182 @@
+/* kb-suspend - check the suspend power states on the host build
+ *
+ * Boots the firmware's own scanner, decoder and report code (the host build,
+ * see host/kb-mock.h), then has the host suspend and resume the bus:
+ *   - suspended, the state is SUSPENDED and the scanner is parked, so it does
+ *     far fewer full scans a second than when active,
+ *   - a key down whilst suspended asks for a remote wake-up, and once the
+ *     host resumes the state is ACTIVE and the next key is typed,
+ *   - with no remote wake-up allowed, a key goes WAKING, and back to
+ *     SUSPENDED after PWR_WAKE_MS,
+ *   - a resume from the host brings the scanner back straight away.
+ *
+ * Usage: kb-suspend
+ *   Prints each check and the figures, as kb-cfg power would. The exit status
+ *   is 1 if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "kb-power.h"
+#include "kb-telem.h"
+#include "kb-mock.h"
+
+#define BOOT_US      500000
+#define RATE_US      1000000 // Scans are counted over this long
+#define HOLD_US      100000  // A key is held down this long
+#define SETTLE_US    200000
+#define WAKE_MAX_US  50000   // From a key down to the bus resumed
+#define RESUME_MAX_US 5000   // From a resume to the scanner running in full
+#define RATE_DROP    10      // Suspended, the scans a second must drop by this much at least
+
+static uint32_t n_reports = 0;
+static void count_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    (void) t_us;
+    (void) report_id;
+    (void) report;
+    (void) len;
+    ++n_reports;
+} // count_report
+
+static uint32_t scans (void)
+{
+    uint8_t perf [PERF_REPORT_LEN];
+    telem_perf_fill (perf, sizeof (perf));
+    return perf_get32 (&perf [PERF_OFS_SCANS]);
+} // scans
+
+// Full scans a second, over the next RATE_US
+static uint32_t scan_rate (void)
+{
+    uint32_t s0 = scans ();
+    mock_run_until (mock_now () + RATE_US);
+    return (uint32_t)(((uint64_t)(scans () - s0) * 1000000) / RATE_US);
+} // scan_rate
+
+// A key down (or up, with key < 0), by its keymap index
+static void set_key (int key)
+{
+    uint8_t down [COL_SZ];
+    memset (down, 0, sizeof (down));
+    if (key >= 0)
+    {
+        down [key % COL_SZ] = (uint8_t)(1u << (key / COL_SZ));
+    }
+    mock_set_keys (down);
+} // set_key
+
+// Run until the power state is "state", at most max_us, returns how long it took or -1
+static int64_t run_to_state (int state, uint64_t max_us)
+{
+    uint64_t t0 = mock_now ();
+    while (power_state () != state)
+    {
+        if ((mock_now () - t0) >= max_us)
+        {
+            return -1;
+        }
+        mock_run_until (mock_now () + 100);
+    }
+    return (int64_t)(mock_now () - t0);
+} // run_to_state
+
+// The index of a plain letter in the basic keymap, so a key types on its own
+static int find_letter (void)
+{
+    kb_config const *cfg = cfg_live ();
+    int idx;
+    for (idx = 0; idx < CFG_KEYS; ++idx)
+    {
+        if ((cfg->keys [CFG_LAYER_BASE][idx] >= 'a') && (cfg->keys [CFG_LAYER_BASE][idx] <= 'z'))
+        {
+            return idx;
+        }
+    }
+    return -1;
+} // find_letter
+
+int main (int argc, char **argv)
+{
+    uint8_t info [PWR_INFO_LEN];
+    char what [80];
+
+    (void) argv;
+    if (argc != 1)
+    {
+        fprintf (stderr, "usage: kb-suspend\n");
+        return 2;
+    }
+
+    mock_on_report (count_report);
+    mock_init ();
+    int key = find_letter ();
+    if (key < 0)
+    {
+        fprintf (stderr, "kb-suspend: no letter in the basic keymap\n");
+        return 1;
+    }
+    mock_run_until (BOOT_US);
+    uint32_t active_rate = scan_rate ();
+
+    // Suspended, and parked
+    mock_suspend (1);
+    mock_run_until (mock_now () + SETTLE_US);
+    mock_check (power_state () == PWR_SUSPENDED, "suspended");
+    uint32_t parked_rate = scan_rate ();
+    snprintf (what, sizeof (what), "scans drop from %lu/s to %lu/s", (unsigned long)active_rate,
+              (unsigned long)parked_rate);
+    mock_check ((parked_rate * RATE_DROP) <= active_rate, what);
+
+    // A key wakes the host
+    uint32_t wakeups = mock_wakeups ();
+    set_key (key);
+    int64_t took = run_to_state (PWR_ACTIVE, WAKE_MAX_US);
+    mock_check (mock_wakeups () == (wakeups + 1), "a key asks for a remote wake-up");
+    snprintf (what, sizeof (what), "resumed %.1f ms after the key went down", (took < 0) ? -1.0 : took / 1000.0);
+    mock_check (took >= 0, what);
+    mock_run_until (mock_now () + HOLD_US);
+    set_key (-1);
+    mock_run_until (mock_now () + SETTLE_US);
+
+    uint32_t reports = n_reports;
+    set_key (key);
+    mock_run_until (mock_now () + HOLD_US);
+    set_key (-1);
+    mock_run_until (mock_now () + SETTLE_US);
+    mock_check (n_reports > reports, "a key after the resume is typed");
+
+    // No remote wake-up allowed, back to sleep after PWR_WAKE_MS
+    mock_suspend (0);
+    mock_run_until (mock_now () + SETTLE_US);
+    wakeups = mock_wakeups ();
+    set_key (key);
+    mock_check (run_to_state (PWR_WAKING, HOLD_US) >= 0, "a key with no remote wake-up goes to waking");
+    mock_run_until (mock_now () + HOLD_US);
+    set_key (-1);
+    mock_check (run_to_state (PWR_SUSPENDED, (PWR_WAKE_MS * 1000) + SETTLE_US) >= 0, "...then back to suspended");
+    mock_check (mock_wakeups () == wakeups, "...and asks for no wake-up");
+
+    // The host resumes
+    mock_run_until (mock_now () + SETTLE_US);
+    mock_resume ();
+    mock_check (power_state () == PWR_ACTIVE, "a resume from the host");
+    mock_run_until (mock_now () + SETTLE_US);
+
+    power_info (info, sizeof (info));
+    uint32_t resume_us = perf_get32 (&info [PWR_INFO_RESUME_US]);
+    snprintf (what, sizeof (what), "the scanner runs in full %lu us after a resume", (unsigned long)resume_us);
+    mock_check (resume_us <= RESUME_MAX_US, what);
+    mock_check (perf_get32 (&info [PWR_INFO_SUSPENDS]) == 2, "two suspends counted");
+    mock_check (perf_get32 (&info [PWR_INFO_KEY_WAKES]) == 2, "two key wake-ups counted");
+
+    printf ("\nsuspended for %lu ms, ", (unsigned long)perf_get32 (&info [PWR_INFO_SLEPT_MS]));
+    return mock_check_end ();
+} // main
+
+/* End of File */
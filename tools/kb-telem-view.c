@@ -0,0 +1,145 @@
+/* kb-telem-view - show the keyboard's live telemetry
+ *
+ * Reads the telemetry frames the keyboard sends on its CDC serial port (see
+ * kb-telem.h, TELEM_ON in fw-kb-main.h) and prints the rates worked out from
+ * each pair of frames, with the latency histogram as a bar chart. Anything
+ * else on the port (e.g. the paste mode messages) is skipped.
+ *
+ * Usage: kb-telem-view tty|file|-
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "kb-link.h"
+#include "kb-telem.h"
+
+#define FRAME_LEN ((int)sizeof (telem_frame))
+
+// Show one frame, with the rates since the frame before
+static void show (telem_frame const *f, telem_frame const *prev)
+{
+    double secs = (prev != NULL) ? (f->uptime_ms - prev->uptime_ms) / 1000.0 : 0.0;
+    uint32_t scans   = (prev != NULL) ? (f->scans - prev->scans) : 0;
+    uint32_t reports = (prev != NULL) ? (f->reports - prev->reports) : 0;
+    double scan_rate = (secs > 0.0) ? (scans / secs) : 0.0;
+    int idx;
+
+    printf ("\n-- frame %lu, up %.1f s --\n", (unsigned long)f->seq, f->uptime_ms / 1000.0);
+    printf ("scans/s      %8.1f   longest scan %u us\n", scan_rate, f->scan_max_us);
+    printf ("telemetry    %8u ns per scan = %.3f%% of core-1\n",
+            f->hook_ns, (scan_rate * f->hook_ns) / 1e7);
+    printf ("reports/s    %8.1f   most in one frame %u\n",
+            (secs > 0.0) ? (reports / secs) : 0.0, f->frame_max);
+    printf ("bounces      %8lu   ghosts %lu\n", (unsigned long)f->bounces, (unsigned long)f->ghosts);
+    printf ("fifo drops   %8lu   kc_buf drops %lu, high water %u\n",
+            (unsigned long)f->fifo_drops, (unsigned long)f->kc_drops, f->kc_hwm);
+
+    uint32_t most = 1;
+    for (idx = 0; idx < TELEM_LAT_BUCKETS; ++idx)
+    {
+        if (f->lat [idx] > most)
+        {
+            most = f->lat [idx];
+        }
+    }
+    printf ("scan-to-report latency:\n");
+    for (idx = 0; idx < TELEM_LAT_BUCKETS; ++idx)
+    {
+        char label [24];
+        if (idx < (TELEM_LAT_BUCKETS - 1))
+        {
+            snprintf (label, sizeof (label), "< %u us", TELEM_LAT_FIRST << idx);
+        }
+        else
+        {
+            snprintf (label, sizeof (label), ">= %u us", TELEM_LAT_FIRST << (idx - 1));
+        }
+        int bar = (int)((f->lat [idx] * 40u) / most);
+        printf ("  %-11s %6u %.*s\n", label, f->lat [idx], bar, "########################################");
+    }
+    fflush (stdout);
+} // show
+
+int main (int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "usage: %s tty|file|-\n", argv[0]);
+        return 2;
+    }
+
+    int fd = 0;
+    if (strcmp (argv[1], "-") != 0)
+    {
+        fd = open (argv[1], O_RDONLY | O_NOCTTY);
+        if (fd < 0)
+        {
+            perror (argv[1]);
+            return 1;
+        }
+    }
+
+    struct termios tio;
+    if (tcgetattr (fd, &tio) == 0) // A tty, set it up raw
+    {
+        cfmakeraw (&tio);
+        tcsetattr (fd, TCSANOW, &tio);
+    }
+
+    uint8_t buf [1024];
+    int len = 0;
+    telem_frame prev;
+    int have_prev = 0;
+    uint32_t frames = 0;
+    uint32_t bad = 0;
+
+    while (1)
+    {
+        ssize_t n = read (fd, buf + len, sizeof (buf) - (size_t)len);
+        if (n <= 0)
+        {
+            break;
+        }
+        len += (int)n;
+
+        int idx = 0;
+        while ((len - idx) >= FRAME_LEN)
+        {
+            uint8_t const *p = &buf [idx];
+            if ((p[0] != TELEM_SYNC0) || (p[1] != TELEM_SYNC1))
+            {
+                ++idx;
+                continue;
+            }
+            if ((p[2] != TELEM_VERSION) || (p[3] != FRAME_LEN) ||
+                (p[FRAME_LEN - 1] != link_crc8 (p, FRAME_LEN - 1)))
+            {
+                ++bad;
+                ++idx;
+                continue;
+            }
+
+            telem_frame f;
+            memcpy (&f, p, sizeof (f)); // The Pico and the host are both little endian
+            show (&f, have_prev ? &prev : NULL);
+            prev = f;
+            have_prev = 1;
+            ++frames;
+            idx += FRAME_LEN;
+        }
+        memmove (buf, buf + idx, (size_t)(len - idx));
+        len -= idx;
+    }
+
+    printf ("%lu frames, %lu bad\n", (unsigned long)frames, (unsigned long)bad);
+    return 0;
+} // main
+
+/* End of File */
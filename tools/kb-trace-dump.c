@@ -0,0 +1,169 @@
+/* kb-trace-dump - turn the keyboard's binary trace log back into text
+ *
+ * Reads the trace records the keyboard sends on its UART (see kb-trace.h,
+ * TRACE_ON in fw-kb-main.h) from a tty or a file captured from one, and
+ * prints one line per record. Any plain text in between (e.g. the start-up
+ * messages) is printed as it is, with a "#" in front.
+ *
+ * Usage: kb-trace-dump [-b baud] tty|file|-
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "kb-trace.h"
+
+#define TR_NAME(id, name) name,
+static char const * const trace_names [TR_COUNT] = { TRACE_IDS (TR_NAME) };
+#undef TR_NAME
+
+#define REC_LEN ((int)sizeof (trace_rec))
+
+static uint32_t last_ts [2];
+static uint32_t dropped [2];
+
+// Print one record
+static void print_rec (uint8_t const *p)
+{
+    trace_rec r;
+    memcpy (&r, p, sizeof (r)); // The Pico and the host are both little endian
+    int core = r.magic - TRACE_MAGIC;
+
+    printf ("%d %10lu us (+%7lu) %-9s a=%-5u b=0x%08lX",
+            core, (unsigned long)r.ts_us, (unsigned long)(r.ts_us - last_ts [core]),
+            trace_names [r.id], r.a, (unsigned long)r.b);
+    if (r.id == TR_DROPPED)
+    {
+        printf ("  (%lu lost)", (unsigned long)(r.b - dropped [core]));
+        dropped [core] = r.b;
+    }
+    printf ("\n");
+    last_ts [core] = r.ts_us;
+} // print_rec
+
+// Could this be the start of a record?
+static int is_rec (uint8_t const *p)
+{
+    return ((p[0] == TRACE_MAGIC) || (p[0] == TRACE_MAGIC + 1)) && (p[1] < TR_COUNT);
+} // is_rec
+
+int main (int argc, char **argv)
+{
+    long baud = 921600;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "b:")) != -1)
+    {
+        if (opt == 'b')
+        {
+            baud = strtol (optarg, NULL, 0);
+        }
+        else
+        {
+            fprintf (stderr, "usage: %s [-b baud] tty|file|-\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind >= argc)
+    {
+        fprintf (stderr, "usage: %s [-b baud] tty|file|-\n", argv[0]);
+        return 2;
+    }
+
+    int fd = 0;
+    if (strcmp (argv[optind], "-") != 0)
+    {
+        fd = open (argv[optind], O_RDONLY | O_NOCTTY);
+        if (fd < 0)
+        {
+            perror (argv[optind]);
+            return 1;
+        }
+    }
+
+    struct termios tio;
+    if (tcgetattr (fd, &tio) == 0) // A tty, set it up raw
+    {
+        cfmakeraw (&tio);
+        if (baud == 921600)
+        {
+            cfsetispeed (&tio, B921600);
+        }
+        else if (baud == 115200)
+        {
+            cfsetispeed (&tio, B115200);
+        }
+        tcsetattr (fd, TCSANOW, &tio);
+    }
+
+    uint8_t buf [4096];
+    int len = 0;
+    int text = 0; // Set whilst printing a line of plain text
+    uint32_t records = 0;
+
+    while (1)
+    {
+        ssize_t n = read (fd, buf + len, sizeof (buf) - (size_t)len);
+        if (n <= 0)
+        {
+            break;
+        }
+        len += (int)n;
+
+        int idx = 0;
+        while ((len - idx) >= REC_LEN)
+        {
+            if (is_rec (&buf [idx]))
+            {
+                if (text)
+                {
+                    printf ("\n");
+                    text = 0;
+                }
+                print_rec (&buf [idx]);
+                ++records;
+                idx += REC_LEN;
+                continue;
+            }
+
+            // Not a record, show it if it is plain text
+            uint8_t c = buf [idx++];
+            if ((c == '\n') || (c == '\r'))
+            {
+                if (text)
+                {
+                    printf ("\n");
+                    text = 0;
+                }
+            }
+            else if ((c >= ' ') && (c < 0x7F))
+            {
+                if (!text)
+                {
+                    printf ("# ");
+                    text = 1;
+                }
+                putchar (c);
+            }
+        }
+        memmove (buf, buf + idx, (size_t)(len - idx));
+        len -= idx;
+        fflush (stdout);
+    }
+
+    if (text)
+    {
+        printf ("\n");
+    }
+    printf ("%lu records, %lu dropped on core 0, %lu dropped on core 1\n",
+            (unsigned long)records, (unsigned long)dropped [0], (unsigned long)dropped [1]);
+    return 0;
+} // main
+
+/* End of File */
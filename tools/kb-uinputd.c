@@ -0,0 +1,360 @@
+/* kb-uinputd - key event link daemon for the Sharp FontWriter 620 keyboard
+ *
+ * Reads the framed key events the keyboard sends on its UART (see kb-link.h,
+ * LINK_ON in fw-kb-main.h) and injects them into Linux through uinput, so the
+ * keyboard works on a host wired to the UART without any USB at all.
+ *
+ * Usage: kb-uinputd [-n] [-v] [-b baud] tty
+ *        kb-uinputd [-n] [-v] -p
+ *   -n  Print the events instead of injecting them (no uinput needed)
+ *   -v  Print the events as well as injecting them, with link statistics at exit
+ *   -b  Baud rate (default 921600)
+ *   -p  Open a pseudo-terminal and listen on that instead of a tty, e.g. to
+ *       test with kb-link-send on a machine with no keyboard wired up
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <sys/ioctl.h>
+
+#include "kb-link.h"
+
+// HID usage -> Linux key code
+typedef struct
+{
+    uint16_t usage;
+    uint16_t code;
+} usage_map;
+
+// Keyboard page (0x07)
+static usage_map const key_map [] = {
+    { 0x04, KEY_A }, { 0x05, KEY_B }, { 0x06, KEY_C }, { 0x07, KEY_D }, { 0x08, KEY_E }, { 0x09, KEY_F },
+    { 0x0A, KEY_G }, { 0x0B, KEY_H }, { 0x0C, KEY_I }, { 0x0D, KEY_J }, { 0x0E, KEY_K }, { 0x0F, KEY_L },
+    { 0x10, KEY_M }, { 0x11, KEY_N }, { 0x12, KEY_O }, { 0x13, KEY_P }, { 0x14, KEY_Q }, { 0x15, KEY_R },
+    { 0x16, KEY_S }, { 0x17, KEY_T }, { 0x18, KEY_U }, { 0x19, KEY_V }, { 0x1A, KEY_W }, { 0x1B, KEY_X },
+    { 0x1C, KEY_Y }, { 0x1D, KEY_Z },
+    { 0x1E, KEY_1 }, { 0x1F, KEY_2 }, { 0x20, KEY_3 }, { 0x21, KEY_4 }, { 0x22, KEY_5 }, { 0x23, KEY_6 },
+    { 0x24, KEY_7 }, { 0x25, KEY_8 }, { 0x26, KEY_9 }, { 0x27, KEY_0 },
+    { 0x28, KEY_ENTER },      { 0x29, KEY_ESC },        { 0x2A, KEY_BACKSPACE },  { 0x2B, KEY_TAB },
+    { 0x2C, KEY_SPACE },      { 0x2D, KEY_MINUS },      { 0x2E, KEY_EQUAL },      { 0x2F, KEY_LEFTBRACE },
+    { 0x30, KEY_RIGHTBRACE }, { 0x31, KEY_BACKSLASH },  { 0x32, KEY_BACKSLASH },  { 0x33, KEY_SEMICOLON },
+    { 0x34, KEY_APOSTROPHE }, { 0x35, KEY_GRAVE },      { 0x36, KEY_COMMA },      { 0x37, KEY_DOT },
+    { 0x38, KEY_SLASH },      { 0x39, KEY_CAPSLOCK },
+    { 0x3A, KEY_F1 },  { 0x3B, KEY_F2 },  { 0x3C, KEY_F3 },  { 0x3D, KEY_F4 },  { 0x3E, KEY_F5 },  { 0x3F, KEY_F6 },
+    { 0x40, KEY_F7 },  { 0x41, KEY_F8 },  { 0x42, KEY_F9 },  { 0x43, KEY_F10 }, { 0x44, KEY_F11 }, { 0x45, KEY_F12 },
+    { 0x46, KEY_SYSRQ },      { 0x47, KEY_SCROLLLOCK }, { 0x48, KEY_PAUSE },      { 0x49, KEY_INSERT },
+    { 0x4A, KEY_HOME },       { 0x4B, KEY_PAGEUP },     { 0x4C, KEY_DELETE },     { 0x4D, KEY_END },
+    { 0x4E, KEY_PAGEDOWN },   { 0x4F, KEY_RIGHT },      { 0x50, KEY_LEFT },       { 0x51, KEY_DOWN },
+    { 0x52, KEY_UP },         { 0x53, KEY_NUMLOCK },    { 0x54, KEY_KPSLASH },    { 0x55, KEY_KPASTERISK },
+    { 0x56, KEY_KPMINUS },    { 0x57, KEY_KPPLUS },     { 0x58, KEY_KPENTER },
+    { 0x59, KEY_KP1 }, { 0x5A, KEY_KP2 }, { 0x5B, KEY_KP3 }, { 0x5C, KEY_KP4 }, { 0x5D, KEY_KP5 },
+    { 0x5E, KEY_KP6 }, { 0x5F, KEY_KP7 }, { 0x60, KEY_KP8 }, { 0x61, KEY_KP9 }, { 0x62, KEY_KP0 },
+    { 0x63, KEY_KPDOT },      { 0x64, KEY_102ND },      { 0x65, KEY_COMPOSE },    { 0x66, KEY_POWER },
+    { 0x67, KEY_KPEQUAL },
+    { 0x68, KEY_F13 }, { 0x69, KEY_F14 }, { 0x6A, KEY_F15 }, { 0x6B, KEY_F16 }, { 0x6C, KEY_F17 }, { 0x6D, KEY_F18 },
+    { 0x6E, KEY_F19 }, { 0x6F, KEY_F20 }, { 0x70, KEY_F21 }, { 0x71, KEY_F22 }, { 0x72, KEY_F23 }, { 0x73, KEY_F24 },
+    { 0xE0, KEY_LEFTCTRL },   { 0xE1, KEY_LEFTSHIFT },  { 0xE2, KEY_LEFTALT },    { 0xE3, KEY_LEFTMETA },
+    { 0xE4, KEY_RIGHTCTRL },  { 0xE5, KEY_RIGHTSHIFT }, { 0xE6, KEY_RIGHTALT },   { 0xE7, KEY_RIGHTMETA }
+};
+
+// Consumer page (0x0C) - the media keys the keyboard sends
+static usage_map const con_map [] = {
+    { 0x00E9, KEY_VOLUMEUP },     { 0x00EA, KEY_VOLUMEDOWN },   { 0x00E2, KEY_MUTE },
+    { 0x00CD, KEY_PLAYPAUSE },    { 0x00B5, KEY_NEXTSONG },     { 0x00B6, KEY_PREVIOUSSONG },
+    { 0x006F, KEY_BRIGHTNESSUP }, { 0x0070, KEY_BRIGHTNESSDOWN }
+};
+
+#define MAP_LEN(m) ((int)(sizeof (m) / sizeof ((m)[0])))
+
+static int  ui_fd   = -1; // uinput device, -1 for print only
+static int  verbose = 0;
+static char down [KEY_MAX + 1]; // Keys we have pressed, to release them all at exit
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal (int sig)
+{
+    (void) sig;
+    quit = 1;
+} // on_signal
+
+// Look up the Linux key code for an event, 0 if there is none
+static int event_code (link_event const *ev)
+{
+    usage_map const *map = key_map;
+    int len = MAP_LEN (key_map);
+    int idx;
+
+    if ((ev->type == LK_CON_DOWN) || (ev->type == LK_CON_UP))
+    {
+        map = con_map;
+        len = MAP_LEN (con_map);
+    }
+    for (idx = 0; idx < len; ++idx)
+    {
+        if (map[idx].usage == ev->usage)
+        {
+            return map[idx].code;
+        }
+    }
+    return 0;
+} // event_code
+
+// Write one input event to uinput
+static void ui_emit (int type, int code, int value)
+{
+    struct input_event ie;
+
+    memset (&ie, 0, sizeof (ie));
+    ie.type  = (uint16_t)type;
+    ie.code  = (uint16_t)code;
+    ie.value = value;
+    if (write (ui_fd, &ie, sizeof (ie)) != (ssize_t)sizeof (ie))
+    {
+        perror ("uinput write");
+    }
+} // ui_emit
+
+// Press or release a key
+static void key_event (int code, int value)
+{
+    down [code] = (char)value;
+    if (ui_fd >= 0)
+    {
+        ui_emit (EV_KEY, code, value);
+        ui_emit (EV_SYN, SYN_REPORT, 0);
+    }
+} // key_event
+
+// Create the uinput keyboard, with every key we might send
+static int ui_open (void)
+{
+    struct uinput_setup us;
+    int fd = open ("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    int idx;
+
+    if (fd < 0)
+    {
+        perror ("/dev/uinput");
+        return -1;
+    }
+    ioctl (fd, UI_SET_EVBIT, EV_KEY);
+    ioctl (fd, UI_SET_EVBIT, EV_SYN);
+    for (idx = 0; idx < MAP_LEN (key_map); ++idx)
+    {
+        ioctl (fd, UI_SET_KEYBIT, key_map[idx].code);
+    }
+    for (idx = 0; idx < MAP_LEN (con_map); ++idx)
+    {
+        ioctl (fd, UI_SET_KEYBIT, con_map[idx].code);
+    }
+
+    memset (&us, 0, sizeof (us));
+    us.id.bustype = BUS_RS232;
+    us.id.vendor  = 0x0603; // As the USB keyboard
+    us.id.product = 0x4004;
+    strcpy (us.name, "Fontwriter key link");
+    if ((ioctl (fd, UI_DEV_SETUP, &us) < 0) || (ioctl (fd, UI_DEV_CREATE) < 0))
+    {
+        perror ("uinput setup");
+        close (fd);
+        return -1;
+    }
+    return fd;
+} // ui_open
+
+// Map a baud rate to a termios speed
+static speed_t tty_speed (long baud)
+{
+    switch (baud)
+    {
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+        case 460800:  return B460800;
+        case 921600:  return B921600;
+        case 1000000: return B1000000;
+        default:      return B0;
+    }
+} // tty_speed
+
+// Open the tty (or a new pseudo-terminal) in raw mode
+static int tty_open (char const *path, long baud)
+{
+    struct termios tio;
+    int fd;
+
+    if (path == NULL)
+    {
+        fd = posix_openpt (O_RDWR | O_NOCTTY);
+        if ((fd < 0) || (grantpt (fd) < 0) || (unlockpt (fd) < 0))
+        {
+            perror ("pseudo-terminal");
+            return -1;
+        }
+        printf ("listening on %s\n", ptsname (fd));
+        fflush (stdout);
+    }
+    else
+    {
+        fd = open (path, O_RDWR | O_NOCTTY);
+        if (fd < 0)
+        {
+            perror (path);
+            return -1;
+        }
+    }
+
+    if (tcgetattr (fd, &tio) == 0)
+    {
+        cfmakeraw (&tio);
+        tio.c_cc[VMIN]  = 1;
+        tio.c_cc[VTIME] = 0;
+        if (path != NULL)
+        {
+            cfsetispeed (&tio, tty_speed (baud));
+            cfsetospeed (&tio, tty_speed (baud));
+        }
+        tcsetattr (fd, TCSANOW, &tio);
+    }
+    return fd;
+} // tty_open
+
+int main (int argc, char **argv)
+{
+    char const *path = NULL;
+    int print_only = 0;
+    int use_pty = 0;
+    long baud = 921600;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "nvpb:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': print_only = 1; verbose = 1; break;
+            case 'v': verbose = 1; break;
+            case 'p': use_pty = 1; break;
+            case 'b': baud = strtol (optarg, NULL, 0); break;
+            default:
+                fprintf (stderr, "usage: %s [-n] [-v] [-b baud] tty | -p\n", argv[0]);
+                return 2;
+        }
+    }
+    if (!use_pty)
+    {
+        if (optind >= argc)
+        {
+            fprintf (stderr, "usage: %s [-n] [-v] [-b baud] tty | -p\n", argv[0]);
+            return 2;
+        }
+        path = argv[optind];
+        if (tty_speed (baud) == B0)
+        {
+            fprintf (stderr, "unsupported baud rate %ld\n", baud);
+            return 2;
+        }
+    }
+
+    if ((!print_only) && ((ui_fd = ui_open ()) < 0))
+    {
+        return 1;
+    }
+    int fd = tty_open (path, baud);
+    if (fd < 0)
+    {
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = on_signal; // No SA_RESTART, so read() returns on a signal
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGTERM, &sa, NULL);
+
+    link_decoder dec;
+    memset (&dec, 0, sizeof (dec));
+    uint32_t last_ts = 0;
+    int status = 0;
+
+    while (!quit)
+    {
+        uint8_t buf [256];
+        ssize_t n = read (fd, buf, sizeof (buf));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((errno == EIO) && (use_pty))
+            {
+                usleep (10000); // No one has the other end of the pseudo-terminal open (yet)
+                continue;
+            }
+            perror ("read");
+            status = 1;
+            break;
+        }
+        if (n == 0)
+        {
+            break; // End of file
+        }
+
+        for (ssize_t idx = 0; idx < n; ++idx)
+        {
+            link_event ev;
+            if (!link_decode (&dec, buf[idx], &ev))
+            {
+                continue;
+            }
+            int code = event_code (&ev);
+            int value = ((ev.type == LK_KEY_DOWN) || (ev.type == LK_CON_DOWN)) ? 1 : 0;
+            if (verbose)
+            {
+                printf ("%10lu us (+%7lu) %s %s 0x%02X -> %d\n",
+                        (unsigned long)ev.ts_us, (unsigned long)(ev.ts_us - last_ts),
+                        value ? "down" : "up  ", (ev.type >= LK_CON_DOWN) ? "con" : "key",
+                        ev.usage, code);
+                fflush (stdout);
+            }
+            last_ts = ev.ts_us;
+            if (code != 0)
+            {
+                key_event (code, value);
+            }
+        }
+    }
+
+    // Let go of anything still held down
+    for (int code = 0; code <= KEY_MAX; ++code)
+    {
+        if (down [code])
+        {
+            key_event (code, 0);
+        }
+    }
+    if (verbose)
+    {
+        printf ("%lu frames, %lu bad, %lu bytes skipped\n",
+                (unsigned long)dec.frames, (unsigned long)dec.errors, (unsigned long)dec.skipped);
+    }
+    if (ui_fd >= 0)
+    {
+        ioctl (ui_fd, UI_DEV_DESTROY);
+        close (ui_fd);
+    }
+    close (fd);
+    return status;
+} // main
+
+/* End of File */
@@ -0,0 +1,391 @@
+/* kb-uni-check - check the Unicode entry mode on the host build
+ *
+ * Turns the Unicode entry mode on (HELP + Code-II), then types every special
+ * symbol of the Code-II keymap, with and without Shift, through the firmware's
+ * own scanner, decoder and report code (the host build, see host/kb-mock.h).
+ * The keyboard reports for each are decoded back into code points twice:
+ *   - here, a report at a time: CTRL + SHIFT + U going down starts an entry,
+ *     the hex digits make up the code point, SPACE ends it. A modifier key
+ *     code that leaves the key codes in the same report as the U goes down
+ *     spoils the entry, as the host lets go of that modifier then.
+ *   - by the virtual host (host/kb-vhost.h), as the text it types.
+ * Both must give the code point in the table below, which is taken from the
+ * Unicode charts, not from the firmware. A symbol the table has no code point
+ * for is sent the normal way, and must not start an entry.
+ *
+ * Usage: kb-uni-check [-v]
+ *   Prints the symbols that fail (-v, all of them), and exits 1 if any do.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <tusb.h>
+
+#include "fw-kb-main.h"
+#include "kb-config.h"
+#include "usb_descriptors.h"
+#include "kb-mock.h"
+#include "kb-vhost.h"
+
+// Key codes, as in fw-kb-main.c
+#define KC_CER  128
+#define KC_GBP  147
+#define KC_HLP  201
+#define KC_CD2  202
+#define KC_SHF  203
+
+#define HOLD_MODS_US  60000  // Longer than the combo window
+#define HOLD_KEY_US   100000
+#define SETTLE_US     200000 // Long enough for the longest entry to be sent
+#define GAP_US        500000 // Longer than the one-shot double tap
+
+#define MAX_REPORTS   64     // Keyboard reports kept for one symbol
+
+// What each special symbol should type: name, then the code point [unshifted, shifted], 0 if sent the normal way
+static struct
+{
+    char const *name;
+    uint32_t    cp [2];
+} const want_table [KC_GBP - KC_CER + 1] = {
+    { "CER", {      0, 0x20AC } }, // EURO SIGN
+    { "CAP", {      0,      0 } },
+    { "BSQ", {      0,      0 } },
+    { "BCR", {      0,      0 } },
+    { "SSZ", {      0, 0x00DF } }, // LATIN SMALL LETTER SHARP S
+    { "YEN", {      0, 0x00A5 } }, // YEN SIGN
+    { "CNT", {      0, 0x00A2 } }, // CENT SIGN
+    { "BKT", { 0x2019,      0 } }, // RIGHT SINGLE QUOTATION MARK
+    { "SPM", { 0x00A7, 0x00B1 } }, // SECTION SIGN, PLUS-MINUS SIGN
+    { "DEG", {      0, 0x00B0 } }, // DEGREE SIGN
+    { "IEX", {      0, 0x00A1 } }, // INVERTED EXCLAMATION MARK
+    { "IQM", {      0, 0x00BF } }, // INVERTED QUESTION MARK
+    { "NSQ", { 0x00F1, 0x00D1 } }, // LATIN SMALL / CAPITAL LETTER N WITH TILDE
+    { "CED", { 0x00E7, 0x00C7 } }, // LATIN SMALL / CAPITAL LETTER C WITH CEDILLA
+    { "OHM", {      0, 0x03A9 } }, // GREEK CAPITAL LETTER OMEGA
+    { "Aac", {      0, 0x00E1 } }, // LATIN SMALL LETTER A WITH ACUTE
+    { "Egr", {      0, 0x00E8 } }, // LATIN SMALL LETTER E WITH GRAVE
+    { "Ugr", {      0, 0x00F9 } }, // LATIN SMALL LETTER U WITH GRAVE
+    { "Agr", {      0, 0x00E0 } }, // LATIN SMALL LETTER A WITH GRAVE
+    { "GBP", { 0x00A3, 0x00A3 } }  // POUND SIGN
+};
+
+static uint8_t kbd [MAX_REPORTS][8]; // The keyboard reports for the symbol being typed
+static int n_kbd = 0;
+static uint8_t kbd_last [8];         // The last keyboard report sent
+static uint8_t kbd_before [8];       // ...before the symbol's key went down
+static uint8_t host_leds = 0;
+
+static void on_report (uint64_t t_us, uint8_t report_id, uint8_t const *report, uint16_t len)
+{
+    if ((report_id == REPORT_ID_KEYBOARD) && (len == sizeof (kbd [0])) && (n_kbd < MAX_REPORTS))
+    {
+        memcpy (kbd [n_kbd++], report, len);
+    }
+    if ((report_id == REPORT_ID_KEYBOARD) && (len == sizeof (kbd_last)))
+    {
+        memcpy (kbd_last, report, len);
+    }
+    vhost_report (t_us, report_id, report, len);
+    if (vhost_leds () != host_leds)
+    {
+        host_leds = vhost_leds ();
+        tud_hid_set_report_cb (0, REPORT_ID_KEYBOARD, HID_REPORT_TYPE_OUTPUT, &host_leds, 1);
+    }
+} // on_report
+
+static int has_key (uint8_t const *report, uint8_t usage)
+{
+    int idx;
+    for (idx = 2; idx < 8; ++idx)
+    {
+        if (report [idx] == usage)
+        {
+            return 1;
+        }
+    }
+    return 0;
+} // has_key
+
+static int hex_digit (uint8_t usage)
+{
+    if ((usage >= HID_KEY_1) && (usage <= HID_KEY_9))
+    {
+        return usage - HID_KEY_1 + 1;
+    }
+    if (usage == HID_KEY_0)
+    {
+        return 0;
+    }
+    if ((usage >= HID_KEY_A) && (usage <= HID_KEY_F))
+    {
+        return usage - HID_KEY_A + 10;
+    }
+    return -1;
+} // hex_digit
+
+/* Decode the reports kept: the code points of the entries in them, and how
+ * many entries there were. An entry spoilt, or not finished, gives -1. */
+static int decode_entries (uint32_t *cps, int max)
+{
+    uint8_t const *prev = kbd_before;
+    int n = 0;
+    int in_entry = 0;
+    uint32_t cp = 0;
+    int idx;
+    int k;
+
+    for (idx = 0; idx < n_kbd; ++idx)
+    {
+        uint8_t const *rep = kbd [idx];
+        uint8_t mods = rep [0];
+        for (k = 2; k < 8; ++k)
+        {
+            uint8_t usage = rep [k];
+            if ((usage == 0) || has_key (prev, usage))
+            {
+                continue; // Not a key going down
+            }
+            if (usage == HID_KEY_U)
+            {
+                int spoilt = 0;
+                int j;
+                for (j = 2; j < 8; ++j)
+                {
+                    // A modifier key code let go now lets go of that modifier on the host
+                    if ((prev [j] >= HID_KEY_CONTROL_LEFT) && (prev [j] <= HID_KEY_GUI_RIGHT) && !has_key (rep, prev [j]))
+                    {
+                        spoilt = 1;
+                    }
+                }
+                if ((mods & (KEYBOARD_MODIFIER_LEFTCTRL | KEYBOARD_MODIFIER_RIGHTCTRL)) &&
+                    (mods & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT)))
+                {
+                    if (spoilt || in_entry)
+                    {
+                        return -1;
+                    }
+                    in_entry = 1;
+                    cp = 0;
+                    continue;
+                }
+            }
+            if (!in_entry)
+            {
+                continue;
+            }
+            if (usage == HID_KEY_SPACE)
+            {
+                if (n < max)
+                {
+                    cps [n] = cp;
+                }
+                ++n;
+                in_entry = 0;
+            }
+            else if ((hex_digit (usage) >= 0) && (mods == 0))
+            {
+                cp = (cp << 4) | (uint32_t)hex_digit (usage);
+            }
+            else
+            {
+                return -1; // Not a hex digit, nor the end
+            }
+        }
+        prev = rep;
+    }
+    return in_entry ? -1 : n;
+} // decode_entries
+
+// The first code point of some UTF-8 text, 0 if there is none
+static uint32_t utf8_cp (char const *text, int *len)
+{
+    uint8_t const *p = (uint8_t const *)text;
+    uint32_t cp;
+    int extra;
+    if (p [0] < 0x80)
+    {
+        *len = (p [0] != 0);
+        return p [0];
+    }
+    if ((p [0] & 0xE0) == 0xC0)
+    {
+        cp = p [0] & 0x1F;
+        extra = 1;
+    }
+    else if ((p [0] & 0xF0) == 0xE0)
+    {
+        cp = p [0] & 0x0F;
+        extra = 2;
+    }
+    else
+    {
+        cp = p [0] & 0x07;
+        extra = 3;
+    }
+    *len = 1;
+    while ((extra-- > 0) && ((p [*len] & 0xC0) == 0x80))
+    {
+        cp = (cp << 6) | (p [(*len)++] & 0x3F);
+    }
+    return cp;
+} // utf8_cp
+
+static void set_down (uint8_t *down, int key)
+{
+    down [key % COL_SZ] |= (uint8_t)(1u << (key / COL_SZ));
+} // set_down
+
+static int find_key (uint8_t const *layer, uint8_t code)
+{
+    int idx;
+    for (idx = 0; idx < CFG_KEYS; ++idx)
+    {
+        if (layer [idx] == code)
+        {
+            return idx;
+        }
+    }
+    return -1;
+} // find_key
+
+int main (int argc, char **argv)
+{
+    uint8_t down [COL_SZ];
+    int verbose = 0;
+    int opt;
+    while ((opt = getopt (argc, argv, "v")) != -1)
+    {
+        if (opt == 'v')
+        {
+            verbose = 1;
+        }
+        else
+        {
+            fprintf (stderr, "usage: %s [-v]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    mock_on_report (on_report);
+    mock_init ();
+    mock_run_until (SETTLE_US);
+
+    kb_config const *cfg = cfg_live ();
+    int shift = find_key (cfg->keys [CFG_LAYER_BASE], KC_SHF);
+    int cd2 = find_key (cfg->keys [CFG_LAYER_BASE], KC_CD2);
+    int hlp = find_key (cfg->keys [CFG_LAYER_BASE], KC_HLP);
+    if ((shift < 0) || (cd2 < 0) || (hlp < 0))
+    {
+        fprintf (stderr, "kb-uni-check: Shift, Code-II or HELP is not in the basic keymap\n");
+        return 1;
+    }
+
+    // HELP + Code-II toggles the Unicode entry mode
+    memset (down, 0, sizeof (down));
+    set_down (down, hlp);
+    set_down (down, cd2);
+    mock_set_keys (down);
+    mock_run_until (mock_now () + HOLD_KEY_US);
+    memset (down, 0, sizeof (down));
+    mock_set_keys (down);
+    mock_run_until (mock_now () + GAP_US);
+
+    int n_sym = 0;
+    int n_failed = 0;
+    int key;
+    for (key = 0; key < CFG_KEYS; ++key)
+    {
+        uint8_t code = cfg->keys [CFG_LAYER_CD2][key];
+        if ((code < KC_CER) || (code > KC_GBP))
+        {
+            continue;
+        }
+        int shifted;
+        for (shifted = 0; shifted < 2; ++shifted)
+        {
+            uint32_t want = want_table [code - KC_CER].cp [shifted];
+
+            // Code-II (and Shift) held, then the key
+            vhost_reset ();
+            memset (down, 0, sizeof (down));
+            set_down (down, cd2);
+            if (shifted)
+            {
+                set_down (down, shift);
+            }
+            mock_set_keys (down);
+            mock_run_until (mock_now () + HOLD_MODS_US);
+            n_kbd = 0;
+            memcpy (kbd_before, kbd_last, sizeof (kbd_before));
+            set_down (down, key);
+            mock_set_keys (down);
+            mock_run_until (mock_now () + HOLD_KEY_US);
+            down [key % COL_SZ] &= (uint8_t)~(1u << (key / COL_SZ));
+            mock_set_keys (down);
+            mock_run_until (mock_now () + SETTLE_US);
+            memset (down, 0, sizeof (down));
+            mock_set_keys (down);
+            mock_run_until (mock_now () + GAP_US);
+
+            uint32_t cps [4];
+            int n_ent = decode_entries (cps, 4);
+            int len;
+            uint32_t typed = utf8_cp (vhost_text (), &len);
+            int one_char = (vhost_text () [len] == 0);
+            char const *fail = NULL;
+            if (want == 0)
+            {
+                if (n_ent != 0)
+                {
+                    fail = "sent as a Unicode entry, not the normal way";
+                }
+            }
+            else if (n_ent != 1)
+            {
+                fail = (n_ent < 0) ? "the entry is spoilt" : "not one entry";
+            }
+            else if (cps [0] != want)
+            {
+                fail = "the entry is the wrong code point";
+            }
+            else if ((typed != want) || !one_char)
+            {
+                fail = "the host types something else";
+            }
+
+            ++n_sym;
+            if (fail != NULL)
+            {
+                ++n_failed;
+            }
+            if ((verbose) || (fail != NULL))
+            {
+                printf ("r%dc%d %-7s %s  want U+%04lX  entry ", key / COL_SZ, key % COL_SZ,
+                        shifted ? "CD2+SHF" : "CD2", want_table [code - KC_CER].name, (unsigned long)want);
+                if (n_ent == 1)
+                {
+                    printf ("U+%04lX", (unsigned long)cps [0]);
+                }
+                else
+                {
+                    printf ("%-6s", (n_ent < 0) ? "bad" : (n_ent == 0) ? "none" : "many");
+                }
+                printf ("  typed \"%s\"", vhost_text ());
+                if (fail != NULL)
+                {
+                    printf ("  FAIL: %s", fail);
+                }
+                printf ("\n");
+            }
+        }
+    }
+
+    printf ("%d symbols typed, %d failed\n", n_sym, n_failed);
+    return (n_failed != 0) ? 1 : 0;
+} // main
+
+/* End of File */
@@ -101,13 +101,24 @@
 
 //------------- CLASS -------------//
 #define CFG_TUD_HID               1
-#define CFG_TUD_CDC               0
-#define CFG_TUD_MSC               0
+#define CFG_TUD_CDC               0 // Set 1 for the CDC serial port "paste mode" (see kb-paste.c)
+#define CFG_TUD_MSC               0 // Set 1 for the USB drive with the config, stats and recordings (see kb-msc.c)
 #define CFG_TUD_MIDI              0
 #define CFG_TUD_VENDOR            0
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
-#define CFG_TUD_HID_EP_BUFSIZE    16
+// This is also the GET_REPORT buffer, so it must hold the performance counters feature report
+#define CFG_TUD_HID_EP_BUFSIZE    64
+
+// CDC FIFO size of TX and RX
+#define CFG_TUD_CDC_RX_BUFSIZE    64
+#define CFG_TUD_CDC_TX_BUFSIZE    256
+
+// CDC Endpoint transfer buffer size, more is faster
+#define CFG_TUD_CDC_EP_BUFSIZE    64
+
+// MSC buffer size, one block, so each read or write callback is a single whole block
+#define CFG_TUD_MSC_EP_BUFSIZE    512
 
 #ifdef __cplusplus
  }
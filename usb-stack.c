@@ -33,10 +33,19 @@
 
 #include "bsp/board.h"
 #include "tusb.h"
+#include "kb-hal.h"
 
 // local parts
 #include "usb_descriptors.h"
 #include "fw-kb-main.h"
+#include "kb-stream.h"
+#include "kb-mouse.h"
+#include "kb-trace.h"
+#include "kb-telem.h"
+#include "kb-config.h"
+#include "kb-store.h"
+#include "kb-sched.h"
+#include "kb-power.h"
 
 /* Blink pattern */
 enum  {
@@ -56,6 +65,23 @@ static const uint16_t blink_suspended [BLINK_LEN]   = {20,  100, 20, 2000}; // S
 
 // Used to track the LED flash state
 static uint32_t blink_state = BLINK_NOT_MOUNTED;
+static int blink_task = -1; // led_blinking_task(), in the scheduler
+
+// Change the LED flash pattern, starting it now (led_blinking_task() stops itself for BLINK_NONE)
+static void blink_set(uint32_t state)
+{
+  blink_state = state;
+  sched_at(blink_task, hal_time_us());
+} // blink_set
+
+// use to avoid sending multiple consecutive zero reports for the keyboard
+static bool has_keyboard_key = false;
+
+// The last keyboard report sent (modifiers, reserved, 6 key codes), for GET_REPORT
+static uint8_t last_keyboard [8];
+
+// Set once a keystroke stream has the keyboard report, until a key message is sent again
+static bool stream_owns_keyboard = false;
 
 //--------------------------------------------------------------------+
 // Device callbacks
@@ -64,13 +90,22 @@ static uint32_t blink_state = BLINK_NOT_MOUNTED;
 // Invoked when device is mounted
 void tud_mount_cb(void)
 {
-  blink_state = BLINK_MOUNTED;
+  blink_set(BLINK_MOUNTED);
+#if POWER_ON
+  power_resume(); // A bus reset whilst suspended
+#endif // POWER_ON
+#if STORE_ON
+  store_boot_mount(); // For the boot time figures
+#endif // STORE_ON
 } // tud_mount_cb
 
 // Invoked when device is unmounted
 void tud_umount_cb(void)
 {
-  blink_state = BLINK_NOT_MOUNTED;
+  blink_set(BLINK_NOT_MOUNTED);
+#if POWER_ON
+  power_resume();
+#endif // POWER_ON
 } // tud_umount_cb
 
 // Invoked when USB is suspended
@@ -78,33 +113,61 @@ void tud_umount_cb(void)
 // within 7ms, device must draw an average current less than 2.5 mA from bus
 void tud_suspend_cb(bool remote_wakeup_en)
 {
+  blink_set(BLINK_SUSPENDED);
+#if POWER_ON
+  power_suspend(remote_wakeup_en); // Slow clock, and park the scanner
+#else
   (void) remote_wakeup_en;
-  blink_state = BLINK_SUSPENDED;
+#endif // POWER_ON
 } // tud_suspend_cb
 
 // Invoked when USB bus is resumed
 void tud_resume_cb(void)
 {
-  blink_state = BLINK_MOUNTED;
+#if TELEM_COUNT
+  telem_wake_done(); // How long did the host take to wake up?
+#endif // TELEM_COUNT
+#if POWER_ON
+  power_resume(); // Full clock, and the scanner back to full speed
+#endif // POWER_ON
+  blink_set(BLINK_MOUNTED);
 } // tud_resume_cb
 
 //--------------------------------------------------------------------+
 // USB HID
 //--------------------------------------------------------------------+
 
-static void send_hid_report(uint8_t report_id, uint32_t btn)
+// use to avoid sending multiple consecutive zero reports for the consumer control
+static bool has_consumer_key = false;
+
+// Mouse movement waiting to be sent, added up until the next mouse report goes
+static mouse_move mouse_pend = { 0, 0, 0, 0 };
+
+// The consumer control usage held down, for GET_REPORT
+static uint16_t last_consumer = 0;
+
+// Send a keyboard report, keeping a copy for GET_REPORT
+static void keyboard_report(uint8_t mods, uint8_t const keycode[6])
+{
+  memset(last_keyboard, 0, sizeof(last_keyboard));
+  last_keyboard[0] = mods;
+  if (keycode) memcpy(&last_keyboard[2], keycode, 6);
+  LAT_MARK(LAT_GPIO_REPORT);
+  tud_hid_keyboard_report(REPORT_ID_KEYBOARD, mods, keycode);
+} // keyboard_report
+
+// Returns true if a report was actually sent
+static bool send_hid_report(uint8_t report_id, uint32_t btn)
 {
   // skip if hid is not ready yet
-  if ( !tud_hid_ready() ) return;
+  if ( !tud_hid_ready() ) return false;
 
   switch(report_id)
   {
     case REPORT_ID_KEYBOARD:
     {
-      // use to avoid sending multiple consecutive zero reports for the keyboard
-      static bool has_keyboard_key = false;
-
       bool do_reset = false;
+      stream_owns_keyboard = false;
       // Were we sent an "All Keys Up" signal?
       if (FLAG_ALL_UP == btn)
       {
@@ -125,94 +188,336 @@ static void send_hid_report(uint8_t report_id, uint32_t btn)
         keycode[4] = 0;
         keycode[5] = 0;
 
-        tud_hid_keyboard_report(REPORT_ID_KEYBOARD, Mods, keycode); // KEY DOWN, in effect
+        keyboard_report(Mods, keycode); // KEY DOWN, in effect
         has_keyboard_key = true;
+        return true;
       }
       else
       {
         // send an empty key report if previously had key pressed - KEY UP effectively
         if ((has_keyboard_key) && (do_reset))
         {
-          tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, NULL);
+          keyboard_report(0, NULL);
           has_keyboard_key = false;
+          return true;
         }
       }
     }
     break;
 
+    case REPORT_ID_CONSUMER_CONTROL:
+    {
+      // The usage is in the low 16 bits, or "All Keys Up" releases it
+      uint16_t usage = (FLAG_ALL_UP == btn) ? 0 : (uint16_t)(btn & 0xFFFF);
+      if ((usage != 0) || (has_consumer_key))
+      {
+        tud_hid_report(REPORT_ID_CONSUMER_CONTROL, &usage, 2);
+        has_consumer_key = (usage != 0);
+        last_consumer = usage;
+        return true;
+      }
+    }
+    break;
+
+    case REPORT_ID_MOUSE:
+    {
+      (void) btn; // The movement is in mouse_pend
+      tud_hid_mouse_report(REPORT_ID_MOUSE, mouse_pend.buttons, mouse_pend.dx, mouse_pend.dy, mouse_pend.wheel, 0);
+      mouse_pend.dx = 0;
+      mouse_pend.dy = 0;
+      mouse_pend.wheel = 0;
+      return true;
+    }
+    break;
+
     /* The original example also provided these endpoints, but we do not use them here... */
-    //case REPORT_ID_MOUSE:
-    //case REPORT_ID_CONSUMER_CONTROL:
     //case REPORT_ID_GAMEPAD:
     default:
     break;
   }
+  return false;
 } // send_hid_report
 
-// Every PW_POLL period, we will send 1 report for each HID profile (keyboard, mouse etc.)
+// Send the next report of a keystroke stream, returns true if a report was sent
+static bool send_stream_report(void)
+{
+  if ( !tud_hid_ready() ) return false;
+
+  /* Let go of the keys still down from the key messages first. Shift goes as a
+   * key code (0xE1) as well as a modifier bit, so if it vanished from the key
+   * codes in the stream's first report, the host would let go of Shift even
+   * though the report has the Shift bit, e.g. CTRL + SHIFT + U would be CTRL + U. */
+  if (!stream_owns_keyboard)
+  {
+    static const uint8_t no_keys[6] = { 0 };
+    stream_owns_keyboard = true;
+    if (memcmp(&last_keyboard[2], no_keys, sizeof(no_keys)) != 0)
+    {
+      keyboard_report(0, NULL);
+      has_keyboard_key = false;
+      return true;
+    }
+  }
+
+  uint8_t mods;
+  uint8_t key;
+  if (stream_report (&mods, &key))
+  {
+    uint8_t keycode[6] = { 0 };
+    keycode[0] = key;
+    keyboard_report(mods, keycode);
+    has_keyboard_key = (key != 0);
+    return true;
+  }
+  return false;
+} // send_stream_report
+
+/* Reports waiting to be sent, one slot for each report ID.
+ * The slots are served in turn, each time the last report has gone to the
+ * host (tud_hid_report_complete_cb), so one kind of report cannot hold up
+ * another. A keystroke stream takes the place of the keyboard slot. */
+static uint32_t report_msg [REPORT_ID_COUNT];
+static uint32_t report_ts [REPORT_ID_COUNT]; // Start of the scan behind each report, 0 if none
+static bool     report_pending [REPORT_ID_COUNT];
+static uint8_t  last_report_id = 0;
+
+static void queue_report(uint8_t report_id, uint32_t btn, uint32_t ts_us)
+{
+  report_msg [report_id] = btn;
+  report_ts [report_id] = ts_us;
+  report_pending [report_id] = true;
+} // queue_report
+
+// Send the next waiting report, taking the report IDs in turn after the last one sent
+static void send_next_report(void)
+{
+  if ( !tud_hid_ready() ) return;
+
+  for (uint8_t i = 1; i < REPORT_ID_COUNT; i++)
+  {
+    uint8_t report_id = ((last_report_id + i - 1) % (REPORT_ID_COUNT - 1)) + 1;
+    bool sent = false;
+    uint32_t ts = 0; // Stream reports are not counted for latency
+
+    if ((report_id == REPORT_ID_KEYBOARD) && (stream_busy ()))
+    {
+      sent = send_stream_report();
+    }
+    else if (report_pending [report_id])
+    {
+      report_pending [report_id] = false;
+      ts = report_ts [report_id];
+      sent = send_hid_report(report_id, report_msg [report_id]);
+    }
+
+    if (sent)
+    {
+      TRACE(TR_REPORT, report_id, report_msg [report_id]);
+#if TELEM_COUNT
+      telem_report(ts);
+#else
+      (void) ts;
+#endif // TELEM_COUNT
+      last_report_id = report_id;
+      return;
+    }
+  }
+} // send_next_report
+
+// Add some mouse movement to the next mouse report, called by mouse_task() every 1 ms or so
+void mouse_queue(const mouse_move *mv)
+{
+  if ( tud_suspended() )
+  {
+    // Wake up host if we are in suspend mode and REMOTE_WAKEUP feature is enabled by host
+#if TELEM_COUNT
+    telem_wake_start();
+#endif // TELEM_COUNT
+    tud_remote_wakeup();
+    return;
+  }
+
+  int32_t dx = mouse_pend.dx + mv->dx;
+  int32_t dy = mouse_pend.dy + mv->dy;
+  int32_t wh = mouse_pend.wheel + mv->wheel;
+  mouse_pend.buttons = mv->buttons;
+  mouse_pend.dx = (int8_t)((dx > 127) ? 127 : ((dx < -127) ? -127 : dx));
+  mouse_pend.dy = (int8_t)((dy > 127) ? 127 : ((dy < -127) ? -127 : dy));
+  mouse_pend.wheel = (int8_t)((wh > 127) ? 127 : ((wh < -127) ? -127 : wh));
+
+  queue_report(REPORT_ID_MOUSE, 0, 0);
+  send_next_report();
+} // mouse_queue
+
+// Called on every pass of the main loop, keeps the keystroke streams and the queued reports moving
 // tud_hid_report_complete_cb() is used to send the next report after previous one is complete
 void hid_task(void)
 {
-  // Poll every PW_POLL milliseconds
-  const uint32_t interval_ms = PW_POLL;
-  static uint32_t start_ms = 0;
+  /* A keystroke stream paces itself: send each report as soon as the last one
+   * has gone. Anything in the kc_buf queue waits until the stream is done,
+   * so keys stay in the order they were typed. */
+  if (stream_busy ())
+  {
+#if MACRO_ON
+    /* Key ups queued behind the stream are not needed, it always ends with a
+     * key up anyway. A real key press can cut a macro short, if allowed. */
+    while (kc_peek () == FLAG_ALL_UP)
+    {
+      (void) kc_get ();
+    }
+    if ((MACRO_INTERRUPT) && (macro_busy ()) && (kc_peek () != 0))
+    {
+      macro_stop ();
+    }
+#endif // MACRO_ON
+    send_next_report();
+    return;
+  }
+
+#if CFG_TUD_CDC
+  /* Pasted text is typed when no real key is waiting or held down, so the two
+   * never get mixed up. This does not wait for PW_POLL, to keep the rate up. */
+  if ((kc_peek () == 0) && (!has_keyboard_key) && (!report_pending [REPORT_ID_KEYBOARD]) &&
+      (!tud_suspended()) && (paste_start ()))
+  {
+    send_next_report();
+    return;
+  }
+#endif // CFG_TUD_CDC
+
+  send_next_report(); // Keep anything queued moving
+} // hid_task
+
+// Every PW_POLL period (a task in the scheduler), we take 1 code from the queue and queue up the report(s) it needs
+static void hid_poll_task(void)
+{
+  // A keystroke stream paces itself, the queue waits for it to finish
+  if (stream_busy ())
+  {
+    return;
+  }
 
-  if ( board_millis() - start_ms < interval_ms) return; // not enough time has elapsed since last poll
-  start_ms += interval_ms;
+  // Leave the next code in the queue until the reports already waiting have gone
+  if ((report_pending [REPORT_ID_KEYBOARD]) || (report_pending [REPORT_ID_CONSUMER_CONTROL]))
+  {
+    send_next_report();
+    return;
+  }
 
   uint32_t const btn = kc_get ();
+  uint32_t const ts = kc_time (); // For the latency figures
 
   // Remote wake-up
   if ( tud_suspended() && btn )
   {
     // Wake up host if we are in suspend mode
     // and REMOTE_WAKEUP feature is enabled by host
+#if TELEM_COUNT
+    telem_wake_start();
+#endif // TELEM_COUNT
     tud_remote_wakeup();
   }
-  else
+#if UNICODE_ON
+  else if ((btn & FLAG_TAG_MASK) == FLAG_UNICODE)
   {
-    // Send the 1st element of the report chain, any others will be sent by tud_hid_report_complete_cb()
-    send_hid_report(REPORT_ID_KEYBOARD, btn);
+    // A Unicode symbol to type - start the entry sequence stream
+    uni_start (btn);
   }
-} // hid_task
+#endif // UNICODE_ON
+#if MACRO_ON
+  else if ((btn & FLAG_TAG_MASK) == FLAG_MACRO)
+  {
+    // A macro to type - start the macro stream
+    macro_start (btn & ~FLAG_TAG_MASK);
+  }
+#endif // MACRO_ON
+  else if ((btn & FLAG_TAG_MASK) == FLAG_CONSUMER)
+  {
+    queue_report(REPORT_ID_CONSUMER_CONTROL, btn, ts);
+  }
+  else if (btn)
+  {
+    queue_report(REPORT_ID_KEYBOARD, btn, ts);
+    if (has_consumer_key)
+    {
+      // Only one key is decoded at a time, so the media key is no longer the one down: release it
+      queue_report(REPORT_ID_CONSUMER_CONTROL, FLAG_ALL_UP, ts);
+    }
+  }
+
+  // Send the 1st element of the report chain, any others will be sent by tud_hid_report_complete_cb()
+  send_next_report();
+} // hid_poll_task
 
 // Invoked when sent REPORT successfully to host
-// Application can use this to chain to the next report - though since we only have the keyboard now,
-// that seems unlikely to actually do anything!
+// Application can use this to chain to the next report, taking the report IDs in turn
 // Note: For composite reports, report[0] is report ID
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint8_t len)
 {
   (void) instance;
   (void) len;
 
-  uint8_t next_report_id = report[0] + 1;
-
-  if (next_report_id < REPORT_ID_COUNT)
-  {
-    send_hid_report(next_report_id, board_button_read());
-  }
+  if (report[0] == REPORT_ID_KEYBOARD) LAT_MARK(LAT_GPIO_DONE);
+  send_next_report();
 } // tud_hid_report_complete_cb
 
 // Invoked when we receive a GET_REPORT control request
 // Application must fill buffer report's content and return its length.
 // Return zero will cause the stack to STALL request
+// Input reports give the current state, the feature report gives the performance counters
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
 {
-  // TODO not Implemented
   (void) instance;
-  (void) report_id;
-  (void) report_type;
-  (void) buffer;
-  (void) reqlen;
 
-  return 0;
+  if (report_type == HID_REPORT_TYPE_INPUT)
+  {
+    switch (report_id)
+    {
+      case REPORT_ID_KEYBOARD:
+      if (reqlen < sizeof(last_keyboard)) return 0;
+      memcpy(buffer, last_keyboard, sizeof(last_keyboard));
+      return sizeof(last_keyboard);
+
+      case REPORT_ID_CONSUMER_CONTROL:
+      if (reqlen < 2) return 0;
+      buffer[0] = (uint8_t)last_consumer;
+      buffer[1] = (uint8_t)(last_consumer >> 8);
+      return 2;
+
+      case REPORT_ID_MOUSE:
+      {
+        // Buttons held, no movement (the same layout as hid_mouse_report_t)
+        if (reqlen < 5) return 0;
+        memset(buffer, 0, 5);
+        buffer[0] = mouse_pend.buttons;
+        return 5;
+      }
+
+      default:
+      break;
+    }
+  }
+#if PERF_REPORT_ON
+  else if ((report_type == HID_REPORT_TYPE_FEATURE) && (report_id == REPORT_ID_PERF))
+  {
+    return telem_perf_fill(buffer, reqlen);
+  }
+#endif // PERF_REPORT_ON
+#if CONFIG_ON
+  else if ((report_type == HID_REPORT_TYPE_FEATURE) && (report_id == REPORT_ID_CONFIG))
+  {
+    return cfg_get_report(buffer, reqlen); // The response to the last config request
+  }
+#endif // CONFIG_ON
+
+  return 0; // Anything else is STALLed
 } // tud_hid_get_report_cb
 
 /* Invoked when we received SET_REPORT control request or
  * receive data on OUT endpoint ( Report ID = 0, Type = 0 )
  *
- * Here, this is only checking for the CapsLock message from the host.
- * All this does is change the board LED, in effect.
+ * Here, this is checking for the CapsLock message from the host, which
+ * changes the board LED, and for the live config requests (see kb-config.c).
  */
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type,
                            uint8_t const* buffer, uint16_t bufsize)
@@ -240,23 +545,29 @@ void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_
       {
         // Caplocks Off: back to normal blink
         board_led_write(false);      // Pico LED OFF
-        blink_state = BLINK_MOUNTED; // Re-enable led_blinking_task() flashing the LED
+        blink_set(BLINK_MOUNTED);    // Re-enable led_blinking_task() flashing the LED
         set_caps_lock_led (0);       // External LED on GPIO_22 OFF
       }
     }
   }
+#if CONFIG_ON
+  else if ((report_type == HID_REPORT_TYPE_FEATURE) && (report_id == REPORT_ID_CONFIG))
+  {
+    cfg_set_report(buffer, bufsize); // The host reads the response with GET_REPORT
+  }
+#endif // CONFIG_ON
 } // tud_hid_set_report_cb
 
 //--------------------------------------------------------------------+
 // BLINKING TASK
 //--------------------------------------------------------------------+
-void led_blinking_task(void)
+// A one-shot task in the scheduler, it runs again after each step of the pattern
+static void led_blinking_task(void)
 {
-  static uint32_t start_ms = 0;
   static int led_state = 0;
 
   // blink is disabled - happens when Caps Lock is set ON by tud_hid_set_report_cb()
-  if (BLINK_NONE == blink_state) return;
+  if (BLINK_NONE == blink_state) return; // Not run again until blink_set()
 
   const uint16_t *seq = NULL;
   switch (blink_state)
@@ -274,15 +585,20 @@ void led_blinking_task(void)
     break;
   }
 
-  uint32_t delay_for = seq [blink_phase];
-
-  // Blink every "delay_for" ms
-  if ( (board_millis() - start_ms) < delay_for) return; // not enough time has elapsed
-  start_ms += delay_for;
-  blink_phase = (blink_phase + 1) & BLINK_MASK;
-
   board_led_write(led_state);
   led_state = 1 - led_state; // toggle LED state
+
+  // Run again when this step of the pattern is over
+  blink_phase = (blink_phase + 1) & BLINK_MASK;
+  sched_at(blink_task, hal_time_us() + (seq [blink_phase] * 1000u));
 } // led_blinking_task
 
+// Add the HID poll and the LED to the scheduler, called by kb_init()
+void usb_task_init(void)
+{
+  sched_add("hid-poll", hid_poll_task, PW_POLL * 1000u);
+  blink_task = sched_add("led", led_blinking_task, 0);
+  sched_at(blink_task, hal_time_us());
+} // usb_task_init
+
 // End of File //
@@ -33,6 +33,8 @@
 
 // local parts
 #include "fw-kb-main.h"
+#include "kb-telem.h"
+#include "kb-config.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save device driver after the first plug.
  * Same VID/PID with different interface e.g MSC (first), then CDC (later) will possibly cause system error on PC.
@@ -57,9 +59,17 @@ tusb_desc_device_t const desc_device =
     .bLength            = sizeof(tusb_desc_device_t),
     .bDescriptorType    = TUSB_DESC_DEVICE,
     .bcdUSB             = USB_BCD,
+#if CFG_TUD_CDC
+    // Use Interface Association Descriptor (IAD) for CDC
+    // As required by USB Specs IAD's subclass must be common class (2) and protocol must be IAD (1)
+    .bDeviceClass       = TUSB_CLASS_MISC,
+    .bDeviceSubClass    = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol    = MISC_PROTOCOL_IAD,
+#else
     .bDeviceClass       = 0x00,
     .bDeviceSubClass    = 0x00,
     .bDeviceProtocol    = 0x00,
+#endif
     .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
 
     .idVendor           = USB_VID,
@@ -84,12 +94,48 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
+// Vendor defined feature report, PERF_REPORT_LEN bytes of performance counters (see kb-telem.h)
+#define TUD_HID_REPORT_DESC_PERF(...) \
+  HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2   ),\
+  HID_USAGE        ( 0x01                       ),\
+  HID_COLLECTION   ( HID_COLLECTION_APPLICATION ),\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE       ( 0x02                                ),\
+    HID_LOGICAL_MIN ( 0x00                                ),\
+    HID_LOGICAL_MAX_N ( 0xFF, 2                           ),\
+    HID_REPORT_SIZE ( 8                                   ),\
+    HID_REPORT_COUNT( PERF_REPORT_LEN                     ),\
+    HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ),\
+  HID_COLLECTION_END
+
+// Vendor defined feature report, CFG_REPORT_LEN bytes each way for the config protocol (see kb-config.h)
+#define TUD_HID_REPORT_DESC_CONFIG(...) \
+  HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2   ),\
+  HID_USAGE        ( 0x03                       ),\
+  HID_COLLECTION   ( HID_COLLECTION_APPLICATION ),\
+    /* Report ID if any */\
+    __VA_ARGS__ \
+    HID_USAGE       ( 0x04                                ),\
+    HID_LOGICAL_MIN ( 0x00                                ),\
+    HID_LOGICAL_MAX_N ( 0xFF, 2                           ),\
+    HID_REPORT_SIZE ( 8                                   ),\
+    HID_REPORT_COUNT( CFG_REPORT_LEN                      ),\
+    HID_FEATURE     ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ),\
+  HID_COLLECTION_END
+
 uint8_t const desc_hid_report[] =
 {
-  TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD         ))
+  TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD         )),
+  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )),
+  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE            )),
+#if PERF_REPORT_ON
+  TUD_HID_REPORT_DESC_PERF    ( HID_REPORT_ID(REPORT_ID_PERF             )),
+#endif // PERF_REPORT_ON
+#if CONFIG_ON
+  TUD_HID_REPORT_DESC_CONFIG  ( HID_REPORT_ID(REPORT_ID_CONFIG           )),
+#endif // CONFIG_ON
 /* The original example also provided these endpoints, but we do not need them here... */
-  //TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE            )),
-  //TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )),
   //TUD_HID_REPORT_DESC_GAMEPAD ( HID_REPORT_ID(REPORT_ID_GAMEPAD          ))
 };
 
@@ -109,12 +155,25 @@ uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 enum
 {
   ITF_NUM_HID,
+#if CFG_TUD_CDC
+  ITF_NUM_CDC,
+  ITF_NUM_CDC_DATA,
+#endif
+#if CFG_TUD_MSC
+  ITF_NUM_MSC,
+#endif
   ITF_NUM_TOTAL
 };
 
-#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN + (CFG_TUD_CDC * TUD_CDC_DESC_LEN) + \
+                            (CFG_TUD_MSC * TUD_MSC_DESC_LEN))
 
-#define EPNUM_HID   0x81
+#define EPNUM_HID       0x81
+#define EPNUM_CDC_NOTIF 0x82
+#define EPNUM_CDC_OUT   0x03
+#define EPNUM_CDC_IN    0x83
+#define EPNUM_MSC_OUT   0x04
+#define EPNUM_MSC_IN    0x84
 
 uint8_t const desc_configuration[] =
 {
@@ -128,7 +187,15 @@ uint8_t const desc_configuration[] =
                      sizeof(desc_hid_report), // report descriptor length
                      EPNUM_HID,               // EP In address
                      CFG_TUD_HID_EP_BUFSIZE,  // size
-                     PW_POLL)                 // polling interval
+                     HID_EP_POLL),            // polling interval
+#if CFG_TUD_CDC
+  // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
+  TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
+#endif
+#if CFG_TUD_MSC
+  // Interface number, string index, EP Out & EP In address, EP size
+  TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, 5, EPNUM_MSC_OUT, EPNUM_MSC_IN, 64),
+#endif
 };
 
 #if TUD_OPT_HIGH_SPEED
@@ -201,6 +268,8 @@ char const* string_desc_arr [] =
   "PicoWrite",                   // 1: Manufacturer
   "Fontwriter",                  // 2: Product
   "456789",                      // 3: Serials, should use board ID
+  "Fontwriter Paste",            // 4: CDC Interface
+  "Fontwriter Files",            // 5: MSC Interface
 };
 
 static uint16_t _desc_str[32];
@@ -33,9 +33,11 @@
 enum
 {
   REPORT_ID_KEYBOARD = 1,
+  REPORT_ID_CONSUMER_CONTROL,
+  REPORT_ID_MOUSE,
+  REPORT_ID_PERF,   // Feature report, the performance counters (see kb-telem.h)
+  REPORT_ID_CONFIG, // Feature report, the live config protocol (see kb-config.h)
 /* The original example also provided these endpoints, but we do not need them here... */
-  //REPORT_ID_MOUSE,
-  //REPORT_ID_CONSUMER_CONTROL,
   //REPORT_ID_GAMEPAD,
   REPORT_ID_COUNT
 };